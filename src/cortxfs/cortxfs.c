@@ -34,6 +34,7 @@
 #include <debug.h>
 #include <management.h>
 #include <nsal.h> /* nsal_init,fini */
+#include "cortxfs_internal.h" /* cfs_*_cache_init */
 
 static struct collection_item *cfg_items;
 
@@ -97,10 +98,60 @@ int cfs_init(const char *config_path, const struct cfs_endpoint_ops *e_ops)
 		log_err("dsal_init failed, rc=%d", rc);
 		goto nsal_cleanup;
 	}
+	rc = cfs_fh_cache_init(cfg_items);
+	if (rc) {
+		log_err("cfs_fh_cache_init failed, rc=%d", rc);
+		goto dsal_cleanup;
+	}
+	rc = cfs_dcache_init(cfg_items);
+	if (rc) {
+		log_err("cfs_dcache_init failed, rc=%d", rc);
+		goto fh_cache_cleanup;
+	}
+	rc = cfs_oid_cache_init(cfg_items);
+	if (rc) {
+		log_err("cfs_oid_cache_init failed, rc=%d", rc);
+		goto dcache_cleanup;
+	}
+	rc = cfs_readdir_init(cfg_items);
+	if (rc) {
+		log_err("cfs_readdir_init failed, rc=%d", rc);
+		goto oid_cache_cleanup;
+	}
+	rc = cfs_statahead_init(cfg_items);
+	if (rc) {
+		log_err("cfs_statahead_init failed, rc=%d", rc);
+		goto readdir_cleanup;
+	}
+	rc = cfs_rstat_init(cfg_items);
+	if (rc) {
+		log_err("cfs_rstat_init failed, rc=%d", rc);
+		goto statahead_cleanup;
+	}
+	rc = cfs_orphan_init(cfg_items);
+	if (rc) {
+		log_err("cfs_orphan_init failed, rc=%d", rc);
+		goto rstat_cleanup;
+	}
+	rc = cfs_remove_tree_init(cfg_items);
+	if (rc) {
+		log_err("cfs_remove_tree_init failed, rc=%d", rc);
+		goto orphan_cleanup;
+	}
+	rc = cfs_sindex_init(cfg_items);
+	if (rc) {
+		log_err("cfs_sindex_init failed, rc=%d", rc);
+		goto rmtree_cleanup;
+	}
+	rc = cfs_watch_init(cfg_items);
+	if (rc) {
+		log_err("cfs_watch_init failed, rc=%d", rc);
+		goto sindex_cleanup;
+	}
 	rc = cfs_fs_init(e_ops);
 	if (rc) {
 		log_err("cfs_fs_init failed, rc=%d", rc);
-		goto dsal_cleanup;
+		goto watch_cleanup;
 	}
 	rc = management_init();
 	if (rc) {
@@ -110,6 +161,26 @@ int cfs_init(const char *config_path, const struct cfs_endpoint_ops *e_ops)
 	goto out;
 cfs_fs_cleanup:
 	cfs_fs_fini();
+watch_cleanup:
+	cfs_watch_fini();
+sindex_cleanup:
+	cfs_sindex_fini();
+rmtree_cleanup:
+	cfs_remove_tree_fini();
+orphan_cleanup:
+	cfs_orphan_fini();
+rstat_cleanup:
+	cfs_rstat_fini();
+statahead_cleanup:
+	cfs_statahead_fini();
+readdir_cleanup:
+	cfs_readdir_fini();
+oid_cache_cleanup:
+	cfs_oid_cache_fini();
+dcache_cleanup:
+	cfs_dcache_fini();
+fh_cache_cleanup:
+	cfs_fh_cache_fini();
 dsal_cleanup:
 	dsal_fini();
 nsal_cleanup:
@@ -124,7 +195,9 @@ out:
 		return rc;
 	}
 
-	/** @todo : remove all existing opened FD (crash recovery) */
+	/* The files which were open when the server went down are in
+	 * the orphan lists, they are reaped once their FS is loaded.
+	 */
 	return rc;
 }
 
@@ -139,6 +212,16 @@ int cfs_fini(void)
 	if (rc) {
                 log_err("cfs_fs_fini failed, rc=%d", rc);
         }
+	cfs_watch_fini();
+	cfs_sindex_fini();
+	cfs_remove_tree_fini();
+	cfs_orphan_fini();
+	cfs_rstat_fini();
+	cfs_statahead_fini();
+	cfs_readdir_fini();
+	cfs_oid_cache_fini();
+	cfs_dcache_fini();
+	cfs_fh_cache_fini();
 	rc = nsal_module_fini();
 	if (rc) {
                 log_err("nsal_fini failed, rc=%d", rc);
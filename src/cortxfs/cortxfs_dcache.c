@@ -0,0 +1,430 @@
+/*
+ * Filename: cortxfs_dcache.c
+ * Description: CORTXFS directory entry cache.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Directory entry cache.
+ * ----------------------
+ *
+ * The cache maps (fs, parent inode, name) to the inode of the entry so that
+ * path components resolved once do not need a kvtree_lookup() next time.
+ * The cache is split into shards by the hash of the key, every shard has its
+ * own lock, hash table and LRU list. The total number of entries is bounded
+ * by "dcache_max" from the "cortxfs" section of the config file; zero
+ * disables the cache.
+ *
+ * Coherency:
+ *	- Every operation which changes a directory calls cfs_dcache_add() or
+ *	  cfs_dcache_remove() for the entries it has modified, once the change
+ *	  has been committed: a lookup which misses the cache before the commit
+ *	  would still find the old entry in the storage.
+ *	- Each shard has a sequence number bumped by every modification.
+ *	  A lookup which missed the cache remembers the sequence number and
+ *	  inserts the result of kvtree_lookup() only if the shard has not been
+ *	  modified in the meantime, otherwise the result could be stale.
+ *	- The names "." and ".." are never cached.
+ *
+ * Negative entries:
+ *	A lookup which did not find a name in the storage caches the result as
+ *	an entry with inode number CFS_DCACHE_NEGATIVE, so that repeated
+ *	lookups of missing names (create pre-checks, include path probing)
+ *	do not go to the storage. Operations which link a name into a
+ *	directory replace the negative entry with cfs_dcache_add(). Negative
+ *	entries can be disabled by setting "dcache_negative" to 0.
+ */
+
+#include <pthread.h> /* pthread_mutex_t */
+#include <string.h> /* memcmp() */
+#include <sys/queue.h> /* LIST_*, TAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* TAILQ_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_dcache_evict_fs */
+
+#define CFS_DCACHE_SHARDS 64
+#define CFS_DCACHE_BUCKETS 1024
+#define CFS_DCACHE_MAX_DEFAULT (256 * 1024)
+
+struct cfs_dentry {
+	/* Link in the hash bucket of the shard */
+	LIST_ENTRY(cfs_dentry) d_hash;
+	/* Link in the LRU list of the shard, the head is the oldest one */
+	TAILQ_ENTRY(cfs_dentry) d_lru;
+	const struct cfs_fs *d_fs;
+	cfs_ino_t d_parent;
+	cfs_ino_t d_ino;
+	uint64_t d_hash_value;
+	uint8_t d_len;
+	char d_name[];
+};
+
+struct cfs_dcache_shard {
+	pthread_mutex_t lock;
+	LIST_HEAD(cfs_dentry_bucket, cfs_dentry) buckets[CFS_DCACHE_BUCKETS];
+	TAILQ_HEAD(cfs_dentry_lru, cfs_dentry) lru;
+	uint32_t count;
+	uint64_t seq;
+	uint64_t hits;
+	uint64_t neg_hits;
+	uint64_t misses;
+};
+
+struct cfs_dcache {
+	bool enabled;
+	bool negative;
+	/* Max number of entries per shard */
+	uint32_t shard_max;
+	struct cfs_dcache_shard shards[CFS_DCACHE_SHARDS];
+};
+
+static struct cfs_dcache g_dcache;
+
+static inline bool cfs_dcache_is_dot(const str256_t *name)
+{
+	return (name->s_len == 1 && name->s_str[0] == '.') ||
+		(name->s_len == 2 && name->s_str[0] == '.' &&
+		 name->s_str[1] == '.');
+}
+
+static uint64_t cfs_dcache_hash(const struct cfs_fs *fs, cfs_ino_t parent,
+				const str256_t *name)
+{
+	int i;
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (i = 0; i < name->s_len; i++) {
+		hash ^= (uint8_t) name->s_str[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	hash ^= parent * 0x9e3779b97f4a7c15ULL;
+	hash ^= (uintptr_t) fs >> 4;
+
+	return hash;
+}
+
+static inline struct cfs_dcache_shard *cfs_dcache_shard_of(uint64_t hash)
+{
+	return &g_dcache.shards[hash % CFS_DCACHE_SHARDS];
+}
+
+static inline struct cfs_dentry_bucket *
+cfs_dcache_bucket_of(struct cfs_dcache_shard *shard, uint64_t hash)
+{
+	return &shard->buckets[(hash / CFS_DCACHE_SHARDS) % CFS_DCACHE_BUCKETS];
+}
+
+/* Find an entry. The caller must hold the shard lock. */
+static struct cfs_dentry *cfs_dcache_find(struct cfs_dentry_bucket *bucket,
+					  uint64_t hash,
+					  const struct cfs_fs *fs,
+					  cfs_ino_t parent,
+					  const str256_t *name)
+{
+	struct cfs_dentry *de;
+
+	LIST_FOREACH(de, bucket, d_hash) {
+		if (de->d_hash_value == hash && de->d_parent == parent &&
+		    de->d_fs == fs && de->d_len == name->s_len &&
+		    memcmp(de->d_name, name->s_str, name->s_len) == 0) {
+			return de;
+		}
+	}
+
+	return NULL;
+}
+
+static void cfs_dcache_free(struct cfs_dentry *de)
+{
+	kvs_free(kvstore_get(), de);
+}
+
+/* Unlink an entry. The caller must hold the shard lock. */
+static void cfs_dcache_unlink(struct cfs_dcache_shard *shard,
+			      struct cfs_dentry *de)
+{
+	LIST_REMOVE(de, d_hash);
+	TAILQ_REMOVE(&shard->lru, de, d_lru);
+	shard->count--;
+}
+
+/* Insert or update an entry and evict the oldest ones if the shard is full.
+ * The caller must hold the shard lock.
+ */
+static void cfs_dcache_set(struct cfs_dcache_shard *shard, uint64_t hash,
+			   const struct cfs_fs *fs, cfs_ino_t parent,
+			   const str256_t *name, cfs_ino_t ino)
+{
+	int rc;
+	struct cfs_dentry *de;
+	struct cfs_dentry_bucket *bucket = cfs_dcache_bucket_of(shard, hash);
+
+	de = cfs_dcache_find(bucket, hash, fs, parent, name);
+	if (de != NULL) {
+		de->d_ino = ino;
+		TAILQ_REMOVE(&shard->lru, de, d_lru);
+		TAILQ_INSERT_TAIL(&shard->lru, de, d_lru);
+		return;
+	}
+
+	rc = kvs_alloc(kvstore_get(), (void **) &de,
+		       sizeof(*de) + name->s_len + 1);
+	if (rc != 0) {
+		/* The cache is only an optimization */
+		return;
+	}
+
+	de->d_fs = fs;
+	de->d_parent = parent;
+	de->d_ino = ino;
+	de->d_hash_value = hash;
+	de->d_len = name->s_len;
+	memcpy(de->d_name, name->s_str, name->s_len);
+	de->d_name[name->s_len] = '\0';
+
+	LIST_INSERT_HEAD(bucket, de, d_hash);
+	TAILQ_INSERT_TAIL(&shard->lru, de, d_lru);
+	shard->count++;
+
+	while (shard->count > g_dcache.shard_max) {
+		de = TAILQ_FIRST(&shard->lru);
+		cfs_dcache_unlink(shard, de);
+		cfs_dcache_free(de);
+	}
+}
+
+bool cfs_dcache_lookup(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name, cfs_ino_t *ino, uint64_t *seq)
+{
+	bool found = false;
+	uint64_t hash;
+	struct cfs_dentry *de;
+	struct cfs_dcache_shard *shard;
+
+	dassert(fs && parent && name && ino && seq);
+
+	*seq = 0;
+
+	if (!g_dcache.enabled || cfs_dcache_is_dot(name)) {
+		goto out;
+	}
+
+	hash = cfs_dcache_hash(fs, *parent, name);
+	shard = cfs_dcache_shard_of(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	de = cfs_dcache_find(cfs_dcache_bucket_of(shard, hash), hash, fs,
+			     *parent, name);
+	if (de != NULL) {
+		*ino = de->d_ino;
+		TAILQ_REMOVE(&shard->lru, de, d_lru);
+		TAILQ_INSERT_TAIL(&shard->lru, de, d_lru);
+		if (de->d_ino == CFS_DCACHE_NEGATIVE) {
+			shard->neg_hits++;
+		} else {
+			shard->hits++;
+		}
+		found = true;
+	} else {
+		shard->misses++;
+	}
+	*seq = shard->seq;
+	pthread_mutex_unlock(&shard->lock);
+
+out:
+	return found;
+}
+
+void cfs_dcache_insert(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name, const cfs_ino_t *ino, uint64_t seq)
+{
+	uint64_t hash;
+	struct cfs_dcache_shard *shard;
+
+	dassert(fs && parent && name && ino);
+
+	if (!g_dcache.enabled || cfs_dcache_is_dot(name)) {
+		return;
+	}
+
+	if (*ino == CFS_DCACHE_NEGATIVE && !g_dcache.negative) {
+		return;
+	}
+
+	hash = cfs_dcache_hash(fs, *parent, name);
+	shard = cfs_dcache_shard_of(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	/* The directory could have been modified after the lookup */
+	if (shard->seq == seq) {
+		cfs_dcache_set(shard, hash, fs, *parent, name, *ino);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+void cfs_dcache_add(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		    const str256_t *name, const cfs_ino_t *ino)
+{
+	uint64_t hash;
+	struct cfs_dcache_shard *shard;
+
+	dassert(fs && parent && name && ino);
+
+	if (!g_dcache.enabled || cfs_dcache_is_dot(name)) {
+		return;
+	}
+
+	hash = cfs_dcache_hash(fs, *parent, name);
+	shard = cfs_dcache_shard_of(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	shard->seq++;
+	cfs_dcache_set(shard, hash, fs, *parent, name, *ino);
+	pthread_mutex_unlock(&shard->lock);
+
+	log_trace("dcache add (%llu, %.*s) -> %llu", *parent,
+		  name->s_len, name->s_str, *ino);
+}
+
+void cfs_dcache_remove(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name)
+{
+	uint64_t hash;
+	struct cfs_dentry *de;
+	struct cfs_dcache_shard *shard;
+
+	dassert(fs && parent && name);
+
+	if (!g_dcache.enabled || cfs_dcache_is_dot(name)) {
+		return;
+	}
+
+	hash = cfs_dcache_hash(fs, *parent, name);
+	shard = cfs_dcache_shard_of(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	shard->seq++;
+	de = cfs_dcache_find(cfs_dcache_bucket_of(shard, hash), hash, fs,
+			     *parent, name);
+	if (de != NULL) {
+		cfs_dcache_unlink(shard, de);
+		cfs_dcache_free(de);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	log_trace("dcache remove (%llu, %.*s)", *parent,
+		  name->s_len, name->s_str);
+}
+
+/* Drop all entries of the given filesystem (or of all filesystems if fs is
+ * NULL).
+ */
+static void cfs_dcache_purge(const struct cfs_fs *fs)
+{
+	int i;
+	struct cfs_dentry *de;
+	struct cfs_dentry *next;
+
+	for (i = 0; i < CFS_DCACHE_SHARDS; i++) {
+		struct cfs_dcache_shard *shard = &g_dcache.shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		shard->seq++;
+		TAILQ_FOREACH_SAFE(de, &shard->lru, d_lru, next) {
+			if (fs == NULL || de->d_fs == fs) {
+				cfs_dcache_unlink(shard, de);
+				cfs_dcache_free(de);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void cfs_dcache_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (g_dcache.enabled) {
+		cfs_dcache_purge(fs);
+	}
+}
+
+int cfs_dcache_init(struct collection_item *cfg_items)
+{
+	int rc;
+	int i, j;
+	uint64_t max;
+	uint64_t negative;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "dcache_max",
+		      CFS_DCACHE_MAX_DEFAULT, &max);
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "dcache_negative", 1, &negative);
+
+	for (i = 0; i < CFS_DCACHE_SHARDS; i++) {
+		struct cfs_dcache_shard *shard = &g_dcache.shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		for (j = 0; j < CFS_DCACHE_BUCKETS; j++) {
+			LIST_INIT(&shard->buckets[j]);
+		}
+		TAILQ_INIT(&shard->lru);
+		shard->count = 0;
+		shard->seq = 0;
+		shard->hits = shard->neg_hits = shard->misses = 0;
+	}
+
+	g_dcache.shard_max = max / CFS_DCACHE_SHARDS;
+	g_dcache.enabled = (g_dcache.shard_max != 0);
+	g_dcache.negative = (negative != 0);
+
+out:
+	log_info("dcache: shard_max=%u enabled=%d negative=%d rc=%d",
+		 g_dcache.shard_max, (int) g_dcache.enabled,
+		 (int) g_dcache.negative, rc);
+	return rc;
+}
+
+void cfs_dcache_fini(void)
+{
+	int i;
+	uint64_t hits = 0, neg_hits = 0, misses = 0;
+
+	if (!g_dcache.enabled) {
+		return;
+	}
+
+	cfs_dcache_purge(NULL);
+
+	for (i = 0; i < CFS_DCACHE_SHARDS; i++) {
+		hits += g_dcache.shards[i].hits;
+		neg_hits += g_dcache.shards[i].neg_hits;
+		misses += g_dcache.shards[i].misses;
+		pthread_mutex_destroy(&g_dcache.shards[i].lock);
+	}
+
+	g_dcache.enabled = false;
+
+	log_info("dcache: hits=%llu neg_hits=%llu misses=%llu",
+		 (unsigned long long) hits, (unsigned long long) neg_hits,
+		 (unsigned long long) misses);
+}
@@ -18,6 +18,9 @@
  */
 
 #include <kvstore.h>
+#include <pthread.h> /* pthread_mutex_t */
+#include <sys/queue.h> /* LIST_*, TAILQ_* */
+#include <time.h> /* clock_gettime() */
 #include "cortxfs.h"
 #include "cortxfs_internal.h"
 #include "cortxfs_fh.h"
@@ -46,6 +49,18 @@ struct cfs_fh_key {
 	uint64_t file;
 };
 
+/* FH state flags */
+enum cfs_fh_flags {
+	/* FH is linked into the FH cache and shared between users */
+	CFS_FH_CACHED = 1 << 0,
+	/* CLOCK "referenced" bit, set on every cache hit */
+	CFS_FH_REFERENCED = 1 << 1,
+	/* The object behind the FH has been removed from the storage, the FH
+	 * is dropped from the cache on the last release.
+	 */
+	CFS_FH_STALE = 1 << 2,
+};
+
 struct cfs_fh {
 	/* In memory representation of a NSAL kvnode which is linked to a
 	 * kvtree. This contains the basic attributes (stats) of a file
@@ -60,18 +75,244 @@ struct cfs_fh {
 	 */
 	struct cfs_fh_key key;
 
+	/* Number of users holding this FH. Protected by the shard lock. */
+	uint32_t f_ref;
+
+	/* Set of cfs_fh_flags. Protected by the shard lock. */
+	uint32_t f_flags;
+
+	/* Link in the hash bucket of the FH cache shard */
+	LIST_ENTRY(cfs_fh) f_hash;
+
+	/* Link in the CLOCK ring of the FH cache shard */
+	TAILQ_ENTRY(cfs_fh) f_clock;
+
+	/* Protects lazily initialized data object state (f_oid, f_obj) */
+	pthread_mutex_t f_lock;
+
+	/* OID of the data object, valid if f_has_oid is set */
+	dstore_oid_t f_oid;
+	bool f_has_oid;
+
+	/* Opened data object, closed when the FH is freed */
+	struct dstore_obj *f_obj;
+
+	/* Link in the dirty list; f_dirty and f_dirty_since are protected by
+	 * the dirty list lock. A dirty FH holds a reference.
+	 */
+	TAILQ_ENTRY(cfs_fh) f_dirty_link;
+	bool f_dirty;
+	uint64_t f_dirty_since;
+
 	/* @TODO: Following things can be implemented
-	 * 1. Add synchronization primitives to resolve the concurrency
-	 *    issue
-	 * 2. Add ref count to know about file handle in use by multiple
-	 *    front ends (eg: NFS, CIFS etc) which help to take decision whether
-	 *    to release FH or not
-	 * 3. Cache system attributes associated with a file
-	 * 4. Add a file state to make certain decision when multiple users
+	 * 1. Cache system attributes associated with a file
+	 * 2. Add a file state to make certain decision when multiple users
 	 *    are using it, like delete on close
 	 */
 };
 
+/* FH cache.
+ * ---------
+ *
+ * File handles returned by cfs_fh_from_ino() and cfs_fh_lookup() are shared
+ * between all the users of the same (fs, inode) pair. The cache is split into
+ * shards selected by the hash of cfs_fh_key, each shard has its own lock,
+ * hash table and CLOCK ring used for eviction of unreferenced handles.
+ * The amount of memory occupied by the cache is bounded by "fh_cache_mem"
+ * (bytes) from the "cortxfs" section of the config file; zero disables
+ * the cache, and every call constructs a private FH as before.
+ * Handles which are in use are never evicted, so that the limit could be
+ * exceeded temporary when all the handles are held by the callers.
+ */
+#define CFS_FH_CACHE_SHARDS 64
+#define CFS_FH_CACHE_BUCKETS 1024
+#define CFS_FH_CACHE_MEM_DEFAULT (64ULL << 20)
+
+/* Approximate memory footprint of a cached FH: the FH itself and the stat
+ * buffer allocated by kvnode.
+ */
+#define CFS_FH_CACHE_ENTRY_SIZE (sizeof(struct cfs_fh) + \
+				 sizeof(struct cfs_inode_rec))
+
+struct cfs_fh_shard {
+	pthread_mutex_t lock;
+	LIST_HEAD(cfs_fh_bucket, cfs_fh) buckets[CFS_FH_CACHE_BUCKETS];
+	TAILQ_HEAD(cfs_fh_clock, cfs_fh) clock;
+	uint32_t count;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+struct cfs_fh_cache {
+	bool enabled;
+	/* Max number of FHs per shard */
+	uint32_t shard_max;
+	struct cfs_fh_shard shards[CFS_FH_CACHE_SHARDS];
+};
+
+static struct cfs_fh_cache g_fh_cache;
+
+/* Dirty FHs.
+ * ----------
+ *
+ * The data path (cfs_fh_read, cfs_fh_write) does not dump the stat on every
+ * call, instead it marks the FH dirty. Dirty FHs are kept in a list ordered
+ * by the time they became dirty and written back by the flusher thread when
+ * they are older than "fh_dirty_expire_ms" or when there are more than
+ * "fh_dirty_max" of them. The stat is also written back by cfs_fh_fsync(),
+ * when FHs of a filesystem are dropped and at cfs_fini().
+ */
+#define CFS_FH_DIRTY_EXPIRE_MS_DEFAULT 1000
+#define CFS_FH_DIRTY_MAX_DEFAULT 4096
+
+TAILQ_HEAD(cfs_fh_dirty_list, cfs_fh);
+
+struct cfs_fh_dirty {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct cfs_fh_dirty_list list;
+	uint32_t count;
+	uint32_t max;
+	uint64_t expire_ms;
+	bool stop;
+	bool running;
+	pthread_t flusher;
+};
+
+static struct cfs_fh_dirty g_fh_dirty = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.list = TAILQ_HEAD_INITIALIZER(g_fh_dirty.list),
+};
+
+/* FH allocator.
+ * -------------
+ *
+ * FH buffers are recycled through small per-thread free lists, so that
+ * the FH cache misses and evictions do not hit the general purpose allocator
+ * (and its locks) on every call. A thread keeps up to CFS_FH_POOL_MAX free
+ * buffers, the rest goes back to the allocator. A thread's free list is
+ * released when the thread exits, and the free lists of the threads still
+ * running are released by cfs_fh_cache_fini(), while the KVS is still up:
+ * a thread which exits after the library is finalized has nothing left to
+ * release.
+ */
+#define CFS_FH_POOL_MAX 64
+
+struct cfs_fh_pool_item {
+	SLIST_ENTRY(cfs_fh_pool_item) link;
+};
+
+struct cfs_fh_pool {
+	/* In the list of pools of the running threads */
+	LIST_ENTRY(cfs_fh_pool) link;
+	bool registered;
+	uint32_t count;
+	SLIST_HEAD(cfs_fh_pool_list, cfs_fh_pool_item) items;
+};
+
+struct cfs_fh_pools {
+	pthread_mutex_t lock;
+	LIST_HEAD(cfs_fh_pool_head, cfs_fh_pool) list;
+};
+
+static __thread struct cfs_fh_pool tls_fh_pool;
+static pthread_key_t g_fh_pool_key;
+static pthread_once_t g_fh_pool_once = PTHREAD_ONCE_INIT;
+static struct cfs_fh_pools g_fh_pools = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.list = LIST_HEAD_INITIALIZER(g_fh_pools.list),
+};
+
+static void cfs_fh_pool_drain(struct cfs_fh_pool *pool)
+{
+	struct cfs_fh_pool_item *item;
+
+	while ((item = SLIST_FIRST(&pool->items)) != NULL) {
+		SLIST_REMOVE_HEAD(&pool->items, link);
+		kvs_free(kvstore_get(), item);
+	}
+	pool->count = 0;
+}
+
+/* Release the free list of an exiting thread. It is empty if the library
+ * has been finalized.
+ */
+static void cfs_fh_pool_exit(void *arg)
+{
+	struct cfs_fh_pool *pool = arg;
+
+	pthread_mutex_lock(&g_fh_pools.lock);
+	LIST_REMOVE(pool, link);
+	cfs_fh_pool_drain(pool);
+	pthread_mutex_unlock(&g_fh_pools.lock);
+}
+
+static void cfs_fh_pool_key_create(void)
+{
+	int rc;
+
+	rc = pthread_key_create(&g_fh_pool_key, cfs_fh_pool_exit);
+	if (rc != 0) {
+		log_err("Cannot create FH pool key, rc=%d", rc);
+	}
+}
+
+/* Get the free list of the current thread. */
+static struct cfs_fh_pool *cfs_fh_pool_get(void)
+{
+	struct cfs_fh_pool *pool = &tls_fh_pool;
+
+	if (unlikely(!pool->registered)) {
+		pthread_once(&g_fh_pool_once, cfs_fh_pool_key_create);
+		SLIST_INIT(&pool->items);
+		pool->count = 0;
+		pthread_mutex_lock(&g_fh_pools.lock);
+		LIST_INSERT_HEAD(&g_fh_pools.list, pool, link);
+		pthread_mutex_unlock(&g_fh_pools.lock);
+		/* Let the thread release the list on exit */
+		pthread_setspecific(g_fh_pool_key, pool);
+		pool->registered = true;
+	}
+
+	return pool;
+}
+
+static int cfs_fh_alloc(struct cfs_fh **pfh)
+{
+	int rc = 0;
+	struct cfs_fh_pool *pool = cfs_fh_pool_get();
+	struct cfs_fh_pool_item *item = SLIST_FIRST(&pool->items);
+
+	if (item != NULL) {
+		SLIST_REMOVE_HEAD(&pool->items, link);
+		pool->count--;
+		*pfh = (struct cfs_fh *) item;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) pfh,
+		      sizeof(struct cfs_fh));
+
+out:
+	return rc;
+}
+
+static void cfs_fh_release(struct cfs_fh *fh)
+{
+	struct cfs_fh_pool *pool = cfs_fh_pool_get();
+	struct cfs_fh_pool_item *item = (struct cfs_fh_pool_item *) fh;
+
+	if (pool->count >= CFS_FH_POOL_MAX) {
+		kvs_free(kvstore_get(), fh);
+		return;
+	}
+
+	SLIST_INSERT_HEAD(&pool->items, item, link);
+	pool->count++;
+}
+
 /** Initialize an empty invalid FH instance */
 #define CFS_FH_INIT (struct cfs_fh) { .f_node = KVNODE_INIT_EMTPY }
 
@@ -139,8 +380,98 @@ cfs_ino_t *cfs_fh_ino(struct cfs_fh *fh)
 	return (cfs_ino_t *)&stat->st_ino;
 }
 
-int cfs_fh_from_ino(struct cfs_fs *fs, const cfs_ino_t *ino_num,
-                    struct cfs_fh **fh)
+static inline uint64_t cfs_fh_key_hash(const struct cfs_fh_key *key)
+{
+	uint64_t hash = key->file ^ ((uintptr_t) key->fs >> 4);
+
+	/* 64-bit mix function (murmur3 finalizer) */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static inline struct cfs_fh_shard *cfs_fh_shard_of(uint64_t hash)
+{
+	return &g_fh_cache.shards[hash % CFS_FH_CACHE_SHARDS];
+}
+
+static inline struct cfs_fh_bucket *cfs_fh_bucket_of(struct cfs_fh_shard *shard,
+						     uint64_t hash)
+{
+	return &shard->buckets[(hash / CFS_FH_CACHE_SHARDS) %
+			       CFS_FH_CACHE_BUCKETS];
+}
+
+/* Find a usable FH in the bucket. The caller must hold the shard lock. */
+static struct cfs_fh *cfs_fh_cache_find(struct cfs_fh_bucket *bucket,
+					const struct cfs_fh_key *key)
+{
+	struct cfs_fh *fh;
+
+	LIST_FOREACH(fh, bucket, f_hash) {
+		if (fh->key.file == key->file && fh->key.fs == key->fs &&
+		    (fh->f_flags & CFS_FH_STALE) == 0) {
+			return fh;
+		}
+	}
+
+	return NULL;
+}
+
+static void cfs_fh_free(struct cfs_fh *fh)
+{
+	if (fh->f_obj != NULL) {
+		dstore_obj_close(fh->f_obj);
+	}
+	pthread_mutex_destroy(&fh->f_lock);
+	kvnode_fini(&fh->f_node);
+	cfs_fh_release(fh);
+}
+
+/* Unlink FH from the shard. The caller must hold the shard lock. */
+static void cfs_fh_cache_remove(struct cfs_fh_shard *shard, struct cfs_fh *fh)
+{
+	dassert(fh->f_flags & CFS_FH_CACHED);
+
+	LIST_REMOVE(fh, f_hash);
+	TAILQ_REMOVE(&shard->clock, fh, f_clock);
+	fh->f_flags &= ~CFS_FH_CACHED;
+	shard->count--;
+}
+
+/* Evict unreferenced FHs until the shard fits into its budget.
+ * The function runs the CLOCK algorithm: a FH with the referenced bit
+ * gets its second chance and moves to the tail of the ring.
+ * The caller must hold the shard lock.
+ */
+static void cfs_fh_cache_shrink(struct cfs_fh_shard *shard)
+{
+	struct cfs_fh *fh;
+	uint32_t budget = 2 * shard->count;
+
+	while (shard->count > g_fh_cache.shard_max && budget-- > 0) {
+		fh = TAILQ_FIRST(&shard->clock);
+		TAILQ_REMOVE(&shard->clock, fh, f_clock);
+
+		if (fh->f_ref != 0 || (fh->f_flags & CFS_FH_REFERENCED)) {
+			fh->f_flags &= ~CFS_FH_REFERENCED;
+			TAILQ_INSERT_TAIL(&shard->clock, fh, f_clock);
+			continue;
+		}
+
+		TAILQ_INSERT_TAIL(&shard->clock, fh, f_clock);
+		cfs_fh_cache_remove(shard, fh);
+		shard->evictions++;
+		cfs_fh_free(fh);
+	}
+}
+
+static int cfs_fh_create(struct cfs_fs *fs, const cfs_ino_t *ino_num,
+			 struct cfs_fh **fh)
 {
 	int rc;
 	struct cfs_fh *newfh = NULL;
@@ -152,38 +483,607 @@ int cfs_fh_from_ino(struct cfs_fs *fs, const cfs_ino_t *ino_num,
 	RC_WRAP_LABEL(rc, out, cfs_kvnode_load, &node, fs->kvtree,
 		      ino_num);
 
-	/* A caller for this API who uses/caches this FH, will be responsible
-	 * for freeing up this FH, caller should be calling cfs_fh_destroy to
-	 * release this FH
-	 */
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstor, (void **) &newfh,
-		      sizeof(struct cfs_fh));
+	RC_WRAP_LABEL(rc, out, cfs_fh_alloc, &newfh);
 
+	memset(newfh, 0, sizeof(*newfh));
 	newfh->f_node = node;
 	newfh->fs = fs;
+	newfh->f_ref = 1;
+	pthread_mutex_init(&newfh->f_lock, NULL);
 	cfs_fh_init_key(newfh);
 	dassert(cfs_fh_invariant(newfh));
 	*fh = newfh;
 	newfh = NULL;
 
 out:
+	if (rc != 0) {
+		kvnode_fini(&node);
+	}
 	return rc;
 }
 
+int cfs_fh_from_ino(struct cfs_fs *fs, const cfs_ino_t *ino_num,
+                    struct cfs_fh **fh)
+{
+	int rc;
+	uint64_t hash;
+	struct cfs_fh *newfh = NULL;
+	struct cfs_fh *cached = NULL;
+	struct cfs_fh_shard *shard;
+	struct cfs_fh_bucket *bucket;
+	struct cfs_fh_key key = { .fs = fs, .file = *ino_num };
+
+	dassert(fs && ino_num && fh);
+
+	/* A caller for this API who uses/caches this FH, will be responsible
+	 * for releasing this FH, caller should be calling cfs_fh_destroy to
+	 * release this FH
+	 */
+	if (!g_fh_cache.enabled) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_create, fs, ino_num, fh);
+		goto out;
+	}
+
+	hash = cfs_fh_key_hash(&key);
+	shard = cfs_fh_shard_of(hash);
+	bucket = cfs_fh_bucket_of(shard, hash);
+
+	pthread_mutex_lock(&shard->lock);
+	cached = cfs_fh_cache_find(bucket, &key);
+	if (cached != NULL) {
+		cached->f_ref++;
+		cached->f_flags |= CFS_FH_REFERENCED;
+		shard->hits++;
+	} else {
+		shard->misses++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (cached != NULL) {
+		*fh = cached;
+		rc = 0;
+		goto out;
+	}
+
+	/* Do not hold the shard lock while talking to the KVS */
+	RC_WRAP_LABEL(rc, out, cfs_fh_create, fs, ino_num, &newfh);
+
+	pthread_mutex_lock(&shard->lock);
+	/* Somebody could have loaded the same FH in the meantime */
+	cached = cfs_fh_cache_find(bucket, &key);
+	if (cached != NULL) {
+		cached->f_ref++;
+		cached->f_flags |= CFS_FH_REFERENCED;
+	} else {
+		newfh->f_flags |= CFS_FH_CACHED;
+		LIST_INSERT_HEAD(bucket, newfh, f_hash);
+		TAILQ_INSERT_TAIL(&shard->clock, newfh, f_clock);
+		shard->count++;
+		cfs_fh_cache_shrink(shard);
+		cached = newfh;
+		newfh = NULL;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	*fh = cached;
+
+out:
+	if (newfh != NULL) {
+		cfs_fh_free(newfh);
+	}
+	log_trace("fs=%p ino=%llu rc=%d", fs, *ino_num, rc);
+	return rc;
+}
+
+/* Resolve the OID of the data object. The caller must hold f_lock. */
+static int cfs_fh_load_oid(struct cfs_fh *fh)
+{
+	int rc = 0;
+
+	if (!fh->f_has_oid) {
+		RC_WRAP_LABEL(rc, out, cfs_kvnode_to_oid, fh->fs, &fh->f_node,
+			      &fh->f_oid);
+		fh->f_has_oid = true;
+	}
+
+out:
+	return rc;
+}
+
+int cfs_fh_oid(struct cfs_fh *fh, dstore_oid_t *oid)
+{
+	int rc;
+
+	dassert(fh && oid);
+
+	pthread_mutex_lock(&fh->f_lock);
+	RC_WRAP_LABEL(rc, out, cfs_fh_load_oid, fh);
+	*oid = fh->f_oid;
+out:
+	pthread_mutex_unlock(&fh->f_lock);
+	log_trace("ino=%llu rc=%d", (unsigned long long) fh->key.file, rc);
+	return rc;
+}
+
+int cfs_fh_obj(struct cfs_fh *fh, struct dstore_obj **obj)
+{
+	int rc;
+	struct dstore *dstore = dstore_get();
+
+	dassert(dstore && fh && obj);
+
+	pthread_mutex_lock(&fh->f_lock);
+	if (fh->f_obj == NULL) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_load_oid, fh);
+		RC_WRAP_LABEL(rc, out, dstore_obj_open, dstore, &fh->f_oid,
+			      &fh->f_obj);
+	}
+	*obj = fh->f_obj;
+	rc = 0;
+out:
+	pthread_mutex_unlock(&fh->f_lock);
+	log_trace("ino=%llu obj=%p rc=%d", (unsigned long long) fh->key.file,
+		  fh->f_obj, rc);
+	return rc;
+}
+
+/* Drop a reference to the FH and free it if it is not needed anymore. */
+static void cfs_fh_put(struct cfs_fh *fh)
+{
+	bool release = false;
+	struct cfs_fh_shard *shard;
+
+	if ((fh->f_flags & CFS_FH_CACHED) == 0) {
+		cfs_fh_free(fh);
+		return;
+	}
+
+	shard = cfs_fh_shard_of(cfs_fh_key_hash(&fh->key));
+	pthread_mutex_lock(&shard->lock);
+	dassert(fh->f_ref > 0);
+	fh->f_ref--;
+	if (fh->f_ref == 0 && (fh->f_flags & CFS_FH_STALE)) {
+		cfs_fh_cache_remove(shard, fh);
+		release = true;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (release) {
+		cfs_fh_free(fh);
+	}
+}
+
+/* Take one more reference to a cached FH */
+static void cfs_fh_get(struct cfs_fh *fh)
+{
+	struct cfs_fh_shard *shard;
+
+	dassert(fh->f_flags & CFS_FH_CACHED);
+
+	shard = cfs_fh_shard_of(cfs_fh_key_hash(&fh->key));
+	pthread_mutex_lock(&shard->lock);
+	fh->f_ref++;
+	pthread_mutex_unlock(&shard->lock);
+}
+
+int cfs_fh_cached_stat(struct cfs_fs *fs, const cfs_ino_t *ino_num,
+		       struct stat *bufstat)
+{
+	int rc = -ENOENT;
+	uint64_t hash;
+	struct cfs_fh *cached = NULL;
+	struct cfs_fh_shard *shard;
+	struct cfs_fh_key key = { .fs = fs, .file = *ino_num };
+
+	dassert(fs && ino_num && bufstat);
+
+	if (!g_fh_cache.enabled) {
+		goto out;
+	}
+
+	hash = cfs_fh_key_hash(&key);
+	shard = cfs_fh_shard_of(hash);
+
+	pthread_mutex_lock(&shard->lock);
+	cached = cfs_fh_cache_find(cfs_fh_bucket_of(shard, hash), &key);
+	if (cached != NULL) {
+		cached->f_ref++;
+		cached->f_flags |= CFS_FH_REFERENCED;
+		shard->hits++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (cached == NULL) {
+		goto out;
+	}
+
+	cfs_fh_lock(cached);
+	memcpy(bufstat, cfs_fh_stat(cached), sizeof(*bufstat));
+	cfs_fh_unlock(cached);
+
+	cfs_fh_put(cached);
+	rc = 0;
+
+out:
+	log_trace("fs=%p ino=%llu rc=%d", fs, *ino_num, rc);
+	return rc;
+}
+
+static inline uint64_t cfs_fh_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+void cfs_fh_lock(struct cfs_fh *fh)
+{
+	dassert(fh);
+	pthread_mutex_lock(&fh->f_lock);
+}
+
+void cfs_fh_unlock(struct cfs_fh *fh)
+{
+	dassert(fh);
+	pthread_mutex_unlock(&fh->f_lock);
+}
+
+int cfs_fh_mark_dirty(struct cfs_fh *fh)
+{
+	bool kick = false;
+
+	dassert(fh);
+
+	/* A private FH is released right after the call, there is nobody to
+	 * write it back later.
+	 */
+	if ((fh->f_flags & CFS_FH_CACHED) == 0) {
+		return cfs_set_stat(&fh->f_node);
+	}
+
+	pthread_mutex_lock(&g_fh_dirty.lock);
+	if (!fh->f_dirty) {
+		fh->f_dirty = true;
+		fh->f_dirty_since = cfs_fh_now_ms();
+		cfs_fh_get(fh);
+		TAILQ_INSERT_TAIL(&g_fh_dirty.list, fh, f_dirty_link);
+		g_fh_dirty.count++;
+		kick = (g_fh_dirty.count > g_fh_dirty.max);
+	}
+	if (kick) {
+		pthread_cond_signal(&g_fh_dirty.cond);
+	}
+	pthread_mutex_unlock(&g_fh_dirty.lock);
+
+	return 0;
+}
+
+/* Unlink FH from the dirty list. The caller must hold the dirty list lock
+ * and becomes the owner of the reference held by the dirty list.
+ */
+static void cfs_fh_dirty_remove(struct cfs_fh *fh)
+{
+	dassert(fh->f_dirty);
+
+	TAILQ_REMOVE(&g_fh_dirty.list, fh, f_dirty_link);
+	fh->f_dirty = false;
+	g_fh_dirty.count--;
+}
+
+void cfs_fh_invalidate(struct cfs_fh *fh)
+{
+	bool dirty = false;
+	struct cfs_fh_shard *shard;
+
+	dassert(fh);
+
+	/* The flag is set under f_lock, the lock of cfs_fh_writeback(): once
+	 * it is set, no write back can store the stat again.
+	 */
+	pthread_mutex_lock(&fh->f_lock);
+
+	if ((fh->f_flags & CFS_FH_CACHED) == 0) {
+		fh->f_flags |= CFS_FH_STALE;
+		goto unlock;
+	}
+
+	/* The pending changes of the stat are dropped */
+	pthread_mutex_lock(&g_fh_dirty.lock);
+	dirty = fh->f_dirty;
+	if (dirty) {
+		cfs_fh_dirty_remove(fh);
+	}
+	pthread_mutex_unlock(&g_fh_dirty.lock);
+
+	shard = cfs_fh_shard_of(cfs_fh_key_hash(&fh->key));
+	pthread_mutex_lock(&shard->lock);
+	fh->f_flags |= CFS_FH_STALE;
+	pthread_mutex_unlock(&shard->lock);
+
+unlock:
+	pthread_mutex_unlock(&fh->f_lock);
+
+	if (dirty) {
+		/* The caller holds a reference, the FH stays alive */
+		cfs_fh_put(fh);
+	}
+}
+
+/* Write the stat of an FH removed from the dirty list back to the storage and
+ * drop the dirty reference.
+ */
+static int cfs_fh_writeback(struct cfs_fh *fh)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&fh->f_lock);
+	if ((fh->f_flags & CFS_FH_STALE) == 0) {
+		rc = cfs_set_stat(&fh->f_node);
+	}
+	pthread_mutex_unlock(&fh->f_lock);
+
+	if (rc != 0) {
+		log_err("Failed to write back stat of ino=%llu, rc=%d",
+			(unsigned long long) fh->key.file, rc);
+	}
+
+	cfs_fh_put(fh);
+	return rc;
+}
+
+int cfs_fh_fsync(struct cfs_fh *fh)
+{
+	int rc = 0;
+	bool dirty;
+
+	dassert(fh);
+
+	pthread_mutex_lock(&g_fh_dirty.lock);
+	dirty = fh->f_dirty;
+	if (dirty) {
+		cfs_fh_dirty_remove(fh);
+	}
+	pthread_mutex_unlock(&g_fh_dirty.lock);
+
+	if (dirty) {
+		rc = cfs_fh_writeback(fh);
+	}
+
+	log_trace("ino=%llu dirty=%d rc=%d", (unsigned long long) fh->key.file,
+		  (int) dirty, rc);
+	return rc;
+}
+
+/* Write back all dirty FHs of the given filesystem (or of all filesystems
+ * if fs is NULL).
+ */
+static void cfs_fh_flush_dirty(const struct cfs_fs *fs)
+{
+	struct cfs_fh *fh;
+	struct cfs_fh *next;
+	struct cfs_fh_dirty_list victims = TAILQ_HEAD_INITIALIZER(victims);
+
+	pthread_mutex_lock(&g_fh_dirty.lock);
+	TAILQ_FOREACH_SAFE(fh, &g_fh_dirty.list, f_dirty_link, next) {
+		if (fs != NULL && fh->fs != fs) {
+			continue;
+		}
+		cfs_fh_dirty_remove(fh);
+		TAILQ_INSERT_TAIL(&victims, fh, f_dirty_link);
+	}
+	pthread_mutex_unlock(&g_fh_dirty.lock);
+
+	while ((fh = TAILQ_FIRST(&victims)) != NULL) {
+		TAILQ_REMOVE(&victims, fh, f_dirty_link);
+		(void) cfs_fh_writeback(fh);
+	}
+}
+
+static void *cfs_fh_flusher(void *arg)
+{
+	struct cfs_fh *fh;
+	struct timespec deadline;
+	uint64_t now;
+	uint64_t period_ms = g_fh_dirty.expire_ms / 2 + 1;
+
+	pthread_mutex_lock(&g_fh_dirty.lock);
+	while (!g_fh_dirty.stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += period_ms / 1000;
+		deadline.tv_nsec += (period_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		(void) pthread_cond_timedwait(&g_fh_dirty.cond,
+					      &g_fh_dirty.lock, &deadline);
+
+		now = cfs_fh_now_ms();
+		while ((fh = TAILQ_FIRST(&g_fh_dirty.list)) != NULL) {
+			if (g_fh_dirty.count <= g_fh_dirty.max &&
+			    now - fh->f_dirty_since < g_fh_dirty.expire_ms) {
+				break;
+			}
+			cfs_fh_dirty_remove(fh);
+			pthread_mutex_unlock(&g_fh_dirty.lock);
+			(void) cfs_fh_writeback(fh);
+			pthread_mutex_lock(&g_fh_dirty.lock);
+		}
+	}
+	pthread_mutex_unlock(&g_fh_dirty.lock);
+
+	return NULL;
+}
+
+int cfs_fh_cache_init(struct collection_item *cfg_items)
+{
+	int rc = 0;
+	int i, j;
+	uint64_t mem;
+	uint64_t dirty_max;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "fh_cache_mem",
+		      CFS_FH_CACHE_MEM_DEFAULT, &mem);
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "fh_dirty_expire_ms", CFS_FH_DIRTY_EXPIRE_MS_DEFAULT,
+		      &g_fh_dirty.expire_ms);
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "fh_dirty_max",
+		      CFS_FH_DIRTY_MAX_DEFAULT, &dirty_max);
+	g_fh_dirty.max = dirty_max;
+
+	for (i = 0; i < CFS_FH_CACHE_SHARDS; i++) {
+		struct cfs_fh_shard *shard = &g_fh_cache.shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		for (j = 0; j < CFS_FH_CACHE_BUCKETS; j++) {
+			LIST_INIT(&shard->buckets[j]);
+		}
+		TAILQ_INIT(&shard->clock);
+		shard->count = 0;
+		shard->hits = shard->misses = shard->evictions = 0;
+	}
+
+	g_fh_cache.shard_max = mem / CFS_FH_CACHE_ENTRY_SIZE /
+		CFS_FH_CACHE_SHARDS;
+	g_fh_cache.enabled = (g_fh_cache.shard_max != 0);
+
+	if (g_fh_cache.enabled) {
+		g_fh_dirty.stop = false;
+		rc = -pthread_create(&g_fh_dirty.flusher, NULL, cfs_fh_flusher,
+				     NULL);
+		if (rc != 0) {
+			log_err("Failed to start the FH flusher, rc=%d", rc);
+			g_fh_cache.enabled = false;
+			goto out;
+		}
+		g_fh_dirty.running = true;
+	}
+
+out:
+	log_info("fh cache: shard_max=%u enabled=%d dirty_max=%u "
+		 "dirty_expire_ms=%llu rc=%d", g_fh_cache.shard_max,
+		 (int) g_fh_cache.enabled, g_fh_dirty.max,
+		 (unsigned long long) g_fh_dirty.expire_ms, rc);
+	return rc;
+}
+
+bool cfs_fh_cache_enabled(void)
+{
+	return g_fh_cache.enabled;
+}
+
+/* Drop all unreferenced FHs of the given filesystem (or of all filesystems
+ * if fs is NULL); referenced ones become stale and are released by their
+ * last user.
+ */
+static void cfs_fh_cache_purge(const struct cfs_fs *fs)
+{
+	int i;
+	struct cfs_fh *fh;
+	struct cfs_fh *next;
+
+	for (i = 0; i < CFS_FH_CACHE_SHARDS; i++) {
+		struct cfs_fh_shard *shard = &g_fh_cache.shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		TAILQ_FOREACH_SAFE(fh, &shard->clock, f_clock, next) {
+			if (fs != NULL && fh->fs != fs) {
+				continue;
+			}
+
+			if (fh->f_ref != 0) {
+				log_warn("FH %p (ino=%llu) is still in use",
+					 fh, (unsigned long long) fh->key.file);
+				fh->f_flags |= CFS_FH_STALE;
+				continue;
+			}
+
+			cfs_fh_cache_remove(shard, fh);
+			cfs_fh_free(fh);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void cfs_fh_cache_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (g_fh_cache.enabled) {
+		cfs_fh_flush_dirty(fs);
+		cfs_fh_cache_purge(fs);
+	}
+}
+
+void cfs_fh_cache_flush_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (g_fh_cache.enabled) {
+		cfs_fh_flush_dirty(fs);
+	}
+}
+
+void cfs_fh_cache_fini(void)
+{
+	int i;
+	uint64_t hits = 0, misses = 0, evictions = 0;
+	struct cfs_fh_pool *pool;
+
+	if (!g_fh_cache.enabled) {
+		goto out;
+	}
+
+	if (g_fh_dirty.running) {
+		pthread_mutex_lock(&g_fh_dirty.lock);
+		g_fh_dirty.stop = true;
+		pthread_cond_signal(&g_fh_dirty.cond);
+		pthread_mutex_unlock(&g_fh_dirty.lock);
+		pthread_join(g_fh_dirty.flusher, NULL);
+		g_fh_dirty.running = false;
+	}
+
+	cfs_fh_flush_dirty(NULL);
+	cfs_fh_cache_purge(NULL);
+
+	for (i = 0; i < CFS_FH_CACHE_SHARDS; i++) {
+		hits += g_fh_cache.shards[i].hits;
+		misses += g_fh_cache.shards[i].misses;
+		evictions += g_fh_cache.shards[i].evictions;
+		pthread_mutex_destroy(&g_fh_cache.shards[i].lock);
+	}
+
+	g_fh_cache.enabled = false;
+
+	log_info("fh cache: hits=%llu misses=%llu evictions=%llu",
+		 (unsigned long long) hits, (unsigned long long) misses,
+		 (unsigned long long) evictions);
+
+out:
+	/* The other threads are done with the library, their free lists are
+	 * released before the KVS goes away.
+	 */
+	pthread_mutex_lock(&g_fh_pools.lock);
+	LIST_FOREACH(pool, &g_fh_pools.list, link) {
+		cfs_fh_pool_drain(pool);
+	}
+	pthread_mutex_unlock(&g_fh_pools.lock);
+}
+
 static inline int __cfs_fh_lookup(const cfs_cred_t *cred,
 				  struct cfs_fh *parent_fh,
 				  const char *name, struct cfs_fh **fh)
 {
 	int rc;
 	str256_t kname;
-	struct cfs_fh *newfh = NULL;
 	struct stat *parent_stat = NULL;
-	struct kvstore *kvstor = kvstore_get();
-	struct kvnode node = KVNODE_INIT_EMTPY;
 	cfs_ino_t ino;
+	cfs_ino_t *parent_ino;
 	node_id_t pid, id;
+	uint64_t seq;
 
-	dassert(cred && parent_fh && name && fh && kvstor);
+	dassert(cred && parent_fh && name && fh);
 	dassert(cfs_fh_invariant(parent_fh));
 
 	parent_stat = cfs_fh_stat(parent_fh);
@@ -196,34 +1096,48 @@ static inline int __cfs_fh_lookup(const cfs_cred_t *cred,
 		ino = CFS_ROOT_INODE;
 	} else {
 		str256_from_cstr(kname, name, strlen(name));
+		parent_ino = cfs_fh_ino(parent_fh);
+
+		if (cfs_dcache_lookup(parent_fh->fs, parent_ino, &kname, &ino,
+				      &seq)) {
+			if (ino == CFS_DCACHE_NEGATIVE) {
+				rc = -ENOENT;
+				goto out;
+			}
+			rc = cfs_fh_from_ino(parent_fh->fs, &ino, fh);
+			if (rc != -ENOENT) {
+				goto out;
+			}
+			/* The cached entry points to a removed inode */
+			log_warn("Stale dentry (%llu, %s) -> %llu",
+				 *parent_ino, name, ino);
+			cfs_dcache_remove(parent_fh->fs, parent_ino, &kname);
+			(void) cfs_dcache_lookup(parent_fh->fs, parent_ino,
+						 &kname, &ino, &seq);
+		}
+
 		pid = parent_fh->f_node.node_id;
 
-		RC_WRAP_LABEL(rc, out, kvtree_lookup, parent_fh->fs->kvtree,
-			      &pid, &kname, &id);
+		rc = kvtree_lookup(parent_fh->fs->kvtree, &pid, &kname, &id);
+		if (rc == -ENOENT) {
+			ino = CFS_DCACHE_NEGATIVE;
+			cfs_dcache_insert(parent_fh->fs, parent_ino, &kname,
+					  &ino, seq);
+		}
+		if (rc != 0) {
+			goto out;
+		}
 
 		node_id_to_ino(&id, &ino);
+		cfs_dcache_insert(parent_fh->fs, parent_ino, &kname, &ino, seq);
 	}
 
 	dassert(ino >= CFS_ROOT_INODE);
 
-	RC_WRAP_LABEL(rc, out, cfs_kvnode_load, &node,
-		      parent_fh->fs->kvtree, &ino);
-
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstor, (void **) &newfh,
-		      sizeof(struct cfs_fh));
-
-	newfh->fs = parent_fh->fs;
-	newfh->f_node = node;
-	cfs_fh_init_key(newfh);
-	dassert(cfs_fh_invariant(newfh));
-	*fh = newfh;
-	newfh = NULL;
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, parent_fh->fs, &ino, fh);
 
 	/* FIXME: Shouldn't we update parent.atime here? */
 out:
-	if (newfh) {
-		cfs_fh_destroy(newfh);
-	}
 	return rc;
 }
 
@@ -234,6 +1148,10 @@ int cfs_fh_lookup(const cfs_cred_t *cred, struct cfs_fh *parent_fh,
 
 	perfc_trace_inii(PFT_CFS_LOOKUP, PEM_CFS_TO_NFS);
 	rc = __cfs_fh_lookup(cred, parent_fh, name, fh);
+	if (rc == 0) {
+		cfs_statahead_lookup(parent_fh->fs, *cfs_fh_ino(parent_fh),
+				     *cfs_fh_ino(*fh));
+	}
 	perfc_trace_finii(PERFC_TLS_POP_VERIFY);
 
 	return rc;
@@ -241,9 +1159,7 @@ int cfs_fh_lookup(const cfs_cred_t *cred, struct cfs_fh *parent_fh,
 
 void cfs_fh_destroy(struct cfs_fh *fh)
 {
-	struct kvstore *kvstor = kvstore_get();
-
-	dassert(kvstor && fh);
+	dassert(fh);
 	dassert(cfs_fh_invariant(fh));
 
 	/* Note: As of now, destroying FH does not update the stats in backend
@@ -255,20 +1171,21 @@ void cfs_fh_destroy(struct cfs_fh *fh)
 	 * present everywhere all the update happens to FH
 	 */
 	/* cfs_set_stat(&fh->f_node); */
-	kvnode_fini(&fh->f_node);
-	kvs_free(kvstor, fh);
+	cfs_fh_put(fh);
 }
 
 void cfs_fh_destroy_and_dump_stat(struct cfs_fh *fh)
 {
-	struct kvstore *kvstor = kvstore_get();
-
-	dassert(kvstor && fh);
+	dassert(fh);
 	dassert(cfs_fh_invariant(fh));
 
-	cfs_set_stat(&fh->f_node);
-	kvnode_fini(&fh->f_node);
-	kvs_free(kvstor, fh);
+	/* A stale FH has no stat in the storage anymore */
+	pthread_mutex_lock(&fh->f_lock);
+	if ((fh->f_flags & CFS_FH_STALE) == 0) {
+		cfs_set_stat(&fh->f_node);
+	}
+	pthread_mutex_unlock(&fh->f_lock);
+	cfs_fh_put(fh);
 }
 
 int cfs_fh_getroot(struct cfs_fs *fs, const cfs_cred_t *cred,
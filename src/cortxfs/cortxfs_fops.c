@@ -18,11 +18,13 @@
  */
 
 #include <string.h> /* memset */
+#include <stdlib.h> /* calloc */
+#include <inttypes.h> /* PRIu32 */
 #include <kvstore.h> /* kvstore */
 #include <dstore.h> /* dstore */
 #include <cortxfs.h> /* cfs_access */
 #include "cortxfs_fh.h"
-#include "cortxfs_internal.h" /* cfs_set_ino_oid */
+#include "cortxfs_internal.h" /* cfs_create_entry */
 #include <common/log.h> /* log_* */
 #include <common/helpers.h> /* RC_* */
 #include <sys/param.h> /* DEV_SIZE */
@@ -52,15 +54,14 @@ int cfs_creat(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, parent_stat,
 		      CFS_ACCESS_WRITE);
 
-	/* Create tree entries, get new inode */
-	RC_WRAP_LABEL(rc, out, cfs_create_entry, parent_fh, cred, name, NULL,
-		      mode, &child_ino, CFS_FT_FILE);
-
 	/* Get new unique extstore kfid */
 	RC_WRAP_LABEL(rc, out, dstore_get_new_objid, dstore, &oid);
 
-	/* Set the ino-kfid key-val in kvs */
-	RC_WRAP_LABEL(rc, out, cfs_set_ino_oid, cfs_fs, &child_ino, &oid);
+	/* Create tree entries with the kfid in the inode record,
+	 * get new inode
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_create_entry, parent_fh, cred, name, NULL,
+		      mode, &oid, &child_ino, CFS_FT_FILE);
 
 	/* Create the backend object with passed kfid */
 	RC_WRAP_LABEL(rc, out, dstore_obj_create, dstore, cfs_fs, &oid);
@@ -149,57 +150,173 @@ out:
 	return rc;
 }
 
-static inline ssize_t __cfs_write(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
-				  cfs_file_open_t *fd, void *buf,
-				  size_t count, off_t offset)
+int cfs_creat_batch(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
+		    struct cfs_creat_item *items, uint32_t count)
 {
 	int rc;
-	dstore_oid_t oid;
-	struct stat *stat = NULL;
-	struct cfs_fh *fh = NULL;
+	uint32_t i;
+	dstore_oid_t *oids = NULL;
+	struct cfs_fh *parent_fh = NULL;
 	struct dstore *dstore = dstore_get();
-	struct dstore_obj *obj = NULL;
 
-	dassert(cfs_fs && cred && fd && buf);
-	dassert(dstore);
+	perfc_trace_inii(PFT_CFS_CREATE_BATCH, PEM_CFS_TO_NFS);
+	dassert(dstore && cfs_fs && cred && parent && items);
 
 	if (count == 0) {
 		rc = 0;
 		goto out;
 	}
 
-	/* TODO:Temp_FH_op - to be removed
-	 * Should get rid of creating and destroying FH operation in this
-	 * API when caller pass the valid FH instead of inode number
+	if (count > CFS_CREAT_BATCH_MAX) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, parent, &parent_fh);
+	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, cfs_fh_stat(parent_fh),
+		      CFS_ACCESS_WRITE);
+
+	oids = calloc(count, sizeof(*oids));
+	if (oids == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Get new unique extstore kfids for the whole batch, DSAL hands them
+	 * out one at a time.
 	 */
-	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, &fd->ino, &fh);
+	for (i = 0; i < count; i++) {
+		RC_WRAP_LABEL(rc, out, dstore_get_new_objid, dstore, &oids[i]);
+	}
+
+	/* Dentries, inode records (with the kfids) and the parent stat
+	 * go to the KVS in one transaction.
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_create_entries, parent_fh, cred, items,
+		      count, oids);
+
+	/* Create the backend objects, as cfs_creat does once the tree
+	 * entries are in place.
+	 */
+	for (i = 0; i < count; i++) {
+		items[i].ci_rc = dstore_obj_create(dstore, cfs_fs, &oids[i]);
+		if (items[i].ci_rc != 0 && rc == 0) {
+			rc = items[i].ci_rc;
+		}
+	}
+
+out:
+	free(oids);
+
+	if (parent_fh != NULL) {
+		/* The parent stat is stored by cfs_create_entries */
+		cfs_fh_destroy(parent_fh);
+	}
+
+	log_debug("cfs_fs=%p parent_ino=%llu count=%" PRIu32 " rc=%d",
+		  cfs_fs, *parent, count, rc);
+
+	perfc_trace_attr(PEA_CFS_CREATE_PARENT_INODE, *parent);
+	perfc_trace_attr(PEA_CFS_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	return rc;
+}
+
+static inline ssize_t __cfs_fh_write(struct cfs_fh *fh, cfs_cred_t *cred,
+				     void *buf, size_t count, off_t offset)
+{
+	int rc;
+	off_t old_size;
+	struct stat *stat = NULL;
+	struct stat new_stat;
+	struct dstore_obj *obj = NULL;
+
+	dassert(fh && cred && buf);
+
 	stat = cfs_fh_stat(fh);
 
-	RC_WRAP_LABEL(rc, out, cfs_ino_to_oid, cfs_fs, &fd->ino, &oid);
+	if (count == 0) {
+		rc = 0;
+		goto out;
+	}
 
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat, CFS_ACCESS_WRITE);
 
-	RC_WRAP_LABEL(rc, out, dstore_obj_open, dstore, &oid, &obj);
+	RC_WRAP_LABEL(rc, out, cfs_fh_obj, fh, &obj);
 	RC_WRAP_LABEL(rc, out, dstore_pwrite, obj, offset, count,
 		      stat->st_blksize, (char *)buf);
 
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, stat,
-		      STAT_MTIME_SET|STAT_CTIME_SET);
-
-	if ((offset + count) > stat->st_size) {
+	cfs_fh_lock(fh);
+	old_size = stat->st_size;
+	rc = cfs_amend_stat(stat, STAT_MTIME_SET|STAT_CTIME_SET);
+	if (rc == 0 && (offset + count) > stat->st_size) {
 		stat->st_size = offset + count;
 		/*  TODO: Check if DEV_BSIZE should be stat->st_blksize */
 		stat->st_blocks = (stat->st_size + DEV_BSIZE - 1) / DEV_BSIZE;
 	}
+	new_stat = *stat;
+	cfs_fh_unlock(fh);
+	if (rc != 0) {
+		goto out;
+	}
+
+	cfs_rstat_resized(cfs_fs_from_fh(fh), &new_stat, old_size);
+
+	/* The stat is written back later, see cfs_fh_fsync */
+	RC_WRAP_LABEL(rc, out, cfs_fh_mark_dirty, fh);
+	cfs_watch_notify(cfs_fs_from_fh(fh), NULL, CFS_WATCH_DATA,
+			 cfs_fh_ino(fh), NULL);
 	rc = count;
 
 out:
-	if (obj != NULL) {
-		dstore_obj_close(obj);
+	log_trace("ino=%llu count=%lu offset=%ld rc=%d", *cfs_fh_ino(fh),
+		  count, (long)offset, rc);
+	return rc;
+}
+
+ssize_t cfs_fh_write(struct cfs_fh *fh, cfs_cred_t *cred, void *buf,
+		     size_t count, off_t offset)
+{
+	size_t rc;
+
+	perfc_trace_inii(PFT_CFS_WRITE, PEM_CFS_TO_NFS);
+	perfc_trace_attr(PEA_R_C_COUNT, count);
+	perfc_trace_attr(PEA_R_C_OFFSET, offset);
+
+	rc = __cfs_fh_write(fh, cred, buf, count, offset);
+
+	perfc_trace_attr(PEA_R_C_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_VERIFY);
+
+	return rc;
+}
+
+static inline ssize_t __cfs_write(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
+				  cfs_file_open_t *fd, void *buf,
+				  size_t count, off_t offset)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+
+	dassert(cfs_fs && cred && fd && buf);
+
+	if (count == 0) {
+		rc = 0;
+		goto out;
 	}
 
+	/* TODO:Temp_FH_op - to be removed
+	 * Should get rid of creating and destroying FH operation in this
+	 * API when caller pass the valid FH instead of inode number
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, &fd->ino, &fh);
+
+	rc = __cfs_fh_write(fh, cred, buf, count, offset);
+
+out:
 	if (fh != NULL) {
-		cfs_fh_destroy_and_dump_stat(fh);
+		cfs_fh_destroy(fh);
 	}
 
 	log_trace("cfs_fs=%p ino=%llu fd=%p count=%lu offset=%ld rc=%d",
@@ -224,29 +341,22 @@ ssize_t cfs_write(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_file_open_t *fd,
 	return rc;
 }
 
-int cfs_truncate(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
-		 struct stat *new_stat, int new_stat_flags)
+int cfs_fh_truncate(struct cfs_fh *fh, cfs_cred_t *cred,
+		    struct stat *new_stat, int new_stat_flags)
 {
 	int rc;
-	dstore_oid_t oid;
-	struct dstore *dstore = dstore_get();
 	struct dstore_obj *obj = NULL;
-	struct cfs_fh *fh = NULL;
 	struct stat *stat = NULL;
-	size_t old_size;
+	struct stat old_stat;
+	struct stat cur_stat;
 	size_t new_size;
 
-	dassert(ino && new_stat && dstore);
+	dassert(fh && new_stat);
 	dassert((new_stat_flags & STAT_SIZE_SET) != 0);
+	dassert((new_stat_flags & STAT_SIZE_ATTACH) == 0);
 
-	/* TODO:Temp_FH_op - to be removed
-	 * Should get rid of creating and destroying FH operation in this
-	 * API when caller pass the valid FH instead of inode number
-	 */
-	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, ino, &fh);
 	stat = cfs_fh_stat(fh);
 
-	old_size = stat->st_size;
 	new_size = new_stat->st_size;
 	/*  TODO: Check if DEV_BSIZE should be stat->st_blksize */
 	new_stat->st_blocks = (new_size + DEV_BSIZE - 1) / DEV_BSIZE;
@@ -261,48 +371,97 @@ int cfs_truncate(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
 		new_stat_flags |= (STAT_MTIME_SET | STAT_CTIME_SET);
 	}
 
-	RC_WRAP_LABEL(rc, out, cfs_setattr, fh, cred, new_stat,
-			new_stat_flags);
+	/* cfs_fh_obj() takes the FH lock, the object is opened first */
+	RC_WRAP_LABEL(rc, out, cfs_fh_obj, fh, &obj);
 
-	RC_WRAP_LABEL(rc, out, cfs_ino_to_oid, cfs_fs, ino, &oid);
-	RC_WRAP_LABEL(rc, out, dstore_obj_open, dstore, &oid, &obj);
-	RC_WRAP_LABEL(rc, out, dstore_obj_resize, obj, old_size, new_size,
-		      stat->st_blksize);
-out:
-	if (obj != NULL) {
-		dstore_obj_close(obj);
+	/* The new size is set under the FH lock, so that it does not race
+	 * with writes, and it is written back like the size set by a write.
+	 */
+	cfs_fh_lock(fh);
+	old_stat = *stat;
+	rc = cfs_access_check(cred, stat, CFS_ACCESS_SETATTR);
+	if (rc == 0) {
+		/* ctime is to be updated if md are changed */
+		(void) cfs_amend_stat(stat, STAT_CTIME_SET);
+		cfs_apply_stat(stat, new_stat, new_stat_flags);
+		rc = cfs_fh_mark_dirty(fh);
+		if (rc != 0) {
+			*stat = old_stat;
+		}
+	}
+	cur_stat = *stat;
+	cfs_fh_unlock(fh);
+	if (rc != 0) {
+		goto out;
 	}
 
-	if (fh != NULL) {
-		cfs_fh_destroy_and_dump_stat(fh);
+	rc = dstore_obj_resize(obj, old_stat.st_size, new_size,
+			       cur_stat.st_blksize);
+	if (rc != 0) {
+		/* The object keeps its size, so does the file, unless the size
+		 * has been changed by a write in the meantime.
+		 */
+		cfs_fh_lock(fh);
+		if (stat->st_size == (off_t) new_size) {
+			stat->st_size = old_stat.st_size;
+			stat->st_blocks = old_stat.st_blocks;
+			stat->st_mtim = old_stat.st_mtim;
+			stat->st_ctim = old_stat.st_ctim;
+			(void) cfs_fh_mark_dirty(fh);
+		} else {
+			log_warn("ino=%llu size changed to %lu during a failed"
+				 " resize to %lu, rc=%d", *cfs_fh_ino(fh),
+				 (unsigned long) stat->st_size, new_size, rc);
+		}
+		cfs_fh_unlock(fh);
+		goto out;
 	}
 
+	cfs_rstat_resized(cfs_fs_from_fh(fh), &cur_stat, old_stat.st_size);
+	cfs_watch_notify(cfs_fs_from_fh(fh), NULL,
+			 CFS_WATCH_ATTR | CFS_WATCH_DATA, cfs_fh_ino(fh), NULL);
+
+out:
+	log_trace("ino=%llu new_size=%lu rc=%d", *cfs_fh_ino(fh), new_size, rc);
 	return rc;
 }
 
-static inline ssize_t __cfs_read(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
-				 cfs_file_open_t *fd, void *buf,
-				 size_t count, off_t offset)
+int cfs_truncate(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
+		 struct stat *new_stat, int new_stat_flags)
 {
 	int rc;
-	dstore_oid_t oid;
-	size_t  byte_to_read = count;
-	struct stat *stat = NULL;
 	struct cfs_fh *fh = NULL;
-	struct dstore *dstore = dstore_get();
-	struct dstore_obj *obj = NULL;
 
-	dassert(cfs_fs && cred && fd && buf);
-	dassert(dstore);
+	dassert(ino && new_stat);
 
 	/* TODO:Temp_FH_op - to be removed
 	 * Should get rid of creating and destroying FH operation in this
 	 * API when caller pass the valid FH instead of inode number
 	 */
-	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, &fd->ino, &fh);
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, ino, &fh);
+	RC_WRAP_LABEL(rc, out, cfs_fh_truncate, fh, cred, new_stat,
+		      new_stat_flags);
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	return rc;
+}
+
+static inline ssize_t __cfs_fh_read(struct cfs_fh *fh, cfs_cred_t *cred,
+				    void *buf, size_t count, off_t offset)
+{
+	int rc;
+	bool dirty;
+	size_t  byte_to_read = count;
+	struct stat *stat = NULL;
+	struct dstore_obj *obj = NULL;
+
+	dassert(fh && cred && buf);
+
 	stat = cfs_fh_stat(fh);
 
-	RC_WRAP_LABEL(rc, out, cfs_ino_to_oid, cfs_fs, &fd->ino, &oid);
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat, CFS_ACCESS_READ);
 
 	/* Following are the cases which needs to be handled to ensure we are
@@ -326,20 +485,62 @@ static inline ssize_t __cfs_read(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 		byte_to_read = stat->st_size - offset;
 	}
 
-	RC_WRAP_LABEL(rc, out, dstore_obj_open, dstore, &oid, &obj);
+	RC_WRAP_LABEL(rc, out, cfs_fh_obj, fh, &obj);
 	RC_WRAP_LABEL(rc, out, dstore_pread, obj, offset, byte_to_read,
 		      stat->st_blksize, (char *)buf);
 
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, stat, STAT_ATIME_SET);
+	cfs_fh_lock(fh);
+	dirty = cfs_amend_atime(cfs_fs_from_fh(fh), stat);
+	cfs_fh_unlock(fh);
+
+	if (dirty) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_mark_dirty, fh);
+	}
 	rc = byte_to_read;
 
 out:
-	if (obj != NULL) {
-		dstore_obj_close(obj);
-	}
+	log_trace("ino=%llu count=%lu offset=%ld rc=%d", *cfs_fh_ino(fh),
+		  count, (long)offset, rc);
+	return rc;
+}
+
+ssize_t cfs_fh_read(struct cfs_fh *fh, cfs_cred_t *cred, void *buf,
+		    size_t count, off_t offset)
+{
+	size_t rc;
+
+	perfc_trace_inii(PFT_CFS_READ, PEM_CFS_TO_NFS);
+	perfc_trace_attr(PEA_R_C_COUNT, count);
+	perfc_trace_attr(PEA_R_C_OFFSET, offset);
+
+	rc = __cfs_fh_read(fh, cred, buf, count, offset);
+
+	perfc_trace_attr(PEA_R_C_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_VERIFY);
+
+	return rc;
+}
+
+static inline ssize_t __cfs_read(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
+				 cfs_file_open_t *fd, void *buf,
+				 size_t count, off_t offset)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
 
+	dassert(cfs_fs && cred && fd && buf);
+
+	/* TODO:Temp_FH_op - to be removed
+	 * Should get rid of creating and destroying FH operation in this
+	 * API when caller pass the valid FH instead of inode number
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, &fd->ino, &fh);
+
+	rc = __cfs_fh_read(fh, cred, buf, count, offset);
+
+out:
 	if (fh != NULL) {
-		cfs_fh_destroy_and_dump_stat(fh);
+		cfs_fh_destroy(fh);
 	}
 
 	log_trace("cfs_fs=%p ino=%llu fd=%p count=%lu offset=%ld rc=%d", cfs_fs,
@@ -364,3 +565,21 @@ ssize_t cfs_read(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_file_open_t *fd,
 	return rc;
 }
 
+int cfs_fsync(struct cfs_fs *cfs_fs, const cfs_ino_t *ino)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+
+	dassert(cfs_fs && ino);
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, ino, &fh);
+	RC_WRAP_LABEL(rc, out, cfs_fh_fsync, fh);
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	log_trace("cfs_fs=%p ino=%llu rc=%d", cfs_fs, *ino, rc);
+	return rc;
+}
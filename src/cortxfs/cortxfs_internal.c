@@ -25,6 +25,8 @@
 #include <time.h>
 #include <limits.h> /* PATH_MAX */
 #include <sys/time.h>
+#include <sys/queue.h> /* LIST_*, TAILQ_* */
+#include <pthread.h> /* pthread_rwlock_t */
 #include <ini_config.h>
 #include <common/log.h>
 #include <common/helpers.h>
@@ -41,6 +43,8 @@
 static int cfs_set_ino_no_gen(struct cfs_fs *cfs_fs, cfs_ino_t ino);
 static int cfs_get_ino_no_gen(struct cfs_fs *cfs_fs, cfs_ino_t *ino);
 static int cfs_del_ino_no_gen(struct cfs_fs *cfs_fs);
+static void cfs_oid_cache_put(const struct cfs_fs *fs, cfs_ino_t ino,
+			      const dstore_oid_t *oid, const uint64_t *seq);
 
 /** Get pointer to a const C-string owned by cortxfs_name string. */
 static inline const char *cfs_name_as_cstr(const str256_t *kname)
@@ -73,6 +77,14 @@ static inline const char *cfs_key_type_to_str(cfs_key_type_t ktype)
 		return "fsidnext";
 	case CFS_KEY_TYPE_INO_NUM_GEN:
 		return "ino_counter";
+	case CFS_KEY_TYPE_ORPHAN:
+		return "orphan";
+	case CFS_KEY_TYPE_RSTAT:
+		return "rstat";
+	case CFS_KEY_TYPE_SINDEX:
+		return "sindex";
+	case CFS_KEY_TYPE_RMTREE:
+		return "rmtree";
 	case CFS_KEY_TYPE_INVALID:
 		return "<invalid>";
 	}
@@ -199,6 +211,7 @@ static int cfs_get_ino_no_gen(struct cfs_fs *cfs_fs, cfs_ino_t *ino)
 	if (sizeof (*ino) != value.len) {
 	    log_trace("invalid value size %zu, expected %zu",
 		      value.len, sizeof (*ino));
+	    rc = -EINVAL;
 	    goto out;
 	}
 	memcpy(ino, value.buf, sizeof (*ino));
@@ -226,14 +239,25 @@ out:
 }
 
 int cfs_kvnode_init(struct kvnode *node, struct kvtree *tree,
-		    const cfs_ino_t *ino, const struct stat *bufstat)
+		    const cfs_ino_t *ino, const struct stat *bufstat,
+		    const dstore_oid_t *oid)
 {
 	int rc;
 	node_id_t node_id;
-	uint16_t size = sizeof(struct stat);
+	struct cfs_inode_rec rec;
+	uint16_t size = sizeof(rec);
 
 	dassert(tree);
 	dassert(bufstat);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.ir_stat = *bufstat;
+	rec.ir_version = CFS_VERSION_2;
+	if (oid != NULL) {
+		rec.ir_has_oid = 1;
+		rec.ir_oid = *oid;
+	}
+
 	/**
 	 * A kvnode is identified by a 128 bit node id. However, currently cortxfs
 	 * uses 64 bit inodes in it's apis to identify the entities. The
@@ -244,7 +268,7 @@ int cfs_kvnode_init(struct kvnode *node, struct kvtree *tree,
 	 */
 	ino_to_node_id(ino, &node_id);
 
-	rc = kvnode_init(tree, &node_id, (void *)bufstat, size, node);
+	rc = kvnode_init(tree, &node_id, &rec, size, node);
 
 	log_trace("cfs_kvnode_init: " NODE_ID_F "uid: %d, gid: %d, mode: %04o,"
 		  " rc : %d",
@@ -287,31 +311,20 @@ int cfs_get_stat(const struct kvnode *node, struct stat **bufstat)
 	int rc = 0;
 	uint16_t attr_size;
 	struct stat *attr_buff = NULL;
-	struct kvstore *kvstore = kvstore_get();
 
 	dassert(node);
 	dassert(node->tree);
 	dassert(node->basic_attr);
+	dassert(bufstat);
 
 	attr_size = kvnode_get_basic_attr_buff(node, (void **)&attr_buff);
 
 	dassert(attr_buff);
-	dassert(attr_size == sizeof(struct stat));
+	dassert(cfs_inode_rec_size_valid(attr_size));
 
-	/* TODO: Can we avoid kvs_alloc and have separate API for cortxfs? */
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore, (void **)bufstat,
-		      attr_size);
+	/* The stat is the first member of any version of the inode record */
+	*bufstat = attr_buff;
 
-	/* TODO: This extra memcpy is here because the lifetime of kvnode is
-	 * limited by the scope of this function. When kvnode will be promoted
-	 * upper to the argument list then we can return a weak reference to its
-	 * internals (instead of loading kvsnode from kvstore). But right now we
-	 * cannot do that, so that we just allocate a new buffer, copy data
-	 * there and return this buffer to the caller
-	*/
-	memcpy(*bufstat, attr_buff, attr_size);
-
-out:
 	log_trace("cfs_get_stat: " NODE_ID_F " rc : %d",
 		  NODE_ID_P(&node->node_id), rc);
 
@@ -321,12 +334,18 @@ out:
 int cfs_del_stat(struct kvnode *node)
 {
 	int rc;
+	cfs_ino_t ino;
 
 	dassert(node);
 	dassert(node->tree);
 	dassert(node->basic_attr);
 
-	rc = kvnode_delete(node);
+	node_id_to_ino(&node->node_id, &ino);
+
+	rc = cfs_sindex_del(node->tree, &ino);
+	if (rc == 0) {
+		rc = kvnode_delete(node);
+	}
 
 	log_trace("cfs_del_stat: " NODE_ID_F " rc : %d",
 		  NODE_ID_P(&node->node_id), rc);
@@ -387,6 +406,46 @@ out:
 	return rc;
 }
 
+void cfs_apply_stat(struct stat *stat, const struct stat *setstat, int flags)
+{
+	mode_t ifmt;
+
+	dassert(stat && setstat);
+
+	if (flags & STAT_MODE_SET) {
+		ifmt = stat->st_mode & S_IFMT;
+		stat->st_mode = setstat->st_mode | ifmt;
+	}
+
+	if (flags & STAT_UID_SET) {
+		stat->st_uid = setstat->st_uid;
+	}
+
+	if (flags & STAT_GID_SET) {
+		stat->st_gid = setstat->st_gid;
+	}
+
+	if (flags & STAT_SIZE_SET) {
+		stat->st_size = setstat->st_size;
+		stat->st_blocks = setstat->st_blocks;
+	}
+
+	if (flags & STAT_ATIME_SET) {
+		stat->st_atim.tv_sec = setstat->st_atim.tv_sec;
+		stat->st_atim.tv_nsec = setstat->st_atim.tv_nsec;
+	}
+
+	if (flags & STAT_MTIME_SET) {
+		stat->st_mtim.tv_sec = setstat->st_mtim.tv_sec;
+		stat->st_mtim.tv_nsec = setstat->st_mtim.tv_nsec;
+	}
+
+	if (flags & STAT_CTIME_SET) {
+		stat->st_ctim.tv_sec = setstat->st_ctim.tv_sec;
+		stat->st_ctim.tv_nsec = setstat->st_ctim.tv_nsec;
+	}
+}
+
 int cfs_update_stat(struct kvnode *node, int flags)
 {
 	int rc;
@@ -396,7 +455,7 @@ int cfs_update_stat(struct kvnode *node, int flags)
 	stat_size = kvnode_get_basic_attr_buff(node, (void **)&stat);
 
 	dassert(stat);
-	dassert(stat_size == sizeof(struct stat));
+	dassert(cfs_inode_rec_size_valid(stat_size));
 
 	RC_WRAP_LABEL(rc, out, cfs_amend_stat, stat, flags);
 	RC_WRAP_LABEL(rc, out, cfs_set_stat, node);
@@ -471,6 +530,134 @@ int cfs_ino_num_gen_fini(struct cfs_fs *cfs_fs)
 	return rc;
 }
 
+int cfs_atime_mode_set(struct cfs_fs *cfs_fs, cfs_atime_mode_t mode)
+{
+	int rc;
+	buff_t value;
+	uint8_t raw = mode;
+
+	dassert(cfs_fs != NULL);
+	dassert(mode < CFS_ATIME_INVALID);
+
+	buff_init(&value, &raw, sizeof(raw));
+
+	RC_WRAP_LABEL(rc, out, cfs_set_sysattr, cfs_fs->root_node, value,
+		      CFS_SYS_ATTR_ATIME_MODE);
+
+	cfs_fs->atime_mode = mode;
+
+out:
+	log_trace("cfs_atime_mode_set() ends, mode:%d, rc:%d", (int) mode, rc);
+	return rc;
+}
+
+int cfs_atime_mode_load(struct cfs_fs *cfs_fs)
+{
+	int rc;
+	buff_t value;
+	uint8_t raw;
+
+	dassert(cfs_fs != NULL);
+
+	cfs_fs->atime_mode = CFS_ATIME_STRICT;
+
+	buff_init(&value, NULL, 0);
+
+	rc = cfs_get_sysattr(cfs_fs->root_node, &value,
+			     CFS_SYS_ATTR_ATIME_MODE);
+	if (rc == -ENOENT) {
+		/* The policy has never been set */
+		rc = 0;
+		goto out;
+	}
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (value.len != sizeof(raw)) {
+		log_err("invalid value size %zu, expected %zu",
+			value.len, sizeof(raw));
+		rc = -EINVAL;
+		goto out;
+	}
+	memcpy(&raw, value.buf, sizeof(raw));
+
+	if (raw >= CFS_ATIME_INVALID) {
+		log_err("invalid atime mode %d", (int) raw);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	cfs_fs->atime_mode = raw;
+
+out:
+	log_trace("cfs_atime_mode_load() ends, mode:%d, rc:%d",
+		  (int) cfs_fs->atime_mode, rc);
+	if (value.buf) {
+		free(value.buf);
+	}
+	return rc;
+}
+
+int cfs_atime_mode_fini(struct cfs_fs *cfs_fs)
+{
+	int rc;
+
+	dassert(cfs_fs != NULL);
+
+	rc = cfs_del_sysattr(cfs_fs->root_node, CFS_SYS_ATTR_ATIME_MODE);
+	if (rc == -ENOENT) {
+		rc = 0;
+	}
+
+	log_trace("cfs_atime_mode_fini() ends, rc:%d", rc);
+	return rc;
+}
+
+static inline bool cfs_timespec_le(const struct timespec *a,
+				   const struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+bool cfs_amend_atime(const struct cfs_fs *cfs_fs, struct stat *stat)
+{
+	bool dirty = true;
+	struct timeval t;
+
+	dassert(cfs_fs);
+	dassert(stat);
+
+	switch (cfs_fs->atime_mode) {
+	case CFS_ATIME_NOATIME:
+		return false;
+
+	case CFS_ATIME_RELATIME:
+		if (gettimeofday(&t, NULL) != 0) {
+			return false;
+		}
+		if (!cfs_timespec_le(&stat->st_atim, &stat->st_mtim) &&
+		    !cfs_timespec_le(&stat->st_atim, &stat->st_ctim) &&
+		    t.tv_sec - stat->st_atim.tv_sec < CFS_RELATIME_MAX_AGE) {
+			return false;
+		}
+		break;
+
+	case CFS_ATIME_LAZYTIME:
+		dirty = false;
+		break;
+
+	default:
+		break;
+	}
+
+	/* Setting atime alone cannot fail */
+	(void) cfs_amend_stat(stat, STAT_ATIME_SET);
+
+	return dirty;
+}
+
 int cfs_tree_rename_link(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
                          const str256_t *old_name, const str256_t *new_name)
 {
@@ -494,14 +681,20 @@ int cfs_tree_rename_link(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
 
 	RC_WRAP_LABEL(rc, out, kvtree_detach, cfs_fs->kvtree, pnode_id,
 		      old_name);
+	cfs_dcache_remove(cfs_fs, cfs_fh_ino(parent_fh), old_name);
 
 	cnode_id = cfs_node_id_from_fh(child_fh);
 	RC_WRAP_LABEL(rc, out, kvtree_attach, cfs_fs->kvtree, pnode_id,
 		      cnode_id, new_name);
+	cfs_dcache_add(cfs_fs, cfs_fh_ino(parent_fh), new_name,
+		       cfs_fh_ino(child_fh));
+	cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(parent_fh));
 
 	// Update ctime stat
 	parent_stat = cfs_fh_stat(parent_fh);
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, parent_stat, STAT_CTIME_SET);
+	cfs_fh_lock(parent_fh);
+	rc = cfs_amend_stat(parent_stat, STAT_CTIME_SET);
+	cfs_fh_unlock(parent_fh);
 
 out:
 	log_debug("(%p,pino=%llu,ino=%llu,o=%.*s,n=%.*s) = %d",
@@ -538,27 +731,165 @@ out:
 	return rc;
 }
 
-int cfs_next_inode(struct cfs_fs *cfs_fs, cfs_ino_t *ino_out)
+/* Inode number allocator.
+ * ------------------------
+ *
+ * CFS_SYS_ATTR_INO_NUM_GEN holds the highest inode number which has been
+ * handed out. Instead of updating it on every create, the allocator of
+ * a filesystem reserves CFS_INO_RESERVE numbers with a single update and
+ * gives them out in sub-ranges of CFS_INO_THREAD_BATCH numbers to the
+ * threads, which then allocate from their own sub-range without any locks.
+ * The numbers which have been reserved but not used (for example, because
+ * of a restart) are skipped, inode numbers are never reused anyway.
+ * Each allocator has a unique id, so that a thread never uses a sub-range
+ * which belongs to another (or to a deleted) filesystem. A thread keeps
+ * a sub-range per filesystem (up to CFS_INO_THREAD_SLOTS filesystems), so that
+ * a thread which serves several filesystems does not drop its sub-ranges.
+ *
+ * The generator is read and updated within one transaction under
+ * the allocator lock. NSAL has no atomic increment, so that the allocator
+ * relies on a filesystem being served by a single cortxfs process, as the FH
+ * and dentry caches do.
+ */
+#define CFS_INO_RESERVE 1024
+#define CFS_INO_THREAD_BATCH 32
+#define CFS_INO_THREAD_SLOTS 8
+
+struct cfs_ino_alloc {
+	pthread_mutex_t lock;
+	uint64_t id;
+	/* Reserved range [next, end) */
+	cfs_ino_t next;
+	cfs_ino_t end;
+};
+
+struct cfs_ino_range {
+	uint64_t id;
+	/* Range of the thread [next, end) */
+	cfs_ino_t next;
+	cfs_ino_t end;
+};
+
+static uint64_t g_ino_alloc_id;
+static __thread struct cfs_ino_range tls_ino_ranges[CFS_INO_THREAD_SLOTS];
+
+int cfs_ino_alloc_init(struct cfs_fs *cfs_fs)
+{
+	int rc = 0;
+	struct cfs_ino_alloc *alloc = NULL;
+
+	dassert(cfs_fs != NULL);
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &alloc,
+		      sizeof(*alloc));
+
+	pthread_mutex_init(&alloc->lock, NULL);
+	alloc->id = __sync_add_and_fetch(&g_ino_alloc_id, 1);
+	alloc->next = 0;
+	alloc->end = 0;
+
+	cfs_fs->ino_alloc = alloc;
+
+out:
+	log_trace("cfs_fs=%p rc=%d", cfs_fs, rc);
+	return rc;
+}
+
+void cfs_ino_alloc_fini(struct cfs_fs *cfs_fs)
+{
+	struct cfs_ino_alloc *alloc;
+
+	dassert(cfs_fs != NULL);
+
+	alloc = cfs_fs->ino_alloc;
+	if (alloc == NULL) {
+		return;
+	}
+
+	pthread_mutex_destroy(&alloc->lock);
+	kvs_free(kvstore_get(), alloc);
+	cfs_fs->ino_alloc = NULL;
+}
+
+/* Reserve the next range of inode numbers in the storage.
+ * The caller must hold the allocator lock.
+ */
+static int cfs_ino_reserve(struct cfs_fs *cfs_fs, struct cfs_ino_alloc *alloc)
 {
 	int rc;
-	cfs_ino_t ino;
+	cfs_ino_t last;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = cfs_fs->kvtree->index;
+
+	RC_WRAP_LABEL(rc, out, kvs_begin_transaction, kvstor, &index);
+	RC_WRAP_LABEL(rc, aborted, cfs_get_ino_no_gen, cfs_fs, &last);
+	RC_WRAP_LABEL(rc, aborted, cfs_set_ino_no_gen, cfs_fs,
+		      last + CFS_INO_RESERVE);
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+
+	alloc->next = last + 1;
+	alloc->end = last + CFS_INO_RESERVE + 1;
+
+aborted:
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+	}
+
+out:
+	log_trace("cfs_fs=%p reserved [%llu, %llu) rc=%d", cfs_fs,
+		  alloc->next, alloc->end, rc);
+	return rc;
+}
+
+int cfs_next_inode(struct cfs_fs *cfs_fs, cfs_ino_t *ino_out)
+{
+	int rc = 0;
+	cfs_ino_t batch;
+	struct cfs_ino_alloc *alloc;
+	struct cfs_ino_range *range;
 
 	dassert(cfs_fs != NULL);
 	dassert(ino_out != NULL);
+	dassert(cfs_fs->ino_alloc != NULL);
+
+	alloc = cfs_fs->ino_alloc;
+	range = &tls_ino_ranges[alloc->id % CFS_INO_THREAD_SLOTS];
+
+	if (likely(range->id == alloc->id && range->next < range->end)) {
+		goto alloc;
+	}
 
-	RC_WRAP_LABEL(rc, out, cfs_get_ino_no_gen, cfs_fs, &ino);
-	ino++;
-	RC_WRAP_LABEL(rc, out, cfs_set_ino_no_gen, cfs_fs, ino);
+	pthread_mutex_lock(&alloc->lock);
+	if (alloc->next == alloc->end) {
+		rc = cfs_ino_reserve(cfs_fs, alloc);
+		if (rc != 0) {
+			pthread_mutex_unlock(&alloc->lock);
+			goto out;
+		}
+	}
+
+	batch = alloc->end - alloc->next;
+	if (batch > CFS_INO_THREAD_BATCH) {
+		batch = CFS_INO_THREAD_BATCH;
+	}
+
+	range->id = alloc->id;
+	range->next = alloc->next;
+	range->end = alloc->next + batch;
+	alloc->next += batch;
+	pthread_mutex_unlock(&alloc->lock);
+
+alloc:
+	*ino_out = range->next++;
 
-	*ino_out = ino;
 out:
 	log_trace("cfs_next_inode() ends, ino = %llu, rc:%d", *ino_out, rc);
 	return rc;
 }
 
 int cfs_create_entry(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
-                     char *lnk, mode_t mode, cfs_ino_t *new_entry,
-                     enum cfs_file_type type)
+                     char *lnk, mode_t mode, const obj_id_t *oid,
+                     cfs_ino_t *new_entry, enum cfs_file_type type)
 {
 	int rc;
 	int flags;
@@ -573,6 +904,7 @@ int cfs_create_entry(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
 	struct cfs_fh *fh = NULL;
 	str256_t k_name;
 	node_id_t new_node_id, parent_node_id;
+	bool parent_updated = false;
 
 	dassert(kvstor);
 
@@ -658,8 +990,10 @@ int cfs_create_entry(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
 
 	/* Create node for new entry and set its stats */
 	RC_WRAP_LABEL(rc, errfree, cfs_kvnode_init, &new_node, cfs_fs->kvtree,
-	              new_entry, &bufstat);
+	              new_entry, &bufstat, oid);
 	RC_WRAP_LABEL(rc, errfree, cfs_set_stat, &new_node);
+	RC_WRAP_LABEL(rc, errfree, cfs_rstat_link, cfs_fs, new_entry,
+		      (cfs_ino_t *)&parent_stat->st_ino);
 
 	if (type == CFS_FT_SYMLINK) {
 		buff_t value;
@@ -679,15 +1013,28 @@ int cfs_create_entry(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
 		flags |= STAT_INCR_LINK;
 	}
 
-	RC_WRAP_LABEL(rc, errfree, cfs_amend_stat, parent_stat, flags);
+	RC_WRAP_LABEL(rc, errfree, cfs_fh_update_stat, parent_fh, flags, 1);
+	parent_updated = true;
+
+	RC_WRAP_LABEL(rc, errfree, kvs_end_transaction, kvstor, &index);
 
-	RC_WRAP(kvs_end_transaction, kvstor, &index);
+	cfs_dcache_add(cfs_fs, cfs_fh_ino(parent_fh), &k_name, new_entry);
+	cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(parent_fh));
+	cfs_rstat_created(cfs_fs, cfs_fh_ino(parent_fh), &bufstat);
+	cfs_watch_notify(cfs_fs, cfs_fh_ino(parent_fh), CFS_WATCH_CREATE,
+			 new_entry, &k_name);
+	if (oid != NULL) {
+		cfs_oid_cache_put(cfs_fs, *new_entry, oid, NULL);
+	}
 
 errfree:
 	kvnode_fini(&new_node);
 
 	if (rc != 0) {
 		kvs_discard_transaction(kvstor, &index);
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh, flags, 1);
+		}
 	}
 
 out:
@@ -701,12 +1048,509 @@ out:
 	return rc;
 }
 
+static int cfs_creat_item_cmp(const void *a, const void *b)
+{
+	const struct cfs_creat_item *ia = *(const struct cfs_creat_item **) a;
+	const struct cfs_creat_item *ib = *(const struct cfs_creat_item **) b;
+
+	return strcmp(ia->ci_name, ib->ci_name);
+}
+
+/* Validates the names of a batch: each of them must be a valid name that
+ * does not exist in the parent directory and is not repeated within the
+ * batch. ci_rc of the first offending item is set.
+ */
+static int cfs_create_entries_check(struct cfs_fh *parent_fh,
+				    cfs_cred_t *cred,
+				    struct cfs_creat_item *items,
+				    uint32_t count)
+{
+	int rc = 0;
+	uint32_t i;
+	size_t namelen;
+	struct cfs_fh *fh = NULL;
+	struct cfs_creat_item **sorted = NULL;
+
+	for (i = 0; i < count; i++) {
+		namelen = strlen(items[i].ci_name);
+		if (namelen == 0) {
+			rc = -EINVAL;
+		} else {
+			rc = cfs_create_check_name(items[i].ci_name, namelen);
+		}
+
+		if (rc == 0) {
+			rc = cfs_fh_lookup(cred, parent_fh, items[i].ci_name,
+					   &fh);
+			if (rc == 0) {
+				cfs_fh_destroy(fh);
+				fh = NULL;
+				rc = -EEXIST;
+			} else if (rc == -ENOENT) {
+				rc = 0;
+			}
+		}
+
+		if (rc != 0) {
+			items[i].ci_rc = rc;
+			goto out;
+		}
+	}
+
+	if (count < 2) {
+		goto out;
+	}
+
+	sorted = malloc(count * sizeof(*sorted));
+	if (sorted == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		sorted[i] = &items[i];
+	}
+
+	qsort(sorted, count, sizeof(*sorted), cfs_creat_item_cmp);
+
+	for (i = 1; i < count; i++) {
+		if (strcmp(sorted[i - 1]->ci_name, sorted[i]->ci_name) == 0) {
+			rc = -EEXIST;
+			sorted[i]->ci_rc = rc;
+			goto out;
+		}
+	}
+
+out:
+	free(sorted);
+	return rc;
+}
+
+int cfs_create_entries(struct cfs_fh *parent_fh, cfs_cred_t *cred,
+		       struct cfs_creat_item *items, uint32_t count,
+		       const obj_id_t *oids)
+{
+	int rc;
+	uint32_t i;
+	struct timeval t;
+	struct stat setstat;
+	struct stat *bufstat;
+	struct cfs_fs *cfs_fs = cfs_fs_from_fh(parent_fh);
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = cfs_fs->kvtree->index;
+	struct kvnode new_node = KVNODE_INIT_EMTPY;
+	struct stat *parent_stat = NULL;
+	str256_t k_name;
+	node_id_t new_node_id, parent_node_id;
+	bool in_txn = false;
+	bool parent_updated = false;
+
+	dassert(kvstor && cred && items && oids);
+
+	parent_stat = cfs_fh_stat(parent_fh);
+
+	for (i = 0; i < count; i++) {
+		items[i].ci_ino = 0;
+		items[i].ci_rc = 0;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_create_entries_check, parent_fh, cred,
+		      items, count);
+
+	/* Reserve all inode numbers up front so that the transaction below
+	 * does only tree and record updates.
+	 */
+	for (i = 0; i < count; i++) {
+		RC_WRAP_LABEL(rc, out, cfs_next_inode, cfs_fs, &items[i].ci_ino);
+	}
+
+	if (gettimeofday(&t, NULL) != 0) {
+		rc = -EPERM;
+		goto out;
+	}
+
+	ino_to_node_id((cfs_ino_t *)&parent_stat->st_ino, &parent_node_id);
+
+	RC_WRAP_LABEL(rc, out, kvs_begin_transaction, kvstor, &index);
+	in_txn = true;
+
+	for (i = 0; i < count; i++) {
+		str256_from_cstr(k_name, items[i].ci_name,
+				 strlen(items[i].ci_name));
+		ino_to_node_id(&items[i].ci_ino, &new_node_id);
+
+		rc = kvtree_attach(cfs_fs->kvtree, &parent_node_id,
+				   &new_node_id, &k_name);
+		if (rc != 0) {
+			items[i].ci_rc = rc;
+			goto out;
+		}
+
+		/* Default stats of a new file, then the requested ones.
+		 * ci_stat is the input and becomes the final stat.
+		 */
+		bufstat = &items[i].ci_stat;
+		setstat = *bufstat;
+
+		memset(bufstat, 0, sizeof(struct stat));
+		bufstat->st_uid = cred->uid;
+		bufstat->st_gid = cred->gid;
+		bufstat->st_ino = items[i].ci_ino;
+		bufstat->st_atim.tv_sec = t.tv_sec;
+		bufstat->st_atim.tv_nsec = 1000 * t.tv_usec;
+		bufstat->st_mtim = bufstat->st_atim;
+		bufstat->st_ctim = bufstat->st_atim;
+		bufstat->st_blksize = parent_stat->st_blksize;
+		bufstat->st_mode = S_IFREG | items[i].ci_mode;
+		bufstat->st_nlink = 1;
+
+		cfs_apply_stat(bufstat, &setstat, items[i].ci_stat_flags);
+
+		rc = cfs_kvnode_init(&new_node, cfs_fs->kvtree,
+				     &items[i].ci_ino, bufstat, &oids[i]);
+		if (rc == 0) {
+			rc = cfs_set_stat(&new_node);
+		}
+		if (rc == 0) {
+			rc = cfs_rstat_link(cfs_fs, &items[i].ci_ino,
+					    cfs_fh_ino(parent_fh));
+		}
+		kvnode_fini(&new_node);
+		if (rc != 0) {
+			items[i].ci_rc = rc;
+			goto out;
+		}
+	}
+
+	/* The parent record is stored once for the whole batch, within
+	 * the transaction, so that its number of entries is committed along
+	 * with the entries.
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_fh_update_stat, parent_fh,
+		      STAT_CTIME_SET | STAT_MTIME_SET, (int) count);
+	parent_updated = true;
+
+	RC_WRAP_LABEL(rc, out, kvs_end_transaction, kvstor, &index);
+	in_txn = false;
+
+	cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(parent_fh));
+	for (i = 0; i < count; i++) {
+		str256_from_cstr(k_name, items[i].ci_name,
+				 strlen(items[i].ci_name));
+		cfs_dcache_add(cfs_fs, cfs_fh_ino(parent_fh), &k_name,
+			       &items[i].ci_ino);
+		cfs_rstat_created(cfs_fs, cfs_fh_ino(parent_fh),
+				  &items[i].ci_stat);
+		cfs_watch_notify(cfs_fs, cfs_fh_ino(parent_fh),
+				 CFS_WATCH_CREATE, &items[i].ci_ino, &k_name);
+		cfs_oid_cache_put(cfs_fs, items[i].ci_ino, &oids[i], NULL);
+	}
+
+out:
+	if (in_txn) {
+		kvs_discard_transaction(kvstor, &index);
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh,
+						STAT_CTIME_SET | STAT_MTIME_SET,
+						(int) count);
+		}
+	}
+
+	if (rc != 0) {
+		for (i = 0; i < count; i++) {
+			items[i].ci_ino = 0;
+		}
+	}
+
+	log_trace("parent_ino=%llu count=%" PRIu32 " rc=%d",
+		  (unsigned long long int)parent_stat->st_ino, count, rc);
+	return rc;
+}
+
 #define INODE_KFID_KEY_INIT INODE_ATTR_KEY_PTR_INIT
 
+/* Inode to OID cache.
+ * -------------------
+ *
+ * The mapping between an inode and the OID of its data object never changes
+ * during the lifetime of a file, so that it is cached in memory to avoid a KVS
+ * lookup on every data operation. The cache is filled on inode creation,
+ * by cfs_set_ino_oid() and by the lookups of CFS_VERSION_0 mappings
+ * (CFS_VERSION_1 inode records carry the OID themselves), the entries are
+ * dropped by cfs_del_oid().
+ * The cache is sharded by (fs, ino), the lookups take only a read lock of
+ * a shard. The oldest entries are evicted when a shard exceeds its share of
+ * "oid_cache_max" from the "cortxfs" config section.
+ */
+#define CFS_OID_CACHE_SHARDS 64
+#define CFS_OID_CACHE_BUCKETS 1024
+#define CFS_OID_CACHE_MAX_DEFAULT (256 * 1024)
+
+struct cfs_oid_entry {
+	LIST_ENTRY(cfs_oid_entry) o_hash;
+	TAILQ_ENTRY(cfs_oid_entry) o_fifo;
+	const struct cfs_fs *o_fs;
+	cfs_ino_t o_ino;
+	dstore_oid_t o_oid;
+};
+
+struct cfs_oid_shard {
+	pthread_rwlock_t lock;
+	LIST_HEAD(cfs_oid_bucket, cfs_oid_entry) buckets[CFS_OID_CACHE_BUCKETS];
+	TAILQ_HEAD(cfs_oid_fifo, cfs_oid_entry) fifo;
+	uint32_t count;
+	/* Bumped by every removal, see cfs_oid_cache_put() */
+	uint64_t seq;
+};
+
+struct cfs_oid_cache {
+	bool enabled;
+	uint32_t shard_max;
+	struct cfs_oid_shard shards[CFS_OID_CACHE_SHARDS];
+};
+
+static struct cfs_oid_cache g_oid_cache;
+
+static inline uint64_t cfs_oid_cache_hash(const struct cfs_fs *fs,
+					  cfs_ino_t ino)
+{
+	uint64_t hash = ino ^ ((uintptr_t) fs >> 4);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static inline struct cfs_oid_shard *cfs_oid_shard_of(uint64_t hash)
+{
+	return &g_oid_cache.shards[hash % CFS_OID_CACHE_SHARDS];
+}
+
+static inline struct cfs_oid_bucket *
+cfs_oid_bucket_of(struct cfs_oid_shard *shard, uint64_t hash)
+{
+	return &shard->buckets[(hash / CFS_OID_CACHE_SHARDS) %
+			       CFS_OID_CACHE_BUCKETS];
+}
+
+/* Find an entry. The caller must hold the shard lock. */
+static struct cfs_oid_entry *cfs_oid_cache_find(struct cfs_oid_bucket *bucket,
+						const struct cfs_fs *fs,
+						cfs_ino_t ino)
+{
+	struct cfs_oid_entry *entry;
+
+	LIST_FOREACH(entry, bucket, o_hash) {
+		if (entry->o_ino == ino && entry->o_fs == fs) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Unlink and free an entry. The caller must hold the shard write lock. */
+static void cfs_oid_cache_drop(struct cfs_oid_shard *shard,
+			       struct cfs_oid_entry *entry)
+{
+	LIST_REMOVE(entry, o_hash);
+	TAILQ_REMOVE(&shard->fifo, entry, o_fifo);
+	shard->count--;
+	kvs_free(kvstore_get(), entry);
+}
+
+static bool cfs_oid_cache_get(const struct cfs_fs *fs, cfs_ino_t ino,
+			      dstore_oid_t *oid, uint64_t *seq)
+{
+	bool found = false;
+	uint64_t hash;
+	struct cfs_oid_shard *shard;
+	struct cfs_oid_entry *entry;
+
+	*seq = 0;
+
+	if (!g_oid_cache.enabled) {
+		goto out;
+	}
+
+	hash = cfs_oid_cache_hash(fs, ino);
+	shard = cfs_oid_shard_of(hash);
+
+	pthread_rwlock_rdlock(&shard->lock);
+	entry = cfs_oid_cache_find(cfs_oid_bucket_of(shard, hash), fs, ino);
+	if (entry != NULL) {
+		*oid = entry->o_oid;
+		found = true;
+	}
+	*seq = shard->seq;
+	pthread_rwlock_unlock(&shard->lock);
+
+out:
+	return found;
+}
+
+/* Add a mapping. If seq is not NULL, the mapping was read from the storage
+ * and it is added only if no mappings have been removed from the shard
+ * since cfs_oid_cache_get() returned seq.
+ */
+static void cfs_oid_cache_put(const struct cfs_fs *fs, cfs_ino_t ino,
+			      const dstore_oid_t *oid, const uint64_t *seq)
+{
+	int rc;
+	uint64_t hash;
+	struct cfs_oid_shard *shard;
+	struct cfs_oid_bucket *bucket;
+	struct cfs_oid_entry *entry = NULL;
+
+	if (!g_oid_cache.enabled) {
+		return;
+	}
+
+	hash = cfs_oid_cache_hash(fs, ino);
+	shard = cfs_oid_shard_of(hash);
+	bucket = cfs_oid_bucket_of(shard, hash);
+
+	rc = kvs_alloc(kvstore_get(), (void **) &entry, sizeof(*entry));
+	if (rc != 0) {
+		/* The cache is only an optimization */
+		return;
+	}
+
+	entry->o_fs = fs;
+	entry->o_ino = ino;
+	entry->o_oid = *oid;
+
+	pthread_rwlock_wrlock(&shard->lock);
+	if ((seq != NULL && *seq != shard->seq) ||
+	    cfs_oid_cache_find(bucket, fs, ino) != NULL) {
+		pthread_rwlock_unlock(&shard->lock);
+		kvs_free(kvstore_get(), entry);
+		return;
+	}
+
+	LIST_INSERT_HEAD(bucket, entry, o_hash);
+	TAILQ_INSERT_TAIL(&shard->fifo, entry, o_fifo);
+	shard->count++;
+
+	while (shard->count > g_oid_cache.shard_max) {
+		cfs_oid_cache_drop(shard, TAILQ_FIRST(&shard->fifo));
+	}
+	pthread_rwlock_unlock(&shard->lock);
+}
+
+static void cfs_oid_cache_del(const struct cfs_fs *fs, cfs_ino_t ino)
+{
+	uint64_t hash;
+	struct cfs_oid_shard *shard;
+	struct cfs_oid_entry *entry;
+
+	if (!g_oid_cache.enabled) {
+		return;
+	}
+
+	hash = cfs_oid_cache_hash(fs, ino);
+	shard = cfs_oid_shard_of(hash);
+
+	pthread_rwlock_wrlock(&shard->lock);
+	shard->seq++;
+	entry = cfs_oid_cache_find(cfs_oid_bucket_of(shard, hash), fs, ino);
+	if (entry != NULL) {
+		cfs_oid_cache_drop(shard, entry);
+	}
+	pthread_rwlock_unlock(&shard->lock);
+}
+
+/* Drop all mappings of the given filesystem (or of all filesystems if fs
+ * is NULL).
+ */
+static void cfs_oid_cache_purge(const struct cfs_fs *fs)
+{
+	int i;
+	struct cfs_oid_entry *entry;
+	struct cfs_oid_entry *next;
+
+	for (i = 0; i < CFS_OID_CACHE_SHARDS; i++) {
+		struct cfs_oid_shard *shard = &g_oid_cache.shards[i];
+
+		pthread_rwlock_wrlock(&shard->lock);
+		shard->seq++;
+		TAILQ_FOREACH_SAFE(entry, &shard->fifo, o_fifo, next) {
+			if (fs == NULL || entry->o_fs == fs) {
+				cfs_oid_cache_drop(shard, entry);
+			}
+		}
+		pthread_rwlock_unlock(&shard->lock);
+	}
+}
+
+void cfs_oid_cache_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (g_oid_cache.enabled) {
+		cfs_oid_cache_purge(fs);
+	}
+}
+
+int cfs_oid_cache_init(struct collection_item *cfg_items)
+{
+	int rc;
+	int i, j;
+	uint64_t max;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "oid_cache_max",
+		      CFS_OID_CACHE_MAX_DEFAULT, &max);
+
+	for (i = 0; i < CFS_OID_CACHE_SHARDS; i++) {
+		struct cfs_oid_shard *shard = &g_oid_cache.shards[i];
+
+		pthread_rwlock_init(&shard->lock, NULL);
+		for (j = 0; j < CFS_OID_CACHE_BUCKETS; j++) {
+			LIST_INIT(&shard->buckets[j]);
+		}
+		TAILQ_INIT(&shard->fifo);
+		shard->count = 0;
+		shard->seq = 0;
+	}
+
+	g_oid_cache.shard_max = max / CFS_OID_CACHE_SHARDS;
+	g_oid_cache.enabled = (g_oid_cache.shard_max != 0);
+
+out:
+	log_info("oid cache: shard_max=%u enabled=%d rc=%d",
+		 g_oid_cache.shard_max, (int) g_oid_cache.enabled, rc);
+	return rc;
+}
+
+void cfs_oid_cache_fini(void)
+{
+	int i;
+
+	if (!g_oid_cache.enabled) {
+		return;
+	}
+
+	cfs_oid_cache_purge(NULL);
+
+	for (i = 0; i < CFS_OID_CACHE_SHARDS; i++) {
+		pthread_rwlock_destroy(&g_oid_cache.shards[i].lock);
+	}
+
+	g_oid_cache.enabled = false;
+}
+
+static inline void cfs_oid_key_init(cfs_inode_kfid_key_t *kfid_key,
+				    const cfs_ino_t *ino)
+{
+	INODE_KFID_KEY_INIT(kfid_key, ino, CFS_KEY_TYPE_INODE_KFID);
+}
+
 int cfs_set_ino_oid(struct cfs_fs *cfs_fs, cfs_ino_t *ino, dstore_oid_t *oid)
 {
 	int rc;
-	cfs_inode_kfid_key_t *kfid_key = NULL;
+	cfs_inode_kfid_key_t kfid_key;
 	struct kvstore *kvstor = kvstore_get();
 	struct kvs_idx index;
 
@@ -714,17 +1558,13 @@ int cfs_set_ino_oid(struct cfs_fs *cfs_fs, cfs_ino_t *ino, dstore_oid_t *oid)
 
 	index = cfs_fs->kvtree->index;
 
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstor, (void **)&kfid_key,
-		      sizeof(*kfid_key));
-
-	INODE_KFID_KEY_INIT(kfid_key, ino, CFS_KEY_TYPE_INODE_KFID);
+	cfs_oid_key_init(&kfid_key, ino);
 
-	RC_WRAP_LABEL(rc, free_key, kvs_set, kvstor, &index, kfid_key,
+	RC_WRAP_LABEL(rc, out, kvs_set, kvstor, &index, &kfid_key,
 		      sizeof(cfs_inode_kfid_key_t), oid,
 		      sizeof(cfs_fid_t));
 
-free_key:
-	kvs_free(kvstor, kfid_key);
+	cfs_oid_cache_put(cfs_fs, *ino, oid, NULL);
 
 out:
 	log_trace("cfs_fs=%p ino=%llu oid=%" PRIx64 ":%" PRIx64 " rc=%d",
@@ -732,10 +1572,194 @@ out:
 	return rc;
 }
 
-int cfs_ino_to_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, dstore_oid_t *oid)
+/* Get the OID from a CFS_VERSION_1 (or newer) inode record.
+ * Returns false if the record has an older version or the inode has
+ * no data object.
+ */
+static bool cfs_inode_rec_oid(const struct kvnode *node, dstore_oid_t *oid)
+{
+	uint16_t size;
+	struct cfs_inode_rec *rec = NULL;
+
+	size = kvnode_get_basic_attr_buff(node, (void **)&rec);
+	dassert(rec);
+	dassert(cfs_inode_rec_size_valid(size));
+
+	if (size < CFS_INODE_REC_V1_SIZE || rec->ir_version < CFS_VERSION_1 ||
+	    !rec->ir_has_oid) {
+		return false;
+	}
+
+	*oid = rec->ir_oid;
+	return true;
+}
+
+/* Get a CFS_VERSION_2 inode record or NULL if the record is older */
+static struct cfs_inode_rec *cfs_inode_rec_v2(const struct kvnode *node)
+{
+	uint16_t size;
+	struct cfs_inode_rec *rec = NULL;
+
+	size = kvnode_get_basic_attr_buff(node, (void **)&rec);
+	dassert(rec);
+	dassert(cfs_inode_rec_size_valid(size));
+
+	if (size != sizeof(*rec) || rec->ir_version < CFS_VERSION_2) {
+		return NULL;
+	}
+
+	return rec;
+}
+
+int cfs_dir_nentries(const struct kvnode *node, uint64_t *nentries)
+{
+	int rc = 0;
+	struct cfs_inode_rec *rec;
+
+	dassert(node && nentries);
+
+	rec = cfs_inode_rec_v2(node);
+	if (rec == NULL) {
+		rc = -ENODATA;
+		goto out;
+	}
+
+	*nentries = rec->ir_nentries;
+
+out:
+	return rc;
+}
+
+void cfs_dir_nentries_add(struct kvnode *node, int delta)
+{
+	struct cfs_inode_rec *rec;
+
+	dassert(node);
+
+	rec = cfs_inode_rec_v2(node);
+	if (rec == NULL || delta == 0) {
+		return;
+	}
+
+	dassert(S_ISDIR(rec->ir_stat.st_mode));
+	dassert(delta > 0 || rec->ir_nentries > 0);
+
+	if (delta < 0 && rec->ir_nentries == 0) {
+		/* Should never happen, do not wrap around */
+		log_err("Entry count underflow, ino=%llu",
+			(unsigned long long) rec->ir_stat.st_ino);
+		return;
+	}
+
+	rec->ir_nentries += delta;
+}
+
+/* Flags which revert the change of the link count made by flags */
+static inline int cfs_link_flags_revert(int flags)
+{
+	int revert = 0;
+
+	if (flags & STAT_INCR_LINK) {
+		revert |= STAT_DECR_LINK;
+	}
+	if (flags & STAT_DECR_LINK) {
+		revert |= STAT_INCR_LINK;
+	}
+
+	return revert;
+}
+
+int cfs_fh_update_stat(struct cfs_fh *fh, int flags, int nentries_delta)
 {
 	int rc;
-	cfs_inode_kfid_key_t  *kfid_key = NULL;
+	struct stat *stat;
+	struct stat saved;
+	struct kvnode *node;
+
+	dassert(fh);
+
+	stat = cfs_fh_stat(fh);
+	node = cfs_kvnode_from_fh(fh);
+
+	cfs_fh_lock(fh);
+	saved = *stat;
+	rc = cfs_amend_stat(stat, flags);
+	if (rc == 0) {
+		cfs_dir_nentries_add(node, nentries_delta);
+		rc = cfs_set_stat(node);
+		if (rc != 0) {
+			cfs_dir_nentries_add(node, -nentries_delta);
+		}
+	}
+	if (rc != 0) {
+		/* Nothing has been stored */
+		*stat = saved;
+	}
+	cfs_fh_unlock(fh);
+
+	log_trace("ino=%llu flags=0x%x delta=%d rc=%d", *cfs_fh_ino(fh), flags,
+		  nentries_delta, rc);
+	return rc;
+}
+
+void cfs_fh_update_stat_undo(struct cfs_fh *fh, int flags,
+			     int nentries_delta)
+{
+	int rc;
+	struct kvnode *node;
+
+	dassert(fh);
+
+	node = cfs_kvnode_from_fh(fh);
+
+	/* Only the counters are reverted: the times could have been changed
+	 * by someone else in the meantime, and newer times do no harm.
+	 */
+	cfs_fh_lock(fh);
+	(void) cfs_amend_stat(cfs_fh_stat(fh),
+			      cfs_link_flags_revert(flags));
+	cfs_dir_nentries_add(node, -nentries_delta);
+
+	rc = cfs_set_stat(node);
+	cfs_fh_unlock(fh);
+
+	if (rc != 0) {
+		log_err("Failed to restore stat of ino=%llu, rc=%d",
+			*cfs_fh_ino(fh), rc);
+	}
+}
+
+int cfs_dir_is_empty(struct cfs_fs *cfs_fs, const struct kvnode *node,
+		     bool *empty)
+{
+	int rc;
+	bool has_children;
+	uint64_t nentries;
+
+	dassert(cfs_fs && node && empty);
+
+	if (cfs_dir_nentries(node, &nentries) == 0) {
+		*empty = (nentries == 0);
+		rc = 0;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvtree_has_children, cfs_fs->kvtree,
+		      &node->node_id, &has_children);
+	*empty = !has_children;
+
+out:
+	log_trace("cfs_fs=%p " NODE_ID_F " empty=%d rc=%d", cfs_fs,
+		  NODE_ID_P(&node->node_id), rc == 0 ? (int) *empty : -1, rc);
+	return rc;
+}
+
+/* Get the OID from the CFS_VERSION_0 ino-kfid key-val pair */
+static int cfs_kfid_to_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino,
+			   dstore_oid_t *oid)
+{
+	int rc;
+	cfs_inode_kfid_key_t kfid_key;
 	uint64_t kfid_size = 0;
 	dstore_oid_t *oid_val = NULL;
 	struct kvstore *kvstor = kvstore_get();
@@ -745,56 +1769,143 @@ int cfs_ino_to_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, dstore_oid_t *oi
 
 	index = cfs_fs->kvtree->index;
 
-	dassert(ino != NULL);
-	dassert(oid != NULL);
-
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstor, (void **)&kfid_key,
-		      sizeof(*kfid_key));
-
-	INODE_KFID_KEY_INIT(kfid_key, ino, CFS_KEY_TYPE_INODE_KFID);
+	cfs_oid_key_init(&kfid_key, ino);
 
-	RC_WRAP_LABEL(rc, free_key, kvs_get, kvstor, &index, kfid_key,
+	RC_WRAP_LABEL(rc, out, kvs_get, kvstor, &index, &kfid_key,
 		      sizeof(cfs_inode_kfid_key_t), (void **)&oid_val,
 		      &kfid_size);
 
 	*oid = *oid_val;
 	kvs_free(kvstor, oid_val);
 
-free_key:
-	kvs_free(kvstor, kfid_key);
+out:
+	log_trace("cfs_fs=%p, *ino=%llu rc=%d, kfid_size=%" PRIu64 "",
+		   cfs_fs, *ino, rc, kfid_size);
+	return rc;
+}
+
+int cfs_kvnode_to_oid(struct cfs_fs *cfs_fs, const struct kvnode *node,
+		      dstore_oid_t *oid)
+{
+	int rc = 0;
+	cfs_ino_t ino;
+	uint64_t seq;
+
+	dassert(cfs_fs != NULL);
+	dassert(node != NULL);
+	dassert(oid != NULL);
+
+	node_id_to_ino(&node->node_id, &ino);
+
+	if (cfs_inode_rec_oid(node, oid)) {
+		goto out;
+	}
+
+	if (cfs_oid_cache_get(cfs_fs, ino, oid, &seq)) {
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_kfid_to_oid, cfs_fs, &ino, oid);
+
+	cfs_oid_cache_put(cfs_fs, ino, oid, &seq);
 
 out:
-	log_trace("cfs_fs=%p, *ino=%llu oid=%" PRIx64 ":%" PRIx64 " rc=%d, kfid_size=%" PRIu64 "",
-		   cfs_fs, *ino, oid->f_hi, oid->f_lo, rc, kfid_size);
+	log_trace("cfs_fs=%p, ino=%llu oid=%" PRIx64 ":%" PRIx64 " rc=%d",
+		   cfs_fs, ino, oid->f_hi, oid->f_lo, rc);
 	return rc;
 }
 
-int cfs_del_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino)
+int cfs_ino_to_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, dstore_oid_t *oid)
 {
 	int rc;
-	cfs_inode_kfid_key_t *kfid_key = NULL;
+	uint64_t seq;
+	struct kvnode node = KVNODE_INIT_EMTPY;
+
+	dassert(ino != NULL);
+	dassert(oid != NULL);
+
+	if (cfs_oid_cache_get(cfs_fs, *ino, oid, &seq)) {
+		rc = 0;
+		goto out;
+	}
+
+	/* A single read of the inode record is enough for CFS_VERSION_1
+	 * inodes, the older ones keep the OID under a separate key.
+	 */
+	RC_WRAP_LABEL(rc, out, cfs_kvnode_load, &node, cfs_fs->kvtree, ino);
+
+	if (!cfs_inode_rec_oid(&node, oid)) {
+		RC_WRAP_LABEL(rc, out, cfs_kfid_to_oid, cfs_fs, ino, oid);
+	}
+
+	cfs_oid_cache_put(cfs_fs, *ino, oid, &seq);
+
+out:
+	kvnode_fini(&node);
+	log_trace("cfs_fs=%p, *ino=%llu oid=%" PRIx64 ":%" PRIx64 " rc=%d",
+		   cfs_fs, *ino, oid->f_hi, oid->f_lo, rc);
+	return rc;
+}
+
+int cfs_del_oid(struct cfs_fs *cfs_fs, const struct kvnode *node)
+{
+	int rc = 0;
+	cfs_ino_t ino;
+	dstore_oid_t oid;
+	cfs_inode_kfid_key_t kfid_key;
 	struct kvstore *kvstor = kvstore_get();
 	struct kvs_idx index;
 
 	dassert(kvstor != NULL);
+	dassert(node != NULL);
 
 	index = cfs_fs->kvtree->index;
 
-	dassert(ino != NULL);
+	node_id_to_ino(&node->node_id, &ino);
 
-	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstor, (void **)&kfid_key,
-		      sizeof(*kfid_key));
+	cfs_oid_cache_del(cfs_fs, ino);
 
-	INODE_KFID_KEY_INIT(kfid_key, ino, CFS_KEY_TYPE_INODE_KFID);
+	/* The OID is a part of the inode record and it is deleted with it */
+	if (cfs_inode_rec_oid(node, &oid)) {
+		goto out;
+	}
 
-	RC_WRAP_LABEL(rc, free_key, kvs_del, kvstor, &index, kfid_key,
-		      sizeof(*kfid_key));
+	cfs_oid_key_init(&kfid_key, &ino);
 
-free_key:
-	kvs_free(kvstor, kfid_key);
+	RC_WRAP_LABEL(rc, out, kvs_del, kvstor, &index, &kfid_key,
+		      sizeof(kfid_key));
 
 out:
-	log_trace("cfs_fs=%p, ino=%llu, rc=%d", cfs_fs, *ino, rc);
+	log_trace("cfs_fs=%p, ino=%llu, rc=%d", cfs_fs, ino, rc);
 	return rc;
 }
 
+int cfs_get_config_u64(struct collection_item *cfg_items, const char *key,
+		       uint64_t def, uint64_t *value)
+{
+	int rc;
+	int err = 0;
+	struct collection_item *item = NULL;
+
+	dassert(key && value);
+
+	*value = def;
+
+	RC_WRAP_LABEL(rc, out, get_config_item, "cortxfs", key, cfg_items,
+		      &item);
+	if (item == NULL) {
+		goto out;
+	}
+
+	*value = get_uint64_config_value(item, 0, def, &err);
+	if (err != 0) {
+		log_warn("Invalid value of cortxfs.%s, using default %llu",
+			 key, (unsigned long long) def);
+		*value = def;
+	}
+
+out:
+	log_debug("cortxfs.%s=%llu rc=%d", key, (unsigned long long) *value,
+		  rc);
+	return rc;
+}
@@ -29,11 +29,42 @@ enum cfs_sys_attr_type
 {
    CFS_SYS_ATTR_SYMLINK = 1,
    CFS_SYS_ATTR_INO_NUM_GEN,
+   CFS_SYS_ATTR_ATIME_MODE,
+   CFS_SYS_ATTR_SINDEXED,
    CFS_SYS_ATTR_MAX
 };
 
 #define CFS_ROOT_INODE_NUM_GEN_START (CFS_ROOT_INODE + 1)
 
+/* Inode record stored as the basic attributes of a kvnode.
+ * CFS_VERSION_0 records contain only the stat, the OID of the data object
+ * is kept under a separate CFS_KEY_TYPE_INODE_KFID key.
+ * CFS_VERSION_1 records carry the OID, so that a single kvnode_load() yields
+ * both. CFS_VERSION_2 records also carry the number of entries of
+ * a directory, so that emptiness of a directory is known without a probe of
+ * its children. The stat is the first member, so that a record can be
+ * accessed as a plain stat regardless of its version.
+ */
+struct cfs_inode_rec {
+	struct stat ir_stat;
+	uint8_t ir_version;
+	uint8_t ir_has_oid;
+	dstore_oid_t ir_oid;
+	/* Number of entries of a directory, since CFS_VERSION_2 */
+	uint64_t ir_nentries;
+} __attribute__((packed));
+
+/* Size of a CFS_VERSION_1 inode record */
+#define CFS_INODE_REC_V1_SIZE offsetof(struct cfs_inode_rec, ir_nentries)
+
+/* Check the size of the basic attributes of a kvnode */
+static inline bool cfs_inode_rec_size_valid(uint16_t size)
+{
+	return size == sizeof(struct stat) ||
+		size == CFS_INODE_REC_V1_SIZE ||
+		size == sizeof(struct cfs_inode_rec);
+}
+
 /**
  * A kvnode is identified by a 128 bit node id. However, currently cortxfs uses
  * 64 bit inodes in it's apis to identify the entities. The following apis
@@ -61,14 +92,43 @@ static inline int ino_to_node_id(const cfs_ino_t *ino, node_id_t *nid)
 	return 0;
 }
 
-/** Set the extstore object identifier (kfid) with cortxfs inode as the key */
+/** Set the extstore object identifier (kfid) with cortxfs inode as the key.
+ * Used only for CFS_VERSION_0 inodes, newer inodes get the OID in their
+ * inode record at creation time (see cfs_create_entry).
+ */
 int cfs_set_ino_oid(struct cfs_fs *cfs_fs, cfs_ino_t *ino, dstore_oid_t *oid);
 
 /** Get the extstore object identifier for the passed cortxfs inode */
 int cfs_ino_to_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, dstore_oid_t *oid);
 
-/** Delete the ino-kfid key-val pair from the kvs. Called during unlink/rm. */
-int cfs_del_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino);
+/** Get the extstore object identifier for an inode using its loaded kvnode.
+ * Unlike cfs_ino_to_oid, it does not read the inode record again.
+ */
+int cfs_kvnode_to_oid(struct cfs_fs *cfs_fs, const struct kvnode *node,
+		      dstore_oid_t *oid);
+
+/** Get the number of entries of a directory from its inode record.
+ * @return 0 or -ENODATA if the record predates CFS_VERSION_2.
+ */
+int cfs_dir_nentries(const struct kvnode *node, uint64_t *nentries);
+
+/** Account an entry added to (delta = 1) or removed from (delta = -1)
+ * a directory. The inode record is changed in memory, it is stored along with
+ * the stat of the directory. No-op for records older than CFS_VERSION_2.
+ */
+void cfs_dir_nentries_add(struct kvnode *node, int delta);
+
+/** Check whether a directory has no entries. Uses the number of entries
+ * from the inode record, falls back to a probe of the children for records
+ * older than CFS_VERSION_2.
+ */
+int cfs_dir_is_empty(struct cfs_fs *cfs_fs, const struct kvnode *node,
+		     bool *empty);
+
+/** Delete the ino-kfid mapping of an inode. Called during unlink/rm.
+ * For CFS_VERSION_1 inodes the mapping goes away with the inode record.
+ */
+int cfs_del_oid(struct cfs_fs *cfs_fs, const struct kvnode *node);
 
 /* Initialize the kvnode with given parameters
  *
@@ -77,11 +137,14 @@ int cfs_del_oid(struct cfs_fs *cfs_fs, const cfs_ino_t *ino);
  * @param[in] tree *    - Kvtree pointer which will be stored in kvnode on init
  * @param[in] ino *     - Inode of a file - file identifier
  * @param[in] bufstat * - Stat attribute buffer, stored in kvnode
+ * @param[in] oid *     - OID of the data object stored in the inode record
+ *                        or NULL if the inode has no data object
  *
  * @return - 0 on sucess on failure error code given by kvnode APIs
  */
 int cfs_kvnode_init(struct kvnode *node, struct kvtree *tree,
-		    const cfs_ino_t *ino, const struct stat *bufstat);
+		    const cfs_ino_t *ino, const struct stat *bufstat,
+		    const dstore_oid_t *oid);
 
 /* Load kvnode for given file identifier from disk
  *
@@ -101,6 +164,9 @@ int cfs_kvnode_load(struct kvnode *node, struct kvtree *tree,
  *                         stat attributes
  * @param[in] bufstat ** - Stat attribute buffer pointer to store stat attribute
  *
+ * The returned stat is borrowed from the kvnode: it is not copied, it must
+ * not be freed and it stays valid as long as the kvnode is alive.
+ *
  * @return - 0 on sucess on failure error code given by kvnode APIs
  */
 int cfs_get_stat(const struct kvnode *node, struct stat **bufstat);
@@ -161,4 +227,302 @@ int cfs_get_sysattr(const struct kvnode *node, buff_t *value,
  */
 int cfs_del_sysattr(const struct kvnode *node,
 		    enum cfs_sys_attr_type attr_type);
+
+struct cfs_fh;
+
+/* Get OID of the data object of a regular file. The OID is resolved once
+ * and cached in the FH.
+ *
+ * @param[in] fh   - FH of a regular file.
+ * @param[out] oid - OID of the data object.
+ *
+ * @return - 0 on success, -ENOENT if the file has no data object.
+ */
+int cfs_fh_oid(struct cfs_fh *fh, dstore_oid_t *oid);
+
+/* Get the opened data object of a regular file. The object is opened on
+ * the first call and stays open as long as the FH is alive, the caller
+ * must not close it.
+ *
+ * @param[in] fh   - FH of a regular file.
+ * @param[out] obj - Opened data object.
+ *
+ * @return - 0 on success else error code returned by dstore APIs
+ */
+int cfs_fh_obj(struct cfs_fh *fh, struct dstore_obj **obj);
+
+/* Mark the stat of FH as modified. The stat is written back to the storage
+ * later by the flusher, by cfs_fh_fsync() or when the FH is dropped from
+ * the cache. The caller should hold the FH lock while modifying the stat.
+ *
+ * @param[in] fh - Any initialized FH.
+ *
+ * @return - 0 on success else error code returned by kvnode APIs
+ */
+int cfs_fh_mark_dirty(struct cfs_fh *fh);
+
+/* Serialize modifications of the stat held by FH with its write back. */
+void cfs_fh_lock(struct cfs_fh *fh);
+void cfs_fh_unlock(struct cfs_fh *fh);
+
+/* Amend the stat of FH (see cfs_amend_stat), account nentries_delta entries
+ * if FH is a directory, and store the inode record, under the FH lock. Must be
+ * called within the transaction which makes the change, so that the record
+ * is stored along with it. Nothing is changed on failure.
+ *
+ * @param[in] fh             - Any initialized FH.
+ * @param[in] flags          - Flag mask for which stats needs to be updated
+ * @param[in] nentries_delta - Entries added to (or removed from) a directory.
+ *
+ * @return - 0 on success else error code returned by kvnode APIs
+ */
+int cfs_fh_update_stat(struct cfs_fh *fh, int flags, int nentries_delta);
+
+/* Revert the link count and the number of entries changed by
+ * cfs_fh_update_stat() and store the inode record again, once the transaction
+ * has been discarded.
+ */
+void cfs_fh_update_stat_undo(struct cfs_fh *fh, int flags, int nentries_delta);
+
+struct collection_item;
+
+/* Get an unsigned integer tunable from the "cortxfs" section of the config.
+ *
+ * @param[in] cfg_items - Parsed cortxfs configuration.
+ * @param[in] key       - Name of the tunable.
+ * @param[in] def       - Value to be used if the tunable is not set.
+ * @param[out] value    - Value of the tunable.
+ *
+ * @return - 0 on success else error code return by config APIs
+ */
+int cfs_get_config_u64(struct collection_item *cfg_items, const char *key,
+		       uint64_t def, uint64_t *value);
+
+/* Initialize the FH cache using "cortxfs" section of the config file.
+ *
+ * @param[in] cfg_items - Parsed cortxfs configuration.
+ *
+ * @return - 0 on success else error code return by config APIs
+ */
+int cfs_fh_cache_init(struct collection_item *cfg_items);
+
+/* Write back all dirty FHs, release all the cached FHs and the free FH
+ * buffers of all the threads, and print the cache statistics.
+ */
+void cfs_fh_cache_fini(void);
+
+/* Tell whether FHs are shared through the FH cache. */
+bool cfs_fh_cache_enabled(void);
+
+/* Inode number of a negative dentry: the name is known not to exist. */
+#define CFS_DCACHE_NEGATIVE 0LL
+
+/* Look up a directory entry in the dentry cache.
+ *
+ * @param[in] fs      - Filesystem context.
+ * @param[in] parent  - Inode of the parent directory.
+ * @param[in] name    - Name of the entry.
+ * @param[out] ino    - Inode of the entry if it was found, or
+ *                      CFS_DCACHE_NEGATIVE if the entry does not exist.
+ * @param[out] seq    - Cache version to be passed to cfs_dcache_insert()
+ *                      when the entry is looked up in the storage.
+ *
+ * @return - true if the entry was found in the cache.
+ */
+bool cfs_dcache_lookup(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name, cfs_ino_t *ino, uint64_t *seq);
+
+/* Cache the result of a storage lookup (CFS_DCACHE_NEGATIVE for -ENOENT)
+ * unless the cache has been modified after cfs_dcache_lookup() returned seq.
+ */
+void cfs_dcache_insert(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name, const cfs_ino_t *ino,
+		       uint64_t seq);
+
+/* Add or replace an entry after it has been linked into the directory. */
+void cfs_dcache_add(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		    const str256_t *name, const cfs_ino_t *ino);
+
+/* Drop an entry after it has been unlinked from the directory. */
+void cfs_dcache_remove(const struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const str256_t *name);
+
+/* Initialize the dentry cache using "cortxfs" section of the config file. */
+int cfs_dcache_init(struct collection_item *cfg_items);
+
+/* Drop all the cached dentries. */
+void cfs_dcache_fini(void);
+
+/* Initialize the inode to OID cache using "cortxfs" section of the config
+ * file.
+ */
+int cfs_oid_cache_init(struct collection_item *cfg_items);
+
+/* Drop all the cached inode to OID mappings. */
+void cfs_oid_cache_fini(void);
+
+/* Initialize the cache of directory streams used by cfs_readdir_page()
+ * using "cortxfs" section of the config file.
+ */
+int cfs_readdir_init(struct collection_item *cfg_items);
+
+/* Drop all the cached directory streams. */
+void cfs_readdir_fini(void);
+
+/* Mark the cached streams of a directory as stale, once an entry of
+ * the directory has been added or removed.
+ */
+void cfs_readdir_dir_changed(const struct cfs_fs *fs, const cfs_ino_t *dir);
+
+/* Call the callback for every entry of a directory, the entries are taken
+ * from the stream of the directory.
+ */
+int cfs_readdir_iter(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+		     cfs_readdir_cb_t cb, void *cb_ctx);
+
+/* Initialize statahead using "cortxfs" section of the config file. */
+int cfs_statahead_init(struct collection_item *cfg_items);
+
+/* Stop the statahead threads and drop the statahead state. */
+void cfs_statahead_fini(void);
+
+/* Max number of entries remembered by cfs_statahead_arm() */
+#define CFS_STATAHEAD_ARM_MAX 4096
+
+/* Remember the order of the entries of a directory being listed, from the
+ * read position on, so that the following lookups of the entries in this
+ * order are detected. restart is set for a listing which starts from
+ * the beginning, the next pages of a listing keep the detection going.
+ */
+void cfs_statahead_arm(struct cfs_fs *fs, cfs_ino_t dir,
+		       const cfs_ino_t *inos, uint32_t count, bool restart);
+
+/* Account a lookup of an entry of a directory; prefetches the next entries
+ * of the directory into the FH cache once a sequential access is detected.
+ */
+void cfs_statahead_lookup(struct cfs_fs *fs, cfs_ino_t dir, cfs_ino_t ino);
+
+/* Initialize the tree removal threads using "cortxfs" section of the config
+ * file.
+ */
+int cfs_remove_tree_init(struct collection_item *cfg_items);
+
+/* Stop the tree removal threads and forget the jobs. */
+void cfs_remove_tree_fini(void);
+
+/* Start the orphan reapers using "cortxfs" section of the config file. */
+int cfs_orphan_init(struct collection_item *cfg_items);
+
+/* Stop the orphan reapers, the orphans left stay in the lists. */
+void cfs_orphan_fini(void);
+
+/* Record a file which has lost its last link in the orphan list of
+ * the filesystem. Must be called within the transaction which removes
+ * the last dentry.
+ */
+int cfs_orphan_add(struct cfs_fs *cfs_fs, const cfs_ino_t *ino);
+
+/* Destroy an orphan, or queue it for the reapers, once it is not used
+ * anymore. Does nothing if the file still has links.
+ */
+int cfs_orphan_release(struct cfs_fh *fh);
+
+/* Start the rstat flusher using "cortxfs" section of the config file. */
+int cfs_rstat_init(struct collection_item *cfg_items);
+
+/* Stop the rstat flusher and drop the deltas left. */
+void cfs_rstat_fini(void);
+
+/* Store the pending rstat deltas of a filesystem. */
+int cfs_rstat_flush(struct cfs_fs *cfs_fs);
+
+/* Record the directory a new inode is accounted in. Must be called within
+ * the transaction which creates the inode.
+ */
+int cfs_rstat_link(struct cfs_fs *cfs_fs, const cfs_ino_t *ino,
+		   const cfs_ino_t *parent);
+
+/* Get the directory an inode is accounted in (see cfs_rstat_link()). For
+ * a directory, it is the directory which holds it.
+ *
+ * @return - 0 on success, -ENOENT if the inode has no recorded parent.
+ */
+int cfs_rstat_parent(struct cfs_fs *cfs_fs, const cfs_ino_t *ino,
+		     cfs_ino_t *parent);
+
+/* Account a new entry of a directory, once it has been committed. */
+void cfs_rstat_created(struct cfs_fs *cfs_fs, const cfs_ino_t *parent,
+		       const struct stat *stat);
+
+/* Account a new size (and mtime) of a file. */
+void cfs_rstat_resized(struct cfs_fs *cfs_fs, const struct stat *stat,
+		       off_t old_size);
+
+/* Account a file which has lost its last link, once it has been committed. */
+void cfs_rstat_unlinked(struct cfs_fs *cfs_fs, const struct stat *stat);
+
+/* Totals of an entry moved by cfs_rstat_move() */
+struct cfs_rstat_move {
+	cfs_ino_t m_sdir;
+	/* 0 if the entry leaves the namespace */
+	cfs_ino_t m_ddir;
+	/* The entry is accounted in m_sdir */
+	bool m_accounted;
+	struct cfs_rstat m_totals;
+};
+
+/* Keep the flusher away while entries are moved. */
+void cfs_rstat_begin(void);
+void cfs_rstat_end(void);
+
+/* Move the accounting of an entry from sdir to ddir, or out of
+ * the namespace if ddir is NULL (rmdir, tree removal, overwrite of
+ * a directory). Must be called between cfs_rstat_begin() and
+ * cfs_rstat_end(), within the transaction which moves the entry.
+ */
+int cfs_rstat_move(struct cfs_fs *cfs_fs, const struct stat *stat,
+		   const cfs_ino_t *sdir, const cfs_ino_t *ddir,
+		   struct cfs_rstat_move *move);
+
+/* Account a move once it has been committed, before cfs_rstat_end(). */
+void cfs_rstat_move_commit(struct cfs_fs *cfs_fs,
+			   const struct cfs_rstat_move *move);
+
+/* Drop the totals and the parent of a removed directory. Must be called
+ * within the transaction which removes it.
+ */
+int cfs_rstat_forget(struct cfs_fs *cfs_fs, const cfs_ino_t *dir);
+
+/* Write back the dirty FHs of a filesystem. */
+void cfs_fh_cache_flush_fs(const struct cfs_fs *fs);
+
+/* Read the enabled stat indexes from "cortxfs" section of the config file. */
+int cfs_sindex_init(struct collection_item *cfg_items);
+
+void cfs_sindex_fini(void);
+
+/* Index the stat of an inode which is being stored, within the caller's
+ * transaction. Does nothing if no index is enabled.
+ */
+int cfs_sindex_update(struct kvtree *tree, const struct stat *stat);
+
+/* Remove an inode from the indexes, within the transaction which removes
+ * its stat. Does nothing if the filesystem has never been indexed.
+ */
+int cfs_sindex_del(struct kvtree *tree, const cfs_ino_t *ino);
+
+/* Read the size of the watch queues from "cortxfs" section of the config
+ * file.
+ */
+int cfs_watch_init(struct collection_item *cfg_items);
+
+/* Detach the watches left, their readers get -ENOENT. */
+void cfs_watch_fini(void);
+
+/* Queue an event in the watches of dir (if it is set) and of ino, once
+ * the change has been committed. name is the entry in dir, if any.
+ */
+void cfs_watch_notify(struct cfs_fs *cfs_fs, const cfs_ino_t *dir,
+		      uint32_t event, const cfs_ino_t *ino,
+		      const str256_t *name);
 #endif
@@ -19,10 +19,11 @@
 
 #include <common/log.h> /* log_debug() */
 #include <kvstore.h> /* struct kvstore */
-#include <cortxfs.h> /* cfs_get_stat() */
+#include <cortxfs.h> /* cfs_getattr() */
 #include <debug.h> /* dassert() */
 #include <common/helpers.h> /* RC_WRAP_LABEL() */
 #include <limits.h> /* PATH_MAX */
+#include <stdlib.h> /* malloc() */
 #include <string.h> /* memcpy() */
 #include <sys/time.h> /* gettimeofday() */
 #include <errno.h>  /* errno, -EINVAL */
@@ -36,14 +37,6 @@
 static int cfs_detach2(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
                        const cfs_cred_t *cred, const char *name);
 
-/* Internal cortxfs structure which holds the information given
- * by upper layer in case of readdir operation
- */
-struct cfs_readdir_ctx {
-	cfs_readdir_cb_t cb;
-	void *ctx;
-};
-
 struct stat *cfs_get_stat2(const struct kvnode *node)
 {
 	uint16_t attr_size;
@@ -56,7 +49,7 @@ struct stat *cfs_get_stat2(const struct kvnode *node)
 	attr_size = kvnode_get_basic_attr_buff(node, (void **)&attr_buff);
 
 	dassert(attr_buff);
-	dassert(attr_size == sizeof(struct stat));
+	dassert(cfs_inode_rec_size_valid(attr_size));
 
 	log_trace("efs_get_stat2: " NODE_ID_F, NODE_ID_P(&node->node_id));
 	return attr_buff;
@@ -65,12 +58,17 @@ struct stat *cfs_get_stat2(const struct kvnode *node)
 int cfs_set_stat(struct kvnode *node)
 {
 	int rc;
+	struct stat *stat = NULL;
 
 	dassert(node);
 	dassert(node->tree);
 	dassert(node->basic_attr);
 
 	rc = kvnode_dump(node);
+	if (rc == 0) {
+		(void) kvnode_get_basic_attr_buff(node, (void **)&stat);
+		rc = cfs_sindex_update(node->tree, stat);
+	}
 
 	log_trace("efs_set_stat" NODE_ID_F "rc : %d",
 		  NODE_ID_P(&node->node_id), rc);
@@ -88,10 +86,15 @@ static inline int __cfs_getattr(struct cfs_fh *cfs_fh, struct stat *bufstat)
 	stat = cfs_fh_stat(cfs_fh);
 	if (stat == NULL) {
 		rc = -1;
+		goto out;
 	}
 
+	/* The FH is shared, so that the copy is taken under its lock */
+	cfs_fh_lock(cfs_fh);
 	memcpy(bufstat, stat, sizeof(struct stat));
+	cfs_fh_unlock(cfs_fh);
 
+out:
 	log_debug("ino=%d rc=%d", (int)bufstat->st_ino, rc);
 	return rc;
 }
@@ -110,12 +113,38 @@ int cfs_getattr(struct cfs_fh *cfs_fh, struct stat *bufstat)
 	return rc;
 }
 
+int cfs_getattr_ino(struct cfs_fs *fs, const cfs_ino_t *ino,
+		    struct stat *bufstat)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+
+	dassert(fs && ino && bufstat);
+
+	perfc_trace_inii(PFT_CFS_GETATTR, PEM_CFS_TO_NFS);
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, fs, ino, &fh);
+	RC_WRAP_LABEL(rc, out, __cfs_getattr, fh, bufstat);
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	perfc_trace_attr(PEA_GETATTR_RES_RC, rc);
+	perfc_trace_finii(PERFC_TLS_POP_DONT_VERIFY);
+
+	log_trace("fs=%p ino=%llu rc=%d", fs, *ino, rc);
+	return rc;
+}
+
 static inline int __cfs_setattr(struct cfs_fh *fh, cfs_cred_t *cred,
 				struct stat *setstat, int statflag)
 {
 	struct stat *stat = NULL;
+	struct stat new_stat;
 	struct timeval t;
-	mode_t ifmt;
+	off_t old_size;
 	int rc;
 
 	dassert(cred && setstat && fh);
@@ -131,49 +160,35 @@ static inline int __cfs_setattr(struct cfs_fh *fh, cfs_cred_t *cred,
 
 	stat = cfs_fh_stat(fh);
 
-	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat,
-		      CFS_ACCESS_SETATTR);
+	/* The FH is shared, the stat must not change while it is dumped */
+	cfs_fh_lock(fh);
+
+	rc = cfs_access_check(cred, stat, CFS_ACCESS_SETATTR);
+	if (rc != 0) {
+		cfs_fh_unlock(fh);
+		goto out;
+	}
 
 	/* ctime is to be updated if md are changed */
 	stat->st_ctim.tv_sec = t.tv_sec;
 	stat->st_ctim.tv_nsec = 1000 * t.tv_usec;
 
-	if (statflag & STAT_MODE_SET) {
-		ifmt = stat->st_mode & S_IFMT;
-		stat->st_mode = setstat->st_mode | ifmt;
-	}
-
-	if (statflag & STAT_UID_SET) {
-		stat->st_uid = setstat->st_uid;
-	}
-
-	if (statflag & STAT_GID_SET) {
-		stat->st_gid = setstat->st_gid;
-	}
-
-	if (statflag & STAT_SIZE_SET) {
-		stat->st_size = setstat->st_size;
-		stat->st_blocks = setstat->st_blocks;
-	}
-
 	if (statflag & STAT_SIZE_ATTACH) {
 		dassert(0); /* Unsupported */
 	}
 
-	if (statflag & STAT_ATIME_SET) {
-		stat->st_atim.tv_sec = setstat->st_atim.tv_sec;
-		stat->st_atim.tv_nsec = setstat->st_atim.tv_nsec;
-	}
+	old_size = stat->st_size;
+	cfs_apply_stat(stat, setstat, statflag);
+	new_stat = *stat;
+	cfs_fh_unlock(fh);
 
-	if (statflag & STAT_MTIME_SET) {
-		stat->st_mtim.tv_sec = setstat->st_mtim.tv_sec;
-		stat->st_mtim.tv_nsec = setstat->st_mtim.tv_nsec;
+	if ((statflag & STAT_SIZE_SET) && S_ISREG(new_stat.st_mode)) {
+		cfs_rstat_resized(cfs_fs_from_fh(fh), &new_stat, old_size);
 	}
 
-	if (statflag & STAT_CTIME_SET) {
-		stat->st_ctim.tv_sec = setstat->st_ctim.tv_sec;
-		stat->st_ctim.tv_nsec = setstat->st_ctim.tv_nsec;
-	}
+	cfs_watch_notify(cfs_fs_from_fh(fh), NULL, (statflag & STAT_SIZE_SET) ?
+			 CFS_WATCH_ATTR | CFS_WATCH_DATA : CFS_WATCH_ATTR,
+			 cfs_fh_ino(fh), NULL);
 
 out:
 	log_debug("rc=%d", rc);
@@ -207,6 +222,9 @@ static int __cfs_access(struct cfs_fs *cfs_fs, const cfs_cred_t *cred,
 	stat = cfs_fh_stat(fh);
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat, flags);
 out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
 	return rc;
 }
 
@@ -226,50 +244,38 @@ int cfs_access(struct cfs_fs *cfs_fs, const cfs_cred_t *cred,
 	return rc;
 }
 
-bool cfs_readdir_cb(void *cb_ctx, const char *name, const struct kvnode *node)
-{
-	bool retval = false;
-	struct cfs_readdir_ctx *cb_info = cb_ctx;
-	cfs_ino_t child_inode;
-
-	node_id_to_ino(&node->node_id, &child_inode);
-	retval = cb_info->cb(cb_info->ctx, name, child_inode);
-
-	log_trace("efs_readdir_cb:" NODE_ID_F ", retVal = %d",
-		  NODE_ID_P(&node->node_id), (int)retval);
-
-	return retval;
-}
-
 static inline int __cfs_readdir(struct cfs_fs *cfs_fs,
 		const cfs_cred_t *cred, const cfs_ino_t *dir_ino,
 		cfs_readdir_cb_t cb, void *cb_ctx)
 {
 	int rc;
-	struct cfs_readdir_ctx cb_info = { .cb = cb, .ctx = cb_ctx};
+	bool dirty;
 	struct cfs_fh *fh = NULL;
 	struct stat *stat = NULL;
-	node_id_t *node_id = NULL;
 
 	/* TODO:Temp_FH_op - to be removed
 	 * Should get rid of creating and destroying FH operation in this
 	 * API when caller pass the valid FH instead of inode number
 	 */
 	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, dir_ino, &fh);
-	node_id = cfs_node_id_from_fh(fh);
 	stat = cfs_fh_stat(fh);
 
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat,
 		      CFS_ACCESS_LIST_DIR);
 
-	RC_WRAP_LABEL(rc, out, kvtree_iter_children, cfs_fs->kvtree,
-		      node_id, cfs_readdir_cb, &cb_info);
+	RC_WRAP_LABEL(rc, out, cfs_readdir_iter, cfs_fs, fh, cb, cb_ctx);
+
+	cfs_fh_lock(fh);
+	dirty = cfs_amend_atime(cfs_fs, stat);
+	cfs_fh_unlock(fh);
 
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, stat, STAT_ATIME_SET);
+	if (dirty) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_mark_dirty, fh);
+	}
 
 out:
 	if (fh != NULL ) {
-		cfs_fh_destroy_and_dump_stat(fh);
+		cfs_fh_destroy(fh);
 	}
 
 	log_debug("cfs_fs=%p dir_ino=%llu rc=%d", cfs_fs, *dir_ino, rc);
@@ -312,14 +318,11 @@ static inline int __cfs_mkdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, parent_stat,
 		      CFS_ACCESS_WRITE);
 
-	RC_WRAP_LABEL(rc, out, cfs_create_entry, parent_fh, cred, name, NULL,
-		      mode, newdir, CFS_FT_DIR);
-
-	/* Get a new unique oid */
+	/* Get a new unique oid, it is stored in the inode record */
 	RC_WRAP_LABEL(rc, out, dstore_get_new_objid, dstore, &oid);
 
-	/* Set the ino-oid mapping for this directory in kvs.*/
-	RC_WRAP_LABEL(rc, out, cfs_set_ino_oid, cfs_fs, newdir, &oid);
+	RC_WRAP_LABEL(rc, out, cfs_create_entry, parent_fh, cred, name, NULL,
+		      mode, &oid, newdir, CFS_FT_DIR);
 
 out:
 	if (parent_fh != NULL) {
@@ -380,10 +383,253 @@ out:
 	return rc;
 }
 
+/* Directories walked by cfs_lookup_path(), for ".." */
+#define CFS_LOOKUP_DEPTH_GROW 16
+
+static int cfs_lookup_path_readlink(struct cfs_fh *fh, char *target,
+				    size_t *len)
+{
+	int rc;
+	struct kvstore *kvstor = kvstore_get();
+	buff_t value;
+
+	buff_init(&value, NULL, 0);
+
+	RC_WRAP_LABEL(rc, out, cfs_get_sysattr, cfs_kvnode_from_fh(fh), &value,
+		      CFS_SYS_ATTR_SYMLINK);
+
+	if (value.len == 0) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	if (value.len > *len) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+
+	memcpy(target, value.buf, value.len);
+	*len = value.len;
+
+out:
+	if (value.buf) {
+		kvs_free(kvstor, value.buf);
+	}
+
+	return rc;
+}
+
+static int cfs_lookup_path_push(cfs_ino_t **dirs, uint32_t *depth,
+				uint32_t *size, const cfs_ino_t *ino)
+{
+	int rc = 0;
+	cfs_ino_t *grown;
+
+	if (*depth == *size) {
+		grown = realloc(*dirs, (*size + CFS_LOOKUP_DEPTH_GROW) *
+				sizeof(*grown));
+		if (grown == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		*dirs = grown;
+		*size += CFS_LOOKUP_DEPTH_GROW;
+	}
+
+	(*dirs)[(*depth)++] = *ino;
+
+out:
+	return rc;
+}
+
+int cfs_lookup_path(struct cfs_fs *cfs_fs, const cfs_cred_t *cred,
+		    const cfs_ino_t *start, const char *path, int flags,
+		    cfs_ino_t *ino)
+{
+	int rc;
+	int nlinks = 0;
+	bool last;
+	size_t len;
+	size_t rest_len;
+	size_t target_len;
+	uint32_t depth = 0;
+	uint32_t depth_max = 0;
+	char *buf = NULL;
+	char *target = NULL;
+	char *name = NULL;
+	char *next = NULL;
+	const char *rest = NULL;
+	cfs_ino_t *dirs = NULL;
+	cfs_ino_t root = CFS_ROOT_INODE;
+	cfs_ino_t parent;
+	struct cfs_fh *fh = NULL;
+	struct cfs_fh *child = NULL;
+	struct stat *stat = NULL;
+
+	dassert(cfs_fs && cred && start && path && ino);
+
+	len = strlen(path);
+	if (len == 0) {
+		rc = -ENOENT;
+		goto out;
+	}
+
+	if (len > PATH_MAX) {
+		rc = -ENAMETOOLONG;
+		goto out;
+	}
+
+	/* The path being resolved, then room for a symlink target */
+	buf = malloc(2 * (PATH_MAX + 1));
+	if (buf == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	target = buf + PATH_MAX + 1;
+	memcpy(buf, path, len + 1);
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs,
+		      path[0] == '/' ? &root : start, &fh);
+
+	name = buf;
+	while (true) {
+		while (*name == '/') {
+			name++;
+		}
+
+		if (*name == '\0') {
+			break;
+		}
+
+		next = strchr(name, '/');
+		len = (next != NULL) ? (size_t) (next - name) : strlen(name);
+
+		if (len > NAME_MAX) {
+			rc = -ENAMETOOLONG;
+			goto out;
+		}
+
+		stat = cfs_fh_stat(fh);
+		if (!S_ISDIR(stat->st_mode)) {
+			rc = -ENOTDIR;
+			goto out;
+		}
+
+		RC_WRAP_LABEL(rc, out, cfs_access_check, (cfs_cred_t *) cred,
+			      stat, CFS_ACCESS_EXEC);
+
+		if (len == 1 && name[0] == '.') {
+			name += len;
+			continue;
+		}
+
+		if (len == 2 && strncmp(name, "..", 2) == 0 &&
+		    (depth != 0 || *cfs_fh_ino(fh) != CFS_ROOT_INODE)) {
+			if (depth != 0) {
+				depth--;
+				parent = dirs[depth];
+			} else {
+				/* Above the start: the parent is recorded
+				 * along with the directory.
+				 */
+				RC_WRAP_LABEL(rc, out, cfs_rstat_parent,
+					      cfs_fs, cfs_fh_ino(fh), &parent);
+			}
+			cfs_fh_destroy(fh);
+			fh = NULL;
+			RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs,
+				      &parent, &fh);
+			name += len;
+			continue;
+		}
+
+		if (next != NULL) {
+			*next = '\0';
+		}
+		rc = cfs_fh_lookup(cred, fh, name, &child);
+		if (next != NULL) {
+			*next = '/';
+		}
+		if (rc != 0) {
+			goto out;
+		}
+
+		/* A trailing slash makes the last symlink followed */
+		last = (next == NULL);
+		stat = cfs_fh_stat(child);
+
+		if (S_ISLNK(stat->st_mode) &&
+		    (!last || !(flags & CFS_LOOKUP_NOFOLLOW))) {
+			if (++nlinks > CFS_SYMLOOP_MAX) {
+				rc = -ELOOP;
+				goto out;
+			}
+
+			target_len = PATH_MAX;
+			RC_WRAP_LABEL(rc, out, cfs_lookup_path_readlink, child,
+				      target, &target_len);
+			cfs_fh_destroy(child);
+			child = NULL;
+
+			/* Replace the component with the target */
+			rest = (next != NULL) ? next : "";
+			rest_len = strlen(rest);
+			if (target_len + rest_len > PATH_MAX) {
+				rc = -ENAMETOOLONG;
+				goto out;
+			}
+			memmove(buf + target_len, rest, rest_len + 1);
+			memcpy(buf, target, target_len);
+			name = buf;
+
+			if (target[0] == '/') {
+				cfs_fh_destroy(fh);
+				fh = NULL;
+				depth = 0;
+				RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs,
+					      &root, &fh);
+			}
+			continue;
+		}
+
+		if (next != NULL && !S_ISDIR(stat->st_mode)) {
+			/* "file/" */
+			rc = -ENOTDIR;
+			goto out;
+		}
+
+		RC_WRAP_LABEL(rc, out, cfs_lookup_path_push, &dirs, &depth,
+			      &depth_max, cfs_fh_ino(fh));
+		cfs_fh_destroy(fh);
+		fh = child;
+		child = NULL;
+		name += len;
+	}
+
+	*ino = *cfs_fh_ino(fh);
+
+out:
+	if (child != NULL) {
+		cfs_fh_destroy(child);
+	}
+
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	free(dirs);
+	free(buf);
+
+	log_debug("cfs_fs=%p start=%llu path=%s links=%d ino=%llu rc=%d",
+		  cfs_fs, *start, path, nlinks, rc == 0 ? *ino : 0LL, rc);
+	return rc;
+}
+
 int cfs_readlink(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *lnk,
 		 char *content, size_t *size)
 {
 	int rc;
+	bool dirty;
 	struct kvstore *kvstor = kvstore_get();
 	struct kvnode *node = NULL;
 	struct cfs_fh *fh = NULL;
@@ -403,7 +649,13 @@ int cfs_readlink(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *lnk,
 	stat = cfs_fh_stat(fh);
 	node = cfs_kvnode_from_fh(fh);
 
-	RC_WRAP_LABEL(rc, errfree, cfs_amend_stat, stat, STAT_ATIME_SET);
+	cfs_fh_lock(fh);
+	dirty = cfs_amend_atime(cfs_fs, stat);
+	cfs_fh_unlock(fh);
+
+	if (dirty) {
+		RC_WRAP_LABEL(rc, errfree, cfs_fh_mark_dirty, fh);
+	}
 
 	/* Get symlink attributes */
 	RC_WRAP_LABEL(rc, errfree, cfs_get_sysattr, node, &value,
@@ -423,7 +675,7 @@ int cfs_readlink(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *lnk,
 
 errfree:
 	if (fh != NULL) {
-		cfs_fh_destroy_and_dump_stat(fh);
+		cfs_fh_destroy(fh);
 	}
 
 	if (value.buf) {
@@ -463,7 +715,7 @@ int cfs_symlink(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent_ino,
 		      CFS_ACCESS_WRITE);
 
 	RC_WRAP_LABEL(rc, out, cfs_create_entry, parent_fh, cred, name, content,
-		      CFS_SYMLINK_MODE, newlnk_ino, CFS_FT_SYMLINK);
+		      CFS_SYMLINK_MODE, NULL, newlnk_ino, CFS_FT_SYMLINK);
 
 out:
 	if (parent_fh != NULL) {
@@ -485,9 +737,10 @@ int cfs_link(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
 	struct cfs_fh *parent_fh = NULL;
 	struct cfs_fh *child_fh = NULL;
 	struct stat *parent_stat = NULL;
-	struct  stat *child_stat = NULL;
 	node_id_t *dnode_id = NULL;
 	node_id_t new_node_id;
+	bool parent_updated = false;
+	bool child_updated = false;
 
 	dassert(cred && ino && dname && dino && kvstor);
 
@@ -521,27 +774,44 @@ int cfs_link(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
 		      &new_node_id, &k_name);
 
 	RC_WRAP_LABEL(rc, aborted, cfs_fh_from_ino, cfs_fs, ino, &child_fh);
-	child_stat = cfs_fh_stat(child_fh);
 
-	RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, child_stat,
-		      STAT_CTIME_SET|STAT_INCR_LINK);
+	/* Both records are stored within the transaction */
+	RC_WRAP_LABEL(rc, aborted, cfs_fh_update_stat, child_fh,
+		      STAT_CTIME_SET|STAT_INCR_LINK, 0);
+	child_updated = true;
+
+	RC_WRAP_LABEL(rc, aborted, cfs_fh_update_stat, parent_fh,
+		      STAT_MTIME_SET|STAT_CTIME_SET, 1);
+	parent_updated = true;
 
-	RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, parent_stat,
-		      STAT_MTIME_SET|STAT_CTIME_SET);
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
 
-	RC_WRAP(kvs_end_transaction, kvstor, &index);
+	cfs_dcache_add(cfs_fs, dino, &k_name, ino);
+	cfs_readdir_dir_changed(cfs_fs, dino);
+	cfs_watch_notify(cfs_fs, dino, CFS_WATCH_CREATE, ino, &k_name);
 
 aborted:
-	if (parent_fh != NULL) {
-		cfs_fh_destroy_and_dump_stat(parent_fh);
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh,
+						STAT_MTIME_SET|STAT_CTIME_SET,
+						1);
+		}
+		if (child_updated) {
+			cfs_fh_update_stat_undo(child_fh,
+						STAT_CTIME_SET|STAT_INCR_LINK,
+						0);
+		}
 	}
 
-	if (child_fh != NULL ) {
-		cfs_fh_destroy_and_dump_stat(child_fh);
+	if (parent_fh != NULL) {
+		cfs_fh_destroy(parent_fh);
 	}
 
-	if (rc != 0) {
-		kvs_discard_transaction(kvstor, &index);
+	if (child_fh != NULL ) {
+		cfs_fh_destroy(child_fh);
 	}
 
 	log_trace("cfs_fs=%p rc=%d ino=%llu dino=%llu dname=%s", cfs_fs, rc,
@@ -558,60 +828,15 @@ static inline bool cfs_file_has_links(struct stat *stat)
 static int cfs_destroy_orphaned_file2(struct cfs_fh *fh)
 {
 	int rc;
-	dstore_oid_t oid;
-	cfs_ino_t *ino = NULL;
-	struct cfs_fs *cfs_fs = NULL;
-	struct stat *stat = NULL;
-	struct kvnode *node = NULL;
-	struct kvstore *kvstor = kvstore_get();
-	struct dstore *dstore = dstore_get();
-	struct kvs_idx index;
 
-	dassert(kvstor && dstore && fh);
-
-	cfs_fs = cfs_fs_from_fh(fh);
-	ino = cfs_fh_ino(fh);
-	stat = cfs_fh_stat(fh);
+	dassert(fh);
 
-	index = cfs_fs->kvtree->index;
-
-	if (cfs_file_has_links(stat)) {
-		rc = 0;
-		goto out;
-	}
-
-	kvs_begin_transaction(kvstor, &index);
-
-	node = cfs_kvnode_from_fh(fh);
-	RC_WRAP_LABEL(rc, out, cfs_del_stat, node);
-
-	if (S_ISLNK(stat->st_mode)) {
-		/* Delete symlink */
-		RC_WRAP_LABEL(rc, out, cfs_del_sysattr, node,
-			      CFS_SYS_ATTR_SYMLINK);
-	} else if (S_ISREG(stat->st_mode)) {
-		RC_WRAP_LABEL(rc, out, cfs_ino_to_oid, cfs_fs, ino, &oid);
-		RC_WRAP_LABEL(rc, out, dstore_obj_delete,
-			      dstore, cfs_fs, &oid);
-		RC_WRAP_LABEL(rc, out, cfs_del_oid, cfs_fs, ino);
-	} else {
-		/* Impossible: rmdir handles DIR; LNK and REG are handled by
-		 * this function, the other types cannot be created
-		 * at all.
-		 */
-		dassert(0);
-		log_err("Attempt to remove unsupported object type (%d)",
-			(int) stat->st_mode);
-	}
-	/* TODO: Delete File Xattrs here */
-	kvs_end_transaction(kvstor, &index);
-
-out:
-	if (rc != 0) {
-		kvs_discard_transaction(kvstor, &index);
-	}
+	/* The inode, the data object and the orphan key go away together,
+	 * by a reaper thread unless the reapers are disabled.
+	 */
+	rc = cfs_orphan_release(fh);
 
-	log_trace("inode=%llu rc=%d", *ino, rc);
+	log_trace("inode=%llu rc=%d", *cfs_fh_ino(fh), rc);
 	return rc;
 }
 
@@ -636,192 +861,443 @@ out:
 	return rc;
 }
 
-/* TODO: Seems to be a huge fuction there needs to be a further investigation
- * to find out possibility of optimization and breaking down this APIs to
- * smaller APIs to improve readability
+/* Rename engine.
+ * --------------
+ *
+ * cfs_rename() plans the whole operation before it changes anything:
+ * it loads the handles (a single directory handle for a rename within
+ * a directory, no lookup for the entries given as hints), checks permissions
+ * and checks the destination. Then every KVS change (dentries, entry and link
+ * counts, stats of the directories and of the entries, removal of an
+ * overwritten directory) goes into one transaction. The in-memory stats are
+ * restored if the transaction fails, the dcache is updated once it has been
+ * committed.
+ *
+ * The only step out of the transaction is the removal of an overwritten file,
+ * its data object cannot be removed within a KVS transaction. It happens
+ * when the new name is already in place.
  */
-int cfs_rename(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
-	       cfs_ino_t *sino_dir, char *sname, const cfs_ino_t *psrc,
-	       cfs_ino_t *dino_dir, char *dname, const cfs_ino_t *pdst,
-	       const struct cfs_rename_flags *pflags)
+struct cfs_rename_plan {
+	struct cfs_fs *fs;
+	struct cfs_fh *sdir_fh;
+	/* Same as sdir_fh for a rename within a directory */
+	struct cfs_fh *ddir_fh;
+	struct cfs_fh *src_fh;
+	/* NULL if the destination does not exist */
+	struct cfs_fh *dst_fh;
+	str256_t sname;
+	str256_t dname;
+	bool inplace;
+	bool src_is_dir;
+	/* Source and destination are links to the same inode */
+	bool noop;
+};
+
+static int cfs_rename_plan_load(struct cfs_rename_plan *plan,
+				cfs_cred_t *cred,
+				cfs_ino_t *sino_dir, char *sname,
+				const cfs_ino_t *psrc,
+				cfs_ino_t *dino_dir, char *dname,
+				const cfs_ino_t *pdst)
 {
 	int rc;
-	bool overwrite_dst = false;
-	bool rename_inplace = false;
-	bool is_dst_non_empty_dir = false;
-	str256_t k_sname;
-	str256_t k_dname;
-	mode_t s_mode = 0;
-	mode_t d_mode = 0;
-	cfs_ino_t *sdir_ino = NULL;
-	cfs_ino_t *ddir_ino = NULL;
-	cfs_ino_t *dst_ino = NULL;
-	node_id_t *sdir_id = NULL;
-	node_id_t *ddir_id = NULL;
-	node_id_t *src_id = NULL;
-	node_id_t *dst_id = NULL;
-	struct cfs_fh *sdir_fh = NULL;
-	struct cfs_fh *ddir_fh = NULL;
-	struct cfs_fh *src_fh = NULL;
-	struct cfs_fh *dst_fh = NULL;
-	struct stat *sdir_stat = NULL;
-	struct stat *ddir_stat = NULL;
+	bool is_dst_empty_dir = true;
+	struct cfs_fs *cfs_fs = plan->fs;
 	struct stat *src_stat = NULL;
 	struct stat *dst_stat = NULL;
-	struct kvstore *kvstor = kvstore_get();
-	const struct cfs_rename_flags flags = pflags ? *pflags :
-		(const struct cfs_rename_flags) CFS_RENAME_FLAGS_INIT;
 
-	dassert(kvstor);
-	dassert(cred);
-	dassert(sino_dir && dino_dir);
-	dassert(sname && dname);
-	dassert(strlen(sname) <= NAME_MAX);
-	dassert(strlen(dname) <= NAME_MAX);
-	dassert((*sino_dir != *dino_dir || strcmp(sname, dname) != 0));
-	dassert(cfs_fs);
+	str256_from_cstr(plan->sname, sname, strlen(sname));
+	str256_from_cstr(plan->dname, dname, strlen(dname));
 
 	/* TODO:Temp_FH_op - to be removed
 	 * Should get rid of creating and destroying FH operation in this
 	 * API when caller pass the valid FH instead of inode number
 	 */
-	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, sino_dir, &sdir_fh);
-	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, dino_dir, &ddir_fh);
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, sino_dir,
+		      &plan->sdir_fh);
 
-	sdir_ino = cfs_fh_ino(sdir_fh);
-	sdir_stat = cfs_fh_stat(sdir_fh);
-	sdir_id = cfs_node_id_from_fh(sdir_fh);
-	ddir_ino = cfs_fh_ino(ddir_fh);
-	ddir_stat = cfs_fh_stat(ddir_fh);
-	ddir_id = cfs_node_id_from_fh(ddir_fh);
+	plan->inplace = (*sino_dir == *dino_dir);
+	if (plan->inplace) {
+		plan->ddir_fh = plan->sdir_fh;
+	} else {
+		RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, dino_dir,
+			      &plan->ddir_fh);
+	}
 
-	rename_inplace = (*sdir_ino == *ddir_ino);
+	RC_WRAP_LABEL(rc, out, cfs_access_check, cred,
+		      cfs_fh_stat(plan->sdir_fh), CFS_ACCESS_DELETE_ENTITY);
 
-	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, sdir_stat,
-		      CFS_ACCESS_DELETE_ENTITY);
-
-	if (!rename_inplace) {
-		RC_WRAP_LABEL(rc, out, cfs_access_check, cred, ddir_stat,
+	if (!plan->inplace) {
+		RC_WRAP_LABEL(rc, out, cfs_access_check, cred,
+			      cfs_fh_stat(plan->ddir_fh),
 			      CFS_ACCESS_CREATE_ENTITY);
 	}
 
-	RC_WRAP_LABEL(rc, out, cfs_fh_lookup, cred, sdir_fh, sname, &src_fh);
-	src_stat = cfs_fh_stat(src_fh);
-	src_id = cfs_node_id_from_fh(src_fh);
+	if (psrc != NULL) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, psrc,
+			      &plan->src_fh);
+	} else {
+		RC_WRAP_LABEL(rc, out, cfs_fh_lookup, cred, plan->sdir_fh,
+			      sname, &plan->src_fh);
+	}
+	src_stat = cfs_fh_stat(plan->src_fh);
+	plan->src_is_dir = S_ISDIR(src_stat->st_mode);
 
-	/* Destination file/dir may or may not be present
-	 * based on lookup result we have to take descision
-	 */
-	rc = cfs_fh_lookup(cred, ddir_fh, dname, &dst_fh);
-	if (rc < 0 && rc != -ENOENT) {
+	/* Destination file/dir may or may not be present */
+	if (pdst != NULL) {
+		rc = cfs_fh_from_ino(cfs_fs, pdst, &plan->dst_fh);
+	} else {
+		rc = cfs_fh_lookup(cred, plan->ddir_fh, dname, &plan->dst_fh);
+	}
+	if (rc == -ENOENT) {
+		plan->dst_fh = NULL;
+		rc = 0;
+		goto out;
+	} else if (rc != 0) {
 		goto out;
 	}
-	overwrite_dst = (rc != -ENOENT);
 
-	if (overwrite_dst) {
-		dst_ino = cfs_fh_ino(dst_fh);
-		dst_stat = cfs_fh_stat(dst_fh);
+	dst_stat = cfs_fh_stat(plan->dst_fh);
 
-		/* Fetch 'st_mode' for source and destination. */
-		s_mode = src_stat->st_mode;
-		d_mode = dst_stat->st_mode;
+	if (dst_stat->st_ino == src_stat->st_ino) {
+		/* rename(2): "If oldpath and newpath are existing hard links
+		 * referring to the same file, then rename() does nothing"
+		 */
+		plan->noop = true;
+		goto out;
+	}
 
-		if (S_ISDIR(s_mode) != S_ISDIR(d_mode)) {
-			log_warn("Incompatible source and destination %d,%d.",
-				 (int) s_mode, (int) d_mode);
-			rc = -ENOTDIR;
-			goto out;
-		}
+	if (plan->src_is_dir != S_ISDIR(dst_stat->st_mode)) {
+		log_warn("Incompatible source and destination %d,%d.",
+			 (int) src_stat->st_mode, (int) dst_stat->st_mode);
+		rc = -ENOTDIR;
+		goto out;
+	}
 
-		if (S_ISDIR(d_mode)) {
-			dst_id = cfs_node_id_from_fh(dst_fh);
-			RC_WRAP_LABEL(rc, out, kvtree_has_children,
-				      cfs_fs->kvtree, dst_id,
-				      &is_dst_non_empty_dir);
+	if (plan->src_is_dir) {
+		RC_WRAP_LABEL(rc, out, cfs_dir_is_empty, cfs_fs,
+			      cfs_kvnode_from_fh(plan->dst_fh),
+			      &is_dst_empty_dir);
+	}
+
+	if (!is_dst_empty_dir) {
+		log_warn("Destination is not empty (%llu:%s)",
+			 (unsigned long long) dst_stat->st_ino, dname);
+		rc = -EEXIST;
+		goto out;
+	}
+
+out:
+	return rc;
+}
+
+/* Lock (or unlock) the FHs changed by a rename. The FHs are locked in
+ * the order of their addresses, so that concurrent renames do not deadlock,
+ * and an FH which takes several roles is locked once.
+ */
+static void cfs_rename_plan_lock(struct cfs_rename_plan *plan, bool lock)
+{
+	int i;
+	int j;
+	int nr = 0;
+	struct cfs_fh *tmp;
+	struct cfs_fh *fhs[4];
+
+	fhs[nr++] = plan->sdir_fh;
+	if (plan->ddir_fh != plan->sdir_fh) {
+		fhs[nr++] = plan->ddir_fh;
+	}
+	fhs[nr++] = plan->src_fh;
+	if (plan->dst_fh != NULL) {
+		fhs[nr++] = plan->dst_fh;
+	}
+
+	for (i = 1; i < nr; i++) {
+		for (j = i; j > 0 && fhs[j - 1] > fhs[j]; j--) {
+			tmp = fhs[j - 1];
+			fhs[j - 1] = fhs[j];
+			fhs[j] = tmp;
 		}
+	}
 
-		if (is_dst_non_empty_dir) {
-			log_warn("Destination is not empty (%llu:%s)",
-				 *dst_ino, dname);
-			rc = -EEXIST;
-			goto out;
+	for (i = 0; i < nr; i++) {
+		dassert(i == 0 || fhs[i - 1] != fhs[i]);
+		if (lock) {
+			cfs_fh_lock(fhs[i]);
+		} else {
+			cfs_fh_unlock(fhs[nr - i - 1]);
 		}
+	}
+}
+
+static int cfs_rename_plan_exec(struct cfs_rename_plan *plan)
+{
+	int rc;
+	int sdir_delta = 0;
+	int ddir_delta = 0;
+	struct cfs_fs *cfs_fs = plan->fs;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = cfs_fs->kvtree->index;
+	struct kvnode *sdir_node = cfs_kvnode_from_fh(plan->sdir_fh);
+	struct kvnode *ddir_node = cfs_kvnode_from_fh(plan->ddir_fh);
+	struct kvnode *src_node = cfs_kvnode_from_fh(plan->src_fh);
+	struct kvnode *dst_node = NULL;
+	struct stat *sdir_stat = cfs_fh_stat(plan->sdir_fh);
+	struct stat *ddir_stat = cfs_fh_stat(plan->ddir_fh);
+	struct stat *src_stat = cfs_fh_stat(plan->src_fh);
+	struct stat *dst_stat = NULL;
+	struct stat sdir_saved;
+	struct stat ddir_saved;
+	struct stat src_saved;
+	struct stat dst_saved;
+	struct cfs_rstat_move src_move = { .m_accounted = false };
+	struct cfs_rstat_move dst_move = { .m_accounted = false };
+	bool rstat_held;
+	bool dst_has_links = true;
+
+	if (plan->dst_fh != NULL) {
+		dst_node = cfs_kvnode_from_fh(plan->dst_fh);
+		dst_stat = cfs_fh_stat(plan->dst_fh);
+	}
+
+	/* The entries which change their parent (or go away) are moved
+	 * under the rstat flush lock, the renames within a directory do not
+	 * need it.
+	 */
+	rstat_held = !plan->inplace || (plan->dst_fh != NULL &&
+					plan->src_is_dir);
+	if (rstat_held) {
+		cfs_rstat_begin();
+	}
 
-		if (S_ISDIR(d_mode)) {
-			/* FIXME: rmdir() does not have an option to destroy
-			 * a dir object (unlinked from the tree), therefore
-			 * we might lose some data here if the following
-			 * operations (relinking) fail.
+	/* Do not let a write back store the overwritten directory again */
+	if (plan->dst_fh != NULL && plan->src_is_dir) {
+		cfs_fh_invalidate(plan->dst_fh);
+	}
+
+	/* The FHs are shared, their stats are changed and stored under
+	 * their locks.
+	 */
+	cfs_rename_plan_lock(plan, true);
+
+	sdir_saved = *sdir_stat;
+	ddir_saved = *ddir_stat;
+	src_saved = *src_stat;
+	if (dst_stat != NULL) {
+		dst_saved = *dst_stat;
+	}
+
+	RC_WRAP_LABEL(rc, unlock, kvs_begin_transaction, kvstor, &index);
+
+	if (plan->dst_fh != NULL) {
+		RC_WRAP_LABEL(rc, aborted, kvtree_detach, cfs_fs->kvtree,
+			      &ddir_node->node_id, &plan->dname);
+		ddir_delta--;
+
+		if (plan->src_is_dir) {
+			/* The overwritten directory is empty, it goes away
+			 * along with its dentry.
 			 */
-			RC_WRAP_LABEL(rc, out, cfs_rmdir, cfs_fs, cred,
-				      dino_dir, dname);
+			RC_WRAP_LABEL(rc, aborted, cfs_del_stat, dst_node);
+			RC_WRAP_LABEL(rc, aborted, cfs_del_oid, cfs_fs,
+				      dst_node);
+			RC_WRAP_LABEL(rc, aborted, cfs_rstat_move, cfs_fs,
+				      dst_stat, cfs_fh_ino(plan->ddir_fh), NULL,
+				      &dst_move);
+			RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, ddir_stat,
+				      STAT_DECR_LINK);
 		} else {
-			/* Make an ophaned file: it will be destoyed either
-			 * at the end of the function or when the file
-			 * will be closed.
+			/* The file is destroyed after the commit if it was
+			 * its last link.
 			 */
-			log_trace("Detaching a file from the tree "
-				  "(%llu, %llu, %s)", *dino_dir, *dst_ino,
-				  dname);
-			RC_WRAP_LABEL(rc, out, cfs_detach2, ddir_fh, dst_fh,
-				      cred, dname);
+			RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, dst_stat,
+				      STAT_CTIME_SET|STAT_DECR_LINK);
+			RC_WRAP_LABEL(rc, aborted, cfs_set_stat, dst_node);
+			dst_has_links = cfs_file_has_links(dst_stat);
+			if (!dst_has_links) {
+				RC_WRAP_LABEL(rc, aborted, cfs_orphan_add,
+					      cfs_fs, cfs_fh_ino(plan->dst_fh));
+			}
 		}
-	} /* if (overwrite_dst) */
-
-	str256_from_cstr(k_sname, sname, strlen(sname));
-	str256_from_cstr(k_dname, dname, strlen(dname));
+	}
 
-	if (rename_inplace) {
-		/* a shortcut for renaming only a dentry
-		 * without re-linking of the inodes.
-		 */
-		RC_WRAP_LABEL(rc, out, cfs_tree_rename_link, sdir_fh, src_fh,
-			      &k_sname, &k_dname);
-	} else {
-		s_mode = src_stat->st_mode;
+	RC_WRAP_LABEL(rc, aborted, kvtree_detach, cfs_fs->kvtree,
+		      &sdir_node->node_id, &plan->sname);
+	RC_WRAP_LABEL(rc, aborted, kvtree_attach, cfs_fs->kvtree,
+		      &ddir_node->node_id, &src_node->node_id, &plan->dname);
 
-		RC_WRAP_LABEL(rc, out, kvtree_detach, cfs_fs->kvtree, sdir_id,
-			      &k_sname);
+	if (!plan->inplace) {
+		sdir_delta--;
+		ddir_delta++;
 
-		RC_WRAP_LABEL(rc, out, kvtree_attach, cfs_fs->kvtree, ddir_id,
-			      src_id, &k_dname);
+		RC_WRAP_LABEL(rc, aborted, cfs_rstat_move, cfs_fs, src_stat,
+			      cfs_fh_ino(plan->sdir_fh),
+			      cfs_fh_ino(plan->ddir_fh), &src_move);
 
-		if (S_ISDIR(s_mode)) {
-			RC_WRAP_LABEL(rc, out, cfs_amend_stat, sdir_stat,
+		if (plan->src_is_dir) {
+			/* The ".." of the source moves to the destination */
+			RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, sdir_stat,
 				      STAT_DECR_LINK);
-			RC_WRAP_LABEL(rc, out, cfs_amend_stat, ddir_stat,
+			RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, ddir_stat,
 				      STAT_INCR_LINK);
 		}
 	}
 
-	if (overwrite_dst && !S_ISDIR(d_mode) && !flags.is_dst_open) {
+	if (sdir_delta != 0) {
+		cfs_dir_nentries_add(sdir_node, sdir_delta);
+	}
+	if (ddir_delta != 0) {
+		cfs_dir_nentries_add(ddir_node, ddir_delta);
+	}
+
+	RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, sdir_stat,
+		      STAT_CTIME_SET|STAT_MTIME_SET);
+	RC_WRAP_LABEL(rc, aborted, cfs_set_stat, sdir_node);
+
+	if (!plan->inplace) {
+		RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, ddir_stat,
+			      STAT_CTIME_SET|STAT_MTIME_SET);
+		RC_WRAP_LABEL(rc, aborted, cfs_set_stat, ddir_node);
+	}
+
+	RC_WRAP_LABEL(rc, aborted, cfs_amend_stat, src_stat, STAT_CTIME_SET);
+	RC_WRAP_LABEL(rc, aborted, cfs_set_stat, src_node);
+
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+
+aborted:
+	if (rc != 0) {
+		(void) kvs_discard_transaction(kvstor, &index);
+
+		/* Nothing has been stored, forget the in-memory changes */
+		*sdir_stat = sdir_saved;
+		*ddir_stat = ddir_saved;
+		*src_stat = src_saved;
+		if (dst_stat != NULL) {
+			*dst_stat = dst_saved;
+		}
+		if (sdir_delta != 0) {
+			cfs_dir_nentries_add(sdir_node, -sdir_delta);
+		}
+		if (ddir_delta != 0) {
+			cfs_dir_nentries_add(ddir_node, -ddir_delta);
+		}
+	}
+
+unlock:
+	cfs_rename_plan_lock(plan, false);
+	if (rc != 0) {
+		goto out;
+	}
+
+	cfs_dcache_remove(cfs_fs, cfs_fh_ino(plan->sdir_fh), &plan->sname);
+	cfs_dcache_add(cfs_fs, cfs_fh_ino(plan->ddir_fh), &plan->dname,
+		       cfs_fh_ino(plan->src_fh));
+	cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(plan->sdir_fh));
+	if (!plan->inplace) {
+		cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(plan->ddir_fh));
+	}
+
+	cfs_rstat_move_commit(cfs_fs, &src_move);
+	cfs_rstat_move_commit(cfs_fs, &dst_move);
+
+	if (plan->dst_fh != NULL && !plan->src_is_dir && !dst_has_links) {
+		cfs_rstat_unlinked(cfs_fs, dst_stat);
+	}
+
+	/* The overwritten entry is replaced, only its own watches are told */
+	if (plan->dst_fh != NULL) {
+		cfs_watch_notify(cfs_fs, NULL, CFS_WATCH_UNLINK,
+				 cfs_fh_ino(plan->dst_fh), &plan->dname);
+	}
+	cfs_watch_notify(cfs_fs, cfs_fh_ino(plan->sdir_fh),
+			 CFS_WATCH_RENAME_FROM, cfs_fh_ino(plan->src_fh),
+			 &plan->sname);
+	cfs_watch_notify(cfs_fs, cfs_fh_ino(plan->ddir_fh),
+			 CFS_WATCH_RENAME_TO, cfs_fh_ino(plan->src_fh),
+			 &plan->dname);
+
+out:
+	if (rstat_held) {
+		cfs_rstat_end();
+	}
+
+	return rc;
+}
+
+int cfs_rename(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
+	       cfs_ino_t *sino_dir, char *sname, const cfs_ino_t *psrc,
+	       cfs_ino_t *dino_dir, char *dname, const cfs_ino_t *pdst,
+	       const struct cfs_rename_flags *pflags)
+{
+	int rc;
+	cfs_ino_t src_ino = 0LL;
+	cfs_ino_t dst_ino = 0LL;
+	struct kvstore *kvstor = kvstore_get();
+	struct cfs_rename_plan plan = {
+		.fs = cfs_fs,
+	};
+	const struct cfs_rename_flags flags = pflags ? *pflags :
+		(const struct cfs_rename_flags) CFS_RENAME_FLAGS_INIT;
+
+	dassert(kvstor);
+	dassert(cred);
+	dassert(sino_dir && dino_dir);
+	dassert(sname && dname);
+	dassert(strlen(sname) <= NAME_MAX);
+	dassert(strlen(dname) <= NAME_MAX);
+	dassert((*sino_dir != *dino_dir || strcmp(sname, dname) != 0));
+	dassert(cfs_fs);
+
+	RC_WRAP_LABEL(rc, out, cfs_rename_plan_load, &plan, cred,
+		      sino_dir, sname, psrc, dino_dir, dname, pdst);
+
+	if (plan.noop) {
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_rename_plan_exec, &plan);
+
+	if (plan.dst_fh != NULL && !plan.src_is_dir && !flags.is_dst_open) {
 		/* Remove the actual 'destination' object only if all
 		 * previous operations have completed successfully.
 		 */
-		log_trace("Removing detached file (%llu)", *dst_ino);
-		RC_WRAP_LABEL(rc, out, cfs_destroy_orphaned_file2, dst_fh);
+		log_trace("Removing detached file (%llu)",
+			  *cfs_fh_ino(plan.dst_fh));
+		RC_WRAP_LABEL(rc, out, cfs_destroy_orphaned_file2,
+			      plan.dst_fh);
 	}
 
 out:
-	if (sdir_fh) {
-		cfs_fh_destroy_and_dump_stat(sdir_fh);
+	if (plan.src_fh) {
+		src_ino = *cfs_fh_ino(plan.src_fh);
 	}
 
-	if (ddir_fh) {
-		cfs_fh_destroy_and_dump_stat(ddir_fh);
+	if (plan.dst_fh) {
+		dst_ino = *cfs_fh_ino(plan.dst_fh);
 	}
 
-	if (src_fh) {
-		cfs_fh_destroy_and_dump_stat(src_fh);
+	/* The stats have been stored by the transaction */
+	if (plan.ddir_fh && plan.ddir_fh != plan.sdir_fh) {
+		cfs_fh_destroy(plan.ddir_fh);
 	}
 
-	if (dst_fh) {
-		cfs_fh_destroy(dst_fh);
+	if (plan.sdir_fh) {
+		cfs_fh_destroy(plan.sdir_fh);
 	}
 
-	log_debug("cfs_fs=%p sdir_ino=%llu ddir_ino=%llu src_ino=%llu"
-		  "sname=%s dst_ino=%llu dname=%s rc=%d",cfs_fs, *sino_dir,
-		  *dino_dir, psrc?*psrc:0LL, sname, pdst?*pdst:0LL, dname, rc);
+	if (plan.src_fh) {
+		cfs_fh_destroy(plan.src_fh);
+	}
+
+	if (plan.dst_fh) {
+		cfs_fh_destroy(plan.dst_fh);
+	}
+
+	log_debug("cfs_fs=%p sdir_ino=%llu ddir_ino=%llu src_ino=%llu "
+		  "sname=%s dst_ino=%llu dname=%s inplace=%d rc=%d", cfs_fs,
+		  *sino_dir, *dino_dir, src_ino, sname, dst_ino, dname,
+		  (int) plan.inplace, rc);
 
 	return rc;
 }
@@ -830,7 +1306,7 @@ static inline int __cfs_rmdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
                               cfs_ino_t *parent_ino, char *name)
 {
 	int rc;
-	bool is_non_empty_dir;
+	bool is_empty_dir;
 	str256_t kname;
 	struct kvstore *kvstor = kvstore_get();
 	struct kvs_idx index;
@@ -838,10 +1314,11 @@ static inline int __cfs_rmdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 	struct cfs_fh *child_fh = NULL;
 	struct stat *parent_stat = NULL;
 	struct kvnode *child_node = NULL;
-	struct kvnode *parent_node = NULL;
 	cfs_ino_t *child_ino = NULL;
-	node_id_t *cnode_id = NULL;
 	node_id_t *pnode_id = NULL;
+	struct cfs_rstat_move move;
+	bool rstat_held = false;
+	bool parent_updated = false;
 
 	dassert(cfs_fs && cred && parent_ino && name && kvstor);
 	dassert(strlen(name) <= NAME_MAX);
@@ -862,19 +1339,25 @@ static inline int __cfs_rmdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 	RC_WRAP_LABEL(rc, out, cfs_fh_lookup, cred, parent_fh, name, &child_fh);
 
 	child_ino = cfs_fh_ino(child_fh);
-	cnode_id = cfs_node_id_from_fh(child_fh);
+	child_node = cfs_kvnode_from_fh(child_fh);
 
 	/* Check if directory empty */
-	RC_WRAP_LABEL(rc, out, kvtree_has_children, cfs_fs->kvtree, cnode_id,
-		      &is_non_empty_dir);
+	RC_WRAP_LABEL(rc, out, cfs_dir_is_empty, cfs_fs, child_node,
+		      &is_empty_dir);
 
-	if (is_non_empty_dir) {
+	if (!is_empty_dir) {
 		 rc = -ENOTEMPTY;
 		 log_debug("cfs_fs=%p parent_ino=%llu child_ino=%llu name=%s"
 			   " not empty", cfs_fs, *parent_ino, *child_ino, name);
 		 goto out;
 	}
 
+	/* Do not let a write back store the stat again */
+	cfs_fh_invalidate(child_fh);
+
+	cfs_rstat_begin();
+	rstat_held = true;
+
 	RC_WRAP_LABEL(rc, out, kvs_begin_transaction, kvstor, &index);
 
 	str256_from_cstr(kname, name, strlen(name));
@@ -886,27 +1369,44 @@ static inline int __cfs_rmdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 		      &kname);
 
 	/* Remove its stat */
-	child_node = cfs_kvnode_from_fh(child_fh);
 	RC_WRAP_LABEL(rc, aborted, cfs_del_stat, child_node);
+	RC_WRAP_LABEL(rc, aborted, cfs_rstat_move, cfs_fs,
+		      cfs_fh_stat(child_fh), parent_ino, NULL, &move);
 
 	/* Child dir has a "hardlink" to the parent ("..") */
-	parent_node = cfs_kvnode_from_fh(parent_fh);
-	RC_WRAP_LABEL(rc, aborted, cfs_update_stat, parent_node,
-		      STAT_DECR_LINK|STAT_MTIME_SET|STAT_CTIME_SET);
+	RC_WRAP_LABEL(rc, aborted, cfs_fh_update_stat, parent_fh,
+		      STAT_DECR_LINK|STAT_MTIME_SET|STAT_CTIME_SET, -1);
+	parent_updated = true;
 
-	RC_WRAP_LABEL(rc, aborted, cfs_del_oid, cfs_fs, child_ino);
+	RC_WRAP_LABEL(rc, aborted, cfs_del_oid, cfs_fs, child_node);
 
 	/* TODO: Remove all xattrs when cortxfs_remove_all_xattr is implemented
 	 */
-	RC_WRAP_LABEL(rc, out, kvs_end_transaction, kvstor, &index);
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+
+	/* Once committed, so that a lookup does not cache the entry again */
+	cfs_dcache_remove(cfs_fs, parent_ino, &kname);
+	cfs_readdir_dir_changed(cfs_fs, parent_ino);
+	cfs_rstat_move_commit(cfs_fs, &move);
+	cfs_watch_notify(cfs_fs, parent_ino, CFS_WATCH_UNLINK, child_ino,
+			 &kname);
 
 aborted:
 	if (rc < 0) {
 		/* FIXME: error code is overwritten */
 		RC_WRAP_LABEL(rc, out, kvs_discard_transaction, kvstor, &index);
+
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh, STAT_DECR_LINK|
+						STAT_MTIME_SET|STAT_CTIME_SET,
+						-1);
+		}
 	}
 
 out:
+	if (rstat_held) {
+		cfs_rstat_end();
+	}
 
 	if (parent_fh != NULL) {
 		cfs_fh_destroy_and_dump_stat(parent_fh);
@@ -1015,6 +1515,9 @@ static int cfs_detach2(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
 	struct stat *parent_stat = NULL;
 	struct stat *child_stat = NULL;
 	node_id_t *pnode_id = NULL;
+	bool has_links;
+	bool parent_updated = false;
+	bool child_updated = false;
 
 	dassert(kvstor && parent_fh && cred && child_fh && name);
 
@@ -1033,17 +1536,51 @@ static int cfs_detach2(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
 	RC_WRAP_LABEL(rc, out, kvtree_detach, cfs_fs->kvtree, pnode_id,
 		      &k_name);
 
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, child_stat,
-		      STAT_CTIME_SET|STAT_DECR_LINK);
+	/* Both records are stored within the transaction */
+	RC_WRAP_LABEL(rc, out, cfs_fh_update_stat, child_fh,
+		      STAT_CTIME_SET|STAT_DECR_LINK, 0);
+	child_updated = true;
 
-	RC_WRAP_LABEL(rc, out, cfs_amend_stat, parent_stat,
-		      STAT_CTIME_SET|STAT_MTIME_SET);
+	cfs_fh_lock(child_fh);
+	has_links = cfs_file_has_links(child_stat);
+	cfs_fh_unlock(child_fh);
 
-	kvs_end_transaction(kvstor, &index);
+	if (!has_links) {
+		RC_WRAP_LABEL(rc, out, cfs_orphan_add, cfs_fs,
+			      cfs_fh_ino(child_fh));
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_update_stat, parent_fh,
+		      STAT_CTIME_SET|STAT_MTIME_SET, -1);
+	parent_updated = true;
+
+	RC_WRAP_LABEL(rc, out, kvs_end_transaction, kvstor, &index);
+
+	/* Once committed, so that a lookup does not cache the entry again */
+	cfs_dcache_remove(cfs_fs, cfs_fh_ino(parent_fh), &k_name);
+	cfs_readdir_dir_changed(cfs_fs, cfs_fh_ino(parent_fh));
+
+	if (!has_links && !S_ISDIR(child_stat->st_mode)) {
+		cfs_rstat_unlinked(cfs_fs, child_stat);
+	}
+
+	cfs_watch_notify(cfs_fs, cfs_fh_ino(parent_fh), CFS_WATCH_UNLINK,
+			 cfs_fh_ino(child_fh), &k_name);
 
 out:
 	if (rc != 0) {
 		kvs_discard_transaction(kvstor, &index);
+
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh,
+						STAT_CTIME_SET|STAT_MTIME_SET,
+						-1);
+		}
+		if (child_updated) {
+			cfs_fh_update_stat_undo(child_fh,
+						STAT_CTIME_SET|STAT_DECR_LINK,
+						0);
+		}
 	}
 
 	log_trace("cfs_fs=%p parent_ino=%llu name=%s child_ino=%llu rc=%d",
@@ -0,0 +1,720 @@
+/*
+ * Filename: cortxfs_orphan.c
+ * Description: CORTXFS persistent orphan list and reaper.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Orphans.
+ * --------
+ *
+ * A file (or a symlink) which loses its last link is an orphan: it has no
+ * dentry anymore but it still has its inode, its data object and maybe open
+ * handles. The transaction which removes the last dentry records the inode
+ * in the orphan list of the filesystem (CFS_KEY_TYPE_ORPHAN keys).
+ *
+ * When the file is released (cfs_destroy_orphaned_file and the unlink and
+ * rename calls), it is queued for the reaper threads instead of being
+ * destroyed by the caller. A reaper takes up to CFS_ORPHAN_BATCH orphans of
+ * a filesystem at once, deletes their data objects (at most "orphan_rate"
+ * objects per second if it is set), then removes their inode records and
+ * their orphan keys in a single transaction. An orphan whose object cannot
+ * be deleted stays in the list.
+ *
+ * The list survives a restart: the orphans of a filesystem are queued when
+ * the filesystem is loaded, which covers the files which were open or not
+ * reaped yet when the server went down. A data object which has already
+ * been deleted is not an error.
+ *
+ * "orphan_threads" in the "cortxfs" section of the config file sets the
+ * number of reapers; zero makes orphans destroyed by the caller.
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <stddef.h> /* offsetof() */
+#include <pthread.h> /* pthread_t */
+#include <stdlib.h> /* calloc() */
+#include <string.h> /* memset() */
+#include <time.h> /* clock_gettime() */
+#include <sys/queue.h> /* STAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <dstore.h> /* dstore_obj_delete() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_orphan_evict_fs */
+#include "kvtree.h" /* struct kvtree */
+
+#define CFS_ORPHAN_THREADS_DEFAULT 2
+/* Max number of orphans destroyed in one transaction */
+#define CFS_ORPHAN_BATCH 64
+
+/* An entry of the orphan list. The FID is zero so that the list does not
+ * mix with the keys of the inodes (no inode has a zero FID), all the entries
+ * share the same prefix.
+ */
+struct cfs_orphan_key {
+	cfs_fid_t fid;
+	cfs_key_md_t md;
+	cfs_ino_t ino;
+} __attribute__((packed));
+
+#define CFS_ORPHAN_KEY_PREFIX_LEN offsetof(struct cfs_orphan_key, ino)
+
+struct cfs_orphan_work {
+	STAILQ_ENTRY(cfs_orphan_work) w_link;
+	struct cfs_fs *w_fs;
+	cfs_ino_t w_ino;
+};
+
+struct cfs_orphan_entry {
+	cfs_ino_t e_ino;
+	/* NULL if the inode is already gone */
+	struct cfs_fh *e_fh;
+	/* The handle belongs to the caller */
+	bool e_borrowed;
+	int e_rc;
+};
+
+struct cfs_orphan_thread {
+	pthread_t t_thread;
+	/* Filesystem of the batch being reaped, NULL if idle */
+	const struct cfs_fs *t_fs;
+	struct cfs_orphan_entry *t_batch;
+};
+
+struct cfs_orphan {
+	pthread_mutex_t lock;
+	/* Signaled when an orphan is queued or on stop */
+	pthread_cond_t work;
+	/* Signaled when a thread is done with a batch */
+	pthread_cond_t idle;
+	STAILQ_HEAD(cfs_orphan_queue, cfs_orphan_work) queue;
+	uint64_t nqueued;
+	uint64_t nreaped;
+	uint64_t nfailed;
+	uint32_t nthreads;
+	struct cfs_orphan_thread *threads;
+	/* Data objects deleted per second, 0 is unlimited */
+	uint64_t rate;
+	/* Time slot of the next object deletion, in ns */
+	uint64_t next_slot;
+	bool enabled;
+	bool stop;
+};
+
+static struct cfs_orphan g_orphan = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.queue = STAILQ_HEAD_INITIALIZER(g_orphan.queue),
+};
+
+static inline void cfs_orphan_key_init(struct cfs_orphan_key *key,
+				       const cfs_ino_t *ino)
+{
+	memset(key, 0, sizeof(*key));
+	key->md.type = CFS_KEY_TYPE_ORPHAN;
+	key->md.version = CFS_VERSION_0;
+	if (ino != NULL) {
+		key->ino = *ino;
+	}
+}
+
+int cfs_orphan_add(struct cfs_fs *cfs_fs, const cfs_ino_t *ino)
+{
+	int rc;
+	uint64_t since = time(NULL);
+	struct cfs_orphan_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = cfs_fs->kvtree->index;
+
+	cfs_orphan_key_init(&key, ino);
+
+	RC_WRAP_LABEL(rc, out, kvs_set, kvstor, &index, &key, sizeof(key),
+		      &since, sizeof(since));
+
+out:
+	log_trace("cfs_fs=%p ino=%llu rc=%d", cfs_fs, *ino, rc);
+	return rc;
+}
+
+static int cfs_orphan_del(struct cfs_fs *cfs_fs, const cfs_ino_t *ino)
+{
+	int rc;
+	struct cfs_orphan_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = cfs_fs->kvtree->index;
+
+	cfs_orphan_key_init(&key, ino);
+
+	rc = kvs_del(kvstor, &index, &key, sizeof(key));
+	if (rc == -ENOENT) {
+		/* Orphaned before the list existed */
+		rc = 0;
+	}
+
+	return rc;
+}
+
+static uint64_t cfs_orphan_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Wait for a time slot to delete a data object */
+static void cfs_orphan_throttle(void)
+{
+	uint64_t now;
+	uint64_t slot;
+	struct timespec ts;
+
+	if (g_orphan.rate == 0) {
+		return;
+	}
+
+	now = cfs_orphan_now_ns();
+
+	pthread_mutex_lock(&g_orphan.lock);
+	slot = g_orphan.next_slot > now ? g_orphan.next_slot : now;
+	g_orphan.next_slot = slot + 1000000000ULL / g_orphan.rate;
+	pthread_mutex_unlock(&g_orphan.lock);
+
+	if (slot > now) {
+		ts.tv_sec = (slot - now) / 1000000000ULL;
+		ts.tv_nsec = (slot - now) % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Delete the data object of an orphan */
+static int cfs_orphan_obj_delete(struct cfs_fs *fs, struct cfs_fh *fh)
+{
+	int rc;
+	dstore_oid_t oid;
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_oid, fh, &oid);
+
+	cfs_orphan_throttle();
+
+	rc = dstore_obj_delete(dstore_get(), fs, &oid);
+	if (rc == -ENOENT) {
+		/* Deleted before a restart */
+		rc = 0;
+	}
+
+out:
+	return rc;
+}
+
+/* Remove the inode record of an orphan. Must be called within
+ * a transaction.
+ */
+static int cfs_orphan_destroy_inode(struct cfs_fs *fs, struct cfs_fh *fh)
+{
+	int rc;
+	struct kvnode *node = cfs_kvnode_from_fh(fh);
+	struct stat *stat = cfs_fh_stat(fh);
+
+	RC_WRAP_LABEL(rc, out, cfs_del_stat, node);
+
+	if (S_ISLNK(stat->st_mode)) {
+		RC_WRAP_LABEL(rc, out, cfs_del_sysattr, node,
+			      CFS_SYS_ATTR_SYMLINK);
+	} else if (S_ISREG(stat->st_mode)) {
+		RC_WRAP_LABEL(rc, out, cfs_del_oid, fs, node);
+	} else {
+		/* Directories are removed by rmdir, the other types cannot
+		 * be created at all.
+		 */
+		dassert(0);
+		log_err("Attempt to remove unsupported object type (%d)",
+			(int) stat->st_mode);
+	}
+	/* TODO: Delete File Xattrs here */
+
+out:
+	return rc;
+}
+
+/* Destroy a batch of orphans of a filesystem. The handles which are not
+ * given are loaded here, all the handles but the borrowed ones are released.
+ * The result of every orphan is set in e_rc.
+ */
+static void cfs_orphan_reap(struct cfs_fs *fs, struct cfs_orphan_entry *batch,
+			    uint32_t count)
+{
+	int rc;
+	uint32_t i;
+	struct stat *stat;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	for (i = 0; i < count; i++) {
+		batch[i].e_rc = 0;
+
+		if (batch[i].e_fh == NULL) {
+			rc = cfs_fh_from_ino(fs, &batch[i].e_ino,
+					     &batch[i].e_fh);
+			if (rc == -ENOENT) {
+				/* Only the orphan key is left */
+				batch[i].e_fh = NULL;
+				continue;
+			} else if (rc != 0) {
+				batch[i].e_rc = rc;
+				continue;
+			}
+		}
+
+		stat = cfs_fh_stat(batch[i].e_fh);
+		if (S_ISREG(stat->st_mode)) {
+			batch[i].e_rc = cfs_orphan_obj_delete(fs,
+							      batch[i].e_fh);
+		}
+	}
+
+	/* The objects go away, do not let anyone find them in the FH cache
+	 * nor write their stats back.
+	 */
+	for (i = 0; i < count; i++) {
+		if (batch[i].e_rc == 0 && batch[i].e_fh != NULL) {
+			cfs_fh_invalidate(batch[i].e_fh);
+		}
+	}
+
+	rc = kvs_begin_transaction(kvstor, &index);
+	if (rc != 0) {
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (batch[i].e_rc != 0) {
+			continue;
+		}
+
+		if (batch[i].e_fh != NULL) {
+			RC_WRAP_LABEL(rc, aborted, cfs_orphan_destroy_inode,
+				      fs, batch[i].e_fh);
+		}
+
+		RC_WRAP_LABEL(rc, aborted, cfs_orphan_del, fs,
+			      &batch[i].e_ino);
+	}
+
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+
+aborted:
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+	}
+
+out:
+	for (i = 0; i < count; i++) {
+		if (rc != 0 && batch[i].e_rc == 0) {
+			batch[i].e_rc = rc;
+		}
+
+		if (batch[i].e_rc != 0) {
+			log_warn("Failed to reap orphan fs=%p ino=%llu rc=%d",
+				 fs, batch[i].e_ino, batch[i].e_rc);
+		}
+
+		if (batch[i].e_fh != NULL && !batch[i].e_borrowed) {
+			cfs_fh_destroy(batch[i].e_fh);
+		}
+		batch[i].e_fh = NULL;
+	}
+
+	log_trace("fs=%p count=%u rc=%d", fs, count, rc);
+}
+
+/* Queue an orphan for the reapers. The caller must hold the lock. */
+static int cfs_orphan_queue(struct cfs_fs *fs, cfs_ino_t ino)
+{
+	int rc;
+	struct cfs_orphan_work *work = NULL;
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &work,
+		      sizeof(*work));
+
+	work->w_fs = fs;
+	work->w_ino = ino;
+	STAILQ_INSERT_TAIL(&g_orphan.queue, work, w_link);
+	g_orphan.nqueued++;
+	pthread_cond_signal(&g_orphan.work);
+
+out:
+	return rc;
+}
+
+int cfs_orphan_release(struct cfs_fh *fh)
+{
+	int rc;
+	struct cfs_fs *fs = cfs_fs_from_fh(fh);
+	struct cfs_orphan_entry entry = {
+		.e_ino = *cfs_fh_ino(fh),
+	};
+
+	if (cfs_fh_stat(fh)->st_nlink > 0) {
+		rc = 0;
+		goto out;
+	}
+
+	if (g_orphan.enabled) {
+		pthread_mutex_lock(&g_orphan.lock);
+		rc = cfs_orphan_queue(fs, entry.e_ino);
+		pthread_mutex_unlock(&g_orphan.lock);
+		if (rc == 0) {
+			goto out;
+		}
+	}
+
+	entry.e_fh = fh;
+	entry.e_borrowed = true;
+	cfs_orphan_reap(fs, &entry, 1);
+	rc = entry.e_rc;
+
+out:
+	log_trace("fs=%p ino=%llu queued=%d rc=%d", fs, entry.e_ino,
+		  (int) g_orphan.enabled, rc);
+	return rc;
+}
+
+static void *cfs_orphan_thread(void *arg)
+{
+	uint32_t i;
+	uint32_t count;
+	struct cfs_fs *fs;
+	struct cfs_orphan_work *work;
+	struct cfs_orphan_thread *self = arg;
+
+	pthread_mutex_lock(&g_orphan.lock);
+	while (!g_orphan.stop) {
+		work = STAILQ_FIRST(&g_orphan.queue);
+		if (work == NULL) {
+			pthread_cond_wait(&g_orphan.work, &g_orphan.lock);
+			continue;
+		}
+
+		/* A batch of consecutive orphans of the same filesystem */
+		fs = work->w_fs;
+		count = 0;
+		while (work != NULL && work->w_fs == fs &&
+		       count < CFS_ORPHAN_BATCH) {
+			STAILQ_REMOVE_HEAD(&g_orphan.queue, w_link);
+			g_orphan.nqueued--;
+			self->t_batch[count].e_ino = work->w_ino;
+			self->t_batch[count].e_fh = NULL;
+			self->t_batch[count].e_borrowed = false;
+			count++;
+			kvs_free(kvstore_get(), work);
+			work = STAILQ_FIRST(&g_orphan.queue);
+		}
+
+		self->t_fs = fs;
+		pthread_mutex_unlock(&g_orphan.lock);
+
+		cfs_orphan_reap(fs, self->t_batch, count);
+
+		pthread_mutex_lock(&g_orphan.lock);
+		self->t_fs = NULL;
+		for (i = 0; i < count; i++) {
+			if (self->t_batch[i].e_rc == 0) {
+				g_orphan.nreaped++;
+			} else {
+				g_orphan.nfailed++;
+			}
+		}
+		pthread_cond_broadcast(&g_orphan.idle);
+	}
+	pthread_mutex_unlock(&g_orphan.lock);
+
+	return NULL;
+}
+
+int cfs_orphan_recover(struct cfs_fs *fs)
+{
+	int rc;
+	uint32_t i;
+	uint32_t count = 0;
+	uint32_t size = 0;
+	size_t klen;
+	size_t vlen;
+	void *key_buf;
+	void *val_buf;
+	cfs_ino_t *inos = NULL;
+	cfs_ino_t *grown = NULL;
+	struct cfs_orphan_key prefix;
+	struct cfs_orphan_key *key;
+	struct cfs_orphan_entry *batch = NULL;
+	struct kvs_itr *iter = NULL;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	dassert(fs);
+
+	cfs_orphan_key_init(&prefix, NULL);
+
+	rc = kvs_itr_find(kvstor, &index, &prefix, CFS_ORPHAN_KEY_PREFIX_LEN,
+			  &iter);
+	while (rc == 0) {
+		kvs_itr_get(kvstor, iter, &key_buf, &klen, &val_buf, &vlen);
+		key = key_buf;
+
+		if (klen == sizeof(*key)) {
+			if (count == size) {
+				size += CFS_ORPHAN_BATCH;
+				grown = realloc(inos, size * sizeof(*inos));
+				if (grown == NULL) {
+					rc = -ENOMEM;
+					break;
+				}
+				inos = grown;
+			}
+			inos[count++] = key->ino;
+		}
+
+		rc = kvs_itr_next(kvstor, iter);
+	}
+
+	if (iter != NULL) {
+		kvs_itr_fini(kvstor, iter);
+	}
+
+	if (rc == -ENOENT) {
+		/* The end of the list */
+		rc = 0;
+	}
+
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (g_orphan.enabled) {
+		pthread_mutex_lock(&g_orphan.lock);
+		for (i = 0; i < count && rc == 0; i++) {
+			rc = cfs_orphan_queue(fs, inos[i]);
+		}
+		pthread_mutex_unlock(&g_orphan.lock);
+		goto out;
+	}
+
+	batch = calloc(CFS_ORPHAN_BATCH, sizeof(*batch));
+	if (batch == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		batch[i % CFS_ORPHAN_BATCH].e_ino = inos[i];
+		if (i % CFS_ORPHAN_BATCH == CFS_ORPHAN_BATCH - 1 ||
+		    i == count - 1) {
+			cfs_orphan_reap(fs, batch,
+					i % CFS_ORPHAN_BATCH + 1);
+		}
+	}
+
+out:
+	free(batch);
+	free(inos);
+	log_info("fs=%p orphans=%u queued=%d rc=%d", fs, count,
+		 (int) g_orphan.enabled, rc);
+	return rc;
+}
+
+bool cfs_orphan_busy(const struct cfs_fs *fs)
+{
+	uint32_t i;
+	bool busy = false;
+	struct cfs_orphan_work *work;
+
+	pthread_mutex_lock(&g_orphan.lock);
+	STAILQ_FOREACH(work, &g_orphan.queue, w_link) {
+		if (work->w_fs == fs) {
+			busy = true;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < g_orphan.nthreads; i++) {
+		if (g_orphan.threads[i].t_fs == fs) {
+			busy = true;
+			goto out;
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&g_orphan.lock);
+	return busy;
+}
+
+/* Drop the queued orphans of the given filesystem (or of all filesystems if
+ * fs is NULL), they stay in the list of the filesystem. The caller must
+ * hold the lock.
+ */
+static void cfs_orphan_purge(const struct cfs_fs *fs)
+{
+	struct cfs_orphan_work *work;
+	struct cfs_orphan_queue keep = STAILQ_HEAD_INITIALIZER(keep);
+
+	while ((work = STAILQ_FIRST(&g_orphan.queue)) != NULL) {
+		STAILQ_REMOVE_HEAD(&g_orphan.queue, w_link);
+
+		if (fs != NULL && work->w_fs != fs) {
+			STAILQ_INSERT_TAIL(&keep, work, w_link);
+			continue;
+		}
+
+		g_orphan.nqueued--;
+		kvs_free(kvstore_get(), work);
+	}
+
+	STAILQ_CONCAT(&g_orphan.queue, &keep);
+}
+
+static bool cfs_orphan_reaping(const struct cfs_fs *fs)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_orphan.nthreads; i++) {
+		if (g_orphan.threads[i].t_fs == fs) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void cfs_orphan_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (!g_orphan.enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_orphan.lock);
+	cfs_orphan_purge(fs);
+	/* Wait for the batches which are being reaped */
+	while (cfs_orphan_reaping(fs)) {
+		pthread_cond_wait(&g_orphan.idle, &g_orphan.lock);
+	}
+	pthread_mutex_unlock(&g_orphan.lock);
+}
+
+static void cfs_orphan_stop(uint32_t nthreads)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&g_orphan.lock);
+	g_orphan.stop = true;
+	pthread_cond_broadcast(&g_orphan.work);
+	pthread_mutex_unlock(&g_orphan.lock);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(g_orphan.threads[i].t_thread, NULL);
+	}
+
+	for (i = 0; i < g_orphan.nthreads; i++) {
+		free(g_orphan.threads[i].t_batch);
+	}
+
+	free(g_orphan.threads);
+	g_orphan.threads = NULL;
+	g_orphan.nthreads = 0;
+}
+
+int cfs_orphan_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+	uint64_t nthreads;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "orphan_threads", CFS_ORPHAN_THREADS_DEFAULT,
+		      &nthreads);
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "orphan_rate", 0, &g_orphan.rate);
+
+	g_orphan.stop = false;
+	g_orphan.next_slot = 0;
+
+	if (nthreads == 0) {
+		goto out;
+	}
+
+	g_orphan.threads = calloc(nthreads, sizeof(*g_orphan.threads));
+	if (g_orphan.threads == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	g_orphan.nthreads = nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		g_orphan.threads[i].t_batch =
+			calloc(CFS_ORPHAN_BATCH,
+			       sizeof(*g_orphan.threads[i].t_batch));
+		if (g_orphan.threads[i].t_batch == NULL) {
+			rc = -ENOMEM;
+			cfs_orphan_stop(0);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		rc = -pthread_create(&g_orphan.threads[i].t_thread, NULL,
+				     cfs_orphan_thread, &g_orphan.threads[i]);
+		if (rc != 0) {
+			log_err("Failed to start an orphan thread, rc=%d", rc);
+			cfs_orphan_stop(i);
+			goto out;
+		}
+	}
+
+	g_orphan.enabled = true;
+
+out:
+	log_info("orphan: threads=%u rate=%llu enabled=%d rc=%d",
+		 g_orphan.nthreads, (unsigned long long) g_orphan.rate,
+		 (int) g_orphan.enabled, rc);
+	return rc;
+}
+
+void cfs_orphan_fini(void)
+{
+	if (!g_orphan.enabled) {
+		return;
+	}
+
+	g_orphan.enabled = false;
+	cfs_orphan_stop(g_orphan.nthreads);
+
+	pthread_mutex_lock(&g_orphan.lock);
+	/* The orphans left are reaped after the next start */
+	cfs_orphan_purge(NULL);
+	log_info("orphan: reaped=%llu failed=%llu",
+		 (unsigned long long) g_orphan.nreaped,
+		 (unsigned long long) g_orphan.nfailed);
+	g_orphan.nreaped = 0;
+	g_orphan.nfailed = 0;
+	pthread_mutex_unlock(&g_orphan.lock);
+}
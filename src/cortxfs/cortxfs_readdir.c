@@ -0,0 +1,1203 @@
+/*
+ * Filename: cortxfs_readdir.c
+ * Description: CORTXFS paginated directory listing.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Paginated readdir.
+ * ------------------
+ *
+ * kvtree_iter_children() cannot resume an iteration, so that a directory
+ * listed page by page would be scanned from the beginning for every page.
+ * Instead, the first page of a listing takes a snapshot of the directory
+ * (a directory stream): an array of (name, ino, type) in the storage order
+ * along with an index of the entries sorted by the hash of the name. Pages
+ * are served in the hash order and the cookie of an entry is the hash of its
+ * name, so that the next page is found by a binary search in the index
+ * without going to the storage.
+ *
+ * Coherency:
+ *	Every operation which adds or removes an entry of a directory calls
+ *	cfs_readdir_dir_changed() once the change has been committed, which
+ *	marks the cached streams of the directory as stale. A stream built
+ *	while the directory was changed is stale from the beginning (the
+ *	changes are counted by a generation, as the dentry cache does).
+ *	mtime cannot be used for that, it can be set by the users.
+ *	A stale stream is taken again only for a listing which starts from
+ *	the beginning; the following pages of a listing keep using it, so that
+ *	a directory which is modified while it is listed is not scanned again
+ *	for every page. Since a cookie is a hash of a name rather than
+ *	a position, it stays valid across snapshots: the entries which exist
+ *	during the whole listing are returned exactly once no matter how many
+ *	entries are created or removed concurrently, only the created or
+ *	removed ones could be missed (or returned although removed).
+ *	Entries with the same hash (a collision of 63-bit hashes) are never
+ *	split between pages, so that none of them is skipped on resume.
+ *
+ * cfs_readdir() walks the same stream, and a listing which starts from
+ * the beginning arms statahead of the directory (see cortxfs_statahead.c).
+ *
+ * cfs_readdirplus() serves the same pages with the attributes of the entries.
+ * The attributes are not a part of the snapshot (a change of a child does not
+ * change the directory); they are taken from the FH cache, and only
+ * the entries which are not cached are loaded from the storage.
+ *
+ * The streams are kept in a LRU list, the number of streams is bounded by
+ * "readdir_streams" from the "cortxfs" section of the config file; zero
+ * disables caching of streams.
+ *
+ * Large directories:
+ *	A snapshot holds every entry of the directory in memory, so that it is
+ *	not taken for a directory with more than "readdir_stream_entries"
+ *	entries (zero is no limit). A page of such a directory is served from
+ *	a window instead: a scan of the directory which keeps only the entries
+ *	with the smallest hashes after the cookie, as many as the page can
+ *	hold. The memory is bounded by the size of the page, at the price of
+ *	a scan of the directory per page. cfs_readdir_iter() walks such
+ *	a directory without a snapshot at all.
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <limits.h> /* NAME_MAX */
+#include <pthread.h> /* pthread_mutex_t */
+#include <stdlib.h> /* realloc() */
+#include <string.h> /* memcpy() */
+#include <sys/queue.h> /* TAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* TAILQ_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_readdir_evict_fs */
+#include "kvtree.h" /* kvtree_iter_children() */
+#include "operation.h" /* perf tracepoints */
+#include <cfs_perfc.h>
+
+#define CFS_READDIR_STREAMS_DEFAULT 64
+#define CFS_READDIR_STREAM_ENTRIES_DEFAULT (1024 * 1024)
+#define CFS_DIR_STREAM_GROW 256
+/* No entry is left out of a window */
+#define CFS_DIR_WINDOW_NO_CUT UINT64_MAX
+
+struct cfs_dir_stream_entry {
+	/* Offset of the name in s_names */
+	size_t e_name;
+	uint8_t e_namelen;
+	uint8_t e_type;
+};
+
+/* Slot of the hash index of a stream */
+struct cfs_dir_stream_slot {
+	/* Hash of the name, the cookie of the entry */
+	uint64_t h_hash;
+	/* Position of the entry in s_entries */
+	uint32_t h_pos;
+};
+
+struct cfs_dir_stream {
+	TAILQ_ENTRY(cfs_dir_stream) s_lru;
+	const struct cfs_fs *s_fs;
+	cfs_ino_t s_dir;
+	/* The directory has been changed after the snapshot */
+	bool s_stale;
+	/* Number of users, the stream is freed by the last one */
+	uint32_t s_ref;
+	bool s_cached;
+	/* A window which does not hold the last entries of the directory */
+	bool s_more;
+	uint32_t s_count;
+	uint32_t s_capacity;
+	struct cfs_dir_stream_entry *s_entries;
+	/* Inode numbers of the entries, kept apart for statahead */
+	cfs_ino_t *s_inos;
+	/* Entries sorted by the hash of the name */
+	struct cfs_dir_stream_slot *s_index;
+	/* Inode numbers in the order of s_index */
+	cfs_ino_t *s_index_inos;
+	size_t s_names_len;
+	size_t s_names_capacity;
+	char *s_names;
+};
+
+struct cfs_readdir_streams {
+	pthread_mutex_t lock;
+	TAILQ_HEAD(cfs_dir_stream_lru, cfs_dir_stream) lru;
+	uint32_t count;
+	uint32_t max;
+	/* Max number of entries of a snapshot, 0 is no limit */
+	uint64_t max_entries;
+	/* Bumped by every change of a directory */
+	uint64_t gen;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+static struct cfs_readdir_streams g_readdir = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.lru = TAILQ_HEAD_INITIALIZER(g_readdir.lru),
+};
+
+static void cfs_dir_stream_free(struct cfs_dir_stream *stream)
+{
+	free(stream->s_entries);
+	free(stream->s_inos);
+	free(stream->s_index);
+	free(stream->s_index_inos);
+	free(stream->s_names);
+	kvs_free(kvstore_get(), stream);
+}
+
+/* Drop a reference. The caller must hold the lock. */
+static void cfs_dir_stream_put_locked(struct cfs_dir_stream *stream)
+{
+	dassert(stream->s_ref > 0);
+
+	stream->s_ref--;
+	if (stream->s_ref == 0 && !stream->s_cached) {
+		cfs_dir_stream_free(stream);
+	}
+}
+
+static void cfs_dir_stream_put(struct cfs_dir_stream *stream)
+{
+	pthread_mutex_lock(&g_readdir.lock);
+	cfs_dir_stream_put_locked(stream);
+	pthread_mutex_unlock(&g_readdir.lock);
+}
+
+/* Unlink a stream from the LRU. The caller must hold the lock. */
+static void cfs_dir_stream_unlink(struct cfs_dir_stream *stream)
+{
+	dassert(stream->s_cached);
+
+	TAILQ_REMOVE(&g_readdir.lru, stream, s_lru);
+	g_readdir.count--;
+	stream->s_cached = false;
+
+	/* Take a reference just to release it properly */
+	stream->s_ref++;
+	cfs_dir_stream_put_locked(stream);
+}
+
+/* Hash of a name in a directory: FNV-1a folded to 63 bits, never equal to
+ * CFS_READDIR_COOKIE_START.
+ */
+static uint64_t cfs_dir_name_hash(const char *name, size_t namelen)
+{
+	size_t i;
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (i = 0; i < namelen; i++) {
+		hash ^= (uint8_t) name[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	hash >>= 1;
+	return hash == CFS_READDIR_COOKIE_START ? 1 : hash;
+}
+
+static int cfs_dir_stream_slot_cmp(const void *a, const void *b)
+{
+	const struct cfs_dir_stream_slot *x = a;
+	const struct cfs_dir_stream_slot *y = b;
+
+	if (x->h_hash != y->h_hash) {
+		return x->h_hash < y->h_hash ? -1 : 1;
+	}
+
+	/* The order inside a collision does not matter */
+	return (x->h_pos > y->h_pos) - (x->h_pos < y->h_pos);
+}
+
+/* Build the hash index of the stream */
+static int cfs_dir_stream_index(struct cfs_dir_stream *stream)
+{
+	int rc = 0;
+	uint32_t i;
+	const struct cfs_dir_stream_entry *entry;
+
+	if (stream->s_count == 0) {
+		goto out;
+	}
+
+	stream->s_index = malloc(stream->s_count * sizeof(*stream->s_index));
+	stream->s_index_inos = malloc(stream->s_count *
+				      sizeof(*stream->s_index_inos));
+	if (stream->s_index == NULL || stream->s_index_inos == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < stream->s_count; i++) {
+		entry = &stream->s_entries[i];
+		stream->s_index[i].h_hash =
+			cfs_dir_name_hash(stream->s_names + entry->e_name,
+					  entry->e_namelen);
+		stream->s_index[i].h_pos = i;
+	}
+
+	qsort(stream->s_index, stream->s_count, sizeof(*stream->s_index),
+	      cfs_dir_stream_slot_cmp);
+
+	for (i = 0; i < stream->s_count; i++) {
+		stream->s_index_inos[i] =
+			stream->s_inos[stream->s_index[i].h_pos];
+	}
+
+out:
+	return rc;
+}
+
+/* Position of the first entry after the cookie */
+static uint32_t cfs_dir_stream_seek(const struct cfs_dir_stream *stream,
+				    uint64_t cookie)
+{
+	uint32_t lo = 0;
+	uint32_t hi = stream->s_count;
+	uint32_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (stream->s_index[mid].h_hash <= cookie) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* Make room for the given number of entries */
+static int cfs_dir_stream_reserve(struct cfs_dir_stream *stream,
+				  uint32_t capacity)
+{
+	int rc = 0;
+	void *ptr;
+
+	if (capacity <= stream->s_capacity) {
+		goto out;
+	}
+
+	ptr = realloc(stream->s_entries, capacity * sizeof(*stream->s_entries));
+	if (ptr == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	stream->s_entries = ptr;
+
+	ptr = realloc(stream->s_inos, capacity * sizeof(*stream->s_inos));
+	if (ptr == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	stream->s_inos = ptr;
+	stream->s_capacity = capacity;
+
+out:
+	return rc;
+}
+
+static int cfs_dir_stream_add(struct cfs_dir_stream *stream, const char *name,
+			      cfs_ino_t ino, uint8_t type)
+{
+	int rc = 0;
+	size_t namelen = strlen(name);
+	struct cfs_dir_stream_entry *entry;
+	void *ptr;
+
+	dassert(namelen <= NAME_MAX);
+
+	if (stream->s_count == stream->s_capacity) {
+		RC_WRAP_LABEL(rc, out, cfs_dir_stream_reserve, stream,
+			      stream->s_capacity + CFS_DIR_STREAM_GROW);
+	}
+
+	if (stream->s_names_len + namelen > stream->s_names_capacity) {
+		size_t capacity = 2 * stream->s_names_capacity +
+			CFS_DIR_STREAM_GROW * (NAME_MAX + 1);
+
+		ptr = realloc(stream->s_names, capacity);
+		if (ptr == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		stream->s_names = ptr;
+		stream->s_names_capacity = capacity;
+	}
+
+	stream->s_inos[stream->s_count] = ino;
+	entry = &stream->s_entries[stream->s_count++];
+	entry->e_name = stream->s_names_len;
+	entry->e_namelen = namelen;
+	entry->e_type = type;
+
+	memcpy(stream->s_names + stream->s_names_len, name, namelen);
+	stream->s_names_len += namelen;
+
+out:
+	return rc;
+}
+
+struct cfs_dir_stream_build_ctx {
+	struct cfs_dir_stream *stream;
+	int rc;
+};
+
+static uint8_t cfs_kvnode_type(const struct kvnode *node)
+{
+	uint16_t size;
+	struct stat *stat = NULL;
+
+	if (node->basic_attr == NULL) {
+		return 0;
+	}
+
+	size = kvnode_get_basic_attr_buff(node, (void **)&stat);
+	if (stat == NULL || !cfs_inode_rec_size_valid(size)) {
+		return 0;
+	}
+
+	return cfs_mode_to_type(stat->st_mode);
+}
+
+static bool cfs_dir_stream_build_cb(void *cb_ctx, const char *name,
+				    const struct kvnode *node)
+{
+	struct cfs_dir_stream_build_ctx *ctx = cb_ctx;
+	cfs_ino_t ino;
+
+	node_id_to_ino(&node->node_id, &ino);
+
+	if (g_readdir.max_entries != 0 &&
+	    ctx->stream->s_count >= g_readdir.max_entries) {
+		/* Too large for a snapshot */
+		ctx->rc = -EFBIG;
+		return false;
+	}
+
+	ctx->rc = cfs_dir_stream_add(ctx->stream, name, ino,
+				     cfs_kvnode_type(node));
+
+	return ctx->rc == 0;
+}
+
+static struct cfs_dir_stream *cfs_dir_stream_new(const struct cfs_fs *fs,
+						 cfs_ino_t dir)
+{
+	struct cfs_dir_stream *stream = NULL;
+
+	if (kvs_alloc(kvstore_get(), (void **) &stream, sizeof(*stream)) != 0) {
+		return NULL;
+	}
+
+	memset(stream, 0, sizeof(*stream));
+	stream->s_fs = fs;
+	stream->s_dir = dir;
+	stream->s_ref = 1;
+
+	return stream;
+}
+
+/* Take a snapshot of the directory */
+static int cfs_dir_stream_build(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+				struct cfs_dir_stream **pstream)
+{
+	int rc;
+	uint64_t nentries;
+	struct cfs_dir_stream *stream = NULL;
+	struct cfs_dir_stream_build_ctx ctx = { .rc = 0 };
+
+	stream = cfs_dir_stream_new(fs, *cfs_fh_ino(dir_fh));
+	if (stream == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* The number of entries is only a hint, the directory could be
+	 * modified while it is being scanned.
+	 */
+	cfs_fh_lock(dir_fh);
+	rc = cfs_dir_nentries(cfs_kvnode_from_fh(dir_fh), &nentries);
+	cfs_fh_unlock(dir_fh);
+	if (rc == 0 && g_readdir.max_entries != 0 &&
+	    nentries > g_readdir.max_entries) {
+		rc = -EFBIG;
+		goto out;
+	}
+	if (rc == 0 && nentries <= UINT32_MAX) {
+		RC_WRAP_LABEL(rc, out, cfs_dir_stream_reserve, stream,
+			      nentries);
+	}
+
+	ctx.stream = stream;
+
+	RC_WRAP_LABEL(rc, out, kvtree_iter_children, fs->kvtree,
+		      cfs_node_id_from_fh(dir_fh), cfs_dir_stream_build_cb,
+		      &ctx);
+	rc = ctx.rc;
+	if (rc != 0) {
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_dir_stream_index, stream);
+
+	*pstream = stream;
+	stream = NULL;
+
+out:
+	if (stream != NULL) {
+		cfs_dir_stream_free(stream);
+	}
+	log_trace("fs=%p dir=%llu count=%u rc=%d", fs, *cfs_fh_ino(dir_fh),
+		  rc == 0 ? (*pstream)->s_count : 0, rc);
+	return rc;
+}
+
+static inline uint64_t cfs_dir_stream_hash(const struct cfs_dir_stream *stream,
+					   uint32_t pos)
+{
+	const struct cfs_dir_stream_entry *entry = &stream->s_entries[pos];
+
+	return cfs_dir_name_hash(stream->s_names + entry->e_name,
+				 entry->e_namelen);
+}
+
+static int cfs_dir_hash_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+struct cfs_dir_window_ctx {
+	struct cfs_dir_stream *stream;
+	/* Cookie of the page, only the entries after it are kept */
+	uint64_t after;
+	/* Number of entries the page can hold */
+	uint32_t keep;
+	/* Smallest hash of the entries left out of the window */
+	uint64_t cut;
+	int rc;
+};
+
+/* Keep the ctx->keep entries with the smallest hashes, along with the ones
+ * which collide with the last of them, so that a collision is either in
+ * the window or out of it.
+ */
+static int cfs_dir_window_trim(struct cfs_dir_window_ctx *ctx)
+{
+	int rc = 0;
+	uint32_t i;
+	uint64_t *hashes = NULL;
+	struct cfs_dir_stream *stream = ctx->stream;
+	struct cfs_dir_stream *trimmed = NULL;
+	const struct cfs_dir_stream_entry *entry;
+	char name[NAME_MAX + 1];
+
+	hashes = malloc(stream->s_count * sizeof(*hashes));
+	trimmed = cfs_dir_stream_new(stream->s_fs, stream->s_dir);
+	if (hashes == NULL || trimmed == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < stream->s_count; i++) {
+		hashes[i] = cfs_dir_stream_hash(stream, i);
+	}
+
+	qsort(hashes, stream->s_count, sizeof(*hashes), cfs_dir_hash_cmp);
+
+	i = ctx->keep;
+	while (i < stream->s_count && hashes[i] == hashes[ctx->keep - 1]) {
+		i++;
+	}
+	if (i < stream->s_count && hashes[i] < ctx->cut) {
+		ctx->cut = hashes[i];
+	}
+
+	for (i = 0; i < stream->s_count; i++) {
+		if (cfs_dir_stream_hash(stream, i) >= ctx->cut) {
+			continue;
+		}
+
+		entry = &stream->s_entries[i];
+		memcpy(name, stream->s_names + entry->e_name,
+		       entry->e_namelen);
+		name[entry->e_namelen] = '\0';
+
+		RC_WRAP_LABEL(rc, out, cfs_dir_stream_add, trimmed, name,
+			      stream->s_inos[i], entry->e_type);
+	}
+
+	ctx->stream = trimmed;
+	trimmed = stream;
+
+out:
+	if (trimmed != NULL) {
+		cfs_dir_stream_free(trimmed);
+	}
+	free(hashes);
+	return rc;
+}
+
+static bool cfs_dir_window_build_cb(void *cb_ctx, const char *name,
+				    const struct kvnode *node)
+{
+	struct cfs_dir_window_ctx *ctx = cb_ctx;
+	uint64_t hash = cfs_dir_name_hash(name, strlen(name));
+	cfs_ino_t ino;
+
+	if (hash <= ctx->after || hash >= ctx->cut) {
+		return true;
+	}
+
+	node_id_to_ino(&node->node_id, &ino);
+
+	ctx->rc = cfs_dir_stream_add(ctx->stream, name, ino,
+				     cfs_kvnode_type(node));
+	if (ctx->rc == 0 && ctx->stream->s_count >= 2 * ctx->keep) {
+		ctx->rc = cfs_dir_window_trim(ctx);
+	}
+
+	return ctx->rc == 0;
+}
+
+/* Take the entries of a page of a directory which is too large for
+ * a snapshot. The window is not cached.
+ */
+static int cfs_dir_window_build(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+				uint64_t cookie, uint32_t keep,
+				struct cfs_dir_stream **pstream)
+{
+	int rc;
+	struct cfs_dir_window_ctx ctx = {
+		.after = cookie,
+		.keep = keep,
+		.cut = CFS_DIR_WINDOW_NO_CUT,
+		.rc = 0,
+	};
+
+	dassert(keep > 0);
+
+	ctx.stream = cfs_dir_stream_new(fs, *cfs_fh_ino(dir_fh));
+	if (ctx.stream == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvtree_iter_children, fs->kvtree,
+		      cfs_node_id_from_fh(dir_fh), cfs_dir_window_build_cb,
+		      &ctx);
+	rc = ctx.rc;
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (ctx.stream->s_count > keep) {
+		RC_WRAP_LABEL(rc, out, cfs_dir_window_trim, &ctx);
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_dir_stream_index, ctx.stream);
+	ctx.stream->s_more = (ctx.cut != CFS_DIR_WINDOW_NO_CUT);
+
+	*pstream = ctx.stream;
+	ctx.stream = NULL;
+
+out:
+	if (ctx.stream != NULL) {
+		cfs_dir_stream_free(ctx.stream);
+	}
+	log_trace("fs=%p dir=%llu cookie=%llu keep=%u rc=%d", fs,
+		  *cfs_fh_ino(dir_fh), (unsigned long long) cookie, keep, rc);
+	return rc;
+}
+
+/* Get a stream of the directory, either a cached one or a new one.
+ * A listing which starts from the beginning (fresh) does not accept a stale
+ * stream, the following pages of a listing do.
+ */
+static int cfs_dir_stream_get(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+			      bool fresh, struct cfs_dir_stream **pstream)
+{
+	int rc = 0;
+	uint64_t gen;
+	cfs_ino_t dir = *cfs_fh_ino(dir_fh);
+	struct cfs_dir_stream *stream;
+	struct cfs_dir_stream *next;
+
+	pthread_mutex_lock(&g_readdir.lock);
+	TAILQ_FOREACH_SAFE(stream, &g_readdir.lru, s_lru, next) {
+		if (stream->s_dir != dir || stream->s_fs != fs) {
+			continue;
+		}
+
+		if (stream->s_stale && fresh) {
+			/* The directory has been modified */
+			cfs_dir_stream_unlink(stream);
+			continue;
+		}
+
+		TAILQ_REMOVE(&g_readdir.lru, stream, s_lru);
+		TAILQ_INSERT_TAIL(&g_readdir.lru, stream, s_lru);
+		stream->s_ref++;
+		g_readdir.hits++;
+		*pstream = stream;
+		pthread_mutex_unlock(&g_readdir.lock);
+		goto out;
+	}
+	g_readdir.misses++;
+	gen = g_readdir.gen;
+	pthread_mutex_unlock(&g_readdir.lock);
+
+	RC_WRAP_LABEL(rc, out, cfs_dir_stream_build, fs, dir_fh, &stream);
+
+	pthread_mutex_lock(&g_readdir.lock);
+	if (g_readdir.max != 0) {
+		/* A directory could have been modified during the scan */
+		stream->s_stale = (gen != g_readdir.gen);
+		stream->s_cached = true;
+		TAILQ_INSERT_TAIL(&g_readdir.lru, stream, s_lru);
+		g_readdir.count++;
+
+		while (g_readdir.count > g_readdir.max) {
+			cfs_dir_stream_unlink(TAILQ_FIRST(&g_readdir.lru));
+		}
+	}
+	pthread_mutex_unlock(&g_readdir.lock);
+
+	*pstream = stream;
+
+out:
+	return rc;
+}
+
+void cfs_readdir_dir_changed(const struct cfs_fs *fs, const cfs_ino_t *dir)
+{
+	struct cfs_dir_stream *stream;
+
+	dassert(fs && dir);
+
+	pthread_mutex_lock(&g_readdir.lock);
+	g_readdir.gen++;
+	TAILQ_FOREACH(stream, &g_readdir.lru, s_lru) {
+		if (stream->s_dir == *dir && stream->s_fs == fs) {
+			stream->s_stale = true;
+		}
+	}
+	pthread_mutex_unlock(&g_readdir.lock);
+}
+
+/* Copy the entries starting from the cookie into the caller's buffer */
+static int cfs_dir_stream_fill(const struct cfs_dir_stream *stream,
+			       uint64_t cookie, void *buf, size_t buf_size,
+			       size_t *filled, bool *eof)
+{
+	int rc = 0;
+	uint32_t i;
+	uint32_t first;
+	uint32_t run = 0;
+	size_t run_offset = 0;
+	size_t offset = 0;
+	size_t reclen;
+	struct cfs_dirent *dirent;
+	const struct cfs_dir_stream_entry *entry;
+	const struct cfs_dir_stream_slot *slot;
+
+	first = cfs_dir_stream_seek(stream, cookie);
+
+	for (i = first; i < stream->s_count; i++) {
+		slot = &stream->s_index[i];
+		entry = &stream->s_entries[slot->h_pos];
+		reclen = cfs_dirent_size(entry->e_namelen);
+
+		if (i == first || slot->h_hash != slot[-1].h_hash) {
+			run = i;
+			run_offset = offset;
+		}
+
+		if (offset + reclen > buf_size) {
+			/* Do not split a collision between pages */
+			i = run;
+			offset = run_offset;
+			break;
+		}
+
+		dirent = (struct cfs_dirent *) ((char *) buf + offset);
+		dirent->d_ino = stream->s_inos[slot->h_pos];
+		dirent->d_cookie = slot->h_hash;
+		dirent->d_reclen = reclen;
+		dirent->d_type = entry->e_type;
+		dirent->d_namelen = entry->e_namelen;
+		memcpy(dirent->d_name, stream->s_names + entry->e_name,
+		       entry->e_namelen);
+		dirent->d_name[entry->e_namelen] = '\0';
+
+		offset += reclen;
+	}
+
+	*eof = (i >= stream->s_count && !stream->s_more);
+	*filled = offset;
+
+	if (offset == 0 && i < stream->s_count) {
+		/* The buffer cannot hold even a single entry */
+		rc = -EINVAL;
+	}
+
+	return rc;
+}
+
+/* Get the stream of a directory for a page of a listing, or a window of
+ * the directory if it is too large for a snapshot. The page can hold up to
+ * keep entries.
+ */
+static int cfs_readdir_open(struct cfs_fs *fs, const cfs_cred_t *cred,
+			    const cfs_ino_t *dir_ino, uint64_t cookie,
+			    uint32_t keep, struct cfs_fh **pfh,
+			    struct cfs_dir_stream **pstream)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+	struct stat *stat = NULL;
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, fs, dir_ino, &fh);
+	stat = cfs_fh_stat(fh);
+
+	if (!S_ISDIR(stat->st_mode)) {
+		rc = -ENOTDIR;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat,
+		      CFS_ACCESS_LIST_DIR);
+
+	rc = cfs_dir_stream_get(fs, fh, cookie == CFS_READDIR_COOKIE_START,
+				pstream);
+	if (rc == -EFBIG) {
+		RC_WRAP_LABEL(rc, out, cfs_dir_window_build, fs, fh, cookie,
+			      keep, pstream);
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	*pfh = fh;
+	fh = NULL;
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+	return rc;
+}
+
+/* Number of entries a page can hold at most */
+static inline uint32_t cfs_readdir_keep(size_t buf_size, size_t min_reclen)
+{
+	size_t keep = buf_size / min_reclen + 1;
+
+	return keep > UINT32_MAX / 2 ? UINT32_MAX / 2 : keep;
+}
+
+/* Release the stream and the directory FH taken by cfs_readdir_open(),
+ * the access time is updated if the page has been filled.
+ */
+static int cfs_readdir_close(struct cfs_fs *fs, struct cfs_fh *fh,
+			     struct cfs_dir_stream *stream, int rc)
+{
+	bool dirty;
+
+	if (rc != 0) {
+		goto out;
+	}
+
+	cfs_fh_lock(fh);
+	dirty = cfs_amend_atime(fs, cfs_fh_stat(fh));
+	cfs_fh_unlock(fh);
+
+	if (dirty) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_mark_dirty, fh);
+	}
+
+out:
+	cfs_dir_stream_put(stream);
+	cfs_fh_destroy(fh);
+	return rc;
+}
+
+static inline int __cfs_readdir_page(struct cfs_fs *fs, const cfs_cred_t *cred,
+				     const cfs_ino_t *dir_ino, uint64_t cookie,
+				     void *buf, size_t buf_size, size_t *filled,
+				     bool *eof)
+{
+	int rc;
+	uint32_t first;
+	struct cfs_fh *fh = NULL;
+	struct cfs_dir_stream *stream = NULL;
+
+	dassert(fs && cred && dir_ino && buf && filled && eof);
+
+	*filled = 0;
+	*eof = false;
+
+	RC_WRAP_LABEL(rc, out, cfs_readdir_open, fs, cred, dir_ino, cookie,
+		      cfs_readdir_keep(buf_size, cfs_dirent_size(1)), &fh,
+		      &stream);
+
+	first = cfs_dir_stream_seek(stream, cookie);
+	cfs_statahead_arm(fs, stream->s_dir, stream->s_index_inos + first,
+			  stream->s_count - first,
+			  cookie == CFS_READDIR_COOKIE_START);
+
+	rc = cfs_dir_stream_fill(stream, cookie, buf, buf_size, filled, eof);
+	rc = cfs_readdir_close(fs, fh, stream, rc);
+
+out:
+	log_debug("fs=%p dir_ino=%llu cookie=%llu filled=%zu eof=%d rc=%d",
+		  fs, *dir_ino, (unsigned long long) cookie, *filled,
+		  (int) *eof, rc);
+	return rc;
+}
+
+int cfs_readdir_page(struct cfs_fs *fs, const cfs_cred_t *cred,
+		     const cfs_ino_t *dir_ino, uint64_t cookie,
+		     void *buf, size_t buf_size, size_t *filled, bool *eof)
+{
+	int rc;
+
+	perfc_trace_inii(PFT_CFS_READDIR, PEM_CFS_TO_NFS);
+	rc = __cfs_readdir_page(fs, cred, dir_ino, cookie, buf, buf_size,
+				filled, eof);
+	perfc_trace_finii(PERFC_TLS_POP_VERIFY);
+
+	return rc;
+}
+
+struct cfs_readdir_iter_ctx {
+	cfs_readdir_cb_t cb;
+	void *cb_ctx;
+};
+
+static bool cfs_readdir_iter_cb(void *cb_ctx, const char *name,
+				const struct kvnode *node)
+{
+	struct cfs_readdir_iter_ctx *ctx = cb_ctx;
+	cfs_ino_t ino;
+
+	node_id_to_ino(&node->node_id, &ino);
+
+	return ctx->cb(ctx->cb_ctx, name, ino);
+}
+
+/* Walk a directory in the storage order, without a stream */
+static int cfs_readdir_iter_direct(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+				   cfs_readdir_cb_t cb, void *cb_ctx)
+{
+	struct cfs_readdir_iter_ctx ctx = {
+		.cb = cb,
+		.cb_ctx = cb_ctx,
+	};
+
+	return kvtree_iter_children(fs->kvtree, cfs_node_id_from_fh(dir_fh),
+				    cfs_readdir_iter_cb, &ctx);
+}
+
+int cfs_readdir_iter(struct cfs_fs *fs, struct cfs_fh *dir_fh,
+		     cfs_readdir_cb_t cb, void *cb_ctx)
+{
+	int rc;
+	uint32_t i;
+	char name[NAME_MAX + 1];
+	struct cfs_dir_stream *stream = NULL;
+	const struct cfs_dir_stream_entry *entry;
+
+	dassert(fs && dir_fh && cb);
+
+	rc = cfs_dir_stream_get(fs, dir_fh, true, &stream);
+	if (rc == -EFBIG) {
+		/* Too large for a snapshot, no statahead either */
+		rc = cfs_readdir_iter_direct(fs, dir_fh, cb, cb_ctx);
+		goto out;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	cfs_statahead_arm(fs, stream->s_dir, stream->s_inos, stream->s_count,
+			  true);
+
+	for (i = 0; i < stream->s_count; i++) {
+		entry = &stream->s_entries[i];
+		memcpy(name, stream->s_names + entry->e_name,
+		       entry->e_namelen);
+		name[entry->e_namelen] = '\0';
+
+		if (!cb(cb_ctx, name, stream->s_inos[i])) {
+			break;
+		}
+	}
+
+	cfs_dir_stream_put(stream);
+
+out:
+	log_trace("fs=%p dir=%llu rc=%d", fs, *cfs_fh_ino(dir_fh), rc);
+	return rc;
+}
+
+int cfs_dir_count(struct cfs_fs *fs, const cfs_cred_t *cred,
+		  const cfs_ino_t *dir_ino, uint64_t *nentries)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+	struct stat *stat = NULL;
+
+	dassert(fs && cred && dir_ino && nentries);
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, fs, dir_ino, &fh);
+	stat = cfs_fh_stat(fh);
+
+	if (!S_ISDIR(stat->st_mode)) {
+		rc = -ENOTDIR;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, stat,
+		      CFS_ACCESS_LIST_DIR);
+
+	cfs_fh_lock(fh);
+	rc = cfs_dir_nentries(cfs_kvnode_from_fh(fh), nentries);
+	cfs_fh_unlock(fh);
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	log_debug("fs=%p dir_ino=%llu nentries=%llu rc=%d", fs, *dir_ino,
+		  rc == 0 ? (unsigned long long) *nentries : 0ULL, rc);
+	return rc;
+}
+
+/* Get the stat of a directory entry. The FH cache is checked first; on a miss
+ * the inode is loaded either through the FH cache (CFS_READDIRPLUS_FH_CACHE)
+ * or directly, so that a one-time listing does not evict the working set.
+ */
+static int cfs_direntplus_stat(struct cfs_fs *fs, const cfs_ino_t *ino,
+			       int flags, struct stat *bufstat)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+	struct stat *stat = NULL;
+	struct kvnode node = KVNODE_INIT_EMTPY;
+
+	if (cfs_fh_cached_stat(fs, ino, bufstat) == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	if (flags & CFS_READDIRPLUS_FH_CACHE) {
+		RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, fs, ino, &fh);
+		cfs_fh_lock(fh);
+		memcpy(bufstat, cfs_fh_stat(fh), sizeof(*bufstat));
+		cfs_fh_unlock(fh);
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_kvnode_load, &node, fs->kvtree, ino);
+	RC_WRAP_LABEL(rc, out, cfs_get_stat, &node, &stat);
+	memcpy(bufstat, stat, sizeof(*bufstat));
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+	kvnode_fini(&node);
+	return rc;
+}
+
+static int cfs_dir_stream_fill_plus(struct cfs_fs *fs,
+				    const struct cfs_dir_stream *stream,
+				    uint64_t cookie, int flags, void *buf,
+				    size_t buf_size, size_t *filled, bool *eof)
+{
+	int rc = 0;
+	uint32_t i;
+	uint32_t first;
+	uint32_t run = 0;
+	size_t run_offset = 0;
+	size_t offset = 0;
+	size_t reclen;
+	struct cfs_direntplus *dirent;
+	const struct cfs_dir_stream_entry *entry;
+	const struct cfs_dir_stream_slot *slot;
+
+	first = cfs_dir_stream_seek(stream, cookie);
+
+	for (i = first; i < stream->s_count; i++) {
+		slot = &stream->s_index[i];
+		entry = &stream->s_entries[slot->h_pos];
+		reclen = cfs_direntplus_size(entry->e_namelen);
+
+		if (i == first || slot->h_hash != slot[-1].h_hash) {
+			run = i;
+			run_offset = offset;
+		}
+
+		if (offset + reclen > buf_size) {
+			/* Do not split a collision between pages */
+			i = run;
+			offset = run_offset;
+			break;
+		}
+
+		dirent = (struct cfs_direntplus *) ((char *) buf + offset);
+
+		rc = cfs_direntplus_stat(fs, &stream->s_inos[slot->h_pos],
+					 flags, &dirent->d_stat);
+		if (rc == -ENOENT) {
+			/* Removed after the snapshot has been taken */
+			rc = 0;
+			continue;
+		}
+		if (rc != 0) {
+			goto out;
+		}
+
+		dirent->d_ino = stream->s_inos[slot->h_pos];
+		dirent->d_cookie = slot->h_hash;
+		dirent->d_reclen = reclen;
+		dirent->d_type = cfs_mode_to_type(dirent->d_stat.st_mode);
+		dirent->d_namelen = entry->e_namelen;
+		memcpy(dirent->d_name, stream->s_names + entry->e_name,
+		       entry->e_namelen);
+		dirent->d_name[entry->e_namelen] = '\0';
+
+		offset += reclen;
+	}
+
+	*eof = (i >= stream->s_count && !stream->s_more);
+
+	if (offset == 0 && i < stream->s_count) {
+		/* The buffer cannot hold even a single entry */
+		rc = -EINVAL;
+	}
+
+out:
+	*filled = offset;
+	return rc;
+}
+
+static inline int __cfs_readdirplus(struct cfs_fs *fs, const cfs_cred_t *cred,
+				    const cfs_ino_t *dir_ino, uint64_t cookie,
+				    int flags, void *buf, size_t buf_size,
+				    size_t *filled, bool *eof)
+{
+	int rc;
+	struct cfs_fh *fh = NULL;
+	struct cfs_dir_stream *stream = NULL;
+
+	dassert(fs && cred && dir_ino && buf && filled && eof);
+
+	*filled = 0;
+	*eof = false;
+
+	RC_WRAP_LABEL(rc, out, cfs_readdir_open, fs, cred, dir_ino, cookie,
+		      cfs_readdir_keep(buf_size, cfs_direntplus_size(1)), &fh,
+		      &stream);
+
+	rc = cfs_dir_stream_fill_plus(fs, stream, cookie, flags, buf,
+				      buf_size, filled, eof);
+	rc = cfs_readdir_close(fs, fh, stream, rc);
+
+out:
+	log_debug("fs=%p dir_ino=%llu cookie=%llu flags=%d filled=%zu eof=%d "
+		  "rc=%d", fs, *dir_ino, (unsigned long long) cookie, flags,
+		  *filled, (int) *eof, rc);
+	return rc;
+}
+
+int cfs_readdirplus(struct cfs_fs *fs, const cfs_cred_t *cred,
+		    const cfs_ino_t *dir_ino, uint64_t cookie, int flags,
+		    void *buf, size_t buf_size, size_t *filled, bool *eof)
+{
+	int rc;
+
+	perfc_trace_inii(PFT_CFS_READDIR, PEM_CFS_TO_NFS);
+	rc = __cfs_readdirplus(fs, cred, dir_ino, cookie, flags, buf,
+			       buf_size, filled, eof);
+	perfc_trace_finii(PERFC_TLS_POP_VERIFY);
+
+	return rc;
+}
+
+/* Drop the cached streams of the given filesystem (or of all filesystems if
+ * fs is NULL).
+ */
+static void cfs_readdir_purge(const struct cfs_fs *fs)
+{
+	struct cfs_dir_stream *stream;
+	struct cfs_dir_stream *next;
+
+	pthread_mutex_lock(&g_readdir.lock);
+	TAILQ_FOREACH_SAFE(stream, &g_readdir.lru, s_lru, next) {
+		if (fs == NULL || stream->s_fs == fs) {
+			cfs_dir_stream_unlink(stream);
+		}
+	}
+	pthread_mutex_unlock(&g_readdir.lock);
+}
+
+void cfs_readdir_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	cfs_readdir_purge(fs);
+}
+
+int cfs_readdir_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint64_t max;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "readdir_streams", CFS_READDIR_STREAMS_DEFAULT, &max);
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "readdir_stream_entries",
+		      CFS_READDIR_STREAM_ENTRIES_DEFAULT,
+		      &g_readdir.max_entries);
+
+	g_readdir.max = max;
+	g_readdir.count = 0;
+	g_readdir.hits = 0;
+	g_readdir.misses = 0;
+
+out:
+	log_info("readdir streams: max=%u entries=%llu rc=%d", g_readdir.max,
+		 (unsigned long long) g_readdir.max_entries, rc);
+	return rc;
+}
+
+void cfs_readdir_fini(void)
+{
+	cfs_readdir_purge(NULL);
+
+	log_info("readdir streams: hits=%llu misses=%llu",
+		 (unsigned long long) g_readdir.hits,
+		 (unsigned long long) g_readdir.misses);
+}
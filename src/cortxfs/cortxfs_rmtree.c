@@ -0,0 +1,991 @@
+/*
+ * Filename: cortxfs_rmtree.c
+ * Description: CORTXFS server-side removal of directory trees.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Tree removal.
+ * -------------
+ *
+ * cfs_remove_tree() detaches the root of the tree from its parent in a single
+ * transaction, so that the tree is gone from the namespace at once, and
+ * queues the root for the worker threads. A worker empties a directory
+ * batch by batch (CFS_RMTREE_BATCH entries are taken per scan, the scan
+ * starts over since the removed entries are gone):
+ *	- a file or a symlink is unlinked (cfs_unlink2), so that a file which
+ *	  has hard links outside of the tree keeps living;
+ *	- a subdirectory is detached and queued as a directory on its own,
+ *	  so that the tree is emptied by all the workers in parallel.
+ * Once a directory has no entries left, its inode is removed.
+ *
+ * A job keeps the number of removed directories and files and the number of
+ * directories still queued; it is over when no directory is queued. The last
+ * CFS_RMTREE_DONE_JOBS finished jobs are kept for cfs_remove_tree_status().
+ * A job stops at the first error.
+ *
+ * The part of the tree which is left is not reachable from the namespace
+ * anymore, so that every detached directory is recorded (CFS_KEY_TYPE_RMTREE
+ * keys, with the root of its tree) in the transaction which detaches it, and
+ * the record goes away in the transaction which removes its inode. When
+ * a filesystem is loaded, the recorded directories are queued again as
+ * a job per tree, which resumes the jobs stopped by an error, an unmount or
+ * a crash.
+ *
+ * "rmtree_threads" in the "cortxfs" section of the config file sets the
+ * number of workers; zero disables cfs_remove_tree().
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <limits.h> /* NAME_MAX */
+#include <stddef.h> /* offsetof() */
+#include <pthread.h> /* pthread_t */
+#include <stdlib.h> /* malloc() */
+#include <string.h> /* memcpy() */
+#include <sys/queue.h> /* TAILQ_*, STAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* TAILQ_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_remove_tree_evict_fs */
+#include "kvtree.h" /* kvtree_iter_children() */
+
+#define CFS_RMTREE_THREADS_DEFAULT 4
+/* Max number of entries taken from a directory per scan */
+#define CFS_RMTREE_BATCH 256
+/* Number of finished jobs kept for cfs_remove_tree_status() */
+#define CFS_RMTREE_DONE_JOBS 64
+
+struct cfs_rmtree_job {
+	TAILQ_ENTRY(cfs_rmtree_job) j_link;
+	uint64_t j_id;
+	/* NULL once the filesystem is gone */
+	const struct cfs_fs *j_fs;
+	cfs_ino_t j_root;
+	struct cfs_remove_tree_stat j_stat;
+};
+
+/* A directory to be emptied and removed */
+struct cfs_rmtree_work {
+	STAILQ_ENTRY(cfs_rmtree_work) w_link;
+	struct cfs_rmtree_job *w_job;
+	cfs_ino_t w_dir;
+};
+
+struct cfs_rmtree_entry {
+	cfs_ino_t e_ino;
+	char e_name[NAME_MAX + 1];
+};
+
+struct cfs_rmtree_thread {
+	pthread_t t_thread;
+	/* Filesystem of the directory being emptied, NULL if idle */
+	const struct cfs_fs *t_fs;
+	/* Entries of the current batch */
+	struct cfs_rmtree_entry *t_batch;
+};
+
+struct cfs_rmtree {
+	pthread_mutex_t lock;
+	/* Signaled when a directory is queued or on stop */
+	pthread_cond_t work;
+	/* Signaled when a thread is done with a directory */
+	pthread_cond_t idle;
+	TAILQ_HEAD(cfs_rmtree_jobs, cfs_rmtree_job) jobs;
+	uint32_t ndone;
+	uint64_t next_id;
+	STAILQ_HEAD(cfs_rmtree_queue, cfs_rmtree_work) queue;
+	uint32_t nthreads;
+	struct cfs_rmtree_thread *threads;
+	bool enabled;
+	bool stop;
+};
+
+static struct cfs_rmtree g_rmtree = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.jobs = TAILQ_HEAD_INITIALIZER(g_rmtree.jobs),
+	.queue = STAILQ_HEAD_INITIALIZER(g_rmtree.queue),
+	.next_id = 1,
+};
+
+/* The tree is not reachable anymore, so that its removal does not depend on
+ * the permissions of the entries below the root.
+ */
+static cfs_cred_t g_rmtree_cred = {
+	.uid = CFS_ROOT_UID,
+	.gid = 0,
+};
+
+/* A detached directory, the value is the root of its tree. The FID is zero
+ * so that the records do not mix with the keys of the inodes, all of them
+ * share the same prefix.
+ */
+struct cfs_rmtree_key {
+	cfs_fid_t fid;
+	cfs_key_md_t md;
+	cfs_ino_t ino;
+} __attribute__((packed));
+
+#define CFS_RMTREE_KEY_PREFIX_LEN offsetof(struct cfs_rmtree_key, ino)
+
+static inline void cfs_rmtree_key_init(struct cfs_rmtree_key *key,
+				       const cfs_ino_t *ino)
+{
+	memset(key, 0, sizeof(*key));
+	key->md.type = CFS_KEY_TYPE_RMTREE;
+	key->md.version = CFS_VERSION_0;
+	if (ino != NULL) {
+		key->ino = *ino;
+	}
+}
+
+/* Record a detached directory. Must be called within the transaction which
+ * detaches it.
+ */
+static int cfs_rmtree_record_add(struct cfs_fs *fs, const cfs_ino_t *dir,
+				 cfs_ino_t root)
+{
+	int rc;
+	struct cfs_rmtree_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	cfs_rmtree_key_init(&key, dir);
+
+	rc = kvs_set(kvstor, &index, &key, sizeof(key), &root, sizeof(root));
+
+	log_trace("fs=%p dir=%llu root=%llu rc=%d", fs, *dir, root, rc);
+	return rc;
+}
+
+/* Drop the record of a directory, within the transaction which removes
+ * its inode.
+ */
+static int cfs_rmtree_record_del(struct cfs_fs *fs, const cfs_ino_t *dir)
+{
+	int rc;
+	struct cfs_rmtree_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	cfs_rmtree_key_init(&key, dir);
+
+	rc = kvs_del(kvstor, &index, &key, sizeof(key));
+	if (rc == -ENOENT) {
+		/* Detached before the records existed */
+		rc = 0;
+	}
+
+	return rc;
+}
+
+/* Mark a job as finished and forget the oldest finished jobs.
+ * The caller must hold the lock.
+ */
+static void cfs_rmtree_job_done(struct cfs_rmtree_job *job)
+{
+	struct cfs_rmtree_job *old;
+	struct cfs_rmtree_job *next;
+
+	dassert(!job->j_stat.rt_done);
+
+	job->j_stat.rt_done = true;
+	g_rmtree.ndone++;
+
+	log_info("rmtree job=%llu root=%llu dirs=%llu files=%llu rc=%d",
+		 (unsigned long long) job->j_id, job->j_root,
+		 (unsigned long long) job->j_stat.rt_dirs,
+		 (unsigned long long) job->j_stat.rt_files,
+		 job->j_stat.rt_rc);
+
+	TAILQ_FOREACH_SAFE(old, &g_rmtree.jobs, j_link, next) {
+		if (g_rmtree.ndone <= CFS_RMTREE_DONE_JOBS) {
+			break;
+		}
+
+		if (old->j_stat.rt_done) {
+			TAILQ_REMOVE(&g_rmtree.jobs, old, j_link);
+			g_rmtree.ndone--;
+			kvs_free(kvstore_get(), old);
+		}
+	}
+}
+
+/* Queue a directory of a job. The caller must hold the lock. */
+static int cfs_rmtree_queue(struct cfs_rmtree_job *job, cfs_ino_t dir)
+{
+	int rc;
+	struct cfs_rmtree_work *work = NULL;
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &work,
+		      sizeof(*work));
+
+	work->w_job = job;
+	work->w_dir = dir;
+	STAILQ_INSERT_TAIL(&g_rmtree.queue, work, w_link);
+	job->j_stat.rt_pending++;
+	pthread_cond_signal(&g_rmtree.work);
+
+out:
+	return rc;
+}
+
+struct cfs_rmtree_scan_ctx {
+	struct cfs_rmtree_entry *batch;
+	uint32_t count;
+};
+
+static bool cfs_rmtree_scan_cb(void *cb_ctx, const char *name,
+			       const struct kvnode *node)
+{
+	struct cfs_rmtree_scan_ctx *ctx = cb_ctx;
+	struct cfs_rmtree_entry *entry = &ctx->batch[ctx->count];
+
+	node_id_to_ino(&node->node_id, &entry->e_ino);
+	strncpy(entry->e_name, name, NAME_MAX);
+	entry->e_name[NAME_MAX] = '\0';
+	ctx->count++;
+
+	return ctx->count < CFS_RMTREE_BATCH;
+}
+
+/* Detach an entry without touching its inode. A subdirectory (subdir is not
+ * NULL) is recorded as a part of the tree of the job.
+ */
+static int cfs_rmtree_detach(struct cfs_rmtree_job *job, struct cfs_fh *dir_fh,
+			     const char *name, const cfs_ino_t *subdir)
+{
+	int rc;
+	str256_t k_name;
+	struct cfs_fs *fs = cfs_fs_from_fh(dir_fh);
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	str256_from_cstr(k_name, name, strlen(name));
+
+	RC_WRAP_LABEL(rc, out, kvs_begin_transaction, kvstor, &index);
+
+	RC_WRAP_LABEL(rc, aborted, kvtree_detach, fs->kvtree,
+		      cfs_node_id_from_fh(dir_fh), &k_name);
+
+	if (subdir != NULL) {
+		RC_WRAP_LABEL(rc, aborted, cfs_rmtree_record_add, fs, subdir,
+			      job->j_root);
+	}
+
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+	cfs_dcache_remove(fs, cfs_fh_ino(dir_fh), &k_name);
+	cfs_readdir_dir_changed(fs, cfs_fh_ino(dir_fh));
+
+aborted:
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+	}
+
+out:
+	return rc;
+}
+
+/* Remove an entry of a directory being emptied. */
+static int cfs_rmtree_entry(struct cfs_rmtree_job *job, struct cfs_fh *dir_fh,
+			    struct cfs_rmtree_entry *entry)
+{
+	int rc;
+	struct stat *stat = NULL;
+	struct cfs_fh *fh = NULL;
+	struct cfs_fs *fs = cfs_fs_from_fh(dir_fh);
+
+	rc = cfs_fh_from_ino(fs, &entry->e_ino, &fh);
+	if (rc == -ENOENT) {
+		/* A dentry without an inode, just drop it */
+		rc = cfs_rmtree_detach(job, dir_fh, entry->e_name, NULL);
+		goto out;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	stat = cfs_fh_stat(fh);
+
+	if (S_ISDIR(stat->st_mode)) {
+		/* Its entries are removed as a separate work */
+		RC_WRAP_LABEL(rc, out, cfs_rmtree_detach, job, dir_fh,
+			      entry->e_name, &entry->e_ino);
+
+		pthread_mutex_lock(&g_rmtree.lock);
+		rc = cfs_rmtree_queue(job, entry->e_ino);
+		pthread_mutex_unlock(&g_rmtree.lock);
+	} else {
+		RC_WRAP_LABEL(rc, out, cfs_unlink2, dir_fh, fh,
+			      &g_rmtree_cred, entry->e_name);
+
+		pthread_mutex_lock(&g_rmtree.lock);
+		job->j_stat.rt_files++;
+		pthread_mutex_unlock(&g_rmtree.lock);
+	}
+
+out:
+	if (fh != NULL) {
+		if (rc == 0 && !S_ISDIR(stat->st_mode) && stat->st_nlink > 0) {
+			/* Hard links outside of the tree keep the file */
+			cfs_fh_destroy_and_dump_stat(fh);
+		} else {
+			cfs_fh_destroy(fh);
+		}
+	}
+
+	log_trace("job=%llu dir=%llu name=%s ino=%llu rc=%d",
+		  (unsigned long long) job->j_id, *cfs_fh_ino(dir_fh),
+		  entry->e_name, entry->e_ino, rc);
+	return rc;
+}
+
+/* Remove the inode of an emptied directory */
+static int cfs_rmtree_destroy_dir(struct cfs_fh *dir_fh)
+{
+	int rc;
+	struct cfs_fs *fs = cfs_fs_from_fh(dir_fh);
+	struct kvnode *node = cfs_kvnode_from_fh(dir_fh);
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	RC_WRAP_LABEL(rc, out, cfs_remove_all_xattr, fs, &g_rmtree_cred,
+		      cfs_fh_ino(dir_fh));
+
+	/* Do not let a write back store the stat again */
+	cfs_fh_invalidate(dir_fh);
+
+	/* Do not let a flush store the totals again */
+	cfs_rstat_begin();
+
+	RC_WRAP_LABEL(rc, unlock, kvs_begin_transaction, kvstor, &index);
+	RC_WRAP_LABEL(rc, aborted, cfs_del_stat, node);
+	RC_WRAP_LABEL(rc, aborted, cfs_del_oid, fs, node);
+	RC_WRAP_LABEL(rc, aborted, cfs_rstat_forget, fs, cfs_fh_ino(dir_fh));
+	RC_WRAP_LABEL(rc, aborted, cfs_rmtree_record_del, fs,
+		      cfs_fh_ino(dir_fh));
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+
+aborted:
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+	}
+
+unlock:
+	cfs_rstat_end();
+
+out:
+	return rc;
+}
+
+static bool cfs_rmtree_aborted(const struct cfs_rmtree_job *job)
+{
+	bool aborted;
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	aborted = job->j_stat.rt_rc != 0;
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	return aborted;
+}
+
+/* Empty and remove a directory of a job */
+static int cfs_rmtree_dir(struct cfs_rmtree_thread *self,
+			  struct cfs_rmtree_job *job, cfs_ino_t dir)
+{
+	int rc;
+	uint32_t i;
+	struct cfs_fh *dir_fh = NULL;
+	struct cfs_fs *fs = (struct cfs_fs *) job->j_fs;
+	struct cfs_rmtree_scan_ctx ctx = { .batch = self->t_batch };
+
+	rc = cfs_fh_from_ino(fs, &dir, &dir_fh);
+	if (rc == -ENOENT) {
+		/* Only the record is left */
+		rc = cfs_rmtree_record_del(fs, &dir);
+		goto out;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	do {
+		if (cfs_rmtree_aborted(job)) {
+			rc = 0;
+			goto out;
+		}
+
+		ctx.count = 0;
+		RC_WRAP_LABEL(rc, out, kvtree_iter_children, fs->kvtree,
+			      cfs_node_id_from_fh(dir_fh), cfs_rmtree_scan_cb,
+			      &ctx);
+
+		for (i = 0; i < ctx.count; i++) {
+			RC_WRAP_LABEL(rc, out, cfs_rmtree_entry, job, dir_fh,
+				      &ctx.batch[i]);
+		}
+	} while (ctx.count == CFS_RMTREE_BATCH);
+
+	RC_WRAP_LABEL(rc, out, cfs_rmtree_destroy_dir, dir_fh);
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	job->j_stat.rt_dirs++;
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+out:
+	if (dir_fh != NULL) {
+		cfs_fh_destroy(dir_fh);
+	}
+
+	log_trace("job=%llu dir=%llu rc=%d", (unsigned long long) job->j_id,
+		  dir, rc);
+	return rc;
+}
+
+static void *cfs_rmtree_thread(void *arg)
+{
+	int rc;
+	struct cfs_rmtree_job *job;
+	struct cfs_rmtree_work *work;
+	struct cfs_rmtree_thread *self = arg;
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	while (!g_rmtree.stop) {
+		work = STAILQ_FIRST(&g_rmtree.queue);
+		if (work == NULL) {
+			pthread_cond_wait(&g_rmtree.work, &g_rmtree.lock);
+			continue;
+		}
+
+		STAILQ_REMOVE_HEAD(&g_rmtree.queue, w_link);
+		job = work->w_job;
+
+		if (job->j_stat.rt_rc == 0) {
+			self->t_fs = job->j_fs;
+			pthread_mutex_unlock(&g_rmtree.lock);
+
+			rc = cfs_rmtree_dir(self, job, work->w_dir);
+
+			pthread_mutex_lock(&g_rmtree.lock);
+			self->t_fs = NULL;
+			if (rc != 0 && job->j_stat.rt_rc == 0) {
+				job->j_stat.rt_rc = rc;
+			}
+		}
+
+		kvs_free(kvstore_get(), work);
+
+		dassert(job->j_stat.rt_pending > 0);
+		job->j_stat.rt_pending--;
+		if (job->j_stat.rt_pending == 0 && !job->j_stat.rt_done) {
+			cfs_rmtree_job_done(job);
+		}
+
+		pthread_cond_broadcast(&g_rmtree.idle);
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	return NULL;
+}
+
+/* Detach the root of a tree from its parent */
+static int cfs_rmtree_detach_root(struct cfs_fh *parent_fh,
+				  struct cfs_fh *child_fh, const char *name)
+{
+	int rc;
+	str256_t k_name;
+	struct cfs_fs *fs = cfs_fs_from_fh(parent_fh);
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+	struct cfs_rstat_move move;
+	bool parent_updated = false;
+
+	str256_from_cstr(k_name, name, strlen(name));
+
+	cfs_rstat_begin();
+
+	RC_WRAP_LABEL(rc, unlock, kvs_begin_transaction, kvstor, &index);
+
+	RC_WRAP_LABEL(rc, aborted, kvtree_detach, fs->kvtree,
+		      cfs_node_id_from_fh(parent_fh), &k_name);
+
+	/* The tree is resumed from the record after a restart */
+	RC_WRAP_LABEL(rc, aborted, cfs_rmtree_record_add, fs,
+		      cfs_fh_ino(child_fh), *cfs_fh_ino(child_fh));
+
+	/* The whole tree leaves the totals of the parents at once */
+	RC_WRAP_LABEL(rc, aborted, cfs_rstat_move, fs, cfs_fh_stat(child_fh),
+		      cfs_fh_ino(parent_fh), NULL, &move);
+
+	/* Child dir has a "hardlink" to the parent ("..") */
+	RC_WRAP_LABEL(rc, aborted, cfs_fh_update_stat, parent_fh,
+		      STAT_DECR_LINK|STAT_MTIME_SET|STAT_CTIME_SET, -1);
+	parent_updated = true;
+
+	RC_WRAP_LABEL(rc, aborted, kvs_end_transaction, kvstor, &index);
+	cfs_dcache_remove(fs, cfs_fh_ino(parent_fh), &k_name);
+	cfs_readdir_dir_changed(fs, cfs_fh_ino(parent_fh));
+	cfs_rstat_move_commit(fs, &move);
+	cfs_watch_notify(fs, cfs_fh_ino(parent_fh), CFS_WATCH_UNLINK,
+			 cfs_fh_ino(child_fh), &k_name);
+
+aborted:
+	if (rc != 0) {
+		kvs_discard_transaction(kvstor, &index);
+
+		if (parent_updated) {
+			cfs_fh_update_stat_undo(parent_fh, STAT_DECR_LINK|
+						STAT_MTIME_SET|STAT_CTIME_SET,
+						-1);
+		}
+	}
+
+unlock:
+	cfs_rstat_end();
+
+	log_trace("parent=%llu name=%s child=%llu rc=%d",
+		  *cfs_fh_ino(parent_fh), name, *cfs_fh_ino(child_fh), rc);
+	return rc;
+}
+
+/* Register a new job. The caller must hold the lock. */
+static int cfs_rmtree_job_new(const struct cfs_fs *fs, cfs_ino_t root,
+			      struct cfs_rmtree_job **pjob)
+{
+	int rc;
+	struct cfs_rmtree_job *job = NULL;
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &job,
+		      sizeof(*job));
+
+	memset(job, 0, sizeof(*job));
+	job->j_id = g_rmtree.next_id++;
+	job->j_fs = fs;
+	job->j_root = root;
+	TAILQ_INSERT_TAIL(&g_rmtree.jobs, job, j_link);
+
+	*pjob = job;
+
+out:
+	return rc;
+}
+
+int cfs_remove_tree(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
+		    char *name, uint64_t *job_id)
+{
+	int rc;
+	bool is_dir = false;
+	cfs_ino_t root = 0LL;
+	struct cfs_fh *parent_fh = NULL;
+	struct cfs_fh *child_fh = NULL;
+	struct cfs_rmtree_job *job = NULL;
+
+	dassert(cfs_fs && cred && parent && name && job_id);
+
+	if (!g_rmtree.enabled) {
+		rc = -ENOTSUP;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, cfs_fs, parent, &parent_fh);
+	RC_WRAP_LABEL(rc, out, cfs_access_check, cred, cfs_fh_stat(parent_fh),
+		      CFS_ACCESS_WRITE);
+	RC_WRAP_LABEL(rc, out, cfs_fh_lookup, cred, parent_fh, name,
+		      &child_fh);
+
+	root = *cfs_fh_ino(child_fh);
+	is_dir = S_ISDIR(cfs_fh_stat(child_fh)->st_mode);
+
+	if (is_dir) {
+		RC_WRAP_LABEL(rc, out, cfs_rmtree_detach_root, parent_fh,
+			      child_fh, name);
+	} else {
+		cfs_fh_destroy(child_fh);
+		child_fh = NULL;
+		RC_WRAP_LABEL(rc, out, cfs_unlink, cfs_fs, cred, parent, NULL,
+			      name);
+	}
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	rc = cfs_rmtree_job_new(cfs_fs, root, &job);
+	if (rc == 0) {
+		*job_id = job->j_id;
+		if (is_dir) {
+			rc = cfs_rmtree_queue(job, root);
+			if (rc != 0) {
+				job->j_stat.rt_rc = rc;
+			}
+		} else {
+			job->j_stat.rt_files = 1;
+		}
+
+		if (job->j_stat.rt_pending == 0) {
+			cfs_rmtree_job_done(job);
+		}
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	/* The tree is already detached, a failure to queue it leaves
+	 * the inodes behind until the filesystem is loaded again.
+	 */
+	if (rc != 0) {
+		log_err("Failed to queue tree removal fs=%p root=%llu rc=%d",
+			cfs_fs, root, rc);
+	}
+
+out:
+	if (parent_fh != NULL) {
+		cfs_fh_destroy_and_dump_stat(parent_fh);
+	}
+
+	if (child_fh != NULL) {
+		cfs_fh_destroy(child_fh);
+	}
+
+	log_debug("cfs_fs=%p parent_ino=%llu name=%s root=%llu rc=%d",
+		  cfs_fs, *parent, name, root, rc);
+	return rc;
+}
+
+int cfs_remove_tree_status(uint64_t job_id, struct cfs_remove_tree_stat *stat)
+{
+	int rc = -ENOENT;
+	struct cfs_rmtree_job *job;
+
+	dassert(stat);
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	TAILQ_FOREACH(job, &g_rmtree.jobs, j_link) {
+		if (job->j_id == job_id) {
+			*stat = job->j_stat;
+			rc = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	return rc;
+}
+
+bool cfs_remove_tree_busy(const struct cfs_fs *fs)
+{
+	bool busy = false;
+	struct cfs_rmtree_job *job;
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	TAILQ_FOREACH(job, &g_rmtree.jobs, j_link) {
+		if (job->j_fs == fs && !job->j_stat.rt_done) {
+			busy = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	return busy;
+}
+
+/* A recorded directory and the root of its tree */
+struct cfs_rmtree_record {
+	cfs_ino_t r_dir;
+	cfs_ino_t r_root;
+};
+
+/* Queue a recorded directory in the job of its tree, which is created by
+ * the first directory of the tree. The caller must hold the lock.
+ */
+static int cfs_rmtree_resume(const struct cfs_fs *fs,
+			     const struct cfs_rmtree_record *record)
+{
+	int rc;
+	struct cfs_rmtree_job *job;
+
+	TAILQ_FOREACH(job, &g_rmtree.jobs, j_link) {
+		if (job->j_fs == fs && job->j_root == record->r_root &&
+		    !job->j_stat.rt_done) {
+			break;
+		}
+	}
+
+	if (job == NULL) {
+		RC_WRAP_LABEL(rc, out, cfs_rmtree_job_new, fs, record->r_root,
+			      &job);
+		log_info("rmtree job=%llu root=%llu resumed",
+			 (unsigned long long) job->j_id, job->j_root);
+	}
+
+	rc = cfs_rmtree_queue(job, record->r_dir);
+	if (rc != 0) {
+		job->j_stat.rt_rc = rc;
+		if (job->j_stat.rt_pending == 0) {
+			cfs_rmtree_job_done(job);
+		}
+	}
+
+out:
+	return rc;
+}
+
+int cfs_remove_tree_recover(struct cfs_fs *fs)
+{
+	int rc;
+	uint32_t i;
+	uint32_t count = 0;
+	uint32_t size = 0;
+	size_t klen;
+	size_t vlen;
+	void *key_buf;
+	void *val_buf;
+	struct cfs_rmtree_record *records = NULL;
+	struct cfs_rmtree_record *grown = NULL;
+	struct cfs_rmtree_key prefix;
+	struct cfs_rmtree_key *key;
+	struct kvs_itr *iter = NULL;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	dassert(fs);
+
+	cfs_rmtree_key_init(&prefix, NULL);
+
+	rc = kvs_itr_find(kvstor, &index, &prefix, CFS_RMTREE_KEY_PREFIX_LEN,
+			  &iter);
+	while (rc == 0) {
+		kvs_itr_get(kvstor, iter, &key_buf, &klen, &val_buf, &vlen);
+		key = key_buf;
+
+		if (klen == sizeof(*key) && vlen == sizeof(cfs_ino_t)) {
+			if (count == size) {
+				size += CFS_RMTREE_BATCH;
+				grown = realloc(records,
+						size * sizeof(*records));
+				if (grown == NULL) {
+					rc = -ENOMEM;
+					break;
+				}
+				records = grown;
+			}
+			records[count].r_dir = key->ino;
+			records[count].r_root = *(cfs_ino_t *) val_buf;
+			count++;
+		}
+
+		rc = kvs_itr_next(kvstor, iter);
+	}
+
+	if (iter != NULL) {
+		kvs_itr_fini(kvstor, iter);
+	}
+
+	if (rc == -ENOENT) {
+		/* The end of the records */
+		rc = 0;
+	}
+
+	if (rc != 0 || count == 0) {
+		goto out;
+	}
+
+	if (!g_rmtree.enabled) {
+		/* The records stay until the workers are enabled */
+		log_warn("fs=%p has %u directories of removed trees left",
+			 fs, count);
+		goto out;
+	}
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	for (i = 0; i < count && rc == 0; i++) {
+		rc = cfs_rmtree_resume(fs, &records[i]);
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+out:
+	free(records);
+	log_info("fs=%p rmtree dirs=%u rc=%d", fs, count, rc);
+	return rc;
+}
+
+/* Drop the queued directories of the given filesystem (or of all
+ * filesystems if fs is NULL) and fail their jobs. The caller must hold
+ * the lock.
+ */
+static void cfs_rmtree_purge(const struct cfs_fs *fs)
+{
+	struct cfs_rmtree_job *job;
+	struct cfs_rmtree_work *work;
+	struct cfs_rmtree_queue keep = STAILQ_HEAD_INITIALIZER(keep);
+
+	TAILQ_FOREACH(job, &g_rmtree.jobs, j_link) {
+		if ((fs == NULL || job->j_fs == fs) &&
+		    job->j_stat.rt_rc == 0) {
+			job->j_stat.rt_rc = -ESHUTDOWN;
+		}
+	}
+
+	while ((work = STAILQ_FIRST(&g_rmtree.queue)) != NULL) {
+		STAILQ_REMOVE_HEAD(&g_rmtree.queue, w_link);
+		job = work->w_job;
+
+		if (fs != NULL && job->j_fs != fs) {
+			STAILQ_INSERT_TAIL(&keep, work, w_link);
+			continue;
+		}
+
+		job->j_stat.rt_pending--;
+		if (job->j_stat.rt_pending == 0 && !job->j_stat.rt_done) {
+			cfs_rmtree_job_done(job);
+		}
+		kvs_free(kvstore_get(), work);
+	}
+
+	STAILQ_CONCAT(&g_rmtree.queue, &keep);
+}
+
+static bool cfs_rmtree_busy(const struct cfs_fs *fs)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_rmtree.nthreads; i++) {
+		if (g_rmtree.threads[i].t_fs == fs) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void cfs_remove_tree_evict_fs(const struct cfs_fs *fs)
+{
+	struct cfs_rmtree_job *job;
+
+	dassert(fs);
+
+	if (!g_rmtree.enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	cfs_rmtree_purge(fs);
+	/* Wait for the directories which are being emptied */
+	while (cfs_rmtree_busy(fs)) {
+		pthread_cond_wait(&g_rmtree.idle, &g_rmtree.lock);
+	}
+
+	TAILQ_FOREACH(job, &g_rmtree.jobs, j_link) {
+		if (job->j_fs == fs) {
+			job->j_fs = NULL;
+		}
+	}
+	pthread_mutex_unlock(&g_rmtree.lock);
+}
+
+static void cfs_rmtree_stop(uint32_t nthreads)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	g_rmtree.stop = true;
+	pthread_cond_broadcast(&g_rmtree.work);
+	pthread_mutex_unlock(&g_rmtree.lock);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(g_rmtree.threads[i].t_thread, NULL);
+	}
+
+	for (i = 0; i < g_rmtree.nthreads; i++) {
+		free(g_rmtree.threads[i].t_batch);
+	}
+
+	free(g_rmtree.threads);
+	g_rmtree.threads = NULL;
+	g_rmtree.nthreads = 0;
+}
+
+int cfs_remove_tree_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+	uint64_t nthreads;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "rmtree_threads", CFS_RMTREE_THREADS_DEFAULT,
+		      &nthreads);
+
+	g_rmtree.stop = false;
+
+	if (nthreads == 0) {
+		goto out;
+	}
+
+	g_rmtree.threads = calloc(nthreads, sizeof(*g_rmtree.threads));
+	if (g_rmtree.threads == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	g_rmtree.nthreads = nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		g_rmtree.threads[i].t_batch =
+			malloc(CFS_RMTREE_BATCH *
+			       sizeof(*g_rmtree.threads[i].t_batch));
+		if (g_rmtree.threads[i].t_batch == NULL) {
+			rc = -ENOMEM;
+			cfs_rmtree_stop(0);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		rc = -pthread_create(&g_rmtree.threads[i].t_thread, NULL,
+				     cfs_rmtree_thread, &g_rmtree.threads[i]);
+		if (rc != 0) {
+			log_err("Failed to start a rmtree thread, rc=%d", rc);
+			cfs_rmtree_stop(i);
+			goto out;
+		}
+	}
+
+	g_rmtree.enabled = true;
+
+out:
+	log_info("rmtree: threads=%u enabled=%d rc=%d", g_rmtree.nthreads,
+		 (int) g_rmtree.enabled, rc);
+	return rc;
+}
+
+void cfs_remove_tree_fini(void)
+{
+	struct cfs_rmtree_job *job;
+
+	if (!g_rmtree.enabled) {
+		return;
+	}
+
+	g_rmtree.enabled = false;
+	cfs_rmtree_stop(g_rmtree.nthreads);
+
+	pthread_mutex_lock(&g_rmtree.lock);
+	cfs_rmtree_purge(NULL);
+	while ((job = TAILQ_FIRST(&g_rmtree.jobs)) != NULL) {
+		TAILQ_REMOVE(&g_rmtree.jobs, job, j_link);
+		kvs_free(kvstore_get(), job);
+	}
+	g_rmtree.ndone = 0;
+	pthread_mutex_unlock(&g_rmtree.lock);
+}
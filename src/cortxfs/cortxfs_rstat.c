@@ -0,0 +1,967 @@
+/*
+ * Filename: cortxfs_rstat.c
+ * Description: CORTXFS recursive directory statistics.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Recursive statistics.
+ * ---------------------
+ *
+ * Every directory has the totals of its subtree (struct cfs_rstat) under
+ * a CFS_KEY_TYPE_RSTAT key, and every inode has the directory it is
+ * accounted in under a CFS_KEY_TYPE_PARENT key. The parent is the directory
+ * the inode was created in, or moved to by a rename; the other hard links of
+ * a file are not accounted.
+ *
+ * The namespace operations do not touch the totals, they record deltas in
+ * memory: a file which grows or is unlinked records a delta for itself,
+ * a directory in which an entry is created records a delta for itself.
+ * The flusher thread (every "rstat_flush_ms" or once too many deltas are
+ * pending) takes the deltas of a filesystem, adds every one of them to all
+ * the directories up to the root, and stores each touched directory once,
+ * in a single transaction. cfs_get_rstat() flushes the deltas of the
+ * filesystem first, then it reads the totals of the directory.
+ *
+ * A directory which moves (rename, rmdir, tree removal) takes its stored
+ * totals away from its old parents and gives them to the new ones. Its
+ * pending deltas stay where they are, they follow the new parent chain when
+ * they are flushed. The moves are done under the flush lock, so that the
+ * totals do not change under them.
+ *
+ * A chain stops at an inode which has no parent: a detached or removed
+ * directory, or an inode created before the statistics existed. Such
+ * subtrees are not accounted.
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <pthread.h> /* pthread_t */
+#include <stdlib.h> /* calloc() */
+#include <string.h> /* memset() */
+#include <time.h> /* clock_gettime() */
+#include <sys/queue.h> /* LIST_*, TAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* TAILQ_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_rstat_evict_fs */
+#include "kvtree.h" /* struct kvtree */
+
+#define CFS_RSTAT_FLUSH_MS_DEFAULT 1000
+/* Number of pending deltas which wakes up the flusher */
+#define CFS_RSTAT_PENDING_MAX 4096
+#define CFS_RSTAT_BUCKETS 1024
+/* Buckets of the directories touched by a flush */
+#define CFS_RSTAT_FLUSH_BUCKETS 256
+/* Longest parent chain, a longer one is a loop */
+#define CFS_RSTAT_DEPTH_MAX 4096
+
+struct cfs_rstat_delta {
+	int64_t d_bytes;
+	int64_t d_files;
+	int64_t d_subdirs;
+	struct timespec d_mtime;
+};
+
+/* Pending delta of an inode */
+struct cfs_rstat_entry {
+	LIST_ENTRY(cfs_rstat_entry) e_hash;
+	TAILQ_ENTRY(cfs_rstat_entry) e_link;
+	struct cfs_fs *e_fs;
+	cfs_ino_t e_ino;
+	/* The delta is for the directory e_ino itself, not for its parent */
+	bool e_self;
+	/* The file is gone, its parent is forgotten once the delta is applied,
+	 * later deltas are ignored.
+	 */
+	bool e_final;
+	struct cfs_rstat_delta e_delta;
+};
+
+TAILQ_HEAD(cfs_rstat_list, cfs_rstat_entry);
+
+/* An inode touched by a flush */
+struct cfs_rstat_node {
+	LIST_ENTRY(cfs_rstat_node) n_hash;
+	TAILQ_ENTRY(cfs_rstat_node) n_link;
+	cfs_ino_t n_ino;
+	cfs_ino_t n_parent;
+	/* 0 if n_parent is known, -ENOENT if there is none */
+	int n_parent_rc;
+	bool n_parent_loaded;
+	/* n_delta goes to the totals of the directory */
+	bool n_dirty;
+	/* The parent key goes away */
+	bool n_forget;
+	struct cfs_rstat_delta n_delta;
+};
+
+struct cfs_rstat_flush {
+	LIST_HEAD(cfs_rstat_nbucket, cfs_rstat_node)
+		buckets[CFS_RSTAT_FLUSH_BUCKETS];
+	TAILQ_HEAD(cfs_rstat_nodes, cfs_rstat_node) nodes;
+};
+
+struct cfs_rstat_table {
+	pthread_mutex_t lock;
+	/* Held by a flush and by the moves */
+	pthread_mutex_t flush_lock;
+	/* Signaled when too many deltas are pending or on stop */
+	pthread_cond_t work;
+	LIST_HEAD(cfs_rstat_bucket, cfs_rstat_entry) buckets[CFS_RSTAT_BUCKETS];
+	struct cfs_rstat_list pending;
+	uint32_t npending;
+	uint64_t nflushes;
+	uint64_t nfailed;
+	uint64_t flush_ms;
+	pthread_t thread;
+	bool running;
+	bool stop;
+};
+
+static struct cfs_rstat_table g_rstat = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.flush_lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.pending = TAILQ_HEAD_INITIALIZER(g_rstat.pending),
+};
+
+static inline void cfs_rstat_key_init(struct cfs_inode_attr_key *key,
+				      const cfs_ino_t *ino,
+				      cfs_key_type_t type)
+{
+	memset(key, 0, sizeof(*key));
+	key->fid.f_hi = *ino;
+	key->md.type = type;
+	key->md.version = CFS_VERSION_0;
+}
+
+static inline uint64_t cfs_rstat_hash(const struct cfs_fs *fs, cfs_ino_t ino)
+{
+	uint64_t hash = ino ^ ((uintptr_t) fs >> 4);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static inline bool cfs_rstat_time_after(const struct timespec *a,
+					const struct timespec *b)
+{
+	return a->tv_sec > b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+static void cfs_rstat_delta_add(struct cfs_rstat_delta *to,
+				const struct cfs_rstat_delta *delta)
+{
+	to->d_bytes += delta->d_bytes;
+	to->d_files += delta->d_files;
+	to->d_subdirs += delta->d_subdirs;
+	if (cfs_rstat_time_after(&delta->d_mtime, &to->d_mtime)) {
+		to->d_mtime = delta->d_mtime;
+	}
+}
+
+static inline uint64_t cfs_rstat_apply(uint64_t total, int64_t delta)
+{
+	/* Inodes accounted before a crash may be taken away twice */
+	if (delta < 0 && (uint64_t) -delta > total) {
+		return 0;
+	}
+
+	return total + delta;
+}
+
+static struct cfs_rstat_entry *cfs_rstat_find(struct cfs_rstat_bucket *bucket,
+					      const struct cfs_fs *fs,
+					      cfs_ino_t ino)
+{
+	struct cfs_rstat_entry *entry;
+
+	LIST_FOREACH(entry, bucket, e_hash) {
+		if (entry->e_ino == ino && entry->e_fs == fs) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Record a delta. The caller must hold the lock. */
+static void cfs_rstat_merge(struct cfs_fs *fs, cfs_ino_t ino, bool self,
+			    bool final, const struct cfs_rstat_delta *delta)
+{
+	int rc;
+	struct cfs_rstat_bucket *bucket;
+	struct cfs_rstat_entry *entry;
+
+	bucket = &g_rstat.buckets[cfs_rstat_hash(fs, ino) % CFS_RSTAT_BUCKETS];
+	entry = cfs_rstat_find(bucket, fs, ino);
+
+	if (entry == NULL) {
+		rc = kvs_alloc(kvstore_get(), (void **) &entry, sizeof(*entry));
+		if (rc != 0) {
+			log_warn("Lost an rstat delta fs=%p ino=%llu rc=%d",
+				 fs, ino, rc);
+			return;
+		}
+
+		memset(entry, 0, sizeof(*entry));
+		entry->e_fs = fs;
+		entry->e_ino = ino;
+		entry->e_self = self;
+		LIST_INSERT_HEAD(bucket, entry, e_hash);
+		TAILQ_INSERT_TAIL(&g_rstat.pending, entry, e_link);
+		g_rstat.npending++;
+	} else if (entry->e_final) {
+		/* Written through an open handle after the last unlink */
+		return;
+	}
+
+	dassert(entry->e_self == self);
+	cfs_rstat_delta_add(&entry->e_delta, delta);
+	entry->e_final = final;
+
+	if (g_rstat.npending > CFS_RSTAT_PENDING_MAX) {
+		pthread_cond_signal(&g_rstat.work);
+	}
+}
+
+static void cfs_rstat_account(struct cfs_fs *fs, cfs_ino_t ino, bool self,
+			      bool final, const struct cfs_rstat_delta *delta)
+{
+	pthread_mutex_lock(&g_rstat.lock);
+	cfs_rstat_merge(fs, ino, self, final, delta);
+	pthread_mutex_unlock(&g_rstat.lock);
+
+	log_trace("fs=%p ino=%llu self=%d final=%d bytes=%lld files=%lld "
+		  "subdirs=%lld", fs, ino, (int) self, (int) final,
+		  (long long) delta->d_bytes, (long long) delta->d_files,
+		  (long long) delta->d_subdirs);
+}
+
+/* Take the pending deltas of a filesystem. The caller must hold
+ * the lock.
+ */
+static void cfs_rstat_take(const struct cfs_fs *fs, struct cfs_rstat_list *out)
+{
+	struct cfs_rstat_entry *entry;
+	struct cfs_rstat_entry *next;
+
+	TAILQ_FOREACH_SAFE(entry, &g_rstat.pending, e_link, next) {
+		if (entry->e_fs != fs) {
+			continue;
+		}
+
+		LIST_REMOVE(entry, e_hash);
+		TAILQ_REMOVE(&g_rstat.pending, entry, e_link);
+		g_rstat.npending--;
+		TAILQ_INSERT_TAIL(out, entry, e_link);
+	}
+}
+
+static void cfs_rstat_free_list(struct cfs_rstat_list *list)
+{
+	struct cfs_rstat_entry *entry;
+
+	while ((entry = TAILQ_FIRST(list)) != NULL) {
+		TAILQ_REMOVE(list, entry, e_link);
+		kvs_free(kvstore_get(), entry);
+	}
+}
+
+static int cfs_rstat_get_parent(struct cfs_fs *fs, const cfs_ino_t *ino,
+				cfs_ino_t *parent)
+{
+	int rc;
+	size_t size = 0;
+	cfs_ino_t *value = NULL;
+	struct cfs_inode_attr_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	cfs_rstat_key_init(&key, ino, CFS_KEY_TYPE_PARENT);
+
+	rc = kvs_get(kvstor, &index, &key, sizeof(key), (void **) &value,
+		     &size);
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (size != sizeof(*value)) {
+		rc = -EINVAL;
+	} else {
+		*parent = *value;
+	}
+	kvs_free(kvstor, value);
+
+out:
+	return rc;
+}
+
+static int cfs_rstat_forget_parent(struct cfs_fs *fs, const cfs_ino_t *ino)
+{
+	int rc;
+	struct cfs_inode_attr_key key;
+
+	cfs_rstat_key_init(&key, ino, CFS_KEY_TYPE_PARENT);
+
+	rc = kvs_del(kvstore_get(), &fs->kvtree->index, &key, sizeof(key));
+	if (rc == -ENOENT) {
+		/* Created before the statistics existed */
+		rc = 0;
+	}
+
+	return rc;
+}
+
+static int cfs_rstat_load(struct cfs_fs *fs, const cfs_ino_t *dir,
+			  struct cfs_rstat *rstat)
+{
+	int rc;
+	size_t size = 0;
+	struct cfs_rstat *value = NULL;
+	struct cfs_inode_attr_key key;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index = fs->kvtree->index;
+
+	cfs_rstat_key_init(&key, dir, CFS_KEY_TYPE_RSTAT);
+
+	rc = kvs_get(kvstor, &index, &key, sizeof(key), (void **) &value,
+		     &size);
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (size != sizeof(*value)) {
+		rc = -EINVAL;
+	} else {
+		*rstat = *value;
+	}
+	kvs_free(kvstor, value);
+
+out:
+	return rc;
+}
+
+static int cfs_rstat_store(struct cfs_fs *fs, const cfs_ino_t *dir,
+			   const struct cfs_rstat_delta *delta)
+{
+	int rc;
+	struct cfs_rstat rstat;
+	struct cfs_inode_attr_key key;
+
+	rc = cfs_rstat_load(fs, dir, &rstat);
+	if (rc == -ENOENT) {
+		memset(&rstat, 0, sizeof(rstat));
+		rc = 0;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	rstat.rs_bytes = cfs_rstat_apply(rstat.rs_bytes, delta->d_bytes);
+	rstat.rs_files = cfs_rstat_apply(rstat.rs_files, delta->d_files);
+	rstat.rs_subdirs = cfs_rstat_apply(rstat.rs_subdirs, delta->d_subdirs);
+	if (cfs_rstat_time_after(&delta->d_mtime, &rstat.rs_mtime)) {
+		rstat.rs_mtime = delta->d_mtime;
+	}
+
+	cfs_rstat_key_init(&key, dir, CFS_KEY_TYPE_RSTAT);
+
+	rc = kvs_set(kvstore_get(), &fs->kvtree->index, &key, sizeof(key),
+		     &rstat, sizeof(rstat));
+
+out:
+	return rc;
+}
+
+static struct cfs_rstat_node *cfs_rstat_node_get(struct cfs_rstat_flush *flush,
+						 cfs_ino_t ino)
+{
+	int rc;
+	struct cfs_rstat_nbucket *bucket;
+	struct cfs_rstat_node *node;
+
+	bucket = &flush->buckets[cfs_rstat_hash(NULL, ino) %
+				 CFS_RSTAT_FLUSH_BUCKETS];
+
+	LIST_FOREACH(node, bucket, n_hash) {
+		if (node->n_ino == ino) {
+			return node;
+		}
+	}
+
+	rc = kvs_alloc(kvstore_get(), (void **) &node, sizeof(*node));
+	if (rc != 0) {
+		return NULL;
+	}
+
+	memset(node, 0, sizeof(*node));
+	node->n_ino = ino;
+	LIST_INSERT_HEAD(bucket, node, n_hash);
+	TAILQ_INSERT_TAIL(&flush->nodes, node, n_link);
+
+	return node;
+}
+
+static int cfs_rstat_node_parent(struct cfs_fs *fs,
+				 struct cfs_rstat_node *node)
+{
+	if (!node->n_parent_loaded) {
+		node->n_parent_rc = cfs_rstat_get_parent(fs, &node->n_ino,
+							 &node->n_parent);
+		node->n_parent_loaded = true;
+	}
+
+	return node->n_parent_rc;
+}
+
+/* Add a pending delta to the directories of its parent chain */
+static int cfs_rstat_resolve(struct cfs_fs *fs, struct cfs_rstat_flush *flush,
+			     const struct cfs_rstat_entry *entry)
+{
+	int rc;
+	uint32_t depth = 0;
+	cfs_ino_t dir;
+	struct cfs_rstat_node *node;
+
+	node = cfs_rstat_node_get(flush, entry->e_ino);
+	if (node == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	node->n_forget = node->n_forget || entry->e_final;
+
+	if (entry->e_self) {
+		dir = entry->e_ino;
+	} else {
+		rc = cfs_rstat_node_parent(fs, node);
+		if (rc != 0) {
+			goto not_accounted;
+		}
+		dir = node->n_parent;
+	}
+
+	while (true) {
+		node = cfs_rstat_node_get(flush, dir);
+		if (node == NULL) {
+			rc = -ENOMEM;
+			goto out;
+		}
+
+		if (dir != CFS_ROOT_INODE) {
+			rc = cfs_rstat_node_parent(fs, node);
+			if (rc != 0) {
+				goto not_accounted;
+			}
+		}
+
+		cfs_rstat_delta_add(&node->n_delta, &entry->e_delta);
+		node->n_dirty = true;
+
+		if (dir == CFS_ROOT_INODE) {
+			break;
+		}
+
+		if (++depth > CFS_RSTAT_DEPTH_MAX) {
+			log_warn("Parent chain of ino=%llu is too long, dir=%llu",
+				 entry->e_ino, dir);
+			break;
+		}
+
+		dir = node->n_parent;
+	}
+
+	rc = 0;
+	goto out;
+
+not_accounted:
+	if (rc == -ENOENT) {
+		/* The chain ends out of the namespace */
+		rc = 0;
+	}
+
+out:
+	return rc;
+}
+
+/* Apply the pending deltas of a filesystem. The caller must hold the flush
+ * lock. The deltas are put back if they cannot be stored.
+ */
+static int cfs_rstat_flush_locked(struct cfs_fs *fs)
+{
+	int rc = 0;
+	uint32_t i;
+	uint32_t ndirs = 0;
+	bool in_txn = false;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index;
+	struct cfs_rstat_list batch = TAILQ_HEAD_INITIALIZER(batch);
+	struct cfs_rstat_entry *entry;
+	struct cfs_rstat_node *node;
+	struct cfs_rstat_flush *flush = NULL;
+
+	pthread_mutex_lock(&g_rstat.lock);
+	cfs_rstat_take(fs, &batch);
+	pthread_mutex_unlock(&g_rstat.lock);
+
+	if (TAILQ_EMPTY(&batch)) {
+		/* The filesystem may be gone already */
+		goto out;
+	}
+
+	index = fs->kvtree->index;
+
+	flush = calloc(1, sizeof(*flush));
+	if (flush == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < CFS_RSTAT_FLUSH_BUCKETS; i++) {
+		LIST_INIT(&flush->buckets[i]);
+	}
+	TAILQ_INIT(&flush->nodes);
+
+	TAILQ_FOREACH(entry, &batch, e_link) {
+		RC_WRAP_LABEL(rc, out, cfs_rstat_resolve, fs, flush, entry);
+	}
+
+	RC_WRAP_LABEL(rc, out, kvs_begin_transaction, kvstor, &index);
+	in_txn = true;
+
+	TAILQ_FOREACH(node, &flush->nodes, n_link) {
+		if (node->n_dirty) {
+			RC_WRAP_LABEL(rc, out, cfs_rstat_store, fs,
+				      &node->n_ino, &node->n_delta);
+			ndirs++;
+		}
+
+		if (node->n_forget) {
+			RC_WRAP_LABEL(rc, out, cfs_rstat_forget_parent, fs,
+				      &node->n_ino);
+		}
+	}
+
+	RC_WRAP_LABEL(rc, out, kvs_end_transaction, kvstor, &index);
+	in_txn = false;
+
+out:
+	if (in_txn) {
+		kvs_discard_transaction(kvstor, &index);
+	}
+
+	pthread_mutex_lock(&g_rstat.lock);
+	if (rc != 0) {
+		/* Try again with the next flush */
+		TAILQ_FOREACH(entry, &batch, e_link) {
+			cfs_rstat_merge(fs, entry->e_ino, entry->e_self,
+					entry->e_final, &entry->e_delta);
+		}
+		g_rstat.nfailed++;
+	}
+	g_rstat.nflushes++;
+	pthread_mutex_unlock(&g_rstat.lock);
+
+	cfs_rstat_free_list(&batch);
+
+	if (flush != NULL) {
+		while ((node = TAILQ_FIRST(&flush->nodes)) != NULL) {
+			TAILQ_REMOVE(&flush->nodes, node, n_link);
+			kvs_free(kvstor, node);
+		}
+		free(flush);
+	}
+
+	if (rc != 0) {
+		log_warn("Failed to flush rstats fs=%p rc=%d", fs, rc);
+	}
+
+	log_trace("fs=%p ndirs=%u rc=%d", fs, ndirs, rc);
+	return rc;
+}
+
+int cfs_rstat_flush(struct cfs_fs *fs)
+{
+	int rc;
+
+	dassert(fs);
+
+	pthread_mutex_lock(&g_rstat.flush_lock);
+	rc = cfs_rstat_flush_locked(fs);
+	pthread_mutex_unlock(&g_rstat.flush_lock);
+
+	return rc;
+}
+
+int cfs_rstat_link(struct cfs_fs *fs, const cfs_ino_t *ino,
+		   const cfs_ino_t *parent)
+{
+	int rc;
+	struct cfs_inode_attr_key key;
+
+	cfs_rstat_key_init(&key, ino, CFS_KEY_TYPE_PARENT);
+
+	rc = kvs_set(kvstore_get(), &fs->kvtree->index, &key, sizeof(key),
+		     (void *) parent, sizeof(*parent));
+
+	log_trace("fs=%p ino=%llu parent=%llu rc=%d", fs, *ino, *parent, rc);
+	return rc;
+}
+
+int cfs_rstat_parent(struct cfs_fs *fs, const cfs_ino_t *ino,
+		     cfs_ino_t *parent)
+{
+	int rc;
+
+	dassert(fs && ino && parent);
+
+	rc = cfs_rstat_get_parent(fs, ino, parent);
+
+	log_trace("fs=%p ino=%llu parent=%llu rc=%d", fs, *ino,
+		  rc == 0 ? *parent : 0LL, rc);
+	return rc;
+}
+
+void cfs_rstat_created(struct cfs_fs *fs, const cfs_ino_t *parent,
+		       const struct stat *stat)
+{
+	struct cfs_rstat_delta delta = {
+		.d_bytes = stat->st_size,
+		.d_mtime = stat->st_mtim,
+	};
+
+	if (S_ISDIR(stat->st_mode)) {
+		delta.d_subdirs = 1;
+	} else {
+		delta.d_files = 1;
+	}
+
+	cfs_rstat_account(fs, *parent, true, false, &delta);
+}
+
+void cfs_rstat_resized(struct cfs_fs *fs, const struct stat *stat,
+		       off_t old_size)
+{
+	struct cfs_rstat_delta delta = {
+		.d_bytes = (int64_t) stat->st_size - old_size,
+		.d_mtime = stat->st_mtim,
+	};
+
+	cfs_rstat_account(fs, stat->st_ino, false, false, &delta);
+}
+
+void cfs_rstat_unlinked(struct cfs_fs *fs, const struct stat *stat)
+{
+	struct cfs_rstat_delta delta = {
+		.d_bytes = -(int64_t) stat->st_size,
+		.d_files = -1,
+	};
+
+	dassert(!S_ISDIR(stat->st_mode));
+
+	cfs_rstat_account(fs, stat->st_ino, false, true, &delta);
+}
+
+void cfs_rstat_begin(void)
+{
+	pthread_mutex_lock(&g_rstat.flush_lock);
+}
+
+void cfs_rstat_end(void)
+{
+	pthread_mutex_unlock(&g_rstat.flush_lock);
+}
+
+int cfs_rstat_forget(struct cfs_fs *fs, const cfs_ino_t *dir)
+{
+	int rc;
+	struct cfs_inode_attr_key key;
+
+	RC_WRAP_LABEL(rc, out, cfs_rstat_forget_parent, fs, dir);
+
+	cfs_rstat_key_init(&key, dir, CFS_KEY_TYPE_RSTAT);
+
+	rc = kvs_del(kvstore_get(), &fs->kvtree->index, &key, sizeof(key));
+	if (rc == -ENOENT) {
+		/* Nothing has been accounted in it */
+		rc = 0;
+	}
+
+out:
+	log_trace("fs=%p dir=%llu rc=%d", fs, *dir, rc);
+	return rc;
+}
+
+int cfs_rstat_move(struct cfs_fs *fs, const struct stat *stat,
+		   const cfs_ino_t *sdir, const cfs_ino_t *ddir,
+		   struct cfs_rstat_move *move)
+{
+	int rc;
+	cfs_ino_t ino = stat->st_ino;
+	cfs_ino_t parent;
+	int64_t pending = 0;
+	struct cfs_rstat_entry *entry;
+
+	memset(move, 0, sizeof(*move));
+	move->m_sdir = *sdir;
+	move->m_ddir = ddir != NULL ? *ddir : 0;
+
+	rc = cfs_rstat_get_parent(fs, &ino, &parent);
+	if (rc == -ENOENT || (rc == 0 && parent != *sdir)) {
+		/* Accounted elsewhere (a hard link) or not at all */
+		rc = 0;
+		goto out;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	move->m_accounted = true;
+
+	if (S_ISDIR(stat->st_mode)) {
+		rc = cfs_rstat_load(fs, &ino, &move->m_totals);
+		if (rc == -ENOENT) {
+			rc = 0;
+		} else if (rc != 0) {
+			goto out;
+		}
+
+		move->m_totals.rs_subdirs++;
+	} else {
+		/* The pending part of the size follows the new parent */
+		pthread_mutex_lock(&g_rstat.lock);
+		entry = cfs_rstat_find(&g_rstat.buckets[cfs_rstat_hash(fs, ino) %
+							CFS_RSTAT_BUCKETS],
+				       fs, ino);
+		if (entry != NULL) {
+			pending = entry->e_delta.d_bytes;
+		}
+		pthread_mutex_unlock(&g_rstat.lock);
+
+		move->m_totals.rs_bytes =
+			cfs_rstat_apply(stat->st_size, -pending);
+		move->m_totals.rs_files = 1;
+	}
+
+	if (cfs_rstat_time_after(&stat->st_mtim, &move->m_totals.rs_mtime)) {
+		move->m_totals.rs_mtime = stat->st_mtim;
+	}
+
+	if (ddir != NULL) {
+		RC_WRAP_LABEL(rc, out, cfs_rstat_link, fs, &ino, ddir);
+	} else if (S_ISDIR(stat->st_mode)) {
+		RC_WRAP_LABEL(rc, out, cfs_rstat_forget, fs, &ino);
+	} else {
+		RC_WRAP_LABEL(rc, out, cfs_rstat_forget_parent, fs, &ino);
+	}
+
+out:
+	log_trace("fs=%p ino=%llu sdir=%llu ddir=%llu accounted=%d rc=%d",
+		  fs, ino, *sdir, move->m_ddir, (int) move->m_accounted, rc);
+	return rc;
+}
+
+void cfs_rstat_move_commit(struct cfs_fs *fs,
+			   const struct cfs_rstat_move *move)
+{
+	struct cfs_rstat_delta delta = {
+		.d_bytes = move->m_totals.rs_bytes,
+		.d_files = move->m_totals.rs_files,
+		.d_subdirs = move->m_totals.rs_subdirs,
+		.d_mtime = move->m_totals.rs_mtime,
+	};
+
+	if (!move->m_accounted) {
+		return;
+	}
+
+	if (move->m_ddir != 0) {
+		cfs_rstat_account(fs, move->m_ddir, true, false, &delta);
+	}
+
+	delta.d_bytes = -delta.d_bytes;
+	delta.d_files = -delta.d_files;
+	delta.d_subdirs = -delta.d_subdirs;
+	cfs_rstat_account(fs, move->m_sdir, true, false, &delta);
+}
+
+int cfs_get_rstat(struct cfs_fs *fs, const cfs_ino_t *dir,
+		  struct cfs_rstat *rstat)
+{
+	int rc;
+	struct stat stat;
+
+	dassert(fs && dir && rstat);
+
+	RC_WRAP_LABEL(rc, out, cfs_rstat_flush, fs);
+
+	rc = cfs_rstat_load(fs, dir, rstat);
+	if (rc != -ENOENT) {
+		goto out;
+	}
+
+	/* Nothing has been accounted in it, if it is a directory */
+	RC_WRAP_LABEL(rc, out, cfs_getattr_ino, fs, dir, &stat);
+	if (!S_ISDIR(stat.st_mode)) {
+		rc = -ENOTDIR;
+		goto out;
+	}
+
+	memset(rstat, 0, sizeof(*rstat));
+
+out:
+	log_debug("fs=%p dir=%llu rc=%d", fs, *dir, rc);
+	return rc;
+}
+
+static void *cfs_rstat_thread(void *arg)
+{
+	int rc;
+	struct timespec ts;
+	struct cfs_fs *fs;
+	struct cfs_rstat_entry *entry;
+
+	(void) arg;
+
+	pthread_mutex_lock(&g_rstat.lock);
+	while (!g_rstat.stop) {
+		if (g_rstat.npending <= CFS_RSTAT_PENDING_MAX) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += g_rstat.flush_ms / 1000;
+			ts.tv_nsec += (g_rstat.flush_ms % 1000) * 1000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&g_rstat.work, &g_rstat.lock,
+					       &ts);
+		}
+
+		/* One flush per filesystem, a failed one waits for
+		 * the next round.
+		 */
+		rc = 0;
+		while (rc == 0 && !g_rstat.stop &&
+		       (entry = TAILQ_FIRST(&g_rstat.pending)) != NULL) {
+			fs = entry->e_fs;
+			pthread_mutex_unlock(&g_rstat.lock);
+
+			pthread_mutex_lock(&g_rstat.flush_lock);
+			rc = cfs_rstat_flush_locked(fs);
+			pthread_mutex_unlock(&g_rstat.flush_lock);
+
+			pthread_mutex_lock(&g_rstat.lock);
+		}
+	}
+	pthread_mutex_unlock(&g_rstat.lock);
+
+	return NULL;
+}
+
+/* Drop the pending deltas of a filesystem (of all of them if fs is NULL).
+ * The caller must hold the lock.
+ */
+static void cfs_rstat_purge(const struct cfs_fs *fs)
+{
+	struct cfs_rstat_entry *entry;
+	struct cfs_rstat_entry *next;
+
+	TAILQ_FOREACH_SAFE(entry, &g_rstat.pending, e_link, next) {
+		if (fs != NULL && entry->e_fs != fs) {
+			continue;
+		}
+
+		LIST_REMOVE(entry, e_hash);
+		TAILQ_REMOVE(&g_rstat.pending, entry, e_link);
+		g_rstat.npending--;
+		kvs_free(kvstore_get(), entry);
+	}
+}
+
+void cfs_rstat_evict_fs(struct cfs_fs *cfs_fs)
+{
+	(void) cfs_rstat_flush(cfs_fs);
+
+	pthread_mutex_lock(&g_rstat.lock);
+	/* Whatever could not be stored is lost */
+	cfs_rstat_purge(cfs_fs);
+	pthread_mutex_unlock(&g_rstat.lock);
+}
+
+int cfs_rstat_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "rstat_flush_ms", CFS_RSTAT_FLUSH_MS_DEFAULT,
+		      &g_rstat.flush_ms);
+
+	for (i = 0; i < CFS_RSTAT_BUCKETS; i++) {
+		LIST_INIT(&g_rstat.buckets[i]);
+	}
+
+	g_rstat.stop = false;
+
+	if (g_rstat.flush_ms == 0) {
+		/* Flushed by the readers only */
+		goto out;
+	}
+
+	rc = -pthread_create(&g_rstat.thread, NULL, cfs_rstat_thread, NULL);
+	if (rc != 0) {
+		log_err("Failed to start the rstat thread, rc=%d", rc);
+		goto out;
+	}
+
+	g_rstat.running = true;
+
+out:
+	log_info("rstat: flush_ms=%llu running=%d rc=%d",
+		 (unsigned long long) g_rstat.flush_ms,
+		 (int) g_rstat.running, rc);
+	return rc;
+}
+
+void cfs_rstat_fini(void)
+{
+	if (g_rstat.running) {
+		pthread_mutex_lock(&g_rstat.lock);
+		g_rstat.stop = true;
+		pthread_cond_broadcast(&g_rstat.work);
+		pthread_mutex_unlock(&g_rstat.lock);
+
+		pthread_join(g_rstat.thread, NULL);
+		g_rstat.running = false;
+	}
+
+	pthread_mutex_lock(&g_rstat.lock);
+	/* The filesystems have been flushed when they were unloaded */
+	cfs_rstat_purge(NULL);
+	log_info("rstat: flushes=%llu failed=%llu",
+		 (unsigned long long) g_rstat.nflushes,
+		 (unsigned long long) g_rstat.nfailed);
+	g_rstat.nflushes = 0;
+	g_rstat.nfailed = 0;
+	pthread_mutex_unlock(&g_rstat.lock);
+}
@@ -0,0 +1,604 @@
+/*
+ * Filename: cortxfs_sindex.c
+ * Description: CORTXFS secondary indexes of the inode attributes.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Stat indexes.
+ * -------------
+ *
+ * An index of an attribute (enum cfs_query_key) is a set of
+ * CFS_KEY_TYPE_SINDEX keys (key, value, ino) in the index of the
+ * filesystem, the value is a placeholder. The KVS compares the keys as byte
+ * strings, so that the values and the inodes are stored big-endian: the
+ * entries of an attribute are sorted by value, and a range of values is
+ * a range of keys.
+ *
+ * Every indexed inode also has a CFS_KEY_TYPE_SINDEX record under its own
+ * FID with the values it is indexed by. cfs_set_stat() compares the new stat
+ * with the record and replaces only the entries which have changed; it is
+ * done within the transaction which stores the stat, if there is one.
+ * cfs_del_stat() removes the entries and the record.
+ *
+ * The KVS iterator only knows prefixes, cfs_query() iterates over the
+ * leading bytes that min and max have in common, skips the values below
+ * min and stops at the first value above max.
+ *
+ * "stat_index" in the "cortxfs" section of the config file is the bitmap
+ * of the enabled indexes (1 mtime, 2 size, 4 uid), 0 disables them. An
+ * index enabled on an existing filesystem is filled by cfs_query_rebuild().
+ *
+ * A filesystem loaded with an index enabled is marked as indexed
+ * (CFS_SYS_ATTR_SINDEXED of its root), for good: the entries of its inodes
+ * are removed along with them even once the indexes are disabled. The
+ * removal of an inode of a filesystem which has never been indexed does not
+ * look up its record.
+ */
+
+#include <errno.h> /* EOPNOTSUPP */
+#include <endian.h> /* htobe64() */
+#include <stddef.h> /* offsetof() */
+#include <pthread.h> /* pthread_mutex_t */
+#include <stdlib.h> /* free() */
+#include <string.h> /* memset() */
+#include <sys/queue.h> /* LIST_* */
+#include <kvstore.h> /* kvs_get() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include "cortxfs.h"
+#include "cortxfs_internal.h"
+#include "kvtree.h" /* struct kvtree */
+#include <internal/fs.h> /* cfs_sindex_load */
+
+#define CFS_SINDEX_MASK ((1ULL << CFS_QUERY_NR) - 1)
+/* Locks of the records, an inode uses the lock (ino % CFS_SINDEX_LOCKS) */
+#define CFS_SINDEX_LOCKS 64
+
+/* An entry of an index. The FID is zero so that the entries do not mix
+ * with the records of the inodes.
+ */
+struct cfs_sindex_key {
+	cfs_fid_t fid;
+	cfs_key_md_t md;
+	uint8_t key;
+	/* Big-endian */
+	uint64_t value;
+	/* Big-endian */
+	uint64_t ino;
+} __attribute__((packed));
+
+#define CFS_SINDEX_KEY_PREFIX_LEN offsetof(struct cfs_sindex_key, value)
+
+/* The values an inode is indexed by */
+struct cfs_sindex_rec {
+	/* Indexes the inode is in */
+	uint64_t mask;
+	uint64_t values[CFS_QUERY_NR];
+} __attribute__((packed));
+
+/* A loaded filesystem which has been indexed */
+struct cfs_sindex_fs {
+	LIST_ENTRY(cfs_sindex_fs) sf_link;
+	const struct cfs_fs *sf_fs;
+};
+
+LIST_HEAD(cfs_sindex_fs_list, cfs_sindex_fs);
+
+struct cfs_sindex {
+	/* Enabled indexes */
+	uint64_t mask;
+	/* The read-modify-write of a record is not left to the transaction:
+	 * the stats of an inode can be stored concurrently outside of any
+	 * transaction (FH flush).
+	 */
+	pthread_mutex_t locks[CFS_SINDEX_LOCKS];
+	pthread_rwlock_t fs_lock;
+	struct cfs_sindex_fs_list fs_list;
+	/* Atomic, the length of fs_list, read without the lock */
+	uint32_t nindexed;
+	bool initialized;
+};
+
+static struct cfs_sindex g_sindex;
+
+static inline void cfs_sindex_key_init(struct cfs_sindex_key *key,
+				       enum cfs_query_key query_key,
+				       uint64_t value, cfs_ino_t ino)
+{
+	memset(key, 0, sizeof(*key));
+	key->md.type = CFS_KEY_TYPE_SINDEX;
+	key->md.version = CFS_VERSION_0;
+	key->key = query_key;
+	key->value = htobe64(value);
+	key->ino = htobe64(ino);
+}
+
+static inline void cfs_sindex_rec_key_init(struct cfs_inode_attr_key *key,
+					   const cfs_ino_t *ino)
+{
+	memset(key, 0, sizeof(*key));
+	key->fid.f_hi = *ino;
+	key->md.type = CFS_KEY_TYPE_SINDEX;
+	key->md.version = CFS_VERSION_0;
+}
+
+static inline pthread_mutex_t *cfs_sindex_lock(cfs_ino_t ino)
+{
+	return &g_sindex.locks[ino % CFS_SINDEX_LOCKS];
+}
+
+static void cfs_sindex_values(const struct stat *stat, uint64_t *values)
+{
+	values[CFS_QUERY_MTIME] = stat->st_mtim.tv_sec;
+	values[CFS_QUERY_SIZE] = stat->st_size;
+	values[CFS_QUERY_UID] = stat->st_uid;
+}
+
+/* Whether the inodes of a filesystem may have index entries */
+static bool cfs_sindex_tree_indexed(const struct kvtree *tree)
+{
+	bool indexed = false;
+	struct cfs_sindex_fs *entry;
+
+	if (g_sindex.mask != 0) {
+		/* Every loaded filesystem is marked */
+		return true;
+	}
+
+	if (__atomic_load_n(&g_sindex.nindexed, __ATOMIC_RELAXED) == 0) {
+		return false;
+	}
+
+	pthread_rwlock_rdlock(&g_sindex.fs_lock);
+	LIST_FOREACH(entry, &g_sindex.fs_list, sf_link) {
+		if (entry->sf_fs->kvtree == tree) {
+			indexed = true;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&g_sindex.fs_lock);
+
+	return indexed;
+}
+
+/* A missing record is an inode which is not indexed */
+static int cfs_sindex_rec_get(struct kvs_idx *index, const cfs_ino_t *ino,
+			      struct cfs_sindex_rec *rec)
+{
+	int rc;
+	size_t size = 0;
+	struct cfs_sindex_rec *value = NULL;
+	struct cfs_inode_attr_key key;
+	struct kvstore *kvstor = kvstore_get();
+
+	memset(rec, 0, sizeof(*rec));
+	cfs_sindex_rec_key_init(&key, ino);
+
+	rc = kvs_get(kvstor, index, &key, sizeof(key), (void **) &value,
+		     &size);
+	if (rc == -ENOENT) {
+		rc = 0;
+		goto out;
+	}
+
+	if (rc != 0) {
+		goto out;
+	}
+
+	if (size != sizeof(*value)) {
+		rc = -EINVAL;
+	} else {
+		*rec = *value;
+	}
+	kvs_free(kvstor, value);
+
+out:
+	return rc;
+}
+
+static int cfs_sindex_entry_set(struct kvs_idx *index,
+				enum cfs_query_key query_key,
+				uint64_t value, cfs_ino_t ino)
+{
+	/* The key is the entry */
+	uint8_t none = 0;
+	struct cfs_sindex_key key;
+
+	cfs_sindex_key_init(&key, query_key, value, ino);
+
+	return kvs_set(kvstore_get(), index, &key, sizeof(key), &none,
+		       sizeof(none));
+}
+
+static int cfs_sindex_entry_del(struct kvs_idx *index,
+				enum cfs_query_key query_key,
+				uint64_t value, cfs_ino_t ino)
+{
+	int rc;
+	struct cfs_sindex_key key;
+
+	cfs_sindex_key_init(&key, query_key, value, ino);
+
+	rc = kvs_del(kvstore_get(), index, &key, sizeof(key));
+	if (rc == -ENOENT) {
+		/* Already gone, the record is the reference */
+		rc = 0;
+	}
+
+	return rc;
+}
+
+int cfs_sindex_update(struct kvtree *tree, const struct stat *stat)
+{
+	int rc = 0;
+	int k;
+	bool was;
+	bool is;
+	bool changed = false;
+	cfs_ino_t ino;
+	uint64_t values[CFS_QUERY_NR];
+	struct cfs_sindex_rec rec;
+	struct cfs_inode_attr_key key;
+	struct kvs_idx *index;
+
+	dassert(tree && stat);
+
+	if (g_sindex.mask == 0) {
+		goto out;
+	}
+
+	index = &tree->index;
+	ino = stat->st_ino;
+	cfs_sindex_values(stat, values);
+
+	pthread_mutex_lock(cfs_sindex_lock(ino));
+
+	RC_WRAP_LABEL(rc, unlock, cfs_sindex_rec_get, index, &ino, &rec);
+
+	for (k = 0; k < CFS_QUERY_NR; k++) {
+		was = (rec.mask & (1ULL << k)) != 0;
+		is = (g_sindex.mask & (1ULL << k)) != 0;
+
+		if (was && is && rec.values[k] == values[k]) {
+			continue;
+		}
+
+		if (was) {
+			RC_WRAP_LABEL(rc, unlock, cfs_sindex_entry_del, index,
+				      k, rec.values[k], ino);
+			changed = true;
+		}
+
+		if (is) {
+			RC_WRAP_LABEL(rc, unlock, cfs_sindex_entry_set, index,
+				      k, values[k], ino);
+			changed = true;
+		}
+	}
+
+	if (!changed) {
+		goto unlock;
+	}
+
+	rec.mask = g_sindex.mask;
+	memcpy(rec.values, values, sizeof(rec.values));
+	cfs_sindex_rec_key_init(&key, &ino);
+
+	RC_WRAP_LABEL(rc, unlock, kvs_set, kvstore_get(), index, &key,
+		      sizeof(key), &rec, sizeof(rec));
+
+unlock:
+	pthread_mutex_unlock(cfs_sindex_lock(ino));
+	log_trace("ino=%llu changed=%d rc=%d", ino, (int) changed, rc);
+out:
+	return rc;
+}
+
+int cfs_sindex_del(struct kvtree *tree, const cfs_ino_t *ino)
+{
+	int rc;
+	int k;
+	struct cfs_sindex_rec rec;
+	struct cfs_inode_attr_key key;
+	struct kvs_idx *index;
+
+	dassert(tree && ino);
+
+	/* Looked up even if the indexes are disabled: the entries of an inode
+	 * indexed before they were disabled must not outlive it.
+	 */
+	if (!cfs_sindex_tree_indexed(tree)) {
+		rc = 0;
+		goto out;
+	}
+
+	index = &tree->index;
+
+	pthread_mutex_lock(cfs_sindex_lock(*ino));
+
+	RC_WRAP_LABEL(rc, unlock, cfs_sindex_rec_get, index, ino, &rec);
+
+	if (rec.mask == 0) {
+		goto unlock;
+	}
+
+	for (k = 0; k < CFS_QUERY_NR; k++) {
+		if ((rec.mask & (1ULL << k)) == 0) {
+			continue;
+		}
+
+		RC_WRAP_LABEL(rc, unlock, cfs_sindex_entry_del, index, k,
+			      rec.values[k], *ino);
+	}
+
+	cfs_sindex_rec_key_init(&key, ino);
+
+	RC_WRAP_LABEL(rc, unlock, kvs_del, kvstore_get(), index, &key,
+		      sizeof(key));
+
+unlock:
+	pthread_mutex_unlock(cfs_sindex_lock(*ino));
+out:
+	log_trace("ino=%llu rc=%d", *ino, rc);
+	return rc;
+}
+
+int cfs_query(struct cfs_fs *cfs_fs, enum cfs_query_key key, uint64_t min,
+	      uint64_t max, cfs_query_cb_t cb, void *ctx)
+{
+	int rc;
+	size_t klen;
+	size_t vlen;
+	size_t prefix_len;
+	size_t i;
+	uint64_t value;
+	uint64_t nfound = 0;
+	void *key_buf;
+	void *val_buf;
+	cfs_ino_t ino;
+	struct cfs_sindex_key prefix;
+	struct cfs_sindex_key *entry;
+	struct kvs_itr *iter = NULL;
+	struct kvstore *kvstor = kvstore_get();
+	struct kvs_idx index;
+
+	dassert(cfs_fs && cb);
+
+	if (key < 0 || key >= CFS_QUERY_NR || min > max) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if ((g_sindex.mask & (1ULL << key)) == 0) {
+		rc = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* The stats written back lazily are indexed when they are stored */
+	cfs_fh_cache_flush_fs(cfs_fs);
+
+	index = cfs_fs->kvtree->index;
+
+	/* The values within [min, max] share the leading bytes min and max
+	 * have in common.
+	 */
+	cfs_sindex_key_init(&prefix, key, min, 0);
+	prefix_len = CFS_SINDEX_KEY_PREFIX_LEN;
+	for (i = 0; i < sizeof(uint64_t); i++) {
+		if (((min ^ max) >> (56 - 8 * i)) != 0) {
+			break;
+		}
+		prefix_len++;
+	}
+
+	rc = kvs_itr_find(kvstor, &index, &prefix, prefix_len, &iter);
+	while (rc == 0) {
+		kvs_itr_get(kvstor, iter, &key_buf, &klen, &val_buf, &vlen);
+		entry = key_buf;
+
+		if (klen != sizeof(*entry)) {
+			goto next;
+		}
+
+		value = be64toh(entry->value);
+		if (value < min) {
+			goto next;
+		}
+
+		if (value > max) {
+			break;
+		}
+
+		ino = be64toh(entry->ino);
+		nfound++;
+
+		rc = cb(ctx, &ino, value);
+		if (rc != 0) {
+			break;
+		}
+next:
+		rc = kvs_itr_next(kvstor, iter);
+	}
+
+	if (iter != NULL) {
+		kvs_itr_fini(kvstor, iter);
+	}
+
+	if (rc == -ENOENT || rc == CFS_QUERY_STOP) {
+		/* The end of the range */
+		rc = 0;
+	}
+
+out:
+	log_debug("cfs_fs=%p key=%d min=%llu max=%llu found=%llu rc=%d",
+		  cfs_fs, (int) key, (unsigned long long) min,
+		  (unsigned long long) max, (unsigned long long) nfound, rc);
+	return rc;
+}
+
+static int cfs_query_rebuild_cb(void *ctx, const cfs_ino_t *parent,
+				const char *name, const cfs_ino_t *ino,
+				const struct stat *stat)
+{
+	struct cfs_fs *cfs_fs = ctx;
+
+	/* A file with several links is visited once per link, the second
+	 * visit finds it up to date.
+	 */
+	return cfs_sindex_update(cfs_fs->kvtree, stat);
+}
+
+int cfs_query_rebuild(struct cfs_fs *cfs_fs, uint32_t nthreads)
+{
+	int rc;
+	cfs_ino_t root = CFS_ROOT_INODE;
+	struct stat stat;
+
+	dassert(cfs_fs);
+
+	if (g_sindex.mask == 0) {
+		rc = -EOPNOTSUPP;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_getattr_ino, cfs_fs, &root, &stat);
+	RC_WRAP_LABEL(rc, out, cfs_sindex_update, cfs_fs->kvtree, &stat);
+	RC_WRAP_LABEL(rc, out, cfs_walk, cfs_fs, &root, cfs_query_rebuild_cb,
+		      cfs_fs, nthreads);
+
+out:
+	log_info("cfs_fs=%p nthreads=%u rc=%d", cfs_fs, nthreads, rc);
+	return rc;
+}
+
+int cfs_sindex_load(struct cfs_fs *cfs_fs)
+{
+	int rc;
+	uint8_t raw = 1;
+	buff_t value;
+	buff_t stored;
+	struct cfs_sindex_fs *entry = NULL;
+
+	dassert(cfs_fs);
+
+	buff_init(&stored, NULL, 0);
+
+	rc = cfs_get_sysattr(cfs_fs->root_node, &stored,
+			     CFS_SYS_ATTR_SINDEXED);
+	if (rc == -ENOENT) {
+		if (g_sindex.mask == 0) {
+			/* Never indexed */
+			rc = 0;
+			goto out;
+		}
+
+		/* Any inode stored from now on may be indexed */
+		buff_init(&value, &raw, sizeof(raw));
+		RC_WRAP_LABEL(rc, out, cfs_set_sysattr, cfs_fs->root_node,
+			      value, CFS_SYS_ATTR_SINDEXED);
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &entry,
+		      sizeof(*entry));
+	entry->sf_fs = cfs_fs;
+
+	pthread_rwlock_wrlock(&g_sindex.fs_lock);
+	LIST_INSERT_HEAD(&g_sindex.fs_list, entry, sf_link);
+	__atomic_add_fetch(&g_sindex.nindexed, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&g_sindex.fs_lock);
+
+out:
+	if (stored.buf) {
+		free(stored.buf);
+	}
+	log_trace("cfs_fs=%p indexed=%d rc=%d", cfs_fs, (int) (entry != NULL),
+		  rc);
+	return rc;
+}
+
+void cfs_sindex_evict_fs(const struct cfs_fs *cfs_fs)
+{
+	struct cfs_sindex_fs *entry;
+
+	dassert(cfs_fs);
+
+	pthread_rwlock_wrlock(&g_sindex.fs_lock);
+	LIST_FOREACH(entry, &g_sindex.fs_list, sf_link) {
+		if (entry->sf_fs == cfs_fs) {
+			LIST_REMOVE(entry, sf_link);
+			__atomic_sub_fetch(&g_sindex.nindexed, 1,
+					   __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&g_sindex.fs_lock);
+
+	if (entry != NULL) {
+		kvs_free(kvstore_get(), entry);
+	}
+}
+
+int cfs_sindex_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "stat_index",
+		      0, &g_sindex.mask);
+
+	if ((g_sindex.mask & ~CFS_SINDEX_MASK) != 0) {
+		log_warn("Unknown indexes in cortxfs.stat_index=%llu",
+			 (unsigned long long) g_sindex.mask);
+		g_sindex.mask &= CFS_SINDEX_MASK;
+	}
+
+	for (i = 0; i < CFS_SINDEX_LOCKS; i++) {
+		pthread_mutex_init(&g_sindex.locks[i], NULL);
+	}
+
+	pthread_rwlock_init(&g_sindex.fs_lock, NULL);
+	LIST_INIT(&g_sindex.fs_list);
+	g_sindex.nindexed = 0;
+	g_sindex.initialized = true;
+
+out:
+	log_info("sindex: mask=%llu rc=%d",
+		 (unsigned long long) g_sindex.mask, rc);
+	return rc;
+}
+
+void cfs_sindex_fini(void)
+{
+	uint32_t i;
+
+	if (!g_sindex.initialized) {
+		return;
+	}
+
+	for (i = 0; i < CFS_SINDEX_LOCKS; i++) {
+		pthread_mutex_destroy(&g_sindex.locks[i]);
+	}
+
+	/* The filesystems are unloaded first */
+	dassert(LIST_EMPTY(&g_sindex.fs_list));
+	pthread_rwlock_destroy(&g_sindex.fs_lock);
+
+	g_sindex.mask = 0;
+	g_sindex.initialized = false;
+}
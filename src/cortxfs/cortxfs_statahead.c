@@ -0,0 +1,604 @@
+/*
+ * Filename: cortxfs_statahead.c
+ * Description: CORTXFS statahead of directory entries.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Statahead.
+ * ----------
+ *
+ * Tree walkers (find, rsync, du) list a directory and then look up its
+ * entries one by one in the listing order, so that every lookup waits for
+ * a KVS round trip. A listing of a directory (cfs_readdir() or a page of
+ * cfs_readdir_page()) arms statahead for the directory: the order of up to
+ * CFS_STATAHEAD_ARM_MAX entries after the read position is remembered, every
+ * following page replaces them. Once CFS_STATAHEAD_TRIGGER lookups in a row
+ * follow that order, the next "statahead_window" entries are queued for the
+ * statahead threads which load them into the FH cache; the window slides
+ * forward with every following lookup.
+ *
+ * Accounting:
+ *	issued - entries queued for prefetching;
+ *	used - prefetched entries which have been looked up afterwards;
+ *	wasted - prefetched entries which have not been looked up before
+ *	         the directory was dropped from statahead;
+ *	dropped - entries not queued because the queue was full.
+ *
+ * Every lookup goes through cfs_statahead_lookup(), so that it does not take
+ * any lock while no directory is armed, and the armed directories are spread
+ * over CFS_STATAHEAD_SHARDS shards by the hash of (fs, dir), each with its
+ * own lock and LRU list. The number of armed directories is bounded by
+ * CFS_STATAHEAD_DIRS. The queue of the statahead threads has its own lock,
+ * taken after the lock of a shard.
+ * "statahead_window" = 0 or "statahead_threads" = 0 in the "cortxfs" section
+ * of the config file disables statahead; it is also disabled when the FH
+ * cache is disabled since there is nowhere to prefetch to.
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <pthread.h> /* pthread_t */
+#include <stdlib.h> /* malloc() */
+#include <string.h> /* memcpy() */
+#include <sys/queue.h> /* TAILQ_*, STAILQ_* */
+#include <kvstore.h> /* kvs_alloc() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* TAILQ_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_statahead_evict_fs */
+
+#define CFS_STATAHEAD_WINDOW_DEFAULT 32
+#define CFS_STATAHEAD_THREADS_DEFAULT 2
+#define CFS_STATAHEAD_DIRS 64
+#define CFS_STATAHEAD_SHARDS 16
+#define CFS_STATAHEAD_SHARD_DIRS (CFS_STATAHEAD_DIRS / CFS_STATAHEAD_SHARDS)
+/* Number of lookups in the listing order which start prefetching */
+#define CFS_STATAHEAD_TRIGGER 2
+/* Max number of queued entries per statahead thread */
+#define CFS_STATAHEAD_QUEUE_PER_THREAD 1024
+
+struct cfs_statahead_dir {
+	TAILQ_ENTRY(cfs_statahead_dir) d_lru;
+	struct cfs_fs *d_fs;
+	cfs_ino_t d_dir;
+	uint32_t d_count;
+	cfs_ino_t *d_inos;
+	/* Position of the entry expected to be looked up next */
+	uint32_t d_next;
+	/* Number of lookups in the listing order in a row */
+	uint32_t d_streak;
+	/* Entries below this position have been queued */
+	uint32_t d_prefetched;
+	uint32_t d_issued;
+	uint32_t d_used;
+};
+
+struct cfs_statahead_job {
+	STAILQ_ENTRY(cfs_statahead_job) j_link;
+	struct cfs_fs *j_fs;
+	cfs_ino_t j_ino;
+};
+
+struct cfs_statahead_thread {
+	pthread_t t_thread;
+	/* Filesystem of the job being executed, NULL if idle */
+	const struct cfs_fs *t_fs;
+};
+
+struct cfs_statahead_shard {
+	pthread_mutex_t lock;
+	TAILQ_HEAD(cfs_statahead_lru, cfs_statahead_dir) dirs;
+	uint32_t ndirs;
+};
+
+struct cfs_statahead {
+	/* Protects the jobs and the threads */
+	pthread_mutex_t lock;
+	/* Signaled when a job is queued or on stop */
+	pthread_cond_t work;
+	/* Signaled when a thread finishes a job */
+	pthread_cond_t idle;
+	struct cfs_statahead_shard shards[CFS_STATAHEAD_SHARDS];
+	/* Number of armed directories, read without a lock by the lookups */
+	uint32_t narmed;
+	STAILQ_HEAD(cfs_statahead_queue, cfs_statahead_job) jobs;
+	uint32_t njobs;
+	uint32_t max_jobs;
+	uint32_t window;
+	uint32_t nthreads;
+	struct cfs_statahead_thread *threads;
+	bool enabled;
+	bool stop;
+	uint64_t issued;
+	uint64_t used;
+	uint64_t wasted;
+	uint64_t dropped;
+};
+
+static struct cfs_statahead g_statahead = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+	.jobs = STAILQ_HEAD_INITIALIZER(g_statahead.jobs),
+};
+
+static inline struct cfs_statahead_shard *cfs_statahead_shard(
+	const struct cfs_fs *fs, cfs_ino_t ino)
+{
+	uint64_t hash = ino ^ ((uintptr_t) fs >> 4);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return &g_statahead.shards[hash % CFS_STATAHEAD_SHARDS];
+}
+
+/* Unlink and free an armed directory. The caller must hold the lock of
+ * the shard.
+ */
+static void cfs_statahead_dir_drop(struct cfs_statahead_shard *shard,
+				   struct cfs_statahead_dir *dir)
+{
+	TAILQ_REMOVE(&shard->dirs, dir, d_lru);
+	shard->ndirs--;
+	__atomic_sub_fetch(&g_statahead.narmed, 1, __ATOMIC_RELAXED);
+
+	dassert(dir->d_issued >= dir->d_used);
+	__atomic_add_fetch(&g_statahead.wasted, dir->d_issued - dir->d_used,
+			   __ATOMIC_RELAXED);
+
+	free(dir->d_inos);
+	kvs_free(kvstore_get(), dir);
+}
+
+/* Find an armed directory. The caller must hold the lock of the shard. */
+static struct cfs_statahead_dir *cfs_statahead_dir_find(
+	struct cfs_statahead_shard *shard, const struct cfs_fs *fs,
+	cfs_ino_t ino)
+{
+	struct cfs_statahead_dir *dir;
+
+	TAILQ_FOREACH(dir, &shard->dirs, d_lru) {
+		if (dir->d_dir == ino && dir->d_fs == fs) {
+			break;
+		}
+	}
+
+	return dir;
+}
+
+void cfs_statahead_arm(struct cfs_fs *fs, cfs_ino_t ino,
+		       const cfs_ino_t *inos, uint32_t count, bool restart)
+{
+	int rc = 0;
+	cfs_ino_t *window = NULL;
+	struct cfs_statahead_dir *dir = NULL;
+	struct cfs_statahead_dir *old;
+	struct cfs_statahead_shard *shard = cfs_statahead_shard(fs, ino);
+
+	if (!g_statahead.enabled || count == 0 ||
+	    (restart && count < CFS_STATAHEAD_TRIGGER)) {
+		goto out;
+	}
+
+	if (count > CFS_STATAHEAD_ARM_MAX) {
+		count = CFS_STATAHEAD_ARM_MAX;
+	}
+
+	window = malloc(count * sizeof(*inos));
+	if (window == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	memcpy(window, inos, count * sizeof(*inos));
+
+	RC_WRAP_LABEL(rc, out, kvs_alloc, kvstore_get(), (void **) &dir,
+		      sizeof(*dir));
+	memset(dir, 0, sizeof(*dir));
+	dir->d_fs = fs;
+	dir->d_dir = ino;
+
+	pthread_mutex_lock(&shard->lock);
+
+	old = cfs_statahead_dir_find(shard, fs, ino);
+	if (old != NULL && !restart) {
+		/* The next page of a listing keeps the detection going */
+		TAILQ_REMOVE(&shard->dirs, old, d_lru);
+		TAILQ_INSERT_TAIL(&shard->dirs, old, d_lru);
+		free(old->d_inos);
+		old->d_inos = window;
+		old->d_count = count;
+		old->d_next = 0;
+		old->d_prefetched = 0;
+		window = NULL;
+		pthread_mutex_unlock(&shard->lock);
+		goto out;
+	}
+
+	/* A new listing restarts the detection */
+	if (old != NULL) {
+		cfs_statahead_dir_drop(shard, old);
+	}
+
+	dir->d_inos = window;
+	dir->d_count = count;
+	window = NULL;
+
+	TAILQ_INSERT_TAIL(&shard->dirs, dir, d_lru);
+	shard->ndirs++;
+	__atomic_add_fetch(&g_statahead.narmed, 1, __ATOMIC_RELAXED);
+
+	while (shard->ndirs > CFS_STATAHEAD_SHARD_DIRS) {
+		cfs_statahead_dir_drop(shard, TAILQ_FIRST(&shard->dirs));
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+	dir = NULL;
+
+out:
+	if (dir != NULL) {
+		kvs_free(kvstore_get(), dir);
+	}
+	free(window);
+	log_trace("fs=%p dir=%llu count=%u restart=%d rc=%d", fs, ino, count,
+		  (int) restart, rc);
+}
+
+/* Queue the entries of the directory up to the end of the window.
+ * The caller must hold the lock of the shard.
+ */
+static void cfs_statahead_dir_advance(struct cfs_statahead_dir *dir)
+{
+	int rc;
+	uint32_t i;
+	uint32_t end;
+	uint32_t queued = 0;
+	struct cfs_statahead_job *job;
+
+	end = dir->d_next + g_statahead.window;
+	if (end > dir->d_count) {
+		end = dir->d_count;
+	}
+
+	i = dir->d_prefetched > dir->d_next ? dir->d_prefetched : dir->d_next;
+
+	pthread_mutex_lock(&g_statahead.lock);
+	for (; i < end; i++) {
+		if (g_statahead.njobs >= g_statahead.max_jobs) {
+			g_statahead.dropped += end - i;
+			break;
+		}
+
+		rc = kvs_alloc(kvstore_get(), (void **) &job, sizeof(*job));
+		if (rc != 0) {
+			break;
+		}
+
+		job->j_fs = dir->d_fs;
+		job->j_ino = dir->d_inos[i];
+		STAILQ_INSERT_TAIL(&g_statahead.jobs, job, j_link);
+		g_statahead.njobs++;
+		queued++;
+	}
+
+	/* Entries which have not been queued are not retried */
+	if (dir->d_prefetched < end) {
+		dir->d_prefetched = end;
+	}
+	dir->d_issued += queued;
+	g_statahead.issued += queued;
+
+	if (queued != 0) {
+		pthread_cond_broadcast(&g_statahead.work);
+	}
+	pthread_mutex_unlock(&g_statahead.lock);
+}
+
+void cfs_statahead_lookup(struct cfs_fs *fs, cfs_ino_t ino, cfs_ino_t child)
+{
+	uint32_t i;
+	uint32_t end;
+	struct cfs_statahead_dir *dir;
+	struct cfs_statahead_shard *shard;
+
+	if (!g_statahead.enabled ||
+	    __atomic_load_n(&g_statahead.narmed, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	shard = cfs_statahead_shard(fs, ino);
+	pthread_mutex_lock(&shard->lock);
+
+	dir = cfs_statahead_dir_find(shard, fs, ino);
+	if (dir == NULL) {
+		goto out;
+	}
+
+	/* The walker could skip a few entries (already known, filtered out),
+	 * so that the entry is searched for within the window.
+	 */
+	end = dir->d_next + g_statahead.window;
+	if (end > dir->d_count) {
+		end = dir->d_count;
+	}
+
+	for (i = dir->d_next; i < end; i++) {
+		if (dir->d_inos[i] == child) {
+			break;
+		}
+	}
+
+	if (i == end) {
+		dir->d_streak = 0;
+		goto out;
+	}
+
+	if (i < dir->d_prefetched) {
+		dir->d_used++;
+		__atomic_add_fetch(&g_statahead.used, 1, __ATOMIC_RELAXED);
+	}
+
+	dir->d_next = i + 1;
+	dir->d_streak++;
+
+	TAILQ_REMOVE(&shard->dirs, dir, d_lru);
+	TAILQ_INSERT_TAIL(&shard->dirs, dir, d_lru);
+
+	if (dir->d_next == dir->d_count) {
+		/* The walk of the window is over */
+		cfs_statahead_dir_drop(shard, dir);
+		goto out;
+	}
+
+	if (dir->d_streak >= CFS_STATAHEAD_TRIGGER) {
+		cfs_statahead_dir_advance(dir);
+	}
+
+out:
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static void *cfs_statahead_thread(void *arg)
+{
+	int rc;
+	struct cfs_fh *fh;
+	struct cfs_statahead_job *job;
+	struct cfs_statahead_thread *self = arg;
+
+	pthread_mutex_lock(&g_statahead.lock);
+	while (!g_statahead.stop) {
+		job = STAILQ_FIRST(&g_statahead.jobs);
+		if (job == NULL) {
+			pthread_cond_wait(&g_statahead.work, &g_statahead.lock);
+			continue;
+		}
+
+		STAILQ_REMOVE_HEAD(&g_statahead.jobs, j_link);
+		g_statahead.njobs--;
+		self->t_fs = job->j_fs;
+		pthread_mutex_unlock(&g_statahead.lock);
+
+		/* The FH stays in the FH cache after it is released */
+		rc = cfs_fh_from_ino(job->j_fs, &job->j_ino, &fh);
+		if (rc == 0) {
+			cfs_fh_destroy(fh);
+		}
+		log_trace("fs=%p ino=%llu rc=%d", job->j_fs, job->j_ino, rc);
+		kvs_free(kvstore_get(), job);
+
+		pthread_mutex_lock(&g_statahead.lock);
+		self->t_fs = NULL;
+		pthread_cond_broadcast(&g_statahead.idle);
+	}
+	pthread_mutex_unlock(&g_statahead.lock);
+
+	return NULL;
+}
+
+/* Drop the armed directories of the given filesystem (or of all
+ * filesystems if fs is NULL).
+ */
+static void cfs_statahead_purge_dirs(const struct cfs_fs *fs)
+{
+	uint32_t i;
+	struct cfs_statahead_dir *dir;
+	struct cfs_statahead_dir *next;
+	struct cfs_statahead_shard *shard;
+
+	for (i = 0; i < CFS_STATAHEAD_SHARDS; i++) {
+		shard = &g_statahead.shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		TAILQ_FOREACH_SAFE(dir, &shard->dirs, d_lru, next) {
+			if (fs == NULL || dir->d_fs == fs) {
+				cfs_statahead_dir_drop(shard, dir);
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/* Drop the queued jobs of the given filesystem (or of all filesystems if fs
+ * is NULL). The caller must hold the lock.
+ */
+static void cfs_statahead_purge_jobs(const struct cfs_fs *fs)
+{
+	struct cfs_statahead_job *job;
+	struct cfs_statahead_queue keep = STAILQ_HEAD_INITIALIZER(keep);
+
+	while ((job = STAILQ_FIRST(&g_statahead.jobs)) != NULL) {
+		STAILQ_REMOVE_HEAD(&g_statahead.jobs, j_link);
+
+		if (fs != NULL && job->j_fs != fs) {
+			STAILQ_INSERT_TAIL(&keep, job, j_link);
+			continue;
+		}
+
+		g_statahead.njobs--;
+		kvs_free(kvstore_get(), job);
+	}
+
+	STAILQ_CONCAT(&g_statahead.jobs, &keep);
+}
+
+static bool cfs_statahead_busy(const struct cfs_fs *fs)
+{
+	uint32_t i;
+
+	for (i = 0; i < g_statahead.nthreads; i++) {
+		if (g_statahead.threads[i].t_fs == fs) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void cfs_statahead_evict_fs(const struct cfs_fs *fs)
+{
+	dassert(fs);
+
+	if (!g_statahead.enabled) {
+		return;
+	}
+
+	cfs_statahead_purge_dirs(fs);
+
+	pthread_mutex_lock(&g_statahead.lock);
+	cfs_statahead_purge_jobs(fs);
+	/* Wait for the loads which are in flight */
+	while (cfs_statahead_busy(fs)) {
+		pthread_cond_wait(&g_statahead.idle, &g_statahead.lock);
+	}
+	pthread_mutex_unlock(&g_statahead.lock);
+}
+
+static void cfs_statahead_stop(uint32_t nthreads)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&g_statahead.lock);
+	g_statahead.stop = true;
+	pthread_cond_broadcast(&g_statahead.work);
+	pthread_mutex_unlock(&g_statahead.lock);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(g_statahead.threads[i].t_thread, NULL);
+	}
+
+	free(g_statahead.threads);
+	g_statahead.threads = NULL;
+	g_statahead.nthreads = 0;
+}
+
+int cfs_statahead_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+	uint64_t window;
+	uint64_t nthreads;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "statahead_window", CFS_STATAHEAD_WINDOW_DEFAULT,
+		      &window);
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items,
+		      "statahead_threads", CFS_STATAHEAD_THREADS_DEFAULT,
+		      &nthreads);
+
+	for (i = 0; i < CFS_STATAHEAD_SHARDS; i++) {
+		pthread_mutex_init(&g_statahead.shards[i].lock, NULL);
+		TAILQ_INIT(&g_statahead.shards[i].dirs);
+		g_statahead.shards[i].ndirs = 0;
+	}
+
+	g_statahead.narmed = 0;
+	g_statahead.window = window;
+	g_statahead.issued = g_statahead.used = 0;
+	g_statahead.wasted = g_statahead.dropped = 0;
+	g_statahead.stop = false;
+
+	if (window == 0 || nthreads == 0 || !cfs_fh_cache_enabled()) {
+		goto out;
+	}
+
+	g_statahead.threads = calloc(nthreads, sizeof(*g_statahead.threads));
+	if (g_statahead.threads == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	g_statahead.max_jobs = nthreads * CFS_STATAHEAD_QUEUE_PER_THREAD;
+	g_statahead.nthreads = nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		rc = -pthread_create(&g_statahead.threads[i].t_thread, NULL,
+				     cfs_statahead_thread,
+				     &g_statahead.threads[i]);
+		if (rc != 0) {
+			log_err("Failed to start a statahead thread, rc=%d",
+				rc);
+			cfs_statahead_stop(i);
+			goto out;
+		}
+	}
+
+	g_statahead.enabled = true;
+
+out:
+	log_info("statahead: window=%u threads=%u enabled=%d rc=%d",
+		 g_statahead.window, g_statahead.nthreads,
+		 (int) g_statahead.enabled, rc);
+	return rc;
+}
+
+bool cfs_statahead_stats(uint64_t *issued, uint64_t *used)
+{
+	dassert(issued && used);
+
+	pthread_mutex_lock(&g_statahead.lock);
+	*issued = g_statahead.issued;
+	pthread_mutex_unlock(&g_statahead.lock);
+
+	*used = __atomic_load_n(&g_statahead.used, __ATOMIC_RELAXED);
+
+	return g_statahead.enabled;
+}
+
+void cfs_statahead_fini(void)
+{
+	if (!g_statahead.enabled) {
+		return;
+	}
+
+	g_statahead.enabled = false;
+	cfs_statahead_stop(g_statahead.nthreads);
+
+	cfs_statahead_purge_dirs(NULL);
+
+	pthread_mutex_lock(&g_statahead.lock);
+	cfs_statahead_purge_jobs(NULL);
+	pthread_mutex_unlock(&g_statahead.lock);
+
+	log_info("statahead: issued=%llu used=%llu wasted=%llu dropped=%llu",
+		 (unsigned long long) g_statahead.issued,
+		 (unsigned long long) g_statahead.used,
+		 (unsigned long long) g_statahead.wasted,
+		 (unsigned long long) g_statahead.dropped);
+}
@@ -0,0 +1,427 @@
+/*
+ * Filename: cortxfs_walk.c
+ * Description: CORTXFS parallel namespace walker.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Parallel walk.
+ * --------------
+ *
+ * Every thread of a walk owns a deque of directories to be walked. A thread
+ * lists a directory with kvtree_iter_children(), calls the visitor for every
+ * entry and pushes the subdirectories to the tail of its own deque. It takes
+ * the next directory from the tail of its deque (depth first, the deque stays
+ * short) and, when the deque is empty, steals one from the head of the deque
+ * of another thread (the oldest entry, the closest to the root, which is
+ * likely the biggest subtree). Threads which have found nothing to steal
+ * sleep until a directory is pushed.
+ *
+ * The walk is over when no directory is queued or being walked (w_pending).
+ * A directory is counted before it is pushed, so that the counter cannot
+ * drop to zero while the directory which has pushed it is being walked.
+ *
+ * The attributes of an entry are taken from the FH cache (a cached stat could
+ * be newer than the stored one), then from the node given by the iteration
+ * and, if it does not carry them, from the storage.
+ */
+
+#include <errno.h> /* ENOMEM */
+#include <pthread.h> /* pthread_t */
+#include <stdlib.h> /* calloc() */
+#include <string.h> /* memcpy() */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include "cortxfs.h"
+#include "cortxfs_fh.h"
+#include "cortxfs_internal.h"
+#include "kvtree.h" /* kvtree_iter_children() */
+
+#define CFS_WALK_DEQUE_GROW 64
+
+struct cfs_walk_deque {
+	pthread_mutex_t q_lock;
+	cfs_ino_t *q_dirs;
+	/* Other threads steal from the head */
+	uint32_t q_head;
+	/* The owner pushes to and pops from the tail */
+	uint32_t q_tail;
+	uint32_t q_size;
+};
+
+struct cfs_walk;
+
+struct cfs_walk_thread {
+	pthread_t t_thread;
+	struct cfs_walk *t_walk;
+	uint32_t t_id;
+	struct cfs_walk_deque t_deque;
+	uint64_t t_dirs;
+	uint64_t t_entries;
+	uint64_t t_steals;
+};
+
+struct cfs_walk {
+	struct cfs_fs *w_fs;
+	cfs_walk_cb_t w_visitor;
+	void *w_ctx;
+	uint32_t w_nthreads;
+	struct cfs_walk_thread *w_threads;
+	pthread_mutex_t w_lock;
+	/* Signaled when a directory is pushed or the walk is over */
+	pthread_cond_t w_cond;
+	/* Directories queued or being walked */
+	uint64_t w_pending;
+	/* Incremented on every push, tells a thread which is about to sleep
+	 * that a directory has been pushed since it looked for one.
+	 */
+	uint64_t w_gen;
+	uint32_t w_idle;
+	int w_rc;
+	bool w_stop;
+};
+
+static int cfs_walk_push(struct cfs_walk_thread *self, cfs_ino_t dir)
+{
+	int rc = 0;
+	cfs_ino_t *dirs;
+	uint32_t size;
+	struct cfs_walk *walk = self->t_walk;
+	struct cfs_walk_deque *deque = &self->t_deque;
+
+	pthread_mutex_lock(&walk->w_lock);
+	walk->w_pending++;
+	pthread_mutex_unlock(&walk->w_lock);
+
+	pthread_mutex_lock(&deque->q_lock);
+	if (deque->q_tail == deque->q_size) {
+		if (deque->q_head != 0) {
+			/* Reuse the room left by the stolen directories */
+			memmove(deque->q_dirs, deque->q_dirs + deque->q_head,
+				(deque->q_tail - deque->q_head) *
+				sizeof(*dirs));
+			deque->q_tail -= deque->q_head;
+			deque->q_head = 0;
+		} else {
+			size = deque->q_size + CFS_WALK_DEQUE_GROW;
+			dirs = realloc(deque->q_dirs, size * sizeof(*dirs));
+			if (dirs == NULL) {
+				rc = -ENOMEM;
+				pthread_mutex_unlock(&deque->q_lock);
+				goto out;
+			}
+			deque->q_dirs = dirs;
+			deque->q_size = size;
+		}
+	}
+	deque->q_dirs[deque->q_tail++] = dir;
+	pthread_mutex_unlock(&deque->q_lock);
+
+out:
+	pthread_mutex_lock(&walk->w_lock);
+	if (rc == 0) {
+		walk->w_gen++;
+		if (walk->w_idle != 0) {
+			pthread_cond_signal(&walk->w_cond);
+		}
+	} else {
+		walk->w_pending--;
+	}
+	pthread_mutex_unlock(&walk->w_lock);
+
+	return rc;
+}
+
+static bool cfs_walk_pop(struct cfs_walk_thread *self, cfs_ino_t *dir)
+{
+	bool found = false;
+	struct cfs_walk_deque *deque = &self->t_deque;
+
+	pthread_mutex_lock(&deque->q_lock);
+	if (deque->q_tail != deque->q_head) {
+		*dir = deque->q_dirs[--deque->q_tail];
+		found = true;
+	}
+	if (deque->q_tail == deque->q_head) {
+		deque->q_head = deque->q_tail = 0;
+	}
+	pthread_mutex_unlock(&deque->q_lock);
+
+	return found;
+}
+
+static bool cfs_walk_steal(struct cfs_walk_thread *self, cfs_ino_t *dir)
+{
+	uint32_t i;
+	bool found = false;
+	struct cfs_walk *walk = self->t_walk;
+	struct cfs_walk_deque *deque;
+
+	for (i = 1; i < walk->w_nthreads && !found; i++) {
+		deque = &walk->w_threads[(self->t_id + i) %
+					 walk->w_nthreads].t_deque;
+
+		pthread_mutex_lock(&deque->q_lock);
+		if (deque->q_tail != deque->q_head) {
+			*dir = deque->q_dirs[deque->q_head++];
+			found = true;
+		}
+		pthread_mutex_unlock(&deque->q_lock);
+	}
+
+	if (found) {
+		self->t_steals++;
+	}
+
+	return found;
+}
+
+/* Get the attributes of an entry given by kvtree_iter_children() */
+static int cfs_walk_stat(struct cfs_fs *fs, const struct kvnode *node,
+			 const cfs_ino_t *ino, struct stat *bufstat)
+{
+	int rc;
+	uint16_t size;
+	struct stat *stat = NULL;
+	struct kvnode loaded = KVNODE_INIT_EMTPY;
+
+	if (cfs_fh_cached_stat(fs, ino, bufstat) == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	if (node->basic_attr != NULL) {
+		size = kvnode_get_basic_attr_buff(node, (void **)&stat);
+		if (stat != NULL && cfs_inode_rec_size_valid(size)) {
+			*bufstat = *stat;
+			rc = 0;
+			goto out;
+		}
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_kvnode_load, &loaded, fs->kvtree, ino);
+	RC_WRAP_LABEL(rc, fini, cfs_get_stat, &loaded, &stat);
+	*bufstat = *stat;
+
+fini:
+	kvnode_fini(&loaded);
+out:
+	return rc;
+}
+
+struct cfs_walk_dir_ctx {
+	struct cfs_walk_thread *self;
+	cfs_ino_t dir;
+	int rc;
+};
+
+static bool cfs_walk_dir_cb(void *cb_ctx, const char *name,
+			    const struct kvnode *node)
+{
+	int rc;
+	cfs_ino_t ino;
+	struct stat stat;
+	struct cfs_walk_dir_ctx *ctx = cb_ctx;
+	struct cfs_walk_thread *self = ctx->self;
+	struct cfs_walk *walk = self->t_walk;
+
+	node_id_to_ino(&node->node_id, &ino);
+
+	rc = cfs_walk_stat(walk->w_fs, node, &ino, &stat);
+	if (rc == -ENOENT) {
+		/* Removed while the directory is being walked */
+		rc = 0;
+		goto out;
+	} else if (rc != 0) {
+		goto out;
+	}
+
+	self->t_entries++;
+
+	rc = walk->w_visitor(walk->w_ctx, &ctx->dir, name, &ino, &stat);
+	if (rc < 0) {
+		goto out;
+	}
+
+	if (rc != CFS_WALK_SKIP && S_ISDIR(stat.st_mode)) {
+		rc = cfs_walk_push(self, ino);
+	} else {
+		rc = 0;
+	}
+
+out:
+	ctx->rc = rc;
+	return rc == 0;
+}
+
+static int cfs_walk_dir(struct cfs_walk_thread *self, cfs_ino_t dir)
+{
+	int rc;
+	node_id_t node_id;
+	struct cfs_walk *walk = self->t_walk;
+	struct cfs_walk_dir_ctx ctx = {
+		.self = self,
+		.dir = dir,
+		.rc = 0,
+	};
+
+	ino_to_node_id(&dir, &node_id);
+
+	RC_WRAP_LABEL(rc, out, kvtree_iter_children, walk->w_fs->kvtree,
+		      &node_id, cfs_walk_dir_cb, &ctx);
+	rc = ctx.rc;
+	self->t_dirs++;
+
+out:
+	log_trace("fs=%p dir=%llu rc=%d", walk->w_fs, dir, rc);
+	return rc;
+}
+
+static void *cfs_walk_thread(void *arg)
+{
+	int rc;
+	bool found;
+	uint64_t gen;
+	cfs_ino_t dir;
+	struct cfs_walk_thread *self = arg;
+	struct cfs_walk *walk = self->t_walk;
+
+	pthread_mutex_lock(&walk->w_lock);
+	gen = walk->w_gen;
+	while (walk->w_pending != 0 && !walk->w_stop) {
+		pthread_mutex_unlock(&walk->w_lock);
+
+		found = cfs_walk_pop(self, &dir) || cfs_walk_steal(self, &dir);
+		if (found) {
+			rc = cfs_walk_dir(self, dir);
+		}
+
+		pthread_mutex_lock(&walk->w_lock);
+		if (found) {
+			walk->w_pending--;
+			if (rc != 0 && walk->w_rc == 0) {
+				walk->w_rc = rc;
+				walk->w_stop = true;
+			}
+			if (walk->w_pending == 0 || walk->w_stop) {
+				pthread_cond_broadcast(&walk->w_cond);
+			}
+		} else if (gen == walk->w_gen) {
+			walk->w_idle++;
+			pthread_cond_wait(&walk->w_cond, &walk->w_lock);
+			walk->w_idle--;
+		}
+		gen = walk->w_gen;
+	}
+	pthread_mutex_unlock(&walk->w_lock);
+
+	return NULL;
+}
+
+int cfs_walk(struct cfs_fs *fs, const cfs_ino_t *root, cfs_walk_cb_t visitor,
+	     void *ctx, uint32_t nthreads)
+{
+	int rc;
+	uint32_t i;
+	uint32_t started = 1;
+	uint64_t dirs = 0;
+	uint64_t entries = 0;
+	uint64_t steals = 0;
+	struct cfs_fh *fh = NULL;
+	struct cfs_walk walk = {
+		.w_fs = fs,
+		.w_visitor = visitor,
+		.w_ctx = ctx,
+		.w_lock = PTHREAD_MUTEX_INITIALIZER,
+		.w_cond = PTHREAD_COND_INITIALIZER,
+	};
+
+	dassert(fs && root && visitor);
+
+	if (nthreads == 0) {
+		nthreads = 1;
+	}
+
+	if (nthreads > CFS_WALK_THREADS_MAX) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	RC_WRAP_LABEL(rc, out, cfs_fh_from_ino, fs, root, &fh);
+	if (!S_ISDIR(cfs_fh_stat(fh)->st_mode)) {
+		rc = -ENOTDIR;
+		goto out;
+	}
+
+	walk.w_threads = calloc(nthreads, sizeof(*walk.w_threads));
+	if (walk.w_threads == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Set once, before any thread starts. The deque of a thread which
+	 * fails to start stays empty, the steals only skip it.
+	 */
+	walk.w_nthreads = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		walk.w_threads[i].t_walk = &walk;
+		walk.w_threads[i].t_id = i;
+		pthread_mutex_init(&walk.w_threads[i].t_deque.q_lock, NULL);
+	}
+
+	RC_WRAP_LABEL(rc, free_threads, cfs_walk_push, &walk.w_threads[0],
+		      *root);
+
+	/* The calling thread is the thread 0 of the walk */
+	for (; started < nthreads; started++) {
+		rc = -pthread_create(&walk.w_threads[started].t_thread, NULL,
+				     cfs_walk_thread, &walk.w_threads[started]);
+		if (rc != 0) {
+			log_warn("Failed to start a walk thread, rc=%d", rc);
+			rc = 0;
+			break;
+		}
+	}
+
+	cfs_walk_thread(&walk.w_threads[0]);
+
+	for (i = 1; i < started; i++) {
+		pthread_join(walk.w_threads[i].t_thread, NULL);
+	}
+
+	rc = walk.w_rc;
+
+free_threads:
+	for (i = 0; i < nthreads; i++) {
+		dirs += walk.w_threads[i].t_dirs;
+		entries += walk.w_threads[i].t_entries;
+		steals += walk.w_threads[i].t_steals;
+		free(walk.w_threads[i].t_deque.q_dirs);
+		pthread_mutex_destroy(&walk.w_threads[i].t_deque.q_lock);
+	}
+	free(walk.w_threads);
+
+out:
+	if (fh != NULL) {
+		cfs_fh_destroy(fh);
+	}
+
+	log_debug("fs=%p root=%llu threads=%u dirs=%llu entries=%llu"
+		  " steals=%llu rc=%d", fs, *root, started,
+		  (unsigned long long) dirs, (unsigned long long) entries,
+		  (unsigned long long) steals, rc);
+	return rc;
+}
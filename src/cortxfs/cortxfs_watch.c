@@ -0,0 +1,393 @@
+/*
+ * Filename: cortxfs_watch.c
+ * Description: CORTXFS change notifications.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+/* Watches.
+ * --------
+ *
+ * A watch is hashed by (filesystem, inode). The namespace and data paths
+ * call cfs_watch_notify() once a change has been committed, which looks up
+ * the watches of the directory and of the inode and queues the event into
+ * each of them. Nothing is looked up while there are no watches at all.
+ * Only the namespace events (create, unlink, rename) know the directory of
+ * the entry: an attr or data change goes to the watches of the inode, a
+ * watch of a directory does not see the changes of the files it holds.
+ *
+ * Every watch has its own ring of "watch_queue" events, protected by its
+ * own lock, so that the writers of different watches do not contend and a
+ * slow reader does not hold back the filesystem: a writer never waits for
+ * room. The ring is not a lock-free one: any thread of the filesystem may
+ * queue into it, a writer may amend the last event and the reader sleeps
+ * on the lock's condition, the lock is only held for a slot copy. An attr or data change of an inode is merged into the last event of
+ * the ring if it is an attr or data change of the same inode, which turns a
+ * stream of writes into one event. When the ring has one free slot left, a
+ * CFS_WATCH_OVERFLOW event takes it and the events are dropped until the
+ * reader takes the overflow.
+ *
+ * A watch belongs to its client, the filesystem only detaches it when it is
+ * unloaded.
+ */
+
+#include <errno.h> /* ENOENT */
+#include <pthread.h> /* pthread_rwlock_t */
+#include <stdlib.h> /* calloc() */
+#include <string.h> /* memset() */
+#include <time.h> /* clock_gettime() */
+#include <sys/queue.h> /* LIST_* */
+#include <common/log.h> /* log_* */
+#include <common/helpers.h> /* RC_WRAP_LABEL */
+#include <debug.h> /* dassert */
+#include <common.h> /* LIST_FOREACH_SAFE */
+#include "cortxfs.h"
+#include "cortxfs_internal.h"
+#include <internal/fs.h> /* cfs_watch_evict_fs */
+
+#define CFS_WATCH_QUEUE_DEFAULT 256
+/* A queue needs a slot for the events and one for the overflow */
+#define CFS_WATCH_QUEUE_MIN 2
+#define CFS_WATCH_BUCKETS 256
+/* Events merged into the previous one */
+#define CFS_WATCH_MERGEABLE (CFS_WATCH_ATTR | CFS_WATCH_DATA)
+
+struct cfs_watch {
+	LIST_ENTRY(cfs_watch) w_hash;
+	/* NULL once the filesystem is gone */
+	const struct cfs_fs *w_fs;
+	cfs_ino_t w_ino;
+	uint32_t w_mask;
+	pthread_mutex_t w_lock;
+	/* Signaled when an event is queued or the watch is detached */
+	pthread_cond_t w_cond;
+	uint32_t w_head;
+	uint32_t w_count;
+	uint32_t w_size;
+	/* The overflow is queued, the events are dropped */
+	bool w_overflow;
+	uint64_t w_dropped;
+	struct cfs_watch_event w_ring[];
+};
+
+LIST_HEAD(cfs_watch_bucket, cfs_watch);
+
+struct cfs_watch_table {
+	pthread_rwlock_t lock;
+	struct cfs_watch_bucket buckets[CFS_WATCH_BUCKETS];
+	/* Atomic, read without the lock on the fast path: a watch registered
+	 * while a change is being committed may miss it.
+	 */
+	uint32_t nwatches;
+	uint64_t queue;
+};
+
+static struct cfs_watch_table g_watch = {
+	.lock = PTHREAD_RWLOCK_INITIALIZER,
+};
+
+static inline struct cfs_watch_bucket *cfs_watch_bucket(
+	const struct cfs_fs *fs, cfs_ino_t ino)
+{
+	uint64_t hash = ino ^ ((uintptr_t) fs >> 4);
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return &g_watch.buckets[hash % CFS_WATCH_BUCKETS];
+}
+
+/* Detach a watch from the table. The caller must hold the table lock. */
+static void cfs_watch_unhash(struct cfs_watch *watch)
+{
+	LIST_REMOVE(watch, w_hash);
+	__atomic_sub_fetch(&g_watch.nwatches, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&watch->w_lock);
+	watch->w_fs = NULL;
+	pthread_cond_broadcast(&watch->w_cond);
+	pthread_mutex_unlock(&watch->w_lock);
+}
+
+static inline struct cfs_watch_event *cfs_watch_slot(struct cfs_watch *watch,
+						     uint32_t i)
+{
+	return &watch->w_ring[(watch->w_head + i) % watch->w_size];
+}
+
+/* Queue an event. The caller must hold the watch lock. */
+static void cfs_watch_queue(struct cfs_watch *watch, uint32_t event,
+			    cfs_ino_t dir, cfs_ino_t ino, const str256_t *name)
+{
+	struct cfs_watch_event *slot;
+
+	if (watch->w_overflow) {
+		watch->w_dropped++;
+		return;
+	}
+
+	if (watch->w_count != 0 && (event & ~CFS_WATCH_MERGEABLE) == 0) {
+		slot = cfs_watch_slot(watch, watch->w_count - 1);
+		if ((slot->we_mask & ~CFS_WATCH_MERGEABLE) == 0 &&
+		    slot->we_ino == ino && slot->we_dir == dir) {
+			slot->we_mask |= event;
+			return;
+		}
+	}
+
+	slot = cfs_watch_slot(watch, watch->w_count);
+	memset(slot, 0, sizeof(*slot));
+
+	if (watch->w_count == watch->w_size - 1) {
+		slot->we_mask = CFS_WATCH_OVERFLOW;
+		slot->we_ino = watch->w_ino;
+		watch->w_overflow = true;
+		watch->w_dropped++;
+	} else {
+		slot->we_mask = event;
+		slot->we_dir = dir;
+		slot->we_ino = ino;
+		if (name != NULL) {
+			slot->we_name = *name;
+		}
+	}
+
+	watch->w_count++;
+	pthread_cond_signal(&watch->w_cond);
+}
+
+/* Queue an event in the watches of an inode. The caller must hold the table
+ * lock.
+ */
+static void cfs_watch_notify_ino(const struct cfs_fs *fs,
+				 cfs_ino_t watched, uint32_t event,
+				 cfs_ino_t dir, cfs_ino_t ino,
+				 const str256_t *name)
+{
+	struct cfs_watch *watch;
+
+	LIST_FOREACH(watch, cfs_watch_bucket(fs, watched), w_hash) {
+		if (watch->w_fs != fs || watch->w_ino != watched ||
+		    (watch->w_mask & event) == 0) {
+			continue;
+		}
+
+		pthread_mutex_lock(&watch->w_lock);
+		cfs_watch_queue(watch, event & watch->w_mask, dir, ino, name);
+		pthread_mutex_unlock(&watch->w_lock);
+	}
+}
+
+void cfs_watch_notify(struct cfs_fs *cfs_fs, const cfs_ino_t *dir,
+		      uint32_t event, const cfs_ino_t *ino,
+		      const str256_t *name)
+{
+	dassert(cfs_fs && ino);
+
+	if (__atomic_load_n(&g_watch.nwatches, __ATOMIC_RELAXED) == 0) {
+		return;
+	}
+
+	pthread_rwlock_rdlock(&g_watch.lock);
+	if (dir != NULL) {
+		cfs_watch_notify_ino(cfs_fs, *dir, event, *dir, *ino, name);
+	}
+	cfs_watch_notify_ino(cfs_fs, *ino, event, dir ? *dir : 0, *ino, name);
+	pthread_rwlock_unlock(&g_watch.lock);
+}
+
+int cfs_watch(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, uint32_t mask,
+	      struct cfs_watch **watch)
+{
+	int rc;
+	struct stat stat;
+	struct cfs_watch *new_watch = NULL;
+
+	dassert(cfs_fs && ino && watch);
+
+	if ((mask & ~CFS_WATCH_ALL) != 0 || mask == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	/* The inode must exist */
+	RC_WRAP_LABEL(rc, out, cfs_getattr_ino, cfs_fs, ino, &stat);
+
+	new_watch = calloc(1, sizeof(*new_watch) +
+			   g_watch.queue * sizeof(struct cfs_watch_event));
+	if (new_watch == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	new_watch->w_fs = cfs_fs;
+	new_watch->w_ino = *ino;
+	new_watch->w_mask = mask;
+	new_watch->w_size = g_watch.queue;
+	pthread_mutex_init(&new_watch->w_lock, NULL);
+	pthread_cond_init(&new_watch->w_cond, NULL);
+
+	pthread_rwlock_wrlock(&g_watch.lock);
+	LIST_INSERT_HEAD(cfs_watch_bucket(cfs_fs, *ino), new_watch, w_hash);
+	__atomic_add_fetch(&g_watch.nwatches, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&g_watch.lock);
+
+	*watch = new_watch;
+
+out:
+	log_debug("cfs_fs=%p ino=%llu mask=%x watch=%p rc=%d", cfs_fs, *ino,
+		  mask, new_watch, rc);
+	return rc;
+}
+
+int cfs_watch_read(struct cfs_watch *watch, struct cfs_watch_event *events,
+		   uint32_t max, int timeout_ms, uint32_t *count)
+{
+	int rc = 0;
+	uint32_t n = 0;
+	struct timespec deadline;
+
+	dassert(watch && events && count);
+
+	if (max == 0) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&watch->w_lock);
+	while (watch->w_count == 0 && watch->w_fs != NULL && timeout_ms != 0) {
+		if (timeout_ms < 0) {
+			pthread_cond_wait(&watch->w_cond, &watch->w_lock);
+		} else if (pthread_cond_timedwait(&watch->w_cond,
+						  &watch->w_lock,
+						  &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	while (n < max && watch->w_count != 0) {
+		events[n] = *cfs_watch_slot(watch, 0);
+		if (events[n].we_mask == CFS_WATCH_OVERFLOW) {
+			watch->w_overflow = false;
+		}
+		watch->w_head = (watch->w_head + 1) % watch->w_size;
+		watch->w_count--;
+		n++;
+	}
+
+	if (n == 0 && watch->w_fs == NULL) {
+		rc = -ENOENT;
+	}
+	pthread_mutex_unlock(&watch->w_lock);
+
+out:
+	*count = n;
+	log_trace("watch=%p count=%u rc=%d", watch, n, rc);
+	return rc;
+}
+
+void cfs_unwatch(struct cfs_watch *watch)
+{
+	dassert(watch);
+
+	pthread_rwlock_wrlock(&g_watch.lock);
+	if (watch->w_fs != NULL) {
+		cfs_watch_unhash(watch);
+	}
+	pthread_rwlock_unlock(&g_watch.lock);
+
+	log_debug("watch=%p ino=%llu dropped=%llu", watch, watch->w_ino,
+		  (unsigned long long) watch->w_dropped);
+
+	pthread_cond_destroy(&watch->w_cond);
+	pthread_mutex_destroy(&watch->w_lock);
+	free(watch);
+}
+
+/* Detach the watches of a filesystem (or all of them if fs is NULL). */
+static void cfs_watch_purge(const struct cfs_fs *fs)
+{
+	uint32_t i;
+	struct cfs_watch *watch;
+	struct cfs_watch *next;
+
+	pthread_rwlock_wrlock(&g_watch.lock);
+	for (i = 0; i < CFS_WATCH_BUCKETS; i++) {
+		LIST_FOREACH_SAFE(watch, &g_watch.buckets[i], w_hash, next) {
+			if (fs == NULL || watch->w_fs == fs) {
+				cfs_watch_unhash(watch);
+			}
+		}
+	}
+	pthread_rwlock_unlock(&g_watch.lock);
+}
+
+void cfs_watch_evict_fs(const struct cfs_fs *cfs_fs)
+{
+	dassert(cfs_fs);
+
+	cfs_watch_purge(cfs_fs);
+}
+
+int cfs_watch_init(struct collection_item *cfg_items)
+{
+	int rc;
+	uint32_t i;
+
+	RC_WRAP_LABEL(rc, out, cfs_get_config_u64, cfg_items, "watch_queue",
+		      CFS_WATCH_QUEUE_DEFAULT, &g_watch.queue);
+
+	if (g_watch.queue < CFS_WATCH_QUEUE_MIN) {
+		log_warn("cortxfs.watch_queue=%llu is too small, using %d",
+			 (unsigned long long) g_watch.queue,
+			 CFS_WATCH_QUEUE_MIN);
+		g_watch.queue = CFS_WATCH_QUEUE_MIN;
+	}
+
+	for (i = 0; i < CFS_WATCH_BUCKETS; i++) {
+		LIST_INIT(&g_watch.buckets[i]);
+	}
+
+	g_watch.nwatches = 0;
+
+out:
+	log_info("watch: queue=%llu rc=%d",
+		 (unsigned long long) g_watch.queue, rc);
+	return rc;
+}
+
+void cfs_watch_fini(void)
+{
+	uint32_t nwatches = __atomic_load_n(&g_watch.nwatches,
+					    __ATOMIC_RELAXED);
+
+	if (nwatches != 0) {
+		log_warn("%u watches are still registered", nwatches);
+	}
+
+	/* The clients still own their watches */
+	cfs_watch_purge(NULL);
+}
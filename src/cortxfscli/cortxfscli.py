@@ -73,7 +73,8 @@ cortxfscli_default_validation_rules = """{
 			"access_type" : {"set" : "None,RW,RO,MDONLY,MDONLY_RO"},
 			"protocols" : {"set" : "3,4,4.1,3:4"},
 			"pnfs_enabled" : {"set" : "true,false"},
-			"fs_bsize" : {"set": "4096,8192,16384,32768,65536,131072,262144,524288,1048576"}
+			"fs_bsize" : {"set": "4096,8192,16384,32768,65536,131072,262144,524288,1048576"},
+			"atime" : {"set" : "strict,relatime,noatime,lazytime"}
 	},
 
 	"smb" : {
@@ -209,7 +210,7 @@ class FsCommand(Command):
 				", allowed regex:" + fs_name_regex + ", allowed max len:"\
 				+ str(fs_name_max_len))
 			# args.args[1] is options for FS, must needed for create
-			# fs_bsize=<bsize> value is expected, check it
+			# fs_bsize=<bsize> and atime=<mode> values are expected, check them
 			if len(args.args) != 2:
 				throw_exception_with_msg("Too many or no args for " + \
 				args.action.lower())
@@ -87,8 +87,38 @@ static int fs_node_init(struct cfs_fs_node *fs_node,
 		goto kvnode_load_fail;
 	}
 
+	rc = cfs_atime_mode_load(&fs_node->cfs_fs);
+	if (rc != 0) {
+		log_err("failed to load FS: " STR256_F
+			" , cfs_atime_mode_load() failed!",
+			STR256_P(fs_name));
+		goto atime_mode_load_fail;
+	}
+
+	rc = cfs_ino_alloc_init(&fs_node->cfs_fs);
+	if (rc != 0) {
+		log_err("failed to load FS: " STR256_F
+			" , cfs_ino_alloc_init() failed!",
+			STR256_P(fs_name));
+		goto ino_alloc_init_fail;
+	}
+
+	rc = cfs_sindex_load(&fs_node->cfs_fs);
+	if (rc != 0) {
+		log_err("failed to load FS: " STR256_F
+			" , cfs_sindex_load() failed!",
+			STR256_P(fs_name));
+		goto sindex_load_fail;
+	}
+
 	goto out;
 
+sindex_load_fail:
+	cfs_ino_alloc_fini(&fs_node->cfs_fs);
+ino_alloc_init_fail:
+	/* The atime policy is only kept in the FS context */
+atime_mode_load_fail:
+	kvnode_fini(fs_node->cfs_fs.root_node);
 kvnode_load_fail:
 	free(fs_node->cfs_fs.root_node);
 kvnode_alloc_fail:
@@ -107,6 +137,17 @@ out:
 
 void fs_node_deinit(struct cfs_fs_node *fs_node)
 {
+	cfs_remove_tree_evict_fs(&fs_node->cfs_fs);
+	cfs_orphan_evict_fs(&fs_node->cfs_fs);
+	cfs_rstat_evict_fs(&fs_node->cfs_fs);
+	cfs_watch_evict_fs(&fs_node->cfs_fs);
+	cfs_statahead_evict_fs(&fs_node->cfs_fs);
+	cfs_fh_cache_evict_fs(&fs_node->cfs_fs);
+	cfs_dcache_evict_fs(&fs_node->cfs_fs);
+	cfs_oid_cache_evict_fs(&fs_node->cfs_fs);
+	cfs_readdir_evict_fs(&fs_node->cfs_fs);
+	cfs_sindex_evict_fs(&fs_node->cfs_fs);
+	cfs_ino_alloc_fini(&fs_node->cfs_fs);
 	kvnode_fini(fs_node->cfs_fs.root_node);
 	kvtree_fini(fs_node->cfs_fs.kvtree);
 	free(fs_node->cfs_fs.ns);
@@ -190,6 +231,20 @@ void fs_ns_scan_cb(struct namespace *ns, size_t ns_size)
 	LIST_INSERT_HEAD(&fs_list, fs_node, link);
 	log_info("FS:" STR256_F " loaded from disk, ptr:%p",
 		 STR256_P(fs_name), &fs_node->cfs_fs);
+
+	/* Files unlinked before a restart, the FS is usable anyway */
+	rc = cfs_orphan_recover(&fs_node->cfs_fs);
+	if (rc != 0) {
+		log_err("FS:" STR256_F " failed to recover orphans, rc=%d",
+			STR256_P(fs_name), rc);
+	}
+
+	/* Trees whose removal did not finish */
+	rc = cfs_remove_tree_recover(&fs_node->cfs_fs);
+	if (rc != 0) {
+		log_err("FS:" STR256_F " failed to resume tree removal, rc=%d",
+			STR256_P(fs_name), rc);
+	}
 	return;
 
 fs_init_fail:
@@ -341,7 +396,30 @@ out:
 	return rc;
 }
 
-int cfs_fs_create(const str256_t *fs_name, const size_t *fsbsize)
+int cfs_atime_mode_from_str(const char *str, cfs_atime_mode_t *mode)
+{
+	static const char *names[CFS_ATIME_INVALID] = {
+		[CFS_ATIME_STRICT] = "strict",
+		[CFS_ATIME_RELATIME] = "relatime",
+		[CFS_ATIME_NOATIME] = "noatime",
+		[CFS_ATIME_LAZYTIME] = "lazytime",
+	};
+	int i;
+
+	dassert(str && mode);
+
+	for (i = 0; i < CFS_ATIME_INVALID; i++) {
+		if (strcmp(str, names[i]) == 0) {
+			*mode = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+int cfs_fs_create(const str256_t *fs_name, const size_t *fsbsize,
+		  const cfs_atime_mode_t *atime_mode)
 {
         int rc = 0;
 	struct namespace *ns;
@@ -387,6 +465,10 @@ int cfs_fs_create(const str256_t *fs_name, const size_t *fsbsize)
 	RC_WRAP_LABEL(rc, delete_kvtree, fs_node_init, fs_node, ns, ns_size);
 	RC_WRAP_LABEL(rc, deinit_fs_node, cfs_ino_num_gen_init,
 		      &fs_node->cfs_fs);
+	if (atime_mode != NULL) {
+		RC_WRAP_LABEL(rc, deinit_fs_node, cfs_atime_mode_set,
+			      &fs_node->cfs_fs, *atime_mode);
+	}
 
 	LIST_INSERT_HEAD(&fs_list, fs_node, link);
 
@@ -535,10 +617,38 @@ int cfs_fs_delete(const str256_t *fs_name)
 		goto out;
 	}
 
+	/* A detached tree is still being removed */
+	if (cfs_remove_tree_busy(fs)) {
+		log_err("Can not delete FS " STR256_F ". Tree removal is in"
+			" progress", STR256_P(fs_name));
+		rc = -EBUSY;
+		goto out;
+	}
+
+	/* Unlinked files are still being destroyed */
+	if (cfs_orphan_busy(fs)) {
+		log_err("Can not delete FS " STR256_F ". Orphans are being"
+			" destroyed", STR256_P(fs_name));
+		rc = -EBUSY;
+		goto out;
+	}
+
 	/* Remove fs and its entries from the cortxfs list */
 	fs_node = container_of(fs, struct cfs_fs_node, cfs_fs);
 	LIST_REMOVE(fs_node, link);
+	cfs_remove_tree_evict_fs(fs);
+	cfs_orphan_evict_fs(fs);
+	cfs_rstat_evict_fs(fs);
+	cfs_watch_evict_fs(fs);
+	cfs_statahead_evict_fs(fs);
+	cfs_fh_cache_evict_fs(fs);
+	cfs_dcache_evict_fs(fs);
+	cfs_oid_cache_evict_fs(fs);
+	cfs_readdir_evict_fs(fs);
+	cfs_sindex_evict_fs(fs);
 	RC_WRAP_LABEL(rc, out, cfs_ino_num_gen_fini, fs);
+	RC_WRAP_LABEL(rc, out, cfs_atime_mode_fini, fs);
+	cfs_ino_alloc_fini(fs);
 	RC_WRAP_LABEL(rc, out, kvtree_fini, fs->kvtree);
 	kvnode_fini(fs->root_node);
 	RC_WRAP_LABEL(rc, out, kvtree_delete, fs->kvtree);
@@ -40,6 +40,7 @@ enum perfc_cfs_function_tags {
 	PFT_CFS_LOOKUP,
 	PFT_CFS_CREATE_EX,
 	PFT_CFS_CREATE,
+	PFT_CFS_CREATE_BATCH,
 	PFT_CFS_END = PFTR_RANGE_1_END
 };
 
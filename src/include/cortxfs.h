@@ -21,6 +21,7 @@
 #define _CFS_H
 
 #include <stdlib.h>
+#include <stddef.h> /* offsetof */
 #include <stdint.h>
 #include <stdbool.h>
 #include <utils.h>
@@ -34,12 +35,34 @@
 /* forword declations */
 struct kvs_idx;
 struct cfs_fh;
+struct cfs_ino_alloc;
+
+/** Policy of access time updates on read, readdir and readlink. */
+typedef enum cfs_atime_mode {
+	/* Update and persist atime on every access */
+	CFS_ATIME_STRICT = 0,
+	/* Update atime only if it is not newer than mtime or ctime,
+	 * or if it is older than CFS_RELATIME_MAX_AGE seconds
+	 */
+	CFS_ATIME_RELATIME,
+	/* Never update atime */
+	CFS_ATIME_NOATIME,
+	/* Update atime in memory only, it is persisted along with the next
+	 * write of the stat
+	 */
+	CFS_ATIME_LAZYTIME,
+	CFS_ATIME_INVALID,
+} cfs_atime_mode_t;
+
+#define CFS_RELATIME_MAX_AGE (24 * 60 * 60)
 
 struct cfs_fs {
 	struct namespace *ns; /* namespace object */
 	struct tenant *tenant; /* tenant object */
 	struct kvtree *kvtree; /* kvtree object */
 	struct kvnode *root_node; /* kvnode object for root node */
+	cfs_atime_mode_t atime_mode; /* atime update policy */
+	struct cfs_ino_alloc *ino_alloc; /* inode number allocator */
 };
 
 /** This structure is exposed to upper layer and have information regarding
@@ -176,6 +199,20 @@ enum cfs_file_type {
 	CFS_FT_SYMLINK = 3
 };
 
+/* Get the file type from the mode, 0 if the type is not supported */
+static inline uint8_t cfs_mode_to_type(mode_t mode)
+{
+	if (S_ISDIR(mode)) {
+		return CFS_FT_DIR;
+	} else if (S_ISREG(mode)) {
+		return CFS_FT_FILE;
+	} else if (S_ISLNK(mode)) {
+		return CFS_FT_SYMLINK;
+	}
+
+	return 0;
+}
+
 /* Number of groups supported by CORTXFS */
 #define CORTXFS_CRED_GRPS 16
 typedef struct cfs_cred__ {
@@ -212,9 +249,37 @@ static inline int cfs_is_bsize_valid(size_t fs_bsize)
 /* Inode Attributes API */
 int cfs_amend_stat(struct stat *stat, int flags);
 
+/* Copy the fields selected by STAT_*_SET flags from setstat into stat.
+ * The file type bits of stat->st_mode are preserved.
+ */
+void cfs_apply_stat(struct stat *stat, const struct stat *setstat,
+		    int flags);
+
+/* Update atime of an inode on a read access according to the atime policy
+ * of the filesystem.
+ * @return true if the stat has been changed and has to be written back.
+ */
+bool cfs_amend_atime(const struct cfs_fs *cfs_fs, struct stat *stat);
+
+/* Create a new inode and attach it to the parent directory.
+ * If oid is not NULL, it is stored in the inode record as the OID of
+ * the data object of the new inode.
+ */
 int cfs_create_entry(struct cfs_fh *parent_fh, cfs_cred_t *cred, char *name,
-                     char *lnk, mode_t mode, cfs_ino_t *new_entry,
-                     enum cfs_file_type type);
+                     char *lnk, mode_t mode, const obj_id_t *oid,
+                     cfs_ino_t *new_entry, enum cfs_file_type type);
+
+struct cfs_creat_item;
+
+/* Create a batch of regular files in the parent directory within a single
+ * KVS transaction. oids[i] is stored in the inode record of items[i].
+ * All names are validated before anything is written: if any of them is
+ * invalid, already exists or repeats within the batch, nothing is created
+ * and the offending item gets ci_rc set.
+ */
+int cfs_create_entries(struct cfs_fh *parent_fh, cfs_cred_t *cred,
+		       struct cfs_creat_item *items, uint32_t count,
+		       const obj_id_t *oids);
 
 /******************************************************************************/
 /**  */
@@ -238,6 +303,10 @@ int cfs_tree_rename_link(struct cfs_fh *parent_fh, struct cfs_fh *child_fh,
 /** Version of a cortxfs representation. */
 typedef enum cfs_version {
 	CFS_VERSION_0 = 0,
+	/* Inode records embed the OID of the data object */
+	CFS_VERSION_1,
+	/* Inode records of directories count their entries */
+	CFS_VERSION_2,
 	CFS_VERSION_INVALID,
 } cfs_version_t;
 
@@ -255,6 +324,10 @@ typedef enum cfs_key_type {
         CFS_KEY_TYPE_FS_ID,
 	CFS_KEY_TYPE_FS_ID_NEXT,
 	CFS_KEY_TYPE_INO_NUM_GEN,
+	CFS_KEY_TYPE_ORPHAN,
+	CFS_KEY_TYPE_RSTAT,
+	CFS_KEY_TYPE_SINDEX,
+	CFS_KEY_TYPE_RMTREE,
 	CFS_KEY_TYPE_INVALID,
 } cfs_key_type_t;
 
@@ -306,6 +379,21 @@ struct cfs_inode_attr_key {
  */
 int cfs_getattr(struct cfs_fh *cfs_fh, struct stat *stat);
 
+/**
+ * Gets attributes of an inode.
+ *
+ * The stat is copied into the caller's buffer directly from the cached FH of
+ * the inode, the inode is loaded from the storage only if it is not cached.
+ *
+ * @param fs - File system context
+ * @param ino - Inode number
+ * @param stat - [OUT] inode's stat
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_getattr_ino(struct cfs_fs *fs, const cfs_ino_t *ino,
+		    struct stat *stat);
+
 /**
  * Sets attributes for a known file handle.
  *
@@ -370,6 +458,169 @@ int cfs_readdir(struct cfs_fs *cfs_fs, const cfs_cred_t *cred,
 		const cfs_ino_t *dir_ino,
 		cfs_readdir_cb_t cb,
 		void *cb_ctx);
+
+/** Entry of a directory page filled by cfs_readdir_page().
+ * Entries are packed back to back, d_reclen is the distance to the next one.
+ */
+struct cfs_dirent {
+	cfs_ino_t d_ino;
+	/* Cookie to resume the listing after this entry */
+	uint64_t d_cookie;
+	uint16_t d_reclen;
+	/* enum cfs_file_type or 0 if unknown */
+	uint8_t d_type;
+	uint8_t d_namelen;
+	/* NUL-terminated name */
+	char d_name[];
+};
+
+/* Cookie of the beginning of a directory */
+#define CFS_READDIR_COOKIE_START 0
+
+/* Size of a directory page entry with a name of the given length */
+static inline size_t cfs_dirent_size(size_t namelen)
+{
+	return (offsetof(struct cfs_dirent, d_name) + namelen + 1 + 7) &
+		~((size_t) 7);
+}
+
+static inline struct cfs_dirent *cfs_dirent_next(const struct cfs_dirent *d)
+{
+	return (struct cfs_dirent *) ((char *) d + d->d_reclen);
+}
+
+/* Read a page of a directory.
+ * Fills the buffer with packed cfs_dirent entries which follow the cookie.
+ * Use CFS_READDIR_COOKIE_START to start a listing and the d_cookie of the last
+ * returned entry to get the next page. The entries are ordered by the hash
+ * of the name and the cookie is the hash, so that a cookie stays valid when
+ * the directory is modified: an entry which exists during the whole listing
+ * is returned exactly once.
+ * @param fs - File system context
+ * @param cred - pointer to user's credentials
+ * @param dir_ino - pointer to directory inode
+ * @param cookie - position to resume the listing from
+ * @param buf - buffer for the entries
+ * @param buf_size - size of the buffer
+ * @param filled - [OUT] number of bytes filled in the buffer
+ * @param eof - [OUT] true if the page contains the last entry
+ * @retval 0 on success, -EINVAL if the buffer cannot hold an entry,
+ * other -errno on error.
+ */
+int cfs_readdir_page(struct cfs_fs *fs, const cfs_cred_t *cred,
+		     const cfs_ino_t *dir_ino, uint64_t cookie,
+		     void *buf, size_t buf_size, size_t *filled, bool *eof);
+
+/* Get the number of entries of a directory without listing it, e.g. to size
+ * the buffers for cfs_readdir_page().
+ * @param fs - File system context
+ * @param cred - pointer to user's credentials
+ * @param dir_ino - pointer to directory inode
+ * @param nentries - [OUT] number of entries, "." and ".." are not counted
+ * @retval 0 on success, -ENODATA if the directory has been created by
+ * an older version which did not count the entries, other -errno on error.
+ */
+int cfs_dir_count(struct cfs_fs *fs, const cfs_cred_t *cred,
+		  const cfs_ino_t *dir_ino, uint64_t *nentries);
+
+/** Entry of a directory page filled by cfs_readdirplus().
+ * Same as cfs_dirent, with the attributes of the entry.
+ */
+struct cfs_direntplus {
+	struct stat d_stat;
+	cfs_ino_t d_ino;
+	/* Cookie to resume the listing after this entry */
+	uint64_t d_cookie;
+	uint16_t d_reclen;
+	/* enum cfs_file_type or 0 if unknown */
+	uint8_t d_type;
+	uint8_t d_namelen;
+	/* NUL-terminated name */
+	char d_name[];
+};
+
+/* Flags of cfs_readdirplus() */
+enum cfs_readdirplus_flags {
+	/* Keep FHs of the listed entries in the FH cache, so that the
+	 * following lookups and getattrs do not go to the storage.
+	 */
+	CFS_READDIRPLUS_FH_CACHE = 1 << 0,
+};
+
+static inline size_t cfs_direntplus_size(size_t namelen)
+{
+	return (offsetof(struct cfs_direntplus, d_name) + namelen + 1 + 7) &
+		~((size_t) 7);
+}
+
+static inline struct cfs_direntplus *
+cfs_direntplus_next(const struct cfs_direntplus *d)
+{
+	return (struct cfs_direntplus *) ((char *) d + d->d_reclen);
+}
+
+/* Read a page of a directory along with the attributes of the entries.
+ * Works as cfs_readdir_page(), but fills cfs_direntplus entries. The stats
+ * of the entries are taken from the FH cache when possible; an entry removed
+ * while the page is being filled is skipped.
+ * @param fs - File system context
+ * @param cred - pointer to user's credentials
+ * @param dir_ino - pointer to directory inode
+ * @param cookie - position to resume the listing from
+ * @param flags - set of cfs_readdirplus_flags
+ * @param buf - buffer for the entries
+ * @param buf_size - size of the buffer
+ * @param filled - [OUT] number of bytes filled in the buffer
+ * @param eof - [OUT] true if the page contains the last entry
+ * @retval 0 on success, -EINVAL if the buffer cannot hold an entry,
+ * other -errno on error.
+ */
+int cfs_readdirplus(struct cfs_fs *fs, const cfs_cred_t *cred,
+		    const cfs_ino_t *dir_ino, uint64_t cookie, int flags,
+		    void *buf, size_t buf_size, size_t *filled, bool *eof);
+
+/* Max number of threads of cfs_walk() */
+#define CFS_WALK_THREADS_MAX 64
+
+/* Return value of a cfs_walk() visitor: do not descend into the directory */
+#define CFS_WALK_SKIP 1
+
+/** A visitor of cfs_walk(). It is called concurrently from the threads of
+ * the walk, so that it must be thread-safe.
+ * @param[in] ctx    - Visitor state.
+ * @param[in] parent - Inode of the directory the entry belongs to.
+ * @param[in] name   - Name of the entry.
+ * @param[in] ino    - Inode of the entry.
+ * @param[in] stat   - Attributes of the entry.
+ * @retval 0 continue the walk.
+ * @retval CFS_WALK_SKIP do not walk below this entry (a directory).
+ * @retval a negative "-errno" value stops the walk, cfs_walk returns it.
+ */
+typedef int (*cfs_walk_cb_t)(void *ctx, const cfs_ino_t *parent,
+			     const char *name, const cfs_ino_t *ino,
+			     const struct stat *stat);
+
+/**
+ * Walks the tree below a directory with several threads and calls
+ * the visitor for every entry of the tree. The root itself is not visited.
+ * Entries are delivered in no particular order, an entry is visited after
+ * its parent directory. A directory is walked by a single thread, idle
+ * threads steal directories queued by the busy ones.
+ * The walk does not check permissions, it is meant for internal scans
+ * (usage reports, audits, fsck).
+ *
+ * @param fs - File system context.
+ * @param root - Inode of the directory to walk.
+ * @param visitor - Callback to be called for every entry.
+ * @param ctx - Visitor state.
+ * @param nthreads - Number of threads, 0 means 1, at most
+ *                   CFS_WALK_THREADS_MAX.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ * or the value returned by the visitor to stop the walk.
+ */
+int cfs_walk(struct cfs_fs *fs, const cfs_ino_t *root, cfs_walk_cb_t visitor,
+	     void *ctx, uint32_t nthreads);
 /**
  * Creates a directory.
  *
@@ -400,6 +651,42 @@ int cfs_mkdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent, char *
 int cfs_lookup(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
                char *name, cfs_ino_t *ino);
 
+/* Max number of symlinks followed by cfs_lookup_path() */
+#define CFS_SYMLOOP_MAX 40
+
+/* cfs_lookup_path() flags */
+/* Do not follow the last component if it is a symlink (a trailing slash
+ * makes it followed anyway).
+ */
+#define CFS_LOOKUP_NOFOLLOW 1
+
+/**
+ * Finds the inode of an entry given by a path, in a single call.
+ * The components are looked up one after another, the handle of a directory
+ * is released as soon as the handle of its child is found. Every directory
+ * along the path needs EXEC permission. "." and empty components are
+ * skipped, ".." goes back to the previous directory of the path, or to
+ * the parent of the directory the path starts from (".." of the root is
+ * the root). Symlinks are followed (at most CFS_SYMLOOP_MAX of them), a
+ * relative target is resolved from the directory holding the symlink.
+ *
+ * @param cfs_fs - Filesystem context
+ * @param cred - pointer to user's credentials
+ * @param start - directory a relative path starts from. An absolute path
+ *                starts from the root of the filesystem.
+ * @param path - path like "a/b/c", at most PATH_MAX bytes long.
+ * @param flags - CFS_LOOKUP_* flags.
+ * @param ino - [OUT] points to the found ino if successful.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure:
+ * -ENOTDIR if a component (but the last one) is not a directory, -ELOOP
+ * when there are too many symlinks, -ENAMETOOLONG when the path or
+ * a component is too long.
+ */
+int cfs_lookup_path(struct cfs_fs *cfs_fs, const cfs_cred_t *cred,
+		    const cfs_ino_t *start, const char *path, int flags,
+		    cfs_ino_t *ino);
+
 /** Hints for "cfs_rename" call.
  */
 struct cfs_rename_flags {
@@ -446,6 +733,226 @@ int cfs_rename(struct cfs_fs *cfs_fs, cfs_cred_t *cred,
 int cfs_rmdir(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
               char *name);
 
+/* Progress of a cfs_remove_tree() job. */
+struct cfs_remove_tree_stat {
+	/* Directories removed so far */
+	uint64_t rt_dirs;
+	/* Files and symlinks unlinked so far */
+	uint64_t rt_files;
+	/* Directories which are queued or being emptied */
+	uint64_t rt_pending;
+	/* First error the job ran into, 0 if none */
+	int rt_rc;
+	/* The job is over: either the tree is gone or rt_rc tells why not */
+	bool rt_done;
+};
+
+/**
+ * Removes a directory along with everything below it (rm -rf).
+ * The directory is detached from its parent in one transaction, so that the
+ * whole tree disappears from the namespace at once. Its contents are then
+ * reclaimed in the background by the "rmtree_threads" worker threads.
+ * A job which does not finish (error, unmount, crash) is resumed with a new
+ * job id when the filesystem is loaded again.
+ * If name is not a directory, it is unlinked right away.
+ *
+ * @param cfs_fs - A context associated with a filesystem
+ * @param cred - pointer to user's credentials
+ * @param parent - pointer to parent directory's inode.
+ * @param name - name of the tree to be removed.
+ * @param[out] job_id - id of the job to be passed to cfs_remove_tree_status.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_remove_tree(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
+		    char *name, uint64_t *job_id);
+
+/**
+ * Gets the progress of a job started by cfs_remove_tree.
+ * The last finished jobs are remembered, older ones are forgotten.
+ *
+ * @return 0 if successful, -ENOENT if the job is not known.
+ */
+int cfs_remove_tree_status(uint64_t job_id, struct cfs_remove_tree_stat *stat);
+
+/* Recursive statistics of a directory: the totals of everything below it,
+ * the directory itself is not counted.
+ */
+struct cfs_rstat {
+	/* Size of the files and symlinks */
+	uint64_t rs_bytes;
+	/* Files and symlinks */
+	uint64_t rs_files;
+	uint64_t rs_subdirs;
+	/* Newest mtime seen below the directory, it does not go back when
+	 * the newest file is removed.
+	 */
+	struct timespec rs_mtime;
+};
+
+/**
+ * Gets the recursive statistics of a directory without walking the tree.
+ * The statistics are maintained in the background, the pending changes of
+ * the filesystem are stored before they are read. The entries created
+ * before the statistics existed are not counted.
+ *
+ * @param cfs_fs - A context associated with a filesystem
+ * @param dir - Inode of the directory.
+ * @param[out] rstat - Statistics of the directory.
+ *
+ * @return 0 if successful, -ENOTDIR if dir is not a directory, a negative
+ * "-errno" value in case of failure.
+ */
+int cfs_get_rstat(struct cfs_fs *cfs_fs, const cfs_ino_t *dir,
+		  struct cfs_rstat *rstat);
+
+/* Attributes the inodes can be looked up by, see cfs_query(). The indexes
+ * are enabled by the "stat_index" bitmap of the "cortxfs" section of the
+ * config file, (1 << key) for every key.
+ */
+enum cfs_query_key {
+	/* st_mtim.tv_sec */
+	CFS_QUERY_MTIME = 0,
+	/* st_size */
+	CFS_QUERY_SIZE,
+	/* st_uid */
+	CFS_QUERY_UID,
+	CFS_QUERY_NR,
+};
+
+/* Return value of a cfs_query() callback: end the query */
+#define CFS_QUERY_STOP 1
+
+/** A callback of cfs_query().
+ * @param[in] ctx   - Callback state.
+ * @param[in] ino   - Inode found.
+ * @param[in] value - Value of the attribute when the inode was indexed.
+ * @retval 0 continue the query.
+ * @retval CFS_QUERY_STOP end the query, cfs_query returns 0.
+ * @retval a negative "-errno" value ends the query, cfs_query returns it.
+ */
+typedef int (*cfs_query_cb_t)(void *ctx, const cfs_ino_t *ino,
+			      uint64_t value);
+
+/**
+ * Finds the inodes of a filesystem whose attribute is within [min, max]
+ * with a range scan of the index of the attribute, the namespace is not
+ * walked. The inodes are delivered in the order of the values.
+ * The index is updated along with the stats, the stats cached in memory are
+ * stored before the scan. An inode can change (or be removed) between the
+ * moment it is found and the moment the callback looks at it, so that the
+ * callback must check the stat before acting on the inode. The callback may
+ * remove the inodes it is given.
+ * The inodes whose stat has not been stored since the index was enabled
+ * are not found, see cfs_query_rebuild().
+ *
+ * @param cfs_fs - A context associated with a filesystem
+ * @param key - Attribute to look up.
+ * @param min - Lowest value, included.
+ * @param max - Highest value, included.
+ * @param cb - Callback to be called for every inode found.
+ * @param ctx - Callback state.
+ *
+ * @return 0 if successful, -EOPNOTSUPP if the index of the attribute is not
+ * enabled, a negative "-errno" value in case of failure or the value
+ * returned by the callback to end the query.
+ */
+int cfs_query(struct cfs_fs *cfs_fs, enum cfs_query_key key, uint64_t min,
+	      uint64_t max, cfs_query_cb_t cb, void *ctx);
+
+/**
+ * Indexes all the inodes of a filesystem, see cfs_query(). It is needed
+ * once an index is enabled on a filesystem which already has inodes.
+ * The inodes are found with cfs_walk(), the filesystem stays online.
+ *
+ * @param cfs_fs - A context associated with a filesystem
+ * @param nthreads - Number of threads of the walk.
+ *
+ * @return 0 if successful, -EOPNOTSUPP if no index is enabled, a negative
+ * "-errno" value in case of failure.
+ */
+int cfs_query_rebuild(struct cfs_fs *cfs_fs, uint32_t nthreads);
+
+/* Events of cfs_watch() */
+enum cfs_watch_mask {
+	/* An entry is created in the directory (or linked into it) */
+	CFS_WATCH_CREATE = 1 << 0,
+	/* An entry is removed from the directory, or the inode loses a link */
+	CFS_WATCH_UNLINK = 1 << 1,
+	/* An entry is renamed from the directory */
+	CFS_WATCH_RENAME_FROM = 1 << 2,
+	/* An entry is renamed into the directory */
+	CFS_WATCH_RENAME_TO = 1 << 3,
+	/* The attributes of the inode have changed */
+	CFS_WATCH_ATTR = 1 << 4,
+	/* The content of the inode has changed */
+	CFS_WATCH_DATA = 1 << 5,
+	/* Events have been lost, it is delivered whatever the mask is */
+	CFS_WATCH_OVERFLOW = 1 << 6,
+	CFS_WATCH_ALL = (1 << 6) - 1,
+};
+
+/* An event of a watch */
+struct cfs_watch_event {
+	/* Set of cfs_watch_mask, several attr and data changes of an inode
+	 * in a row are delivered as one event.
+	 */
+	uint32_t we_mask;
+	/* Directory of the entry, 0 for the changes of the inode itself */
+	cfs_ino_t we_dir;
+	cfs_ino_t we_ino;
+	/* Name of the entry, empty for the changes of the inode itself */
+	str256_t we_name;
+};
+
+struct cfs_watch;
+
+/**
+ * Registers interest in the changes of an inode. A watch of a directory
+ * gets the events of its entries (create, unlink, rename) and of the
+ * directory itself, a watch of any inode gets its attr and data changes and
+ * its unlinks. The attr and data changes of the entries of a directory are
+ * not delivered to the watches of the directory.
+ * The events are queued in the watch (up to "watch_queue" in the "cortxfs"
+ * section of the config file) until cfs_watch_read() takes them. Once the
+ * queue is full, a CFS_WATCH_OVERFLOW event is queued and the next events
+ * are dropped until it is read: the client has to rescan.
+ *
+ * @param cfs_fs - A context associated with a filesystem
+ * @param ino - Inode to watch.
+ * @param mask - Set of cfs_watch_mask to deliver.
+ * @param[out] watch - New watch.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_watch(struct cfs_fs *cfs_fs, const cfs_ino_t *ino, uint32_t mask,
+	      struct cfs_watch **watch);
+
+/**
+ * Takes the events queued in a watch, waits for one if there is none.
+ *
+ * @param watch - Watch from cfs_watch().
+ * @param events - Buffer for the events.
+ * @param max - Number of events the buffer can hold.
+ * @param timeout_ms - How long to wait for an event, 0 does not wait,
+ *                     a negative value waits until an event comes.
+ * @param[out] count - Number of events taken, 0 on timeout.
+ *
+ * @return 0 if successful, -ENOENT if the filesystem of the watch has been
+ * unloaded and all its events have been read, a negative "-errno" value in
+ * case of failure.
+ */
+int cfs_watch_read(struct cfs_watch *watch, struct cfs_watch_event *events,
+		   uint32_t max, int timeout_ms, uint32_t *count);
+
+/**
+ * Removes a watch and drops its events. Must not be called while the watch
+ * is being read.
+ *
+ * @param watch - Watch from cfs_watch().
+ */
+void cfs_unwatch(struct cfs_watch *watch);
+
 /**
  * Removes a file or a symbolic link.
  * Destroys the link between 'dir' and 'fino' and removes
@@ -525,6 +1032,40 @@ int cfs_creat_ex(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
 		 int stat_in_flags, cfs_ino_t *newfile,
 		 struct stat *stat_out);
 
+/* Max number of entries accepted by a single cfs_creat_batch call */
+#define CFS_CREAT_BATCH_MAX 1024
+
+/* An entry of a cfs_creat_batch request. */
+struct cfs_creat_item {
+	/* [in] Name of the new file. */
+	char *ci_name;
+	/* [in] Unix mode of the new file. */
+	mode_t ci_mode;
+	/* [in] Stats selected by ci_stat_flags are set on the new file.
+	 * [out] Final stat values of the created file.
+	 */
+	struct stat ci_stat;
+	/* [in] STAT_*_SET flags for ci_stat, 0 if nothing to set. */
+	int ci_stat_flags;
+	/* [out] Inode number of the created file. */
+	cfs_ino_t ci_ino;
+	/* [out] Per-item result, 0 or a negative "-errno" value. */
+	int ci_rc;
+};
+
+/* Batched file creation.
+ * Creates up to CFS_CREAT_BATCH_MAX regular files in the parent directory.
+ * Dentries, inode records and OID keys of the whole batch are committed in
+ * one KVS transaction and the parent stat is updated once per batch.
+ * The batch is all-or-nothing with respect to metadata: if a name is
+ * invalid, exists or is repeated within the batch, no file is created.
+ * @param[in,out] items - Array of count entries, see struct cfs_creat_item.
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ * In case of failure, ci_rc of each item tells which entry has failed.
+ */
+int cfs_creat_batch(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *parent,
+		    struct cfs_creat_item *items, uint32_t count);
+
 /**
  * Writes data to an opened fd
  *
@@ -569,6 +1110,65 @@ ssize_t cfs_read(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_file_open_t *fd,
 int cfs_truncate(struct cfs_fs *cfs_fs, cfs_cred_t *cred, cfs_ino_t *ino,
 		 struct stat *new_stat, int new_stat_flags);
 
+/**
+ * Writes data to a file using a file handle held by the caller.
+ * Unlike cfs_write, the function does not load the inode: the OID and the
+ * opened data object are cached in the FH, so that subsequent I/O on the
+ * same FH costs a single dstore call.
+ *
+ * @param fh - FH of a regular file.
+ * @param cred - pointer to user's credentials
+ * @param buf - write data
+ * @param count - size of buffer to be written
+ * @param offset - write offset
+ *
+ * @return write size or a negative "-errno" in case of failure
+ */
+ssize_t cfs_fh_write(struct cfs_fh *fh, cfs_cred_t *cred, void *buf,
+		     size_t count, off_t offset);
+
+/**
+ * Reads data from a file using a file handle held by the caller.
+ * @see cfs_fh_write.
+ *
+ * @param fh - FH of a regular file.
+ * @param cred - pointer to user's credentials
+ * @param buf - [OUT] read data
+ * @param count - size of buffer to be read
+ * @param offset - read offset
+ *
+ * @return read size or a negative "-errno" in case of failure
+ */
+ssize_t cfs_fh_read(struct cfs_fh *fh, cfs_cred_t *cred, void *buf,
+		    size_t count, off_t offset);
+
+/** Change size of a file using a file handle held by the caller.
+ * @see cfs_truncate.
+ * @param fh - FH of a regular file.
+ * @param new_stat - A set of stat values to be set.
+ * @param new_stat_flags - A set of flags which defines which stat values
+ *	  have to be updated. STAT_SIZE_SET is a required flag.
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_fh_truncate(struct cfs_fh *fh, cfs_cred_t *cred,
+		    struct stat *new_stat, int new_stat_flags);
+
+/** Write back the attributes of a file modified by cfs_fh_read/cfs_fh_write.
+ * The data path keeps modified attributes (size, timestamps) in memory and
+ * writes them back asynchronously; this call makes them durable.
+ * @param fh - Any initialized FH.
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_fh_fsync(struct cfs_fh *fh);
+
+/** Write back the in-memory attributes of a file.
+ * @see cfs_fh_fsync.
+ * @param cfs_fs - Filesystem context.
+ * @param ino - Inode of the file.
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_fsync(struct cfs_fs *cfs_fs, const cfs_ino_t *ino);
+
 /** Removes a link between the parent inode and a filesystem object
  * linked into it with the dentry name.
  */
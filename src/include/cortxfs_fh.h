@@ -61,6 +61,19 @@
  *	- deserialize(buffer, FH*) - Finds a file handle with the corresponding
  *		on-wire data in the storage and creates a new FH.
  *
+ * FH Cache.
+ * ---------
+ *
+ * FHs are shared: all the users of the same inode of the same filesystem get
+ * a pointer to the same in-memory FH, which is kept in a sharded cache and
+ * has a reference count. cfs_fh_destroy() drops a reference; the FH itself is
+ * evicted (CLOCK) only when nobody holds it and the cache is over its memory
+ * budget ("fh_cache_mem" in the "cortxfs" config section). Before an object
+ * is removed from the storage, its FH gets invalidated (cfs_fh_invalidate) so
+ * that its stat is not written back after the removal and subsequent lookups
+ * go to the storage and do not observe stale data.
+ *
+ *
  * FH Memory management.
  * ---------------------
  *
@@ -175,6 +188,15 @@ void cfs_fh_destroy(struct cfs_fh *fh);
  */
 void cfs_fh_destroy_and_dump_stat(struct cfs_fh *fh);
 
+/* Mark FH as stale before the object it represents is removed from the
+ * storage. The FH stays valid for its current users, but it will not be
+ * returned by the FH cache anymore and it is freed on the last release.
+ * Stat of a stale FH is never dumped back to the storage, the changes not
+ * written back yet are dropped. Must not be called with the FH locked.
+ * @param[in] fh - Any initialized FH.
+ */
+void cfs_fh_invalidate(struct cfs_fh *fh);
+
 /* Get a pointer to node_id of a File Handle.
  * @param[in] fh - Any initialized FH.
  * @return Pointer to internal buffer which holds node_id number.
@@ -200,13 +222,16 @@ struct cfs_fs *cfs_fs_from_fh(const struct cfs_fh *fh);
 struct kvnode *cfs_kvnode_from_fh(struct cfs_fh *fh);
 
 /* Get a pointer to attributes (stat) of a File Handle.
+ * The stat is borrowed from the FH: it is not a copy and it stays valid
+ * as long as the caller holds the FH. Since FHs are shared, a caller which
+ * needs a consistent snapshot should use cfs_getattr() instead.
  * @param[in] fh - Any initialized FH.
  * @return Pointer to internal buffer which holds struct stat.
  */
 struct stat *cfs_fh_stat(const struct cfs_fh *fh);
 
-/* The function allocates a new FH, intializes it's all the members and return
- * a newly allocated FH.
+/* The function returns a referenced FH for the given inode: either a cached
+ * one or a newly allocated FH with all the members initialized.
  * @param[in] fs - Filesystem context.
  * @param[in] ino_num - Inode number.
  * @param[out] pfh - Pointer the created FH object.
@@ -218,6 +243,15 @@ struct stat *cfs_fh_stat(const struct cfs_fh *fh);
 int cfs_fh_from_ino(struct cfs_fs *fs, const cfs_ino_t *ino_num,
                     struct cfs_fh **fh);
 
+/* Copy the stat of a cached FH without loading the inode from the storage.
+ * @param[in] fs - Filesystem context.
+ * @param[in] ino_num - Inode number.
+ * @param[out] bufstat - Copy of the stat.
+ * @return 0 or -ENOENT if there is no cached FH for the inode.
+ */
+int cfs_fh_cached_stat(struct cfs_fs *fs, const cfs_ino_t *ino_num,
+		       struct stat *bufstat);
+
 /******************************************************************************/
 /* Representation */
 
@@ -31,7 +31,9 @@
 #define CONTROLLER_MAP(XX)		\
 	XX(FS,		fs)		\
 	XX(ENDPOINT,	endpoint)	\
-	XX(AUTH,	auth)
+	XX(AUTH,	auth)		\
+	XX(RMTREE,	rmtree)		\
+	XX(RSTAT,	rstat)
 /**
  * Not supporeted yet.
  * Add to the CONTROLER_MAP as and when supported.
@@ -107,4 +109,27 @@ enum auth_api_id {
 
 #define AUTH_API_COUNT   (0+AUTH_API_MAP(COUNT))
 
+#define RMTREE_API_MAP(XX)				\
+	XX(START,	start,		PUT)		\
+	XX(STATUS,	status,		GET)
+
+enum rmtree_api_id {
+#define XX(uc, lc, _)	RMTREE_ ## uc ## _ID,
+	RMTREE_API_MAP(XX)
+#undef XX
+};
+
+#define RMTREE_API_COUNT   (0+RMTREE_API_MAP(COUNT))
+
+#define RSTAT_API_MAP(XX)				\
+	XX(GET,		get,		GET)
+
+enum rstat_api_id {
+#define XX(uc, lc, _)	RSTAT_ ## uc ## _ID,
+	RSTAT_API_MAP(XX)
+#undef XX
+};
+
+#define RSTAT_API_COUNT   (0+RSTAT_API_MAP(COUNT))
+
 #endif
@@ -45,6 +45,14 @@ enum error_resp_id {
 	ERR_RES_FS_NONEXIST,
 	ERR_RES_FS_EXPORT_EXIST,
 	ERR_RES_FS_NOT_EMPTY,
+	ERR_RES_FS_RMTREE_BUSY,
+
+	/* Response IDs for rmtree apis */
+	ERR_RES_PATH_NONEXIST,
+	ERR_RES_RMTREE_JOB_NONEXIST,
+
+	/* Response IDs for rstat apis */
+	ERR_RES_PATH_NOT_DIR,
 
 	/* Generic IDs */
 	ERR_RES_INVALID_ETAG,
@@ -67,4 +75,10 @@ const char* fs_create_errno_to_respmsg(int err_code);
 
 const char* fs_delete_errno_to_respmsg(int err_code);
 
+const char* rmtree_start_errno_to_respmsg(int err_code);
+
+const char* rmtree_status_errno_to_respmsg(int err_code);
+
+const char* rstat_get_errno_to_respmsg(int err_code);
+
 #endif /* ERROR_HANDLER_H_ */
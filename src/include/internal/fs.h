@@ -56,9 +56,22 @@ int cfs_fs_fini(void);
  *
  * @fs_bsize - optional fs blocksize
  *
+ * @atime_mode - optional atime policy, CFS_ATIME_STRICT if NULL
+ *
  * @return 0 if successful, a negative "-errno" value in case of failure
  */
-int cfs_fs_create(const str256_t *fs_name, const size_t *fs_bsize);
+int cfs_fs_create(const str256_t *fs_name, const size_t *fs_bsize,
+		  const cfs_atime_mode_t *atime_mode);
+
+/**
+ * Parse atime policy name ("strict", "relatime", "noatime", "lazytime").
+ *
+ * @param str - policy name.
+ * @param mode[out] - parsed policy.
+ *
+ * @return 0 if successful, -EINVAL if the name is unknown.
+ */
+int cfs_atime_mode_from_str(const char *str, cfs_atime_mode_t *mode);
 
 /**
  * Detele FileSystem..
@@ -191,4 +204,186 @@ int cfs_ino_num_gen_init(struct cfs_fs *cfs_fs);
  */
 int cfs_ino_num_gen_fini(struct cfs_fs *cfs_fs);
 
+/**
+ * Initialize the in-memory inode number allocator of a file system.
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_ino_alloc_init(struct cfs_fs *cfs_fs);
+
+/**
+ * Release the inode number allocator set up by cfs_ino_alloc_init().
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_ino_alloc_fini(struct cfs_fs *cfs_fs);
+
+/**
+ * Store the atime policy of a file system as a sys attribute of the root
+ * (ref. CFS_SYS_ATTR_ATIME_MODE) and apply it.
+ *
+ * @param cfs_fs - Valid file system context.
+ * @param mode - atime policy.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_atime_mode_set(struct cfs_fs *cfs_fs, cfs_atime_mode_t mode);
+
+/**
+ * Load the atime policy of a file system stored by cfs_atime_mode_set().
+ * File systems without a stored policy use CFS_ATIME_STRICT.
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_atime_mode_load(struct cfs_fs *cfs_fs);
+
+/**
+ * Remove the atime policy stored by cfs_atime_mode_set(), if any.
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_atime_mode_fini(struct cfs_fs *cfs_fs);
+
+/**
+ * Load whether the given file system has been indexed, and mark it as
+ * indexed if a stat index is enabled (see cfs_query()).
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure
+ */
+int cfs_sindex_load(struct cfs_fs *cfs_fs);
+
+/**
+ * Forget the index state loaded by cfs_sindex_load().
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_sindex_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Drop all the cached file handles which belong to the given file system.
+ * Must be called before the file system context is released.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_fh_cache_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Drop all the cached directory entries which belong to the given file system.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_dcache_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Drop all the cached inode to OID mappings of the given file system.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_oid_cache_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Drop all the cached directory streams of the given file system.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_readdir_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Drop the statahead state of the given file system and wait for
+ * the prefetches in flight. Must be called before the FHs are evicted.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_statahead_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Get the statahead counters.
+ *
+ * @param[out] issued - Entries queued for prefetching.
+ * @param[out] used - Prefetched entries which have been looked up afterwards.
+ *
+ * @return true if statahead is enabled.
+ */
+bool cfs_statahead_stats(uint64_t *issued, uint64_t *used);
+
+/**
+ * Stop the tree removal jobs of the given file system: drop the queued
+ * directories and wait for the ones in flight. The jobs are reported as
+ * failed with -ESHUTDOWN, the directories left stay recorded and are
+ * resumed by cfs_remove_tree_recover(). Must be called before the FHs
+ * are evicted.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_remove_tree_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Tell whether a tree removal job of the given file system is in progress.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+bool cfs_remove_tree_busy(const struct cfs_fs *cfs_fs);
+
+/**
+ * Resume the removal of the trees recorded in a file system which has just
+ * been loaded: the directories left are queued again, as a job per tree.
+ * Nothing is queued if the tree removal is disabled.
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_remove_tree_recover(struct cfs_fs *cfs_fs);
+
+/**
+ * Queue the orphans recorded in the list of a file system which has just
+ * been loaded. The orphans are destroyed right away if the reapers are
+ * disabled.
+ *
+ * @param cfs_fs - Valid file system context.
+ *
+ * @return 0 if successful, a negative "-errno" value in case of failure.
+ */
+int cfs_orphan_recover(struct cfs_fs *cfs_fs);
+
+/**
+ * Drop the queued orphans of the given file system and wait for the ones
+ * being reaped. The dropped orphans stay in the list of the file system.
+ * Must be called before the FHs are evicted.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_orphan_evict_fs(const struct cfs_fs *cfs_fs);
+
+/**
+ * Tell whether orphans of the given file system are queued or being reaped.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+bool cfs_orphan_busy(const struct cfs_fs *cfs_fs);
+
+/**
+ * Store the pending recursive statistics of the given file system and
+ * forget the ones which cannot be stored.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_rstat_evict_fs(struct cfs_fs *cfs_fs);
+
+/**
+ * Detach the watches of the given file system, their readers get -ENOENT
+ * once they have read the events left.
+ *
+ * @param cfs_fs - Valid file system context.
+ */
+void cfs_watch_evict_fs(const struct cfs_fs *cfs_fs);
+
 #endif /* _FS_H_ */
@@ -31,6 +31,14 @@ const char *error_resp_messages[] = {
 	"The specified filesystem does not exist.",
 	"The filesystem you tried to delete is being exported.",
 	"The filesystem you tried to delete is not empty.",
+	"The filesystem you tried to delete has a tree removal in progress.",
+
+	/* rmtree api error response */
+	"The specified path does not exist.",
+	"The specified tree removal job does not exist.",
+
+	/* rstat api error response */
+	"The specified path is not a directory.",
 
 	/* Generic error responses */
 	"The ETag should not be passed for a resource which is not modifiable.",
@@ -82,6 +90,9 @@ const char* fs_delete_errno_to_respmsg(int err_code)
 	case ENOTEMPTY:
 		resp_id = ERR_RES_FS_NOT_EMPTY;
 		break;
+	case EBUSY:
+		resp_id = ERR_RES_FS_RMTREE_BUSY;
+		break;
 	case BAD_DIGEST:
 		resp_id = ERR_RES_BAD_DIGEST;
 		break;
@@ -100,3 +111,63 @@ const char* fs_delete_errno_to_respmsg(int err_code)
 
 	return error_resp_messages[resp_id];
 }
+
+const char* rmtree_start_errno_to_respmsg(int err_code)
+{
+	enum error_resp_id resp_id;
+
+	switch (err_code) {
+	case ENOENT:
+		resp_id = ERR_RES_PATH_NONEXIST;
+		break;
+	case INVALID_PAYLOAD:
+		resp_id = ERR_RES_INVALID_PAYLOAD;
+		break;
+	case INVALID_ETAG:
+		resp_id = ERR_RES_INVALID_ETAG;
+		break;
+	default:
+		resp_id = ERR_RES_DEFAULT;
+	}
+
+	return error_resp_messages[resp_id];
+}
+
+const char* rmtree_status_errno_to_respmsg(int err_code)
+{
+	enum error_resp_id resp_id;
+
+	switch (err_code) {
+	case ENOENT:
+		resp_id = ERR_RES_RMTREE_JOB_NONEXIST;
+		break;
+	case INVALID_PATH_PARAMS:
+		resp_id = ERR_RES_INVALID_PATH_PARAMS;
+		break;
+	default:
+		resp_id = ERR_RES_DEFAULT;
+	}
+
+	return error_resp_messages[resp_id];
+}
+
+const char* rstat_get_errno_to_respmsg(int err_code)
+{
+	enum error_resp_id resp_id;
+
+	switch (err_code) {
+	case ENOENT:
+		resp_id = ERR_RES_PATH_NONEXIST;
+		break;
+	case ENOTDIR:
+		resp_id = ERR_RES_PATH_NOT_DIR;
+		break;
+	case INVALID_PAYLOAD:
+		resp_id = ERR_RES_INVALID_PAYLOAD;
+		break;
+	default:
+		resp_id = ERR_RES_DEFAULT;
+	}
+
+	return error_resp_messages[resp_id];
+}
@@ -139,8 +139,10 @@ static int fs_create_process_data(struct controller_api *fs_create)
 	struct json_object *json_fs_options_obj = NULL;
 	struct json_object *json_fs_bsize_obj = NULL;
 	struct json_object *json_fs_bsize_obj1 = NULL;
+	struct json_object *json_fs_atime_obj = NULL;
 	const char *str = NULL;
 	size_t fs_bsize = CFS_DEFAULT_BLOCKSIZE;
+	cfs_atime_mode_t atime_mode = CFS_ATIME_STRICT;
 
 	request = fs_create->request;
 
@@ -226,6 +228,21 @@ static int fs_create_process_data(struct controller_api *fs_create)
 			}
 			json_object_put(json_fs_bsize_obj);
 		}
+
+		json_object_object_get_ex(json_fs_options_obj, "atime",
+					  &json_fs_atime_obj);
+		if (json_fs_atime_obj != NULL) {
+			str = json_object_get_string(json_fs_atime_obj);
+			if (str == NULL ||
+			    cfs_atime_mode_from_str(str, &atime_mode) != 0) {
+				log_err("fs atime mode %s is not valid",
+					str ? str : "(null)");
+				rc = EINVAL;
+				request_set_errcode(request, rc);
+				fs_create_send_response(fs_create, NULL);
+				goto error;
+			}
+		}
 	}
 
 	/* 2. Compose cfs_fs_create api params. */
@@ -238,17 +255,17 @@ static int fs_create_process_data(struct controller_api *fs_create)
 		goto error;
 	}
 
-	log_info("Creating FS : %s Options: %s. fs_bsize: %lu",
+	log_info("Creating FS : %s Options: %s. fs_bsize: %lu atime: %d",
 		  fs_create_api->req.fs_name,
 		  fs_create_api->req.fs_options,
-		  fs_bsize);
+		  fs_bsize, (int) atime_mode);
 
 	str256_from_cstr(fs_name,
 			 fs_create_api->req.fs_name,
 			 fs_name_len);
 
 	/* 3. Send create fs request */
-	rc = cfs_fs_create(&fs_name, &fs_bsize);
+	rc = cfs_fs_create(&fs_name, &fs_bsize, &atime_mode);
 	request_set_errcode(request, -rc);
 	log_debug("FS create status code : %d.", rc);
 
@@ -0,0 +1,662 @@
+/*
+ * Filename: rmtree.c
+ * Description: Tree removal controller.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <evhtp.h>
+#include <json/json.h> /* for json_object */
+#include <management.h>
+#include <common/log.h>
+#include <str.h>
+#include <debug.h>
+#include "internal/controller.h"
+#include "internal/fs.h"
+#include "internal/error_handler.h"
+#include <limits.h> /* NAME_MAX */
+
+/**
+ * ##############################################################
+ * #		RMTREE START API'S				#
+ * ##############################################################
+ */
+struct rmtree_start_api_req {
+	const char *fs_name;
+	const char *path;
+	/* ... */
+};
+
+struct rmtree_start_api_resp {
+	uint64_t job_id;
+	/* ... */
+};
+
+struct rmtree_start_api {
+	struct rmtree_start_api_req  req;
+	struct rmtree_start_api_resp resp;
+};
+
+static int rmtree_start_send_response(struct controller_api *rmtree_start,
+				      void *args)
+{
+	int rc = 0;
+	int resp_code = 0;
+	struct request *request = NULL;
+	struct rmtree_start_api *rmtree_start_api = NULL;
+	struct json_object *json_resp_obj = NULL;
+
+	request = rmtree_start->request;
+	rmtree_start_api = (struct rmtree_start_api*)rmtree_start->priv;
+
+	rc = request_get_errcode(request);
+	if (rc != 0) {
+		resp_code = errno_to_http_code(rc);
+
+		const char *msg = rmtree_start_errno_to_respmsg(rc);
+		rc = request_set_err_resp(request, msg);
+	} else {
+		resp_code = EVHTP_RES_200;
+
+		json_resp_obj = json_object_new_object();
+		json_object_object_add(json_resp_obj, "job-id",
+			json_object_new_int64(rmtree_start_api->resp.job_id));
+
+		request_set_data(request, json_resp_obj);
+	}
+
+	log_debug("err_code : %d", resp_code);
+
+	request_send_response(request, resp_code);
+
+	return rc;
+}
+
+/* Resolve a path like "/dir1/dir2/name" into the inode of "dir2" and "name".
+ * The name points into the path.
+ */
+static int rmtree_resolve_path(struct cfs_fs *fs, cfs_cred_t *cred,
+			       char *path, cfs_ino_t *parent, char **name)
+{
+	int rc = 0;
+	size_t len = strlen(path);
+	char *slash = NULL;
+	cfs_ino_t root = CFS_ROOT_INODE;
+
+	while (len > 1 && path[len - 1] == '/') {
+		path[--len] = '\0';
+	}
+
+	slash = strrchr(path, '/');
+	if (slash == NULL) {
+		*name = path;
+		*parent = root;
+	} else {
+		*slash = '\0';
+		*name = slash + 1;
+		if (slash == path) {
+			*parent = root;
+		} else {
+			rc = -cfs_lookup_path(fs, cred, &root, path, 0, parent);
+			if (rc != 0) {
+				goto out;
+			}
+		}
+	}
+
+	/* The root of the filesystem cannot be removed */
+	if (**name == '\0' || strcmp(*name, ".") == 0 ||
+	    strcmp(*name, "..") == 0 || strlen(*name) > NAME_MAX) {
+		rc = EINVAL;
+		goto out;
+	}
+
+out:
+	return rc;
+}
+
+static int rmtree_start_process_data(struct controller_api *rmtree_start)
+{
+	int rc = 0;
+	str256_t fs_name;
+	char *path = NULL;
+	char *name = NULL;
+	cfs_ino_t parent = 0LL;
+	struct cfs_fs *fs = NULL;
+	cfs_cred_t cred = { .uid = CFS_ROOT_UID, .gid = 0 };
+	struct request *request = NULL;
+	struct rmtree_start_api *rmtree_start_api = NULL;
+	struct json_object *json_obj = NULL;
+	struct json_object *json_fs_name_obj = NULL;
+	struct json_object *json_path_obj = NULL;
+
+	request = rmtree_start->request;
+
+	/**
+	 * Process the rmtree_start data.
+	 * 1. Parse JSON request data.
+	 * 2. Resolve the path within the filesystem.
+	 * 3. Start the tree removal.
+	 */
+	rc = request_accept_data(request);
+	if (rc != 0) {
+		/**
+		 * Internal error.
+		 */
+		request_set_errcode(request, rc);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	/* 1. Parse JSON request data. */
+	rmtree_start_api = (struct rmtree_start_api*)rmtree_start->priv;
+
+	json_obj = request_get_data(request);
+
+	json_object_object_get_ex(json_obj, "name", &json_fs_name_obj);
+	json_object_object_get_ex(json_obj, "path", &json_path_obj);
+	if (json_fs_name_obj == NULL || json_path_obj == NULL) {
+		log_err("No FS name or path.");
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	rmtree_start_api->req.fs_name = json_object_get_string(json_fs_name_obj);
+	rmtree_start_api->req.path = json_object_get_string(json_path_obj);
+	if (rmtree_start_api->req.fs_name == NULL ||
+	    rmtree_start_api->req.path == NULL ||
+	    strlen(rmtree_start_api->req.fs_name) > NAME_MAX) {
+		log_err("Invalid FS name or path.");
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	/* 2. Resolve the path within the filesystem. */
+	str256_from_cstr(fs_name, rmtree_start_api->req.fs_name,
+			 strlen(rmtree_start_api->req.fs_name));
+
+	rc = -cfs_fs_lookup(&fs_name, &fs);
+	if (rc != 0) {
+		log_err("FS %s doesn't exist.", rmtree_start_api->req.fs_name);
+		request_set_errcode(request, rc);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	path = strdup(rmtree_start_api->req.path);
+	if (path == NULL) {
+		rc = ENOMEM;
+		request_set_errcode(request, rc);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	rc = rmtree_resolve_path(fs, &cred, path, &parent, &name);
+	if (rc != 0) {
+		log_err("Can not resolve path %s, rc=%d",
+			rmtree_start_api->req.path, rc);
+		request_set_errcode(request, rc);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	log_info("Removing tree FS : %s path : %s",
+		 rmtree_start_api->req.fs_name, rmtree_start_api->req.path);
+
+	/* 3. Start the tree removal. */
+	rc = cfs_remove_tree(fs, &cred, &parent, name,
+			     &rmtree_start_api->resp.job_id);
+	request_set_errcode(request, -rc);
+	log_debug("Tree removal status code : %d job : %llu.", rc,
+		  (unsigned long long) rmtree_start_api->resp.job_id);
+
+	request_next_action(rmtree_start);
+
+error:
+	free(path);
+	return rc;
+}
+
+static int rmtree_start_process_request(struct controller_api *rmtree_start,
+					void *args)
+{
+	int rc = 0;
+	struct request *request = NULL;
+
+	request = rmtree_start->request;
+
+	rc = request_validate_headers(request);
+	if (rc != 0) {
+		/**
+		 * Internal error.
+		 */
+		request_set_errcode(request, rc);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	if (request_content_length(request) == 0) {
+		/**
+		 * Expecting the fs name and the path.
+		 */
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	if (request_etag_value(request) != NULL) {
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_ETAG);
+		rmtree_start_send_response(rmtree_start, NULL);
+		goto error;
+	}
+
+	/* Set read data call back. */
+	request_set_readcb(request, rmtree_start_process_data);
+
+error:
+	return rc;
+}
+
+static controller_api_action_func default_rmtree_start_actions[] =
+{
+	rmtree_start_process_request,
+	rmtree_start_send_response,
+};
+
+static int rmtree_start_init(struct controller *controller,
+			     struct request *request,
+			     struct controller_api **api)
+{
+	int rc = 0;
+	struct controller_api *rmtree_start = NULL;
+
+	rmtree_start = malloc(sizeof(struct controller_api));
+	if (rmtree_start == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Init. */
+	rmtree_start->request = request;
+	rmtree_start->controller = controller;
+
+	rmtree_start->name = "START";
+	rmtree_start->type = RMTREE_START_ID;
+	rmtree_start->action_next = 0;
+	rmtree_start->action_table = default_rmtree_start_actions;
+
+	rmtree_start->priv = calloc(1, sizeof(struct rmtree_start_api));
+	if (rmtree_start->priv == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Assign InOut parameter value. */
+	*api = rmtree_start;
+	rmtree_start = NULL;
+
+error:
+	if (rmtree_start) {
+		if (rmtree_start->priv) {
+			free(rmtree_start->priv);
+		}
+
+		free(rmtree_start);
+	}
+
+	return rc;
+}
+
+static void rmtree_start_fini(struct controller_api *rmtree_start)
+{
+	if (rmtree_start->priv) {
+		free(rmtree_start->priv);
+	}
+
+	if (rmtree_start) {
+		free(rmtree_start);
+	}
+}
+
+/**
+ * ##############################################################
+ * #		RMTREE STATUS API'S				#
+ * ##############################################################
+ */
+struct rmtree_status_api_req {
+	uint64_t job_id;
+	/* ... */
+};
+
+struct rmtree_status_api_resp {
+	struct cfs_remove_tree_stat stat;
+	/* ... */
+};
+
+struct rmtree_status_api {
+	struct rmtree_status_api_req  req;
+	struct rmtree_status_api_resp resp;
+};
+
+static int rmtree_status_send_response(struct controller_api *rmtree_status,
+				       void *args)
+{
+	int rc = 0;
+	int resp_code = 0;
+	struct request *request = NULL;
+	struct rmtree_status_api *rmtree_status_api = NULL;
+	struct cfs_remove_tree_stat *stat = NULL;
+	struct json_object *json_resp_obj = NULL;
+
+	request = rmtree_status->request;
+	rmtree_status_api = (struct rmtree_status_api*)rmtree_status->priv;
+
+	rc = request_get_errcode(request);
+	if (rc != 0) {
+		resp_code = errno_to_http_code(rc);
+
+		const char *msg = rmtree_status_errno_to_respmsg(rc);
+		rc = request_set_err_resp(request, msg);
+	} else {
+		resp_code = EVHTP_RES_200;
+		stat = &rmtree_status_api->resp.stat;
+
+		json_resp_obj = json_object_new_object();
+		json_object_object_add(json_resp_obj, "job-id",
+			json_object_new_int64(rmtree_status_api->req.job_id));
+		json_object_object_add(json_resp_obj, "done",
+			json_object_new_boolean(stat->rt_done));
+		json_object_object_add(json_resp_obj, "dirs",
+			json_object_new_int64(stat->rt_dirs));
+		json_object_object_add(json_resp_obj, "files",
+			json_object_new_int64(stat->rt_files));
+		json_object_object_add(json_resp_obj, "pending",
+			json_object_new_int64(stat->rt_pending));
+		json_object_object_add(json_resp_obj, "rc",
+			json_object_new_int64(-stat->rt_rc));
+
+		request_set_data(request, json_resp_obj);
+	}
+
+	log_debug("err_code : %d", resp_code);
+
+	request_send_response(request, resp_code);
+
+	return rc;
+}
+
+static int rmtree_status_process_request(struct controller_api *rmtree_status,
+					 void *args)
+{
+	int rc = 0;
+	char *end = NULL;
+	const char *job = NULL;
+	struct request *request = NULL;
+	struct rmtree_status_api *rmtree_status_api = NULL;
+
+	request = rmtree_status->request;
+
+	rc = request_validate_headers(request);
+	if (rc != 0) {
+		/**
+		 * Internal error.
+		 */
+		request_set_errcode(request, rc);
+		rmtree_status_send_response(rmtree_status, NULL);
+		goto error;
+	}
+
+	if (request_content_length(request) != 0) {
+		/**
+		 * Status request doesn't expect any payload data.
+		 */
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rmtree_status_send_response(rmtree_status, NULL);
+		goto error;
+	}
+
+	rmtree_status_api = (struct rmtree_status_api*)rmtree_status->priv;
+
+	job = request_api_file(request);
+	if (job != NULL) {
+		rmtree_status_api->req.job_id = strtoull(job, &end, 10);
+	}
+
+	if (job == NULL || *job == '\0' || *end != '\0') {
+		log_err("No tree removal job id.");
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PATH_PARAMS);
+		rmtree_status_send_response(rmtree_status, NULL);
+		goto error;
+	}
+
+	rc = cfs_remove_tree_status(rmtree_status_api->req.job_id,
+				    &rmtree_status_api->resp.stat);
+	request_set_errcode(request, -rc);
+
+	log_debug("Tree removal job %llu status code : %d.",
+		  (unsigned long long) rmtree_status_api->req.job_id, rc);
+
+	request_next_action(rmtree_status);
+
+error:
+	return rc;
+}
+
+static controller_api_action_func default_rmtree_status_actions[] =
+{
+	rmtree_status_process_request,
+	rmtree_status_send_response,
+};
+
+static int rmtree_status_init(struct controller *controller,
+			      struct request *request,
+			      struct controller_api **api)
+{
+	int rc = 0;
+	struct controller_api *rmtree_status = NULL;
+
+	rmtree_status = malloc(sizeof(struct controller_api));
+	if (rmtree_status == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Init. */
+	rmtree_status->request = request;
+	rmtree_status->controller = controller;
+
+	rmtree_status->name = "STATUS";
+	rmtree_status->type = RMTREE_STATUS_ID;
+	rmtree_status->action_next = 0;
+	rmtree_status->action_table = default_rmtree_status_actions;
+
+	rmtree_status->priv = calloc(1, sizeof(struct rmtree_status_api));
+	if (rmtree_status->priv == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Assign InOut parameter value. */
+	*api = rmtree_status;
+	rmtree_status = NULL;
+
+error:
+	if (rmtree_status) {
+		if (rmtree_status->priv) {
+			free(rmtree_status->priv);
+		}
+
+		free(rmtree_status);
+	}
+
+	return rc;
+}
+
+static void rmtree_status_fini(struct controller_api *rmtree_status)
+{
+	if (rmtree_status->priv) {
+		free(rmtree_status->priv);
+	}
+
+	if (rmtree_status) {
+		free(rmtree_status);
+	}
+}
+
+/**
+ * ##############################################################
+ * #		RMTREE CONTROLLER API'S				#
+ * ##############################################################
+ */
+#define RMTREE_NAME	"rmtree"
+#define RMTREE_API_URI	"/rmtree"
+
+static char *default_rmtree_api_list[] =
+{
+#define XX(uc, lc, _)	#lc,
+	RMTREE_API_MAP(XX)
+#undef XX
+};
+
+static struct controller_api_table rmtree_api_table [] =
+{
+#define XX(uc, lc, method)	{ #lc, #method, RMTREE_ ## uc ## _ID },
+	RMTREE_API_MAP(XX)
+#undef XX
+};
+
+static int rmtree_api_name_to_id(char *api_name, enum rmtree_api_id *api_id)
+{
+	int rc = EINVAL;
+	int idx = 0;
+
+	for (idx = 0; idx < RMTREE_API_COUNT; idx++) {
+		if (!strcmp(rmtree_api_table[idx].method, api_name)) {
+			*api_id = rmtree_api_table[idx].id;
+			rc = 0;
+			break;
+		}
+	}
+
+	return rc;
+}
+
+static int rmtree_api_init(char *api_name,
+			   struct controller *controller,
+			   struct request *request,
+			   struct controller_api **api)
+{
+	int rc = 0;
+	enum rmtree_api_id api_id;
+	struct controller_api *rmtree_api = NULL;
+
+	rc = rmtree_api_name_to_id(api_name, &api_id);
+	if (rc != 0) {
+		log_err("Unknown rmtree api : %s.\n", api_name);
+		goto error;
+	}
+
+	switch(api_id) {
+#define XX(uc, lc, _)							\
+	case RMTREE_ ## uc ## _ID:					\
+		rc = rmtree_ ## lc ## _init(controller, request, &rmtree_api);\
+		break;
+		RMTREE_API_MAP(XX)
+#undef XX
+	default:
+		log_err("Not supported api : %s", api_name);
+	}
+
+	/* Assign the InOut variable api value. */
+	*api = rmtree_api;
+
+error:
+	return rc;
+}
+
+static void rmtree_api_fini(struct controller_api *rmtree_api)
+{
+	char *api_name = NULL;
+	enum rmtree_api_id api_id;
+
+	api_name = rmtree_api->name;
+	api_id = rmtree_api->type;
+
+	switch(api_id) {
+#define XX(uc, lc, _)							\
+	case RMTREE_ ## uc ## _ID:					\
+		rmtree_ ## lc ## _fini(rmtree_api);			\
+		break;
+		RMTREE_API_MAP(XX)
+#undef XX
+	default:
+		log_err("Not supported api : %s", api_name);
+	}
+}
+
+static struct controller default_rmtree_controller =
+{
+	.name	  = RMTREE_NAME,
+	.type	  = CONTROLLER_RMTREE_ID,
+	.api_uri  = RMTREE_API_URI,
+	.api_list = default_rmtree_api_list,
+	.api_init = rmtree_api_init,
+	.api_fini = rmtree_api_fini,
+};
+
+int ctl_rmtree_init(struct server *server, struct controller **controller)
+{
+	int rc = 0;
+
+	struct controller *rmtree_controller = NULL;
+
+	rmtree_controller = malloc(sizeof(struct controller));
+	if (rmtree_controller == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	/* Init rmtree_controller. */
+	*rmtree_controller = default_rmtree_controller;
+	rmtree_controller->server = server;
+
+	/* Assign the return valure. */
+	*controller = rmtree_controller;
+
+error:
+	return rc;
+}
+
+void ctl_rmtree_fini(struct controller *rmtree_controller)
+{
+	free(rmtree_controller);
+	rmtree_controller = NULL;
+}
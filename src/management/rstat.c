@@ -0,0 +1,418 @@
+/*
+ * Filename: rstat.c
+ * Description: Recursive directory statistics controller.
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <evhtp.h>
+#include <json/json.h> /* for json_object */
+#include <management.h>
+#include <common/log.h>
+#include <str.h>
+#include <debug.h>
+#include "internal/controller.h"
+#include "internal/fs.h"
+#include "internal/error_handler.h"
+#include <limits.h> /* NAME_MAX */
+
+/**
+ * ##############################################################
+ * #		RSTAT GET API'S					#
+ * ##############################################################
+ */
+struct rstat_get_api_req {
+	const char *fs_name;
+	const char *path;
+	/* ... */
+};
+
+struct rstat_get_api_resp {
+	struct cfs_rstat rstat;
+	/* ... */
+};
+
+struct rstat_get_api {
+	struct rstat_get_api_req  req;
+	struct rstat_get_api_resp resp;
+};
+
+static int rstat_get_send_response(struct controller_api *rstat_get,
+				   void *args)
+{
+	int rc = 0;
+	int resp_code = 0;
+	struct request *request = NULL;
+	struct rstat_get_api *rstat_get_api = NULL;
+	struct cfs_rstat *rstat = NULL;
+	struct json_object *json_resp_obj = NULL;
+
+	request = rstat_get->request;
+	rstat_get_api = (struct rstat_get_api*)rstat_get->priv;
+
+	rc = request_get_errcode(request);
+	if (rc != 0) {
+		resp_code = errno_to_http_code(rc);
+
+		const char *msg = rstat_get_errno_to_respmsg(rc);
+		rc = request_set_err_resp(request, msg);
+	} else {
+		resp_code = EVHTP_RES_200;
+		rstat = &rstat_get_api->resp.rstat;
+
+		json_resp_obj = json_object_new_object();
+		json_object_object_add(json_resp_obj, "bytes",
+			json_object_new_int64(rstat->rs_bytes));
+		json_object_object_add(json_resp_obj, "files",
+			json_object_new_int64(rstat->rs_files));
+		json_object_object_add(json_resp_obj, "subdirs",
+			json_object_new_int64(rstat->rs_subdirs));
+		json_object_object_add(json_resp_obj, "mtime",
+			json_object_new_int64(rstat->rs_mtime.tv_sec));
+
+		request_set_data(request, json_resp_obj);
+	}
+
+	log_debug("err_code : %d", resp_code);
+
+	request_send_response(request, resp_code);
+
+	return rc;
+}
+
+static int rstat_get_process_data(struct controller_api *rstat_get)
+{
+	int rc = 0;
+	str256_t fs_name;
+	cfs_ino_t ino = 0LL;
+	cfs_ino_t root = CFS_ROOT_INODE;
+	struct cfs_fs *fs = NULL;
+	cfs_cred_t cred = { .uid = CFS_ROOT_UID, .gid = 0 };
+	struct request *request = NULL;
+	struct rstat_get_api *rstat_get_api = NULL;
+	struct json_object *json_obj = NULL;
+	struct json_object *json_fs_name_obj = NULL;
+	struct json_object *json_path_obj = NULL;
+
+	request = rstat_get->request;
+
+	/**
+	 * Process the rstat_get data.
+	 * 1. Parse JSON request data.
+	 * 2. Resolve the path within the filesystem.
+	 * 3. Get the statistics of the directory.
+	 */
+	rc = request_accept_data(request);
+	if (rc != 0) {
+		/**
+		 * Internal error.
+		 */
+		request_set_errcode(request, rc);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	/* 1. Parse JSON request data. */
+	rstat_get_api = (struct rstat_get_api*)rstat_get->priv;
+
+	json_obj = request_get_data(request);
+
+	json_object_object_get_ex(json_obj, "name", &json_fs_name_obj);
+	json_object_object_get_ex(json_obj, "path", &json_path_obj);
+	if (json_fs_name_obj == NULL || json_path_obj == NULL) {
+		log_err("No FS name or path.");
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	rstat_get_api->req.fs_name = json_object_get_string(json_fs_name_obj);
+	rstat_get_api->req.path = json_object_get_string(json_path_obj);
+	if (rstat_get_api->req.fs_name == NULL ||
+	    rstat_get_api->req.path == NULL ||
+	    strlen(rstat_get_api->req.fs_name) > NAME_MAX) {
+		log_err("Invalid FS name or path.");
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	/* 2. Resolve the path within the filesystem. */
+	str256_from_cstr(fs_name, rstat_get_api->req.fs_name,
+			 strlen(rstat_get_api->req.fs_name));
+
+	rc = -cfs_fs_lookup(&fs_name, &fs);
+	if (rc != 0) {
+		log_err("FS %s doesn't exist.", rstat_get_api->req.fs_name);
+		request_set_errcode(request, rc);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	rc = -cfs_lookup_path(fs, &cred, &root, rstat_get_api->req.path, 0,
+			      &ino);
+	if (rc != 0) {
+		log_err("Can not resolve path %s, rc=%d",
+			rstat_get_api->req.path, rc);
+		request_set_errcode(request, rc);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	/* 3. Get the statistics of the directory. */
+	rc = cfs_get_rstat(fs, &ino, &rstat_get_api->resp.rstat);
+	request_set_errcode(request, -rc);
+	log_debug("Rstat of FS : %s path : %s status code : %d.",
+		  rstat_get_api->req.fs_name, rstat_get_api->req.path, rc);
+
+	request_next_action(rstat_get);
+
+error:
+	return rc;
+}
+
+static int rstat_get_process_request(struct controller_api *rstat_get,
+				     void *args)
+{
+	int rc = 0;
+	struct request *request = NULL;
+
+	request = rstat_get->request;
+
+	rc = request_validate_headers(request);
+	if (rc != 0) {
+		/**
+		 * Internal error.
+		 */
+		request_set_errcode(request, rc);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	if (request_content_length(request) == 0) {
+		/**
+		 * Expecting the fs name and the path.
+		 */
+		rc = EINVAL;
+		request_set_errcode(request, INVALID_PAYLOAD);
+		rstat_get_send_response(rstat_get, NULL);
+		goto error;
+	}
+
+	/* Set read data call back. */
+	request_set_readcb(request, rstat_get_process_data);
+
+error:
+	return rc;
+}
+
+static controller_api_action_func default_rstat_get_actions[] =
+{
+	rstat_get_process_request,
+	rstat_get_send_response,
+};
+
+static int rstat_get_init(struct controller *controller,
+			  struct request *request,
+			  struct controller_api **api)
+{
+	int rc = 0;
+	struct controller_api *rstat_get = NULL;
+
+	rstat_get = malloc(sizeof(struct controller_api));
+	if (rstat_get == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Init. */
+	rstat_get->request = request;
+	rstat_get->controller = controller;
+
+	rstat_get->name = "GET";
+	rstat_get->type = RSTAT_GET_ID;
+	rstat_get->action_next = 0;
+	rstat_get->action_table = default_rstat_get_actions;
+
+	rstat_get->priv = calloc(1, sizeof(struct rstat_get_api));
+	if (rstat_get->priv == NULL) {
+		rc = ENOMEM;
+		log_err("Internal error: No memmory.\n");
+		goto error;
+	}
+
+	/* Assign InOut parameter value. */
+	*api = rstat_get;
+	rstat_get = NULL;
+
+error:
+	if (rstat_get) {
+		if (rstat_get->priv) {
+			free(rstat_get->priv);
+		}
+
+		free(rstat_get);
+	}
+
+	return rc;
+}
+
+static void rstat_get_fini(struct controller_api *rstat_get)
+{
+	if (rstat_get->priv) {
+		free(rstat_get->priv);
+	}
+
+	if (rstat_get) {
+		free(rstat_get);
+	}
+}
+
+/**
+ * ##############################################################
+ * #		RSTAT CONTROLLER API'S				#
+ * ##############################################################
+ */
+#define RSTAT_NAME	"rstat"
+#define RSTAT_API_URI	"/rstat"
+
+static char *default_rstat_api_list[] =
+{
+#define XX(uc, lc, _)	#lc,
+	RSTAT_API_MAP(XX)
+#undef XX
+};
+
+static struct controller_api_table rstat_api_table [] =
+{
+#define XX(uc, lc, method)	{ #lc, #method, RSTAT_ ## uc ## _ID },
+	RSTAT_API_MAP(XX)
+#undef XX
+};
+
+static int rstat_api_name_to_id(char *api_name, enum rstat_api_id *api_id)
+{
+	int rc = EINVAL;
+	int idx = 0;
+
+	for (idx = 0; idx < RSTAT_API_COUNT; idx++) {
+		if (!strcmp(rstat_api_table[idx].method, api_name)) {
+			*api_id = rstat_api_table[idx].id;
+			rc = 0;
+			break;
+		}
+	}
+
+	return rc;
+}
+
+static int rstat_api_init(char *api_name,
+			  struct controller *controller,
+			  struct request *request,
+			  struct controller_api **api)
+{
+	int rc = 0;
+	enum rstat_api_id api_id;
+	struct controller_api *rstat_api = NULL;
+
+	rc = rstat_api_name_to_id(api_name, &api_id);
+	if (rc != 0) {
+		log_err("Unknown rstat api : %s.\n", api_name);
+		goto error;
+	}
+
+	switch(api_id) {
+#define XX(uc, lc, _)							\
+	case RSTAT_ ## uc ## _ID:					\
+		rc = rstat_ ## lc ## _init(controller, request, &rstat_api);\
+		break;
+		RSTAT_API_MAP(XX)
+#undef XX
+	default:
+		log_err("Not supported api : %s", api_name);
+	}
+
+	/* Assign the InOut variable api value. */
+	*api = rstat_api;
+
+error:
+	return rc;
+}
+
+static void rstat_api_fini(struct controller_api *rstat_api)
+{
+	char *api_name = NULL;
+	enum rstat_api_id api_id;
+
+	api_name = rstat_api->name;
+	api_id = rstat_api->type;
+
+	switch(api_id) {
+#define XX(uc, lc, _)							\
+	case RSTAT_ ## uc ## _ID:					\
+		rstat_ ## lc ## _fini(rstat_api);			\
+		break;
+		RSTAT_API_MAP(XX)
+#undef XX
+	default:
+		log_err("Not supported api : %s", api_name);
+	}
+}
+
+static struct controller default_rstat_controller =
+{
+	.name	  = RSTAT_NAME,
+	.type	  = CONTROLLER_RSTAT_ID,
+	.api_uri  = RSTAT_API_URI,
+	.api_list = default_rstat_api_list,
+	.api_init = rstat_api_init,
+	.api_fini = rstat_api_fini,
+};
+
+int ctl_rstat_init(struct server *server, struct controller **controller)
+{
+	int rc = 0;
+
+	struct controller *rstat_controller = NULL;
+
+	rstat_controller = malloc(sizeof(struct controller));
+	if (rstat_controller == NULL) {
+		rc = ENOMEM;
+		goto error;
+	}
+
+	/* Init rstat_controller. */
+	*rstat_controller = default_rstat_controller;
+	rstat_controller->server = server;
+
+	/* Assign the return valure. */
+	*controller = rstat_controller;
+
+error:
+	return rc;
+}
+
+void ctl_rstat_fini(struct controller *rstat_controller)
+{
+	free(rstat_controller);
+	rstat_controller = NULL;
+}
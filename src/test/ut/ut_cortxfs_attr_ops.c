@@ -18,6 +18,7 @@
  */
 
 #include "ut_cortxfs_helper.h"
+#include "kvnode.h"
 
 /**
  * Test to set creation time
@@ -279,6 +280,75 @@ static void set_uid(void **state)
 	}
 }
 
+/**
+ * Test for reading a CFS_VERSION_0 inode record
+ * Description: Get the attributes of an inode stored with the first record
+ * layout, a bare struct stat.
+ * Strategy:
+ *  1. Store a struct stat as the basic attributes of a new inode.
+ *  2. Get the attributes of the inode with cfs_getattr.
+ *  3. Delete the inode record.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The attributes match the stored stat.
+ */
+static void getattr_v0_record(void **state)
+{
+	struct ut_cfs_params *ut_cfs_objs = ENV_FROM_STATE(state);
+	struct cfs_fh *fh = NULL;
+	struct kvnode node = KVNODE_INIT_EMTPY;
+	node_id_t node_id;
+	/* Far above the inode numbers the tests allocate */
+	cfs_ino_t ino = 1ULL << 48;
+
+	int rc = 0;
+
+	struct stat stat_in, stat_out;
+	memset(&stat_in, 0, sizeof(stat_in));
+
+	stat_in.st_ino = ino;
+	stat_in.st_mode = S_IFREG | 0644;
+	stat_in.st_nlink = 1;
+	stat_in.st_uid = 100;
+	stat_in.st_gid = 200;
+	stat_in.st_size = 12345;
+	stat_in.st_blksize = 4096;
+	stat_in.st_mtim.tv_sec = 1000;
+	stat_in.st_ctim.tv_sec = 2000;
+	stat_in.st_atim.tv_sec = 3000;
+
+	node_id.f_hi = ino;
+	node_id.f_lo = 0;
+
+	rc = kvnode_init(ut_cfs_objs->cfs_fs->kvtree, &node_id, &stat_in,
+			 sizeof(stat_in), &node);
+	ut_assert_int_equal(rc, 0);
+
+	rc = kvnode_dump(&node);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_from_ino(ut_cfs_objs->cfs_fs, &ino, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_getattr(fh, &stat_out);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(fh);
+
+	ut_assert_int_equal(stat_out.st_ino, ino);
+	ut_assert_int_equal(stat_out.st_mode, stat_in.st_mode);
+	ut_assert_int_equal(stat_out.st_uid, stat_in.st_uid);
+	ut_assert_int_equal(stat_out.st_gid, stat_in.st_gid);
+	ut_assert_int_equal(stat_out.st_size, stat_in.st_size);
+	ut_assert_int_equal(stat_out.st_mtim.tv_sec, stat_in.st_mtim.tv_sec);
+	ut_assert_int_equal(stat_out.st_ctim.tv_sec, stat_in.st_ctim.tv_sec);
+
+	rc = kvnode_delete(&node);
+	ut_assert_int_equal(rc, 0);
+
+	kvnode_fini(&node);
+}
+
 /**
  * Setup for attr test group
  */
@@ -351,6 +421,7 @@ int main(void)
 		ut_test_case(set_atime, NULL, NULL),
 		ut_test_case(set_gid, NULL, NULL),
 		ut_test_case(set_uid, NULL, NULL),
+		ut_test_case(getattr_v0_record, NULL, NULL),
 	};
 
 	int test_count = sizeof(test_list)/sizeof(test_list[0]);
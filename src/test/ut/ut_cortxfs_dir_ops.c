@@ -17,6 +17,7 @@
  * please email opensource@seagate.com or cortx-questions@seagate.com.
  */
 
+#include <unistd.h> /* usleep() */
 #include "ut_cortxfs_helper.h"
 #define DIR_NAME_LEN_MAX 255
 #define DIR_ENV_FROM_STATE(__state) (*((struct ut_dir_env **)__state))
@@ -71,6 +72,29 @@ static void verify_dentries(struct readdir_ctx *ctx, struct ut_dir_env *env,
 	}
 }
 
+/**
+ * Verify readdir content which comes in an arbitrary order: every expected
+ * entry must be listed exactly once.
+ */
+static void verify_dentries_unordered(struct readdir_ctx *ctx,
+				      struct ut_dir_env *env, int entry_start)
+{
+	int i, j, found;
+
+	ut_assert_int_equal(env->entry_cnt, ctx->index);
+
+	for (i = 0; i < env->entry_cnt; i++) {
+		found = 0;
+		for (j = 0; j < ctx->index; j++) {
+			if (strcmp(env->name_list[entry_start + i],
+				   ctx->readdir_array[j]) == 0) {
+				found++;
+			}
+		}
+		ut_assert_int_equal(found, 1);
+	}
+}
+
 /**
  * Setup for reading root directory content
  * Description: Create directory in root directory.
@@ -217,6 +241,244 @@ static void readdir_sub_dir(void **state)
 	readdir_ctx_fini(readdir_ctx);
 }
 
+/**
+ * Test for path lookup
+ * Description: Resolve paths to the sub directory in a single call.
+ * Strategy:
+ *  1. Lookup "d1/d2" from the root directory.
+ *  2. Lookup "/d1//./d2/" and "d1/d2/.." from the root directory.
+ *  3. Create a symlink "lnk" to "d2" in d1.
+ *  4. Lookup "d1/lnk" with and without following the symlink.
+ *  5. Lookup "d1/d2/lnk" and, from d1, "d2/../lnk/lnk".
+ *  6. Lookup "d1/lnk/" without following the symlink.
+ *  7. Remove the symlink.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The paths resolve to d2, d1 or the symlink as expected, the
+ *     trailing slash makes the symlink followed.
+ */
+static void lookup_path_sub_dir(void **state)
+{
+	int rc = 0;
+	cfs_ino_t ino = 0LL;
+	cfs_ino_t lnk_inode = 0LL;
+	char *lnk_name = "lnk";
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/test_read_subdir", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->file_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "/test_read_sub_dir//./test_read_subdir/", 0,
+			     &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->file_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/test_read_subdir/..", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->parent_inode);
+
+	rc = cfs_symlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			 &ut_cfs_obj->parent_inode, lnk_name,
+			 "test_read_subdir", &lnk_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/lnk", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->file_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/lnk", CFS_LOOKUP_NOFOLLOW,
+			     &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, lnk_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/test_read_subdir/lnk", 0, &ino);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->parent_inode,
+			     "test_read_subdir/../lnk/lnk", 0, &ino);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->current_inode,
+			     "test_read_sub_dir/lnk/", CFS_LOOKUP_NOFOLLOW,
+			     &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->file_inode);
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->parent_inode, &lnk_inode, lnk_name);
+	ut_assert_int_equal(rc, 0);
+}
+
+/**
+ * Test for path lookup above the start directory
+ * Description: Resolve ".." from the directory a path starts from.
+ * Strategy:
+ *  1. Create a directory "sibling" in d1.
+ *  2. From d2 (d1/d2), lookup "..", "../sibling" and "../../..".
+ *  3. Remove the sibling directory.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The paths resolve to d1, the sibling and the root directory.
+ */
+static void lookup_path_parent_sub_dir(void **state)
+{
+	int rc = 0;
+	cfs_ino_t ino = 0LL;
+	cfs_ino_t sibling_inode = 0LL;
+	char *sibling_name = "sibling";
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	rc = cfs_mkdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+		       &ut_cfs_obj->parent_inode, sibling_name, 0755,
+		       &sibling_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->file_inode, "..", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->parent_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->file_inode, "../sibling", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, sibling_inode);
+
+	rc = cfs_lookup_path(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &ut_cfs_obj->file_inode, "../../..", 0, &ino);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(ino, ut_cfs_obj->current_inode);
+
+	rc = cfs_rmdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+		       &ut_cfs_obj->parent_inode, sibling_name);
+	ut_assert_int_equal(rc, 0);
+}
+
+/**
+ * Test for recursive directory statistics
+ * Description: Keep the totals of a tree up to date.
+ * Strategy:
+ *  1. Create a file in d2 (d1/d2) and write to it.
+ *  2. Get the statistics of d1 and d2.
+ *  3. Set the size of the file to half of it with setattr.
+ *  4. Move the file from d2 to d1.
+ *  5. Unlink the file.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The file and its size are counted in d1 and d2.
+ *  3. The new size is counted in d1 and d2.
+ *  4. The file is counted in d1 only after the move.
+ *  5. Only d2 is counted in d1 after the unlink.
+ */
+static void rstat_sub_dir(void **state)
+{
+	int rc = 0;
+	char buf[100];
+	char *name = "rstat_file";
+	cfs_ino_t file_inode = 0LL;
+	cfs_file_open_t fd;
+	struct stat stat_in;
+	struct cfs_rstat rstat;
+	struct cfs_fh *dir_fh = NULL;
+	struct cfs_fh *fh = NULL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+	cfs_ino_t *d1_inode = &ut_cfs_obj->parent_inode;
+	cfs_ino_t *d2_inode = &ut_cfs_obj->file_inode;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, d2_inode, &dir_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(dir_fh, &ut_cfs_obj->cred, name, 0755, &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(dir_fh);
+
+	memset(buf, 'a', sizeof(buf));
+	fd.ino = file_inode;
+
+	rc = cfs_write(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &fd, buf,
+		       sizeof(buf), 0);
+	ut_assert_int_equal(rc, sizeof(buf));
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d1_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, sizeof(buf));
+	ut_assert_int_equal(rstat.rs_files, 1);
+	ut_assert_int_equal(rstat.rs_subdirs, 1);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d2_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, sizeof(buf));
+	ut_assert_int_equal(rstat.rs_files, 1);
+	ut_assert_int_equal(rstat.rs_subdirs, 0);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, &file_inode, &rstat);
+	ut_assert_int_equal(rc, -ENOTDIR);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	memset(&stat_in, 0, sizeof(stat_in));
+	stat_in.st_size = sizeof(buf) / 2;
+
+	rc = cfs_setattr(fh, &ut_cfs_obj->cred, &stat_in, STAT_SIZE_SET);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(fh);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d1_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, sizeof(buf) / 2);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d2_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, sizeof(buf) / 2);
+
+	rc = cfs_rename(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, d2_inode, name,
+			NULL, d1_inode, name, NULL, NULL);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d2_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, 0);
+	ut_assert_int_equal(rstat.rs_files, 0);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d1_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, sizeof(buf) / 2);
+	ut_assert_int_equal(rstat.rs_files, 1);
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, d1_inode,
+			&file_inode, name);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_get_rstat(ut_cfs_obj->cfs_fs, d1_inode, &rstat);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(rstat.rs_bytes, 0);
+	ut_assert_int_equal(rstat.rs_files, 0);
+	ut_assert_int_equal(rstat.rs_subdirs, 1);
+}
+
 /**
  * Teardown for reading sub directory content test
  * Description: Delete directories.
@@ -483,6 +745,365 @@ static void readdir_multiple_dir(void **state)
 	readdir_ctx_fini(readdir_ctx);
 }
 
+/**
+ * Test for paginated reading of a directory
+ * Description: Read nonempty directory page by page.
+ * Strategy:
+ *  1. Read directory d0 using cfs_readdir_page with a buffer which can
+ *     hold only a few entries, resume each page from the cookie of the last
+ *     entry of the previous page.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Readdir content should match
+ */
+static void readdir_multiple_dir_paged(void **state)
+{
+	int rc = 0;
+	bool eof = false;
+	size_t filled;
+	uint64_t cookie = CFS_READDIR_COOKIE_START;
+	char buf[3 * 32];
+	struct cfs_dirent *dirent;
+
+	cfs_ino_t dir_inode = 0LL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	struct readdir_ctx readdir_ctx[1] = {{
+		.index = 0,
+	}};
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	while (!eof) {
+		rc = cfs_readdir_page(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				      &dir_inode, cookie, buf, sizeof(buf),
+				      &filled, &eof);
+		ut_assert_int_equal(rc, 0);
+
+		for (dirent = (struct cfs_dirent *) buf;
+		     (char *) dirent < buf + filled;
+		     dirent = cfs_dirent_next(dirent)) {
+			test_readdir_cb(readdir_ctx, dirent->d_name,
+					dirent->d_ino);
+			cookie = dirent->d_cookie;
+		}
+	}
+
+	verify_dentries_unordered(readdir_ctx, ut_dir_obj, 1);
+
+	readdir_ctx_fini(readdir_ctx);
+}
+
+/**
+ * Test for reading a directory with the attributes of the entries
+ * Description: Read nonempty directory page by page with the stats.
+ * Strategy:
+ *  1. Read directory d0 using cfs_readdirplus with a buffer which can
+ *     hold only a couple of entries.
+ *  2. Compare the stat of every entry with the one from cfs_getattr_ino.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Every entry is listed exactly once.
+ *  3. Every entry is a directory and its stat matches cfs_getattr_ino.
+ */
+static void readdir_multiple_dir_plus(void **state)
+{
+	int rc = 0;
+	bool eof = false;
+	size_t filled;
+	uint64_t cookie = CFS_READDIR_COOKIE_START;
+	char buf[2 * 256];
+	struct cfs_direntplus *dirent;
+	struct stat stat;
+
+	cfs_ino_t dir_inode = 0LL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	struct readdir_ctx readdir_ctx[1] = {{
+		.index = 0,
+	}};
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	while (!eof) {
+		rc = cfs_readdirplus(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				     &dir_inode, cookie,
+				     CFS_READDIRPLUS_FH_CACHE, buf,
+				     sizeof(buf), &filled, &eof);
+		ut_assert_int_equal(rc, 0);
+
+		for (dirent = (struct cfs_direntplus *) buf;
+		     (char *) dirent < buf + filled;
+		     dirent = cfs_direntplus_next(dirent)) {
+			ut_assert_true(S_ISDIR(dirent->d_stat.st_mode));
+			ut_assert_int_equal(dirent->d_stat.st_ino,
+					    dirent->d_ino);
+
+			rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs,
+					     &dirent->d_ino, &stat);
+			ut_assert_int_equal(rc, 0);
+			ut_assert_true(memcmp(&stat, &dirent->d_stat,
+					      sizeof(stat)) == 0);
+
+			test_readdir_cb(readdir_ctx, dirent->d_name,
+					dirent->d_ino);
+			cookie = dirent->d_cookie;
+		}
+	}
+
+	verify_dentries_unordered(readdir_ctx, ut_dir_obj, 1);
+
+	readdir_ctx_fini(readdir_ctx);
+}
+
+/**
+ * Test for paginated reading of a directory modified during the listing
+ * Description: Create an entry between the pages of a listing.
+ * Strategy:
+ *  1. Read the first page of directory d0 with a buffer which can hold only
+ *     a few entries.
+ *  2. Create a new directory in d0.
+ *  3. Read the rest of d0 resuming from the cookie of the last entry.
+ *  4. Remove the new directory.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Every entry which existed before the listing is listed exactly once.
+ */
+static void readdir_multiple_dir_paged_modified(void **state)
+{
+	int rc = 0;
+	int i, j, found;
+	bool eof = false;
+	size_t filled;
+	uint64_t cookie = CFS_READDIR_COOKIE_START;
+	char buf[3 * 32];
+	char *new_name = "dir_new";
+	struct cfs_dirent *dirent;
+
+	cfs_ino_t dir_inode = 0LL;
+	cfs_ino_t new_inode = 0LL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	struct readdir_ctx readdir_ctx[1] = {{
+		.index = 0,
+	}};
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	while (!eof) {
+		rc = cfs_readdir_page(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				      &dir_inode, cookie, buf, sizeof(buf),
+				      &filled, &eof);
+		ut_assert_int_equal(rc, 0);
+
+		for (dirent = (struct cfs_dirent *) buf;
+		     (char *) dirent < buf + filled;
+		     dirent = cfs_dirent_next(dirent)) {
+			test_readdir_cb(readdir_ctx, dirent->d_name,
+					dirent->d_ino);
+			cookie = dirent->d_cookie;
+		}
+
+		if (new_inode == 0LL) {
+			rc = cfs_mkdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				       &dir_inode, new_name, 0755, &new_inode);
+			ut_assert_int_equal(rc, 0);
+		}
+	}
+
+	rc = cfs_rmdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+		       new_name);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 1; i <= ut_dir_obj->entry_cnt; i++) {
+		found = 0;
+		for (j = 0; j < readdir_ctx->index; j++) {
+			if (strcmp(ut_dir_obj->name_list[i],
+				   readdir_ctx->readdir_array[j]) == 0) {
+				found++;
+			}
+		}
+		ut_assert_int_equal(found, 1);
+	}
+
+	readdir_ctx_fini(readdir_ctx);
+}
+
+/**
+ * Test for the number of entries of a directory
+ * Description: Get the number of entries of a nonempty directory.
+ * Strategy:
+ *  1. Get the number of entries of directory d0.
+ *  2. Create a directory in d0 and get the number again.
+ *  3. Remove the new directory and get the number again.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The number follows the creation and the removal.
+ */
+static void dir_count_multiple_dir(void **state)
+{
+	int rc = 0;
+	uint64_t nentries = 0;
+	char *new_name = "dir_new";
+
+	cfs_ino_t dir_inode = 0LL;
+	cfs_ino_t new_inode = 0LL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_dir_count(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+			   &nentries);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(nentries, ut_dir_obj->entry_cnt);
+
+	rc = cfs_mkdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+		       new_name, 0755, &new_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_dir_count(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+			   &nentries);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(nentries, ut_dir_obj->entry_cnt + 1);
+
+	rc = cfs_rmdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+		       new_name);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_dir_count(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+			   &nentries);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(nentries, ut_dir_obj->entry_cnt);
+}
+
+struct walk_ctx {
+	cfs_ino_t root;
+	int nentries;
+	int nforeign;
+};
+
+static int test_walk_cb(void *cb_ctx, const cfs_ino_t *parent,
+			const char *name, const cfs_ino_t *ino,
+			const struct stat *stat)
+{
+	struct walk_ctx *ctx = cb_ctx;
+
+	__sync_fetch_and_add(&ctx->nentries, 1);
+	if (*parent != ctx->root || !S_ISDIR(stat->st_mode) ||
+	    stat->st_ino != *ino) {
+		__sync_fetch_and_add(&ctx->nforeign, 1);
+	}
+
+	return 0;
+}
+
+/**
+ * Test for walking a directory which contains multiple directories
+ * Description: Walk a nonempty directory with several threads.
+ * Strategy:
+ *  1. Walk directory d0 with 4 threads.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Every directory of d0 is visited once, with d0 as its parent.
+ */
+static void walk_multiple_dir(void **state)
+{
+	int rc = 0;
+	struct walk_ctx ctx = { 0 };
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&ctx.root);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_walk(ut_cfs_obj->cfs_fs, &ctx.root, test_walk_cb, &ctx, 4);
+	ut_assert_int_equal(rc, 0);
+
+	ut_assert_int_equal(ctx.nentries, ut_dir_obj->entry_cnt);
+	ut_assert_int_equal(ctx.nforeign, 0);
+}
+
+/**
+ * Test for statahead of the entries of a listed directory
+ * Description: Look up the entries of a directory in the listing order.
+ * Strategy:
+ *  1. Read directory d0.
+ *  2. Look up every entry of d0 in the order of the listing.
+ *  3. Get the statahead counters.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. If statahead is enabled, entries have been prefetched and
+ *     the prefetched entries have been used by the lookups.
+ */
+static void readdir_statahead_multiple_dir(void **state)
+{
+	int rc = 0;
+	int i;
+	bool enabled;
+	uint64_t issued_before, used_before;
+	uint64_t issued_after, used_after;
+
+	cfs_ino_t dir_inode = 0LL;
+	cfs_ino_t ino = 0LL;
+
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	struct readdir_ctx readdir_ctx[1] = {{
+		.index = 0,
+	}};
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, ut_dir_obj->name_list[0],
+			&dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_statahead_stats(&issued_before, &used_before);
+
+	rc = cfs_readdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir_inode,
+				test_readdir_cb, readdir_ctx);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(readdir_ctx->index, ut_dir_obj->entry_cnt);
+
+	for (i = 0; i < readdir_ctx->index; i++) {
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				&dir_inode, readdir_ctx->readdir_array[i],
+				&ino);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	enabled = cfs_statahead_stats(&issued_after, &used_after);
+	if (enabled) {
+		ut_assert_true(issued_after > issued_before);
+		ut_assert_true(used_after > used_before);
+	}
+
+	readdir_ctx_fini(readdir_ctx);
+}
+
 /**
  * Teardown for reading directory which contains multpile directories
  * Description: Create directories.
@@ -1199,6 +1820,62 @@ static int delete_nonempty_dir_teardown(void **state)
 	return rc;
 }
 
+/**
+ * Test for removal of a directory tree
+ * Description: Remove a non empty directory with cfs_remove_tree.
+ * Strategy:
+ * 1. Create a file in directory d2 which is in directory d1.
+ * 2. Remove the tree of d1.
+ * 3. Lookup d1.
+ * 4. Wait for the removal job to be over.
+ * Expected behavior:
+ * 1. No errors from CORTXFS API.
+ * 2. d1 is gone right after cfs_remove_tree returns.
+ * 3. The job removes both directories and the file.
+ */
+static void remove_tree_nonempty_dir(void **state)
+{
+	int rc = 0;
+	int retries = 100;
+	uint64_t job_id = 0;
+	cfs_ino_t ino = 0LL;
+	cfs_ino_t root_inode = CFS_ROOT_INODE;
+	struct cfs_remove_tree_stat stat;
+	struct ut_dir_env *ut_dir_obj = DIR_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_dir_obj->ut_cfs_obj;
+
+	/* parent_inode and file_inode point to d1 and d2 */
+	ut_cfs_obj->parent_inode = ut_cfs_obj->file_inode;
+	ut_cfs_obj->file_name = "test_remove_tree_file";
+	rc = ut_file_create(state);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_remove_tree(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			     &root_inode, ut_dir_obj->name_list[0], &job_id);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &root_inode,
+			ut_dir_obj->name_list[0], &ino);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	do {
+		rc = cfs_remove_tree_status(job_id, &stat);
+		ut_assert_int_equal(rc, 0);
+		if (stat.rt_done) {
+			break;
+		}
+		usleep(10000);
+	} while (--retries > 0);
+
+	ut_assert_true(stat.rt_done);
+	ut_assert_int_equal(stat.rt_rc, 0);
+	ut_assert_int_equal(stat.rt_dirs, 2);
+	ut_assert_int_equal(stat.rt_files, 1);
+	ut_assert_int_equal(stat.rt_pending, 0);
+
+	ut_cfs_obj->parent_inode = CFS_ROOT_INODE;
+}
+
 /**
  * Test for deletion of non existing directory
  * Description: Delete non existing directory.
@@ -1293,10 +1970,34 @@ int main(void)
 				readdir_file_and_dir_teardown),
 		ut_test_case(readdir_sub_dir, readdir_sub_dir_setup,
 				readdir_sub_dir_teardown),
+		ut_test_case(lookup_path_sub_dir, readdir_sub_dir_setup,
+				readdir_sub_dir_teardown),
+		ut_test_case(lookup_path_parent_sub_dir, readdir_sub_dir_setup,
+				readdir_sub_dir_teardown),
+		ut_test_case(rstat_sub_dir, readdir_sub_dir_setup,
+				readdir_sub_dir_teardown),
 		ut_test_case(readdir_empty_dir,readdir_empty_dir_setup,
 				dir_test_teardown),
 		ut_test_case(readdir_multiple_dir, readdir_multiple_dir_setup,
 				readdir_multiple_dir_teardown),
+		ut_test_case(readdir_multiple_dir_paged,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
+		ut_test_case(readdir_multiple_dir_plus,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
+		ut_test_case(readdir_multiple_dir_paged_modified,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
+		ut_test_case(dir_count_multiple_dir,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
+		ut_test_case(walk_multiple_dir,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
+		ut_test_case(readdir_statahead_multiple_dir,
+				readdir_multiple_dir_setup,
+				readdir_multiple_dir_teardown),
 		ut_test_case(create_dir, create_dir_setup, dir_test_teardown),
 		ut_test_case(create_exist_dir, create_exist_dir_setup,
 				dir_test_teardown),
@@ -1313,6 +2014,8 @@ int main(void)
 			     link_unlink_file_teardown),
 		ut_test_case(delete_nonempty_dir, delete_nonempty_dir_setup,
                              delete_nonempty_dir_teardown),
+		ut_test_case(remove_tree_nonempty_dir, delete_nonempty_dir_setup,
+			     NULL),
 		ut_test_case(delete_nonexistent_dir, NULL, NULL),
 		ut_test_case(delete_empty_dir, delete_empty_dir_setup, NULL),
 	};
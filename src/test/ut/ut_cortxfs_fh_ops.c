@@ -0,0 +1,544 @@
+/*
+ * Filename: ut_cortxfs_fh_ops.c
+ * Description: Implementation tests for file handle operations
+ *
+ * Copyright (c) 2020 Seagate Technology LLC and/or its Affiliates
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU Affero General Public License for more details.
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * For any questions about this software or licensing,
+ * please email opensource@seagate.com or cortx-questions@seagate.com.
+ */
+
+#include <pthread.h>
+#include "ut_cortxfs_helper.h"
+#define BLOCK_SIZE 4096
+#define FH_THREADS 8
+#define FH_THREAD_LOOPS 1000
+
+struct fh_thread_ctx {
+	pthread_t thread;
+	struct ut_cfs_params *ut_cfs_obj;
+	int rc;
+};
+
+/**
+ * Setup for fh test
+ * Description: Create file.
+ * Strategy:
+ *  1. Create file.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. File creation should be successful.
+ */
+static int fh_test_setup(void **state)
+{
+	int rc = 0;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	ut_cfs_obj->file_name = "fh_test_file";
+
+	rc = ut_file_create(state);
+
+	ut_assert_int_equal(rc, 0);
+
+	return rc;
+}
+
+/**
+ * Teardown for fh test
+ * Description: Delete file.
+ * Strategy:
+ *  1. Delete file.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. File deletion should be successful.
+ */
+static int fh_test_teardown(void **state)
+{
+	int rc = 0;
+
+	rc = ut_file_delete(state);
+
+	ut_assert_int_equal(rc, 0);
+
+	return rc;
+}
+
+/**
+ * Test for sharing of file handles
+ * Description: Get FH of the same file several times.
+ * Strategy:
+ *  1. Get FH of the file by inode number twice.
+ *  2. Lookup the file in the root directory.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. All the calls return the same FH.
+ */
+static void test_fh_shared(void **state)
+{
+	int rc = 0;
+	struct cfs_fh *fh1 = NULL;
+	struct cfs_fh *fh2 = NULL;
+	struct cfs_fh *fh3 = NULL;
+	struct cfs_fh *root_fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh1);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh2);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_getroot(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &root_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_lookup(&ut_cfs_obj->cred, root_fh, ut_cfs_obj->file_name,
+			   &fh3);
+	ut_assert_int_equal(rc, 0);
+
+	ut_assert_true(fh1 == fh2);
+	ut_assert_true(fh1 == fh3);
+	ut_assert_int_equal(*cfs_fh_ino(fh3), ut_cfs_obj->file_inode);
+
+	cfs_fh_destroy(fh3);
+	cfs_fh_destroy(root_fh);
+	cfs_fh_destroy(fh2);
+	cfs_fh_destroy(fh1);
+}
+
+/**
+ * Test for attributes visibility through the shared file handle
+ * Description: Change the file mode and get FH of the file.
+ * Strategy:
+ *  1. Change mode of the file using cfs_setattr.
+ *  2. Get FH of the file by inode number.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The FH has the new mode.
+ */
+static void test_fh_setattr(void **state)
+{
+	int rc = 0;
+	struct stat set_stat;
+	struct cfs_fh *fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	memset(&set_stat, 0, sizeof(set_stat));
+	set_stat.st_mode = S_IFREG | 0700;
+
+	rc = cfs_setattr(fh, &ut_cfs_obj->cred, &set_stat, STAT_MODE_SET);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(fh);
+	fh = NULL;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	ut_assert_int_equal(cfs_fh_stat(fh)->st_mode & 0777, 0700);
+
+	cfs_fh_destroy(fh);
+}
+
+/**
+ * Test for FH of a removed file
+ * Description: Remove the file while its FH is being held.
+ * Strategy:
+ *  1. Get FH of the file.
+ *  2. Unlink the file.
+ *  3. Get FH of the file by inode number.
+ *  4. Release FH obtained on step 1.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Step 3 fails with -ENOENT.
+ */
+static void test_fh_stale(void **state)
+{
+	int rc = 0;
+	struct cfs_fh *fh = NULL;
+	struct cfs_fh *stale_fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode,
+			     &stale_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = ut_file_delete(state);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	cfs_fh_destroy(stale_fh);
+}
+
+/**
+ * Test for I/O through a file handle
+ * Description: Write, read and truncate a file using the same FH.
+ * Strategy:
+ *  1. Get FH of the file.
+ *  2. Write a block using cfs_fh_write.
+ *  3. Read the block using cfs_fh_read.
+ *  4. Write the attributes back using cfs_fh_fsync.
+ *  5. Truncate the file to zero size using cfs_fh_truncate.
+ *  6. Read the block using cfs_fh_read.
+ *  7. Release the FH, drop the cached FHs and get attributes of the file.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Data read on step 3 matches data written on step 2.
+ *  3. Read on step 6 returns 0 bytes.
+ *  4. File size on step 7 is 0, the new size has been stored.
+ */
+static void test_fh_rw(void **state)
+{
+	int rc = 0;
+	char *buf_in;
+	char *buf_out;
+	struct stat new_stat;
+	struct stat stat_out;
+	struct cfs_fh *fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	buf_in = calloc(sizeof(char), BLOCK_SIZE);
+	ut_assert_not_null(buf_in);
+	memset(buf_in, 'a', BLOCK_SIZE);
+
+	buf_out = calloc(sizeof(char), BLOCK_SIZE);
+	ut_assert_not_null(buf_out);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_write(fh, &ut_cfs_obj->cred, buf_in, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+
+	rc = cfs_fh_read(fh, &ut_cfs_obj->cred, buf_out, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+
+	rc = memcmp(buf_out, buf_in, BLOCK_SIZE);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_fsync(fh);
+	ut_assert_int_equal(rc, 0);
+
+	memset(&new_stat, 0, sizeof(new_stat));
+	new_stat.st_size = 0;
+
+	rc = cfs_fh_truncate(fh, &ut_cfs_obj->cred, &new_stat, STAT_SIZE_SET);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_read(fh, &ut_cfs_obj->cred, buf_out, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(fh);
+
+	/* The stat is loaded again from the storage */
+	cfs_fh_cache_evict_fs(ut_cfs_obj->cfs_fs);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode,
+			     &stat_out);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(stat_out.st_size, 0);
+
+	free(buf_out);
+	free(buf_in);
+}
+
+/**
+ * Test for write back of file attributes
+ * Description: Write a block and make the attributes durable.
+ * Strategy:
+ *  1. Write a block using cfs_fh_write.
+ *  2. Call cfs_fh_fsync.
+ *  3. Call cfs_fsync for a clean file.
+ *  4. Get attributes of the file.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. File size is equal to the block size.
+ */
+static void test_fh_fsync(void **state)
+{
+	int rc = 0;
+	char *buf_in;
+	struct stat stat_out;
+	struct cfs_fh *fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	buf_in = calloc(sizeof(char), BLOCK_SIZE);
+	ut_assert_not_null(buf_in);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_write(fh, &ut_cfs_obj->cred, buf_in, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+
+	rc = cfs_fh_fsync(fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fsync(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_getattr(fh, &stat_out);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(stat_out.st_size, BLOCK_SIZE);
+
+	cfs_fh_destroy(fh);
+	free(buf_in);
+}
+
+/**
+ * Test for atime policies
+ * Description: Read a file using different atime policies of the filesystem.
+ * Strategy:
+ *  1. Write a block using cfs_fh_write.
+ *  2. Reset atime of the file, switch the filesystem to noatime and read
+ *     the block.
+ *  3. Switch the filesystem to relatime and read the block.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. atime is not changed on step 2.
+ *  3. atime is updated on step 3 because it is older than mtime.
+ */
+static void test_fh_atime(void **state)
+{
+	int rc = 0;
+	char *buf;
+	struct stat *stat = NULL;
+	struct cfs_fh *fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	struct cfs_fs *cfs_fs = ut_cfs_obj->cfs_fs;
+
+	buf = calloc(sizeof(char), BLOCK_SIZE);
+	ut_assert_not_null(buf);
+
+	rc = cfs_fh_from_ino(cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_write(fh, &ut_cfs_obj->cred, buf, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+
+	stat = cfs_fh_stat(fh);
+	stat->st_atim.tv_sec = 1;
+	stat->st_atim.tv_nsec = 0;
+
+	cfs_fs->atime_mode = CFS_ATIME_NOATIME;
+
+	rc = cfs_fh_read(fh, &ut_cfs_obj->cred, buf, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+	ut_assert_int_equal(stat->st_atim.tv_sec, 1);
+
+	cfs_fs->atime_mode = CFS_ATIME_RELATIME;
+
+	rc = cfs_fh_read(fh, &ut_cfs_obj->cred, buf, BLOCK_SIZE, 0);
+	ut_assert_int_equal(rc, BLOCK_SIZE);
+	ut_assert_true(stat->st_atim.tv_sec != 1);
+
+	cfs_fs->atime_mode = CFS_ATIME_STRICT;
+
+	cfs_fh_destroy(fh);
+	free(buf);
+}
+
+/**
+ * Test for getattr by inode number
+ * Description: Get attributes of a file using its inode number.
+ * Strategy:
+ *  1. Get attributes of the file using cfs_getattr.
+ *  2. Get attributes of the file using cfs_getattr_ino.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Both calls return the same attributes.
+ */
+static void test_fh_getattr_ino(void **state)
+{
+	int rc = 0;
+	struct stat stat_fh;
+	struct stat stat_ino;
+	struct cfs_fh *fh = NULL;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_getattr(fh, &stat_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode,
+			     &stat_ino);
+	ut_assert_int_equal(rc, 0);
+
+	rc = memcmp(&stat_fh, &stat_ino, sizeof(struct stat));
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(fh);
+}
+
+static void *fh_thread(void *arg)
+{
+	int i;
+	int rc = 0;
+	cfs_ino_t root = CFS_ROOT_INODE;
+	struct cfs_fh *fh = NULL;
+	struct fh_thread_ctx *ctx = arg;
+	struct ut_cfs_params *ut_cfs_obj = ctx->ut_cfs_obj;
+
+	for (i = 0; i < FH_THREAD_LOOPS && rc == 0; i++) {
+		rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs,
+				     &ut_cfs_obj->file_inode, &fh);
+		if (rc != 0) {
+			break;
+		}
+		if (*cfs_fh_ino(fh) != ut_cfs_obj->file_inode) {
+			rc = -EINVAL;
+		}
+		cfs_fh_destroy(fh);
+		if (rc != 0) {
+			break;
+		}
+
+		rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &root, &fh);
+		if (rc != 0) {
+			break;
+		}
+		if (*cfs_fh_ino(fh) != root) {
+			rc = -EINVAL;
+		}
+		cfs_fh_destroy(fh);
+	}
+
+	ctx->rc = rc;
+	return NULL;
+}
+
+/**
+ * Test for FH allocations from several threads
+ * Description: Get and release FHs from several threads at once.
+ * Strategy:
+ *  1. Start several threads which get and release the FHs of the file
+ *     and of the root directory in a loop, and let them exit.
+ *  2. Get the FH of the file from the main thread.
+ * Expected Behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Every FH has the inode it was asked for.
+ */
+static void test_fh_threads(void **state)
+{
+	int i;
+	int rc = 0;
+	struct cfs_fh *fh = NULL;
+	struct fh_thread_ctx ctx[FH_THREADS];
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+
+	for (i = 0; i < FH_THREADS; i++) {
+		ctx[i].ut_cfs_obj = ut_cfs_obj;
+		ctx[i].rc = 0;
+		rc = pthread_create(&ctx[i].thread, NULL, fh_thread, &ctx[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	for (i = 0; i < FH_THREADS; i++) {
+		pthread_join(ctx[i].thread, NULL);
+		ut_assert_int_equal(ctx[i].rc, 0);
+	}
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, &ut_cfs_obj->file_inode, &fh);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(*cfs_fh_ino(fh), ut_cfs_obj->file_inode);
+
+	cfs_fh_destroy(fh);
+}
+
+/**
+ * Setup for fh_ops test group
+ */
+static int fh_ops_setup(void **state)
+{
+	int rc = 0;
+	struct ut_cfs_params *ut_cfs_obj = calloc(sizeof(struct ut_cfs_params), 1);
+
+	ut_assert_not_null(ut_cfs_obj);
+
+	*state = ut_cfs_obj;
+	rc = ut_cfs_fs_setup(state);
+
+	ut_assert_int_equal(rc, 0);
+
+	return rc;
+}
+
+/**
+ * Teardown for fh_ops test group
+ */
+static int fh_ops_teardown(void **state)
+{
+	int rc = 0;
+
+	rc = ut_cfs_fs_teardown(state);
+	ut_assert_int_equal(rc, 0);
+
+	free(*state);
+
+	return rc;
+}
+
+int main(void)
+{
+	int rc = 0;
+	char *test_log = "/var/log/cortx/test/ut/ut_cortxfs.log";
+
+	printf("FH tests\n");
+
+	rc = ut_load_config(CONF_FILE);
+	if (rc != 0) {
+		printf("ut_load_config: err = %d\n", rc);
+		goto end;
+	}
+
+	test_log = ut_get_config("cortxfs", "log_path", test_log);
+
+	rc = ut_init(test_log);
+	if (rc != 0) {
+		printf("ut_init failed, log path=%s, rc=%d.\n", test_log, rc);
+		goto out;
+	}
+
+	struct test_case test_list[] = {
+		ut_test_case(test_fh_shared, fh_test_setup, fh_test_teardown),
+		ut_test_case(test_fh_setattr, fh_test_setup, fh_test_teardown),
+		ut_test_case(test_fh_stale, fh_test_setup, NULL),
+		ut_test_case(test_fh_rw, fh_test_setup, fh_test_teardown),
+		ut_test_case(test_fh_fsync, fh_test_setup, fh_test_teardown),
+		ut_test_case(test_fh_atime, fh_test_setup, fh_test_teardown),
+		ut_test_case(test_fh_getattr_ino, fh_test_setup,
+			     fh_test_teardown),
+		ut_test_case(test_fh_threads, fh_test_setup, fh_test_teardown),
+	};
+
+	int test_count = sizeof(test_list)/sizeof(test_list[0]);
+	int test_failed = 0;
+
+	test_failed = ut_run(test_list, test_count, fh_ops_setup,
+			     fh_ops_teardown);
+
+	ut_fini();
+
+	ut_summary(test_count, test_failed);
+
+out:
+	free(test_log);
+
+end:
+	return rc;
+}
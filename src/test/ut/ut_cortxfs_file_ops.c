@@ -17,6 +17,7 @@
  * please email opensource@seagate.com or cortx-questions@seagate.com.
  */
 
+#include <unistd.h> /* usleep() */
 #include "cortxfs_fh.h"
 #include "ut_cortxfs_helper.h"
 
@@ -293,6 +294,565 @@ static void create_exist_file(void **state)
 	cfs_fh_destroy_and_dump_stat(parent_fh);
 }
 
+/**
+ * Test for batched file creation.
+ * Description: create several files with one cfs_creat_batch call.
+ * Strategy:
+ *  1. Try to create a batch where a name is repeated.
+ *  2. Verify that none of the files of that batch exists.
+ *  3. Create a batch of files, one of them with a mode set via ci_stat.
+ *  4. Lookup for created files and verify inodes and mode.
+ *  5. Delete the files.
+ * Expected behavior:
+ *  1. The first batch should fail with error -EEXIST.
+ *  2. No errors from CORTXFS API for the second batch.
+ *  3. The lookups should verify creation of every file in the batch.
+ */
+static void create_file_batch(void **state)
+{
+	int rc = 0;
+	int i;
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->parent_inode;
+	cfs_ino_t file_inode = 0LL;
+	struct stat stat_out;
+	char *names[] = { "batch_file_0", "batch_file_1", "batch_file_2" };
+	struct cfs_creat_item items[3];
+	int count = sizeof(items) / sizeof(items[0]);
+
+	memset(items, 0, sizeof(items));
+	for (i = 0; i < count; i++) {
+		items[i].ci_name = names[i];
+		items[i].ci_mode = 0755;
+	}
+	items[2].ci_name = names[0];
+
+	rc = cfs_creat_batch(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			     items, count);
+	ut_assert_int_equal(rc, -EEXIST);
+
+	for (i = 0; i < count; i++) {
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				names[i], &file_inode);
+		ut_assert_int_equal(rc, -ENOENT);
+	}
+
+	memset(items, 0, sizeof(items));
+	for (i = 0; i < count; i++) {
+		items[i].ci_name = names[i];
+		items[i].ci_mode = 0755;
+	}
+	items[1].ci_stat.st_mode = 0600;
+	items[1].ci_stat_flags = STAT_MODE_SET;
+
+	rc = cfs_creat_batch(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			     items, count);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < count; i++) {
+		ut_assert_int_equal(items[i].ci_rc, 0);
+
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				names[i], &file_inode);
+		ut_assert_int_equal(rc, 0);
+		ut_assert_int_equal(file_inode, items[i].ci_ino);
+
+		rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &file_inode,
+				     &stat_out);
+		ut_assert_int_equal(rc, 0);
+		ut_assert_int_equal(stat_out.st_mode,
+				    items[i].ci_stat.st_mode);
+	}
+
+	ut_assert_int_equal(items[1].ci_stat.st_mode, S_IFREG | 0600);
+
+	for (i = 0; i < count; i++) {
+		rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				NULL, names[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+}
+
+/**
+ * Test for destroying a file unlinked while it is open
+ * Description: detach a file, release it and wait for the orphan reaper.
+ * Strategy:
+ *  1. Create a file.
+ *  2. Detach the file from its parent, as for an open file.
+ *  3. Lookup for the file name and get the attributes of the inode.
+ *  4. Release the orphaned file.
+ *  5. Get the attributes of the inode until it is gone.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The lookup fails with error -ENOENT, the inode is still there.
+ *  3. The inode is destroyed after the release.
+ */
+static void reap_orphaned_file(void **state)
+{
+	int rc = 0;
+	int retries = 100;
+	char *name = "orphaned_file";
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	cfs_ino_t file_inode = 0LL;
+	cfs_ino_t lookup_inode = 0LL;
+	struct cfs_fh *parent_fh = NULL;
+	struct stat stat_out;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, name, 0755, &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	rc = cfs_detach(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			&file_inode, name);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode, name,
+			&lookup_inode);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &file_inode, &stat_out);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(stat_out.st_nlink, 0);
+
+	rc = cfs_destroy_orphaned_file(ut_cfs_obj->cfs_fs, &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	do {
+		rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &file_inode,
+				     &stat_out);
+		if (rc != 0) {
+			break;
+		}
+		usleep(10000);
+	} while (--retries > 0);
+
+	ut_assert_int_equal(rc, -ENOENT);
+}
+
+/**
+ * Test for lookups of removed entries
+ * Description: remove entries which are in the dentry cache and look them up.
+ * Strategy:
+ *  1. Create a file and a directory, look them up.
+ *  2. Unlink the file and remove the directory.
+ *  3. Look up both names twice.
+ *  4. Create a file with the name of the unlinked one and look it up.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The lookups on step 3 fail with error -ENOENT.
+ *  3. The lookup on step 4 returns the inode of the new file.
+ */
+static void lookup_removed_entry(void **state)
+{
+	int rc = 0;
+	int i;
+	char *file_name = "removed_file";
+	char *dir_name = "removed_dir";
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	cfs_ino_t file_inode = 0LL;
+	cfs_ino_t dir_inode = 0LL;
+	cfs_ino_t lookup_inode = 0LL;
+	struct cfs_fh *parent_fh = NULL;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, file_name, 0755,
+		       &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	rc = cfs_mkdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+		       dir_name, 0755, &dir_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			file_name, &lookup_inode);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(lookup_inode, file_inode);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			dir_name, &lookup_inode);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(lookup_inode, dir_inode);
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			&file_inode, file_name);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_rmdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+		       dir_name);
+	ut_assert_int_equal(rc, 0);
+
+	/* The second lookups hit the negative entries */
+	for (i = 0; i < 2; i++) {
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				file_name, &lookup_inode);
+		ut_assert_int_equal(rc, -ENOENT);
+
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				dir_name, &lookup_inode);
+		ut_assert_int_equal(rc, -ENOENT);
+	}
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, file_name, 0755,
+		       &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			file_name, &lookup_inode);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(lookup_inode, file_inode);
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			&file_inode, file_name);
+	ut_assert_int_equal(rc, 0);
+}
+
+/**
+ * Test for lookups of names which are linked after a failed lookup
+ * Description: link names which are in the dentry cache as missing ones.
+ * Strategy:
+ *  1. Create a file.
+ *  2. Look up four missing names twice.
+ *  3. Link the names: a directory, a symlink, a hard link to the file and
+ *     the file renamed to the last name.
+ *  4. Look up the four names and the old name of the file.
+ *  5. Remove the entries.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The lookups on step 2 fail with error -ENOENT.
+ *  3. The lookups on step 4 return the inodes of the new entries, the old
+ *     name of the file fails with error -ENOENT.
+ */
+static void lookup_negative_entry(void **state)
+{
+	int rc = 0;
+	int i;
+	int j;
+	char *file_name = "negative_file";
+	char *names[] = { "negative_dir", "negative_symlink",
+		"negative_link", "negative_rename" };
+	int count = sizeof(names) / sizeof(names[0]);
+	cfs_ino_t inodes[4];
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	cfs_ino_t file_inode = 0LL;
+	cfs_ino_t lookup_inode = 0LL;
+	struct cfs_fh *parent_fh = NULL;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, file_name, 0755,
+		       &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	/* The second lookups hit the negative entries */
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < count; i++) {
+			rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+					pinode, names[i], &lookup_inode);
+			ut_assert_int_equal(rc, -ENOENT);
+		}
+	}
+
+	rc = cfs_mkdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+		       names[0], 0755, &inodes[0]);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_symlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			 names[1], file_name, &inodes[1]);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_link(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &file_inode,
+		      pinode, names[2]);
+	ut_assert_int_equal(rc, 0);
+	inodes[2] = file_inode;
+
+	rc = cfs_rename(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			file_name, NULL, pinode, names[3], NULL, NULL);
+	ut_assert_int_equal(rc, 0);
+	inodes[3] = file_inode;
+
+	for (i = 0; i < count; i++) {
+		rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				names[i], &lookup_inode);
+		ut_assert_int_equal(rc, 0);
+		ut_assert_int_equal(lookup_inode, inodes[i]);
+	}
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			file_name, &lookup_inode);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = cfs_rmdir(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+		       names[0]);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 1; i < count; i++) {
+		rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				&inodes[i], names[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+}
+
+/**
+ * Test for the inode to OID mappings of files
+ * Description: use the data objects of files through the OID cache and
+ * through the inode records.
+ * Strategy:
+ *  1. Create two files, set a different xattr value on each.
+ *  2. Get the xattr of both files.
+ *  3. Drop the OID cache of the filesystem and get the xattrs again.
+ *  4. Delete the files.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. Every file returns its own value, before and after the OID cache is
+ *     dropped.
+ */
+static void oid_cache_file_xattr(void **state)
+{
+	int rc = 0;
+	int i;
+	int pass;
+	char *names[] = { "oid_file_0", "oid_file_1" };
+	char *values[] = { "oid_value_0", "oid_value_1" };
+	char *xattr_name = "user.oid";
+	char xattr_val[64];
+	size_t val_size;
+	cfs_ino_t inodes[2];
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	struct cfs_fh *parent_fh = NULL;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	for (i = 0; i < 2; i++) {
+		rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, names[i], 0755,
+			       &inodes[i]);
+		ut_assert_int_equal(rc, 0);
+
+		rc = cfs_setxattr(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+				  &inodes[i], xattr_name, values[i],
+				  strlen(values[i]), 0);
+		ut_assert_int_equal(rc, 0);
+	}
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			cfs_oid_cache_evict_fs(ut_cfs_obj->cfs_fs);
+		}
+
+		for (i = 0; i < 2; i++) {
+			memset(xattr_val, 0, sizeof(xattr_val));
+			val_size = sizeof(xattr_val);
+
+			rc = cfs_getxattr(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+					  &inodes[i], xattr_name, xattr_val,
+					  &val_size);
+			ut_assert_int_equal(rc, 0);
+			ut_assert_int_equal(val_size, strlen(values[i]));
+
+			rc = memcmp(xattr_val, values[i], val_size);
+			ut_assert_int_equal(rc, 0);
+		}
+	}
+
+	for (i = 0; i < 2; i++) {
+		rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+				&inodes[i], names[i]);
+		ut_assert_int_equal(rc, 0);
+	}
+}
+
+struct query_file_ctx {
+	cfs_ino_t ino;
+	bool found;
+};
+
+static int query_file_cb(void *ctx, const cfs_ino_t *ino, uint64_t value)
+{
+	struct query_file_ctx *query_ctx = ctx;
+
+	if (*ino == query_ctx->ino) {
+		query_ctx->found = true;
+		return CFS_QUERY_STOP;
+	}
+
+	return 0;
+}
+
+/**
+ * Test for finding files by size
+ * Description: query the size index for a file of a known size.
+ * Strategy:
+ *  1. Create a file and write a buffer into it.
+ *  2. Query the inodes whose size is the size of the buffer.
+ *  3. Query the inodes whose size is above the size of the buffer.
+ *  4. Unlink the file and query the size of the buffer until the file is
+ *     reaped.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The first query finds the file, the second does not.
+ *  3. The file is not found once it is gone.
+ */
+static void query_file_size(void **state)
+{
+	int rc = 0;
+	int retries = 100;
+	char buf[3001];
+	char *name = "query_file";
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	cfs_ino_t file_inode = 0LL;
+	cfs_file_open_t fd;
+	struct cfs_fh *parent_fh = NULL;
+	struct query_file_ctx ctx;
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, name, 0755, &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	memset(buf, 'a', sizeof(buf));
+	fd.ino = file_inode;
+
+	rc = cfs_write(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &fd, buf,
+		       sizeof(buf), 0);
+	ut_assert_int_equal(rc, sizeof(buf));
+
+	ctx.ino = file_inode;
+	ctx.found = false;
+
+	rc = cfs_query(ut_cfs_obj->cfs_fs, CFS_QUERY_SIZE, sizeof(buf),
+		       sizeof(buf), query_file_cb, &ctx);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_true(ctx.found);
+
+	ctx.found = false;
+
+	rc = cfs_query(ut_cfs_obj->cfs_fs, CFS_QUERY_SIZE, sizeof(buf) + 1,
+		       UINT64_MAX, query_file_cb, &ctx);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_true(!ctx.found);
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			&file_inode, name);
+	ut_assert_int_equal(rc, 0);
+
+	do {
+		ctx.found = false;
+		rc = cfs_query(ut_cfs_obj->cfs_fs, CFS_QUERY_SIZE,
+			       sizeof(buf), sizeof(buf), query_file_cb, &ctx);
+		if (rc != 0 || !ctx.found) {
+			break;
+		}
+		usleep(10000);
+	} while (--retries > 0);
+
+	ut_assert_int_equal(rc, 0);
+	ut_assert_true(!ctx.found);
+}
+
+/**
+ * Test for watching a directory and a file
+ * Description: watch a directory and a file of the directory.
+ * Strategy:
+ *  1. Watch the directory.
+ *  2. Create a file and watch it.
+ *  3. Write into the file twice.
+ *  4. Unlink the file.
+ *  5. Read the events of both watches without waiting.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The directory gets the creation and the unlink of the file.
+ *  3. The file gets a single data event for both writes and the unlink.
+ */
+static void watch_file_events(void **state)
+{
+	int rc = 0;
+	char buf[100];
+	char *name = "watched_file";
+	struct ut_cfs_params *ut_cfs_obj = ENV_FROM_STATE(state);
+	cfs_ino_t *pinode = &ut_cfs_obj->current_inode;
+	cfs_ino_t file_inode = 0LL;
+	cfs_file_open_t fd;
+	struct cfs_fh *parent_fh = NULL;
+	struct cfs_watch *dir_watch = NULL;
+	struct cfs_watch *file_watch = NULL;
+	struct cfs_watch_event events[4];
+	uint32_t count = 0;
+
+	rc = cfs_watch(ut_cfs_obj->cfs_fs, pinode, CFS_WATCH_ALL, &dir_watch);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fh_from_ino(ut_cfs_obj->cfs_fs, pinode, &parent_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(parent_fh, &ut_cfs_obj->cred, name, 0755, &file_inode);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy_and_dump_stat(parent_fh);
+
+	rc = cfs_watch(ut_cfs_obj->cfs_fs, &file_inode, CFS_WATCH_ALL,
+		       &file_watch);
+	ut_assert_int_equal(rc, 0);
+
+	memset(buf, 'a', sizeof(buf));
+	fd.ino = file_inode;
+
+	rc = cfs_write(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &fd, buf,
+		       sizeof(buf), 0);
+	ut_assert_int_equal(rc, sizeof(buf));
+
+	rc = cfs_write(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &fd, buf,
+		       sizeof(buf), sizeof(buf));
+	ut_assert_int_equal(rc, sizeof(buf));
+
+	rc = cfs_unlink(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, pinode,
+			&file_inode, name);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_watch_read(dir_watch, events, 4, 0, &count);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(count, 2);
+	ut_assert_int_equal(events[0].we_mask, CFS_WATCH_CREATE);
+	ut_assert_int_equal(events[0].we_ino, file_inode);
+	ut_assert_string_equal(events[0].we_name.s_str, name);
+	ut_assert_int_equal(events[1].we_mask, CFS_WATCH_UNLINK);
+	ut_assert_int_equal(events[1].we_ino, file_inode);
+
+	rc = cfs_watch_read(file_watch, events, 4, 0, &count);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(count, 2);
+	ut_assert_int_equal(events[0].we_mask, CFS_WATCH_DATA);
+	ut_assert_int_equal(events[1].we_mask, CFS_WATCH_UNLINK);
+
+	cfs_unwatch(file_watch);
+	cfs_unwatch(dir_watch);
+}
+
 /**
  * teardown for file test.
  * Description: delete file.
@@ -378,6 +938,13 @@ int main(void)
 			     file_test_teardown),
 		ut_test_case(verify_file_handle, create_file_setup,
 			     file_test_teardown),
+		ut_test_case(create_file_batch, NULL, NULL),
+		ut_test_case(reap_orphaned_file, NULL, NULL),
+		ut_test_case(lookup_removed_entry, NULL, NULL),
+		ut_test_case(lookup_negative_entry, NULL, NULL),
+		ut_test_case(oid_cache_file_xattr, NULL, NULL),
+		ut_test_case(query_file_size, NULL, NULL),
+		ut_test_case(watch_file_events, NULL, NULL),
 	};
 
 	int test_count = sizeof(test_list)/sizeof(test_list[0]);
@@ -28,7 +28,7 @@ static void test_cfs_fs_create(void)
 	char *name = "cortxfs";
 	str256_t fs_name;
 	str256_from_cstr(fs_name, name, strlen(name));
-	rc = cfs_fs_create(&fs_name, NULL);
+	rc = cfs_fs_create(&fs_name, NULL, NULL);
 
 	ut_assert_int_equal(rc, 0);
 }
@@ -66,6 +66,126 @@ static void test_cfs_fs_scan(void)
 	ut_assert_int_equal(rc, 0);
 }
 
+#define INO_TEST_FILES 4
+
+static void ino_test_fs_create(const char *name, struct cfs_fs **fs)
+{
+	int rc = 0;
+	str256_t fs_name;
+
+	str256_from_cstr(fs_name, name, strlen(name));
+	rc = cfs_fs_create(&fs_name, NULL, NULL);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fs_open(name, fs);
+	ut_assert_int_equal(rc, 0);
+}
+
+static void ino_test_fs_delete(const char *name)
+{
+	int rc = 0;
+	str256_t fs_name;
+
+	str256_from_cstr(fs_name, name, strlen(name));
+	rc = cfs_fs_delete(&fs_name);
+	ut_assert_int_equal(rc, 0);
+}
+
+static void ino_test_creat(struct cfs_fs *fs, cfs_cred_t *cred, char *name,
+			   cfs_ino_t *ino)
+{
+	int rc = 0;
+	cfs_ino_t root = CFS_ROOT_INODE;
+	struct cfs_fh *root_fh = NULL;
+
+	rc = cfs_fh_from_ino(fs, &root, &root_fh);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_creat(root_fh, cred, name, 0755, ino);
+	ut_assert_int_equal(rc, 0);
+
+	cfs_fh_destroy(root_fh);
+}
+
+/**
+ * Test for the inode numbers of several filesystems
+ * Description: Allocate inode numbers from two filesystems and reload them.
+ * Strategy:
+ *  1. Create two filesystems.
+ *  2. Create files in both filesystems, one after the other.
+ *  3. Unload and load the filesystems.
+ *  4. Create another file in both filesystems.
+ *  5. Remove the files and the filesystems.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. The inode numbers of a filesystem follow each other: the creates of
+ *     the other filesystem do not take numbers from its range.
+ *  3. The inode numbers allocated after the reload are above the ones
+ *     allocated before it.
+ */
+static void test_cfs_fs_ino_ranges(void)
+{
+	int rc = 0;
+	int i;
+	int f;
+	char *fs_names[2] = { "ino_fs1", "ino_fs2" };
+	char *names[INO_TEST_FILES + 1] = { "ino_file0", "ino_file1",
+		"ino_file2", "ino_file3", "ino_file4" };
+	cfs_ino_t root = CFS_ROOT_INODE;
+	cfs_ino_t inos[2][INO_TEST_FILES + 1];
+	struct cfs_fs *fs[2] = { NULL, NULL };
+	cfs_cred_t cred = {
+		.uid = getuid(),
+		.gid = getgid(),
+	};
+
+	for (f = 0; f < 2; f++) {
+		ino_test_fs_create(fs_names[f], &fs[f]);
+	}
+
+	for (i = 0; i < INO_TEST_FILES; i++) {
+		for (f = 0; f < 2; f++) {
+			ino_test_creat(fs[f], &cred, names[i], &inos[f][i]);
+			ut_assert_true(inos[f][i] > root);
+			if (i != 0) {
+				ut_assert_int_equal(inos[f][i],
+						    inos[f][i - 1] + 1);
+			}
+		}
+	}
+
+	for (f = 0; f < 2; f++) {
+		cfs_fs_close(fs[f]);
+	}
+
+	rc = cfs_fs_fini();
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_fs_init(get_endpoint_dummy_ops());
+	ut_assert_int_equal(rc, 0);
+
+	for (f = 0; f < 2; f++) {
+		rc = cfs_fs_open(fs_names[f], &fs[f]);
+		ut_assert_int_equal(rc, 0);
+
+		ino_test_creat(fs[f], &cred, names[INO_TEST_FILES],
+			       &inos[f][INO_TEST_FILES]);
+		ut_assert_true(inos[f][INO_TEST_FILES] >
+			       inos[f][INO_TEST_FILES - 1]);
+	}
+
+	for (f = 0; f < 2; f++) {
+		for (i = 0; i <= INO_TEST_FILES; i++) {
+			rc = cfs_unlink(fs[f], &cred, &root, &inos[f][i],
+					names[i]);
+			ut_assert_int_equal(rc, 0);
+		}
+
+		cfs_fs_close(fs[f]);
+		ino_test_fs_delete(fs_names[f]);
+	}
+}
+
 int main(void)
 {
 	int rc = 0;
@@ -96,6 +216,7 @@ int main(void)
 		ut_test_case(test_cfs_fs_create, NULL, NULL),
 		ut_test_case(test_cfs_fs_delete, NULL, NULL),
 		ut_test_case(test_cfs_fs_scan, NULL, NULL),
+		ut_test_case(test_cfs_fs_ino_ranges, NULL, NULL),
 	};
 
 	int test_count = sizeof(test_list)/sizeof(test_list[0]);
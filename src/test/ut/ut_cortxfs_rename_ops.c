@@ -233,6 +233,82 @@ static int rename_into_empty_dir_teardown(void **state)
 	return rc;
 }
 
+/**
+ * Test for moving a directory into another directory
+ * Description: move a directory across directories and back.
+ * Strategy:
+ *  1. Move d1 into d2 under a new name.
+ *  2. Verify the entries and the link count of d2.
+ *  3. Move d1 back to the root directory, with the source inode as a hint.
+ *  4. Verify the entries and the link count of d2.
+ * Expected behavior:
+ *  1. No errors from CORTXFS API.
+ *  2. d2 holds d1 and has one more link after the first move.
+ *  3. d2 is empty and has its initial link count after the second move.
+ */
+static void rename_dir_across_dirs(void **state)
+{
+	int rc = 0;
+	uint64_t nentries = 0;
+	cfs_ino_t dir1_inode = 0LL, dir2_inode = 0LL, moved_inode = 0LL;
+	struct stat stat_before, stat_after;
+
+	struct ut_rename_env *ut_rename_obj = RENAME_ENV_FROM_STATE(state);
+	struct ut_cfs_params *ut_cfs_obj = &ut_rename_obj->ut_cfs_obj;
+
+	char *old_name = ut_rename_obj->name_list[0],
+		*new_name = ut_rename_obj->name_list[1],
+		*moved_name = "test_rename_moved";
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->parent_inode, old_name, &dir1_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->parent_inode, new_name, &dir2_inode);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &dir2_inode, &stat_before);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_rename(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&ut_cfs_obj->current_inode, old_name, NULL,
+			&dir2_inode, moved_name, NULL, NULL);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&dir2_inode, moved_name, &moved_inode);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(moved_inode, dir1_inode);
+
+	rc = cfs_dir_count(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir2_inode,
+			   &nentries);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(nentries, 1);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &dir2_inode, &stat_after);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(stat_after.st_nlink, stat_before.st_nlink + 1);
+
+	rc = cfs_rename(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&dir2_inode, moved_name, &dir1_inode,
+			&ut_cfs_obj->current_inode, old_name, NULL, NULL);
+	ut_assert_int_equal(rc, 0);
+
+	rc = cfs_lookup(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred,
+			&dir2_inode, moved_name, &moved_inode);
+	ut_assert_int_equal(rc, -ENOENT);
+
+	rc = cfs_dir_count(ut_cfs_obj->cfs_fs, &ut_cfs_obj->cred, &dir2_inode,
+			   &nentries);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(nentries, 0);
+
+	rc = cfs_getattr_ino(ut_cfs_obj->cfs_fs, &dir2_inode, &stat_after);
+	ut_assert_int_equal(rc, 0);
+	ut_assert_int_equal(stat_after.st_nlink, stat_before.st_nlink);
+}
+
 /**
  * Setup for renaming to nonempty directory test
  * Description: Create directories.
@@ -402,6 +478,9 @@ int main(void)
 				rename_file_teardown),
 		ut_test_case(rename_into_empty_dir, rename_into_empty_dir_setup,
 				rename_into_empty_dir_teardown),
+		ut_test_case(rename_dir_across_dirs,
+				rename_into_empty_dir_setup,
+				rename_into_empty_dir_teardown),
 		ut_test_case(rename_into_nonempty_dir,
 				rename_into_nonempty_dir_setup,
 				rename_into_nonempty_dir_teardown),